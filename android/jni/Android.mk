@@ -10,6 +10,7 @@ LOCAL_SRC_FILES := \
 
 LOCAL_C_INCLUDES += \
   $(HIDAPI_ROOT_ABS)/hidapi \
+  $(HIDAPI_ROOT_ABS)/src \
   $(HIDAPI_ROOT_ABS)/android
 
 LOCAL_SHARED_LIBRARIES := libusb1.0
@@ -0,0 +1,463 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "hidapi_aggregate.h"
+#include "hid_report_fields.h"
+
+struct hid_aggregate_field_state {
+	int selected;
+	/* Statistics of the current window */
+	uint32_t count;
+	int64_t minimum;
+	int64_t maximum;
+	int64_t last;
+	int64_t sum;
+};
+
+struct hid_aggregate_ {
+	hid_device *dev;
+	unsigned long long window_us;
+
+	struct hid_report_layouts layouts;
+	/* One state per field of every layout, the fields of layouts.reports[i]
+	   starting at states[first_state[i]] */
+	struct hid_aggregate_field_state *states;
+	size_t *first_state;
+	size_t num_states;
+
+	/* The current window, if window_open */
+	int window_open;
+	unsigned long long window_start;
+
+	hid_aggregate_callback_fn callback;
+	void *user_data;
+
+	/* Summaries of the window being closed, one per state at most */
+	struct hid_aggregate_summary *closing;
+
+	/* Queued summaries: num_queued summaries from queue[first_queued] */
+	struct hid_aggregate_summary *queue;
+	size_t first_queued;
+	size_t num_queued;
+	size_t queue_capacity;
+
+	/* Input report of hid_aggregate_read() */
+	unsigned char *read_buf;
+	size_t read_buf_size;
+
+	/* Set by hid_aggregate_dispatch(), the reports are then
+	   processed by the threads of the dispatcher */
+	hid_subscription *subscription;
+};
+
+static hid_aggregate *aggregate_create(const unsigned char *descriptor, size_t descriptor_length, unsigned long long window_us)
+{
+	hid_aggregate *aggregate;
+	size_t r, max_report_bits = 0;
+
+	if (window_us == 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	aggregate = (hid_aggregate *) calloc(1, sizeof(*aggregate));
+	if (!aggregate)
+		return NULL;
+	aggregate->window_us = window_us;
+
+	if (hid_report_layouts_parse(&aggregate->layouts, descriptor, descriptor_length, HID_REPORT_INPUT) < 0)
+		goto fail;
+	if (aggregate->layouts.num_reports == 0) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	aggregate->first_state = (size_t *) malloc(aggregate->layouts.num_reports * sizeof(size_t));
+	if (!aggregate->first_state)
+		goto fail;
+	for (r = 0; r < aggregate->layouts.num_reports; r++) {
+		aggregate->first_state[r] = aggregate->num_states;
+		aggregate->num_states += aggregate->layouts.reports[r].num_fields;
+		if (aggregate->layouts.reports[r].report_bits > max_report_bits)
+			max_report_bits = aggregate->layouts.reports[r].report_bits;
+	}
+
+	aggregate->states = (struct hid_aggregate_field_state *) calloc(aggregate->num_states? aggregate->num_states: 1, sizeof(*aggregate->states));
+	aggregate->closing = (struct hid_aggregate_summary *) malloc((aggregate->num_states? aggregate->num_states: 1) * sizeof(*aggregate->closing));
+	/* The Report ID, and one more byte to not mistake a longer report for a complete one */
+	aggregate->read_buf_size = (max_report_bits + 7) / 8 + 2;
+	aggregate->read_buf = (unsigned char *) malloc(aggregate->read_buf_size);
+	if (!aggregate->states || !aggregate->closing || !aggregate->read_buf)
+		goto fail;
+
+	return aggregate;
+
+fail:
+	{
+		/* Keep the errno of the failure */
+		int error = errno;
+		hid_aggregate_close(aggregate);
+		errno = error;
+	}
+	return NULL;
+}
+
+HID_API_EXPORT hid_aggregate * HID_API_CALL hid_aggregate_open_descriptor(const unsigned char *descriptor, size_t descriptor_length, unsigned long long window_us)
+{
+	if (!descriptor) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return aggregate_create(descriptor, descriptor_length, window_us);
+}
+
+HID_API_EXPORT hid_aggregate * HID_API_CALL hid_aggregate_open(hid_device *dev, unsigned long long window_us)
+{
+	unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	hid_aggregate *aggregate;
+	int res;
+
+	if (!dev) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	res = hid_get_report_descriptor(dev, descriptor, sizeof(descriptor));
+	if (res < 0)
+		return NULL;
+
+	aggregate = aggregate_create(descriptor, (size_t) res, window_us);
+	if (aggregate)
+		aggregate->dev = dev;
+
+	return aggregate;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_aggregate_add_fields(hid_aggregate *aggregate, unsigned short usage_page, unsigned short usage)
+{
+	size_t r, f;
+	int count = 0;
+
+	if (!aggregate)
+		return -1;
+
+	for (r = 0; r < aggregate->layouts.num_reports; r++) {
+		const struct hid_report_layout *layout = &aggregate->layouts.reports[r];
+
+		for (f = 0; f < layout->num_fields; f++) {
+			const struct hid_report_field *field = &layout->fields[f];
+			struct hid_aggregate_field_state *state = &aggregate->states[aggregate->first_state[r] + f];
+
+			if (field->usage_page != usage_page || (usage != 0 && field->usage != usage) || (field->flags & HID_REPORT_FIELD_ARRAY) || state->selected)
+				continue;
+
+			state->selected = 1;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_aggregate_set_callback(hid_aggregate *aggregate, hid_aggregate_callback_fn callback, void *user_data)
+{
+	if (!aggregate)
+		return -1;
+
+	/* The callback is used by the threads of the dispatcher */
+	if (aggregate->subscription)
+		return -1;
+
+	aggregate->callback = callback;
+	aggregate->user_data = user_data;
+	return 0;
+}
+
+static int queue_summaries(hid_aggregate *aggregate, const struct hid_aggregate_summary *summaries, size_t count)
+{
+	if (aggregate->first_queued + aggregate->num_queued + count > aggregate->queue_capacity) {
+		if (aggregate->first_queued > 0) {
+			/* Reuse the room of the summaries already taken */
+			memmove(aggregate->queue, aggregate->queue + aggregate->first_queued, aggregate->num_queued * sizeof(*aggregate->queue));
+			aggregate->first_queued = 0;
+		}
+		if (aggregate->num_queued + count > aggregate->queue_capacity) {
+			size_t capacity = aggregate->queue_capacity? aggregate->queue_capacity: 64;
+			struct hid_aggregate_summary *queue;
+
+			while (capacity < aggregate->num_queued + count)
+				capacity *= 2;
+			queue = (struct hid_aggregate_summary *) realloc(aggregate->queue, capacity * sizeof(*queue));
+			if (!queue)
+				return -1;
+			aggregate->queue = queue;
+			aggregate->queue_capacity = capacity;
+		}
+	}
+
+	memcpy(aggregate->queue + aggregate->first_queued + aggregate->num_queued, summaries, count * sizeof(*summaries));
+	aggregate->num_queued += count;
+	return 0;
+}
+
+/* Deliver the summaries of the current window and start over */
+static int close_window(hid_aggregate *aggregate)
+{
+	size_t r, f, count = 0;
+
+	for (r = 0; r < aggregate->layouts.num_reports; r++) {
+		const struct hid_report_layout *layout = &aggregate->layouts.reports[r];
+
+		for (f = 0; f < layout->num_fields; f++) {
+			struct hid_aggregate_field_state *state = &aggregate->states[aggregate->first_state[r] + f];
+			struct hid_aggregate_summary *summary;
+
+			if (state->count == 0)
+				continue;
+
+			summary = &aggregate->closing[count++];
+			summary->usage_page = layout->fields[f].usage_page;
+			summary->usage = layout->fields[f].usage;
+			summary->report_id = layout->report_id;
+			summary->field_index = (unsigned short) f;
+			summary->window_start_us = aggregate->window_start;
+			summary->count = state->count;
+			summary->minimum = state->minimum;
+			summary->maximum = state->maximum;
+			summary->last = state->last;
+			summary->mean = (double) state->sum / (double) state->count;
+
+			state->count = 0;
+		}
+	}
+
+	aggregate->window_open = 0;
+
+	if (count == 0)
+		return 0;
+	if (aggregate->callback)
+		aggregate->callback(aggregate->closing, count, aggregate->user_data);
+	else if (queue_summaries(aggregate, aggregate->closing, count) < 0)
+		return -1;
+
+	return (int) count;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_aggregate_process(hid_aggregate *aggregate, const unsigned char *data, size_t length, unsigned long long timestamp_us)
+{
+	const struct hid_report_layout *layout;
+	struct hid_aggregate_field_state *states;
+	unsigned char report_id = 0;
+	size_t f;
+	int res = 0;
+
+	if (!aggregate || !data)
+		return -1;
+
+	if (aggregate->layouts.uses_report_ids) {
+		if (length == 0)
+			return 0;
+		report_id = data[0];
+		data++;
+		length--;
+	}
+
+	if (aggregate->layouts.index[report_id] < 0)
+		return 0;
+	layout = &aggregate->layouts.reports[aggregate->layouts.index[report_id]];
+	states = &aggregate->states[aggregate->first_state[aggregate->layouts.index[report_id]]];
+
+	if (aggregate->window_open && timestamp_us >= aggregate->window_start + aggregate->window_us)
+		res = close_window(aggregate);
+	if (!aggregate->window_open) {
+		aggregate->window_start = timestamp_us - timestamp_us % aggregate->window_us;
+		aggregate->window_open = 1;
+	}
+
+	for (f = 0; f < layout->num_fields; f++) {
+		struct hid_aggregate_field_state *state = &states[f];
+		int64_t value;
+
+		if (!state->selected)
+			continue;
+
+		value = hid_report_field_get(data, length, &layout->fields[f]);
+		if (state->count == 0) {
+			state->minimum = value;
+			state->maximum = value;
+			state->sum = 0;
+		}
+		else if (value < state->minimum)
+			state->minimum = value;
+		else if (value > state->maximum)
+			state->maximum = value;
+		state->last = value;
+		state->sum += value;
+		state->count++;
+	}
+
+	return res;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_aggregate_flush(hid_aggregate *aggregate, unsigned long long now_us)
+{
+	if (!aggregate)
+		return -1;
+
+	if (!aggregate->window_open || now_us < aggregate->window_start + aggregate->window_us)
+		return 0;
+
+	return close_window(aggregate);
+}
+
+size_t HID_API_EXPORT HID_API_CALL hid_aggregate_get(hid_aggregate *aggregate, struct hid_aggregate_summary *summaries, size_t max_summaries)
+{
+	size_t n;
+
+	if (!aggregate || !summaries)
+		return 0;
+
+	n = (aggregate->num_queued < max_summaries)? aggregate->num_queued: max_summaries;
+	if (n == 0)
+		return 0;
+	memcpy(summaries, aggregate->queue + aggregate->first_queued, n * sizeof(*summaries));
+	aggregate->first_queued += n;
+	aggregate->num_queued -= n;
+	if (aggregate->num_queued == 0)
+		aggregate->first_queued = 0;
+
+	return n;
+}
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (unsigned long long) ts.tv_sec * 1000000ULL + (unsigned long long) ts.tv_nsec / 1000ULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_aggregate_read(hid_aggregate *aggregate, struct hid_aggregate_summary *summaries, size_t max_summaries, int milliseconds)
+{
+	unsigned long long deadline = 0;
+
+	if (!aggregate || !aggregate->dev || !summaries || aggregate->subscription)
+		return -1;
+
+	if (milliseconds > 0)
+		deadline = now_us() + (unsigned long long) milliseconds * 1000ULL;
+
+	while (aggregate->num_queued == 0) {
+		unsigned long long now = now_us();
+		int timeout = milliseconds;
+		int res;
+
+		if (milliseconds > 0)
+			timeout = (deadline > now)? (int) ((deadline - now + 999) / 1000): 0;
+
+		/* Don't wait past the end of the current window, to close it if the device is silent */
+		if (aggregate->window_open) {
+			unsigned long long window_end = aggregate->window_start + aggregate->window_us;
+			int window_timeout = (window_end > now)? (int) ((window_end - now + 999) / 1000): 0;
+			if (timeout < 0 || window_timeout < timeout)
+				timeout = window_timeout;
+		}
+
+		res = hid_read_timeout(aggregate->dev, aggregate->read_buf, aggregate->read_buf_size, timeout);
+		if (res < 0)
+			return res;
+
+		now = now_us();
+		if (res > 0) {
+			if (hid_aggregate_process(aggregate, aggregate->read_buf, (size_t) res, now) < 0)
+				return -1;
+		}
+		else if (hid_aggregate_flush(aggregate, now) < 0)
+			return -1;
+
+		/* Non-blocking: until there is no more report */
+		if ((milliseconds == 0 && res == 0) || (milliseconds > 0 && now >= deadline))
+			break;
+	}
+
+	return (int) hid_aggregate_get(aggregate, summaries, max_summaries);
+}
+
+static void HID_API_CALL on_dispatched_report(hid_device *dev, const unsigned char *data, size_t length, void *user_data)
+{
+	hid_aggregate *aggregate = (hid_aggregate *) user_data;
+
+	(void) dev;
+
+	/* The device is gone, no later report will close the current window */
+	if (!data) {
+		hid_aggregate_flush(aggregate, ~0ULL);
+		return;
+	}
+
+	hid_aggregate_process(aggregate, data, length, now_us());
+}
+
+int HID_API_EXPORT HID_API_CALL hid_aggregate_dispatch(hid_aggregate *aggregate, hid_dispatcher *dispatcher, size_t capacity)
+{
+	if (!aggregate)
+		return -1;
+
+	if (aggregate->subscription) {
+		/* Waits for a running on_dispatched_report() */
+		hid_unsubscribe(aggregate->subscription);
+		aggregate->subscription = NULL;
+	}
+
+	if (!dispatcher)
+		return 0;
+
+	/* Without a callback the summaries would be queued by
+	   the dispatcher while the application takes them */
+	if (!aggregate->dev || !aggregate->callback) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	aggregate->subscription = hid_subscribe_dispatch(dispatcher, aggregate->dev, capacity, aggregate->read_buf_size, HID_API_SUBSCRIPTION_DROP_OLDEST, on_dispatched_report, aggregate);
+	return aggregate->subscription? 0: -1;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_aggregate_close(hid_aggregate *aggregate)
+{
+	if (!aggregate)
+		return;
+
+	if (aggregate->subscription)
+		hid_unsubscribe(aggregate->subscription);
+
+	hid_report_layouts_free(&aggregate->layouts);
+	free(aggregate->first_state);
+	free(aggregate->states);
+	free(aggregate->closing);
+	free(aggregate->queue);
+	free(aggregate->read_buf);
+	free(aggregate);
+}
@@ -0,0 +1,174 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "hidapi_encoder.h"
+#include "hid_report_fields.h"
+
+struct hid_encoder_ {
+	/* Indexed by hid_encoder_report_type */
+	struct hid_report_layouts layouts[2];
+};
+
+HID_API_EXPORT hid_encoder * HID_API_CALL hid_encoder_open_descriptor(const unsigned char *descriptor, size_t descriptor_length)
+{
+	hid_encoder *encoder;
+
+	if (!descriptor) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	encoder = (hid_encoder *) calloc(1, sizeof(*encoder));
+	if (!encoder)
+		return NULL;
+
+	if (hid_report_layouts_parse(&encoder->layouts[HID_ENCODER_OUTPUT], descriptor, descriptor_length, HID_REPORT_OUTPUT) < 0
+	 || hid_report_layouts_parse(&encoder->layouts[HID_ENCODER_FEATURE], descriptor, descriptor_length, HID_REPORT_FEATURE) < 0) {
+		/* Keep the errno of the failure */
+		int error = errno;
+		hid_encoder_close(encoder);
+		errno = error;
+		return NULL;
+	}
+
+	return encoder;
+}
+
+HID_API_EXPORT hid_encoder * HID_API_CALL hid_encoder_open(hid_device *dev)
+{
+	unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	int res;
+
+	if (!dev) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	res = hid_get_report_descriptor(dev, descriptor, sizeof(descriptor));
+	if (res < 0)
+		return NULL;
+
+	return hid_encoder_open_descriptor(descriptor, (size_t) res);
+}
+
+static const struct hid_report_layout *find_layout(hid_encoder *encoder, hid_encoder_report_type type, unsigned char report_id)
+{
+	if (!encoder || (type != HID_ENCODER_OUTPUT && type != HID_ENCODER_FEATURE))
+		return NULL;
+
+	return hid_report_layouts_find(&encoder->layouts[type], report_id);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_encoder_report_length(hid_encoder *encoder, hid_encoder_report_type type, unsigned char report_id)
+{
+	const struct hid_report_layout *layout = find_layout(encoder, type, report_id);
+
+	if (!layout)
+		return -1;
+
+	return (int) (1 + (layout->report_bits + 7) / 8);
+}
+
+/* The field receiving values[index]: the n-th field with its usage,
+   n being the number of times the usage was given before */
+static const struct hid_report_field *find_field(const struct hid_report_layout *layout, const struct hid_usage_value *values, size_t index)
+{
+	const struct hid_usage_value *value = &values[index];
+	size_t occurrence = 0;
+	size_t i;
+
+	for (i = 0; i < index; i++) {
+		if (values[i].usage_page == value->usage_page && values[i].usage == value->usage)
+			occurrence++;
+	}
+
+	for (i = 0; i < layout->num_fields; i++) {
+		const struct hid_report_field *field = &layout->fields[i];
+
+		if (field->usage_page == value->usage_page && field->usage == value->usage) {
+			if (occurrence == 0)
+				return field;
+			occurrence--;
+		}
+	}
+
+	return NULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_encoder_encode(hid_encoder *encoder, hid_encoder_report_type type, unsigned char report_id, const struct hid_usage_value *values, size_t num_values, unsigned char *data, size_t length)
+{
+	const struct hid_report_layout *layout = find_layout(encoder, type, report_id);
+	size_t report_length;
+	size_t i;
+
+	if (!data || (num_values > 0 && !values)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!layout) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	report_length = 1 + (layout->report_bits + 7) / 8;
+	if (length < report_length) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	memset(data, 0, report_length);
+	data[0] = report_id;
+
+	for (i = 0; i < num_values; i++) {
+		const struct hid_report_field *field = find_field(layout, values, i);
+		int64_t value = values[i].value;
+
+		if (!field) {
+			/* Either an unknown usage, or given more times than it has fields */
+			errno = find_field(layout, &values[i], 0)? EINVAL: ENOENT;
+			return -1;
+		}
+
+		if (!(field->flags & HID_REPORT_FIELD_ARRAY) && field->logical_minimum < field->logical_maximum) {
+			if (value < field->logical_minimum)
+				value = field->logical_minimum;
+			else if (value > field->logical_maximum)
+				value = field->logical_maximum;
+		}
+
+		hid_report_field_set(data + 1, field, value);
+	}
+
+	return (int) report_length;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_encoder_close(hid_encoder *encoder)
+{
+	if (!encoder)
+		return;
+
+	hid_report_layouts_free(&encoder->layouts[HID_ENCODER_OUTPUT]);
+	hid_report_layouts_free(&encoder->layouts[HID_ENCODER_FEATURE]);
+	free(encoder);
+}
@@ -0,0 +1,309 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "hidapi_events.h"
+#include "hid_report_fields.h"
+
+struct hid_events_field_state {
+	/* Value of the last event */
+	int64_t last;
+	int64_t deadband;
+};
+
+struct hid_events_ {
+	hid_device *dev;
+
+	struct hid_report_layouts layouts;
+	/* One state per field of every layout, the fields of layouts.reports[i]
+	   starting at states[first_state[i]] */
+	struct hid_events_field_state *states;
+	size_t *first_state;
+
+	/* Queued events: num_queued events from queue[first_queued] */
+	struct hid_event *queue;
+	size_t first_queued;
+	size_t num_queued;
+	size_t queue_capacity;
+
+	/* Input report of hid_events_read() */
+	unsigned char *read_buf;
+	size_t read_buf_size;
+};
+
+static hid_events *events_create(const unsigned char *descriptor, size_t descriptor_length)
+{
+	hid_events *events;
+	size_t r, num_states = 0, max_report_bits = 0;
+
+	events = (hid_events *) calloc(1, sizeof(*events));
+	if (!events)
+		return NULL;
+
+	if (hid_report_layouts_parse(&events->layouts, descriptor, descriptor_length, HID_REPORT_INPUT) < 0)
+		goto fail;
+	if (events->layouts.num_reports == 0) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	events->first_state = (size_t *) malloc(events->layouts.num_reports * sizeof(size_t));
+	if (!events->first_state)
+		goto fail;
+	for (r = 0; r < events->layouts.num_reports; r++) {
+		events->first_state[r] = num_states;
+		num_states += events->layouts.reports[r].num_fields;
+		if (events->layouts.reports[r].report_bits > max_report_bits)
+			max_report_bits = events->layouts.reports[r].report_bits;
+	}
+
+	events->states = (struct hid_events_field_state *) calloc(num_states? num_states: 1, sizeof(*events->states));
+	/* The Report ID, and one more byte to not mistake a longer report for a complete one */
+	events->read_buf_size = (max_report_bits + 7) / 8 + 2;
+	events->read_buf = (unsigned char *) malloc(events->read_buf_size);
+	if (!events->states || !events->read_buf)
+		goto fail;
+
+	return events;
+
+fail:
+	{
+		/* Keep the errno of the failure */
+		int error = errno;
+		hid_events_close(events);
+		errno = error;
+	}
+	return NULL;
+}
+
+HID_API_EXPORT hid_events * HID_API_CALL hid_events_open_descriptor(const unsigned char *descriptor, size_t descriptor_length)
+{
+	if (!descriptor) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return events_create(descriptor, descriptor_length);
+}
+
+HID_API_EXPORT hid_events * HID_API_CALL hid_events_open(hid_device *dev)
+{
+	unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	hid_events *events;
+	int res;
+
+	if (!dev) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	res = hid_get_report_descriptor(dev, descriptor, sizeof(descriptor));
+	if (res < 0)
+		return NULL;
+
+	events = events_create(descriptor, (size_t) res);
+	if (events)
+		events->dev = dev;
+
+	return events;
+}
+
+/* Set the deadband of the matching Variable fields, either fixed or as a percentage of their range */
+static int set_deadband(hid_events *events, unsigned short usage_page, unsigned short usage, long long deadband, double percent)
+{
+	size_t r, f;
+	int count = 0;
+
+	if (!events || deadband < 0 || percent < 0)
+		return -1;
+
+	for (r = 0; r < events->layouts.num_reports; r++) {
+		const struct hid_report_layout *layout = &events->layouts.reports[r];
+
+		for (f = 0; f < layout->num_fields; f++) {
+			const struct hid_report_field *field = &layout->fields[f];
+			struct hid_events_field_state *state = &events->states[events->first_state[r] + f];
+
+			/* The values of an Array field are usage indexes: any change matters */
+			if (field->usage_page != usage_page || (usage != 0 && field->usage != usage) || (field->flags & HID_REPORT_FIELD_ARRAY))
+				continue;
+
+			if (percent > 0)
+				state->deadband = (int64_t) ((double) (field->logical_maximum - field->logical_minimum) * percent / 100.0);
+			else
+				state->deadband = deadband;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_events_set_deadband(hid_events *events, unsigned short usage_page, unsigned short usage, long long deadband)
+{
+	return set_deadband(events, usage_page, usage, deadband, 0.0);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_events_set_deadband_percent(hid_events *events, unsigned short usage_page, unsigned short usage, double percent)
+{
+	return set_deadband(events, usage_page, usage, 0, percent);
+}
+
+static int queue_event(hid_events *events, const struct hid_event *event)
+{
+	if (events->first_queued + events->num_queued == events->queue_capacity) {
+		if (events->first_queued > 0) {
+			/* Reuse the room of the events already taken */
+			memmove(events->queue, events->queue + events->first_queued, events->num_queued * sizeof(*events->queue));
+			events->first_queued = 0;
+		}
+		else {
+			size_t capacity = events->queue_capacity? events->queue_capacity * 2: 64;
+			struct hid_event *queue = (struct hid_event *) realloc(events->queue, capacity * sizeof(*queue));
+			if (!queue)
+				return -1;
+			events->queue = queue;
+			events->queue_capacity = capacity;
+		}
+	}
+
+	events->queue[events->first_queued + events->num_queued++] = *event;
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_events_process(hid_events *events, const unsigned char *data, size_t length)
+{
+	const struct hid_report_layout *layout;
+	struct hid_events_field_state *states;
+	unsigned char report_id = 0;
+	size_t f;
+	int count = 0;
+
+	if (!events || !data)
+		return -1;
+
+	if (events->layouts.uses_report_ids) {
+		if (length == 0)
+			return 0;
+		report_id = data[0];
+		data++;
+		length--;
+	}
+
+	if (events->layouts.index[report_id] < 0)
+		return 0;
+	layout = &events->layouts.reports[events->layouts.index[report_id]];
+	states = &events->states[events->first_state[events->layouts.index[report_id]]];
+
+	for (f = 0; f < layout->num_fields; f++) {
+		int64_t value = hid_report_field_get(data, length, &layout->fields[f]);
+		int64_t change = value - states[f].last;
+		struct hid_event event;
+
+		if (change == 0 || (change < 0? -change: change) <= states[f].deadband)
+			continue;
+
+		event.usage_page = layout->fields[f].usage_page;
+		event.usage = layout->fields[f].usage;
+		event.report_id = report_id;
+		event.field_index = (unsigned short) f;
+		event.old_value = states[f].last;
+		event.new_value = value;
+		if (queue_event(events, &event) < 0)
+			return -1;
+
+		states[f].last = value;
+		count++;
+	}
+
+	return count;
+}
+
+size_t HID_API_EXPORT HID_API_CALL hid_events_get(hid_events *events, struct hid_event *batch, size_t max_events)
+{
+	size_t n;
+
+	if (!events || !batch)
+		return 0;
+
+	n = (events->num_queued < max_events)? events->num_queued: max_events;
+	if (n == 0)
+		return 0;
+	memcpy(batch, events->queue + events->first_queued, n * sizeof(*batch));
+	events->first_queued += n;
+	events->num_queued -= n;
+	if (events->num_queued == 0)
+		events->first_queued = 0;
+
+	return n;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (long long) ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_events_read(hid_events *events, struct hid_event *batch, size_t max_events, int milliseconds)
+{
+	long long deadline = 0;
+	int timeout = milliseconds;
+
+	if (!events || !events->dev || !batch)
+		return -1;
+
+	if (milliseconds > 0)
+		deadline = now_ms() + milliseconds;
+
+	while (events->num_queued == 0) {
+		int res = hid_read_timeout(events->dev, events->read_buf, events->read_buf_size, timeout);
+		if (res <= 0)
+			return res;
+
+		if (hid_events_process(events, events->read_buf, (size_t) res) < 0)
+			return -1;
+
+		/* A report without changes: wait for the next one within the rest of the timeout */
+		if (milliseconds > 0) {
+			long long remaining = deadline - now_ms();
+			timeout = (remaining > 0)? (int) remaining: 0;
+		}
+	}
+
+	return (int) hid_events_get(events, batch, max_events);
+}
+
+void HID_API_EXPORT HID_API_CALL hid_events_close(hid_events *events)
+{
+	if (!events)
+		return;
+
+	hid_report_layouts_free(&events->layouts);
+	free(events->first_state);
+	free(events->states);
+	free(events->queue);
+	free(events->read_buf);
+	free(events);
+}
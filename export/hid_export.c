@@ -0,0 +1,324 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+#if defined(_MSC_VER) && !defined(_CRT_SECURE_NO_WARNINGS)
+/* Do not warn about fopen usage.
+   https://docs.microsoft.com/cpp/c-runtime-library/security-features-in-the-crt */
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "hidapi_export.h"
+#include "hid_report_fields.h"
+
+#define HID_EXPORT_FORMAT_VERSION 1
+
+/* A varint of a 64-bit value takes up to 10 bytes */
+#define HID_EXPORT_MAX_VARINT 10
+
+/* The buffered rows of the Input report with a given Report ID,
+   tables[i] goes with layouts.reports[i] */
+struct hid_export_table {
+	const struct hid_report_layout *layout;
+	size_t rows;
+	/* chunk_rows values per column, the timestamps first */
+	int64_t *values;
+};
+
+struct hid_export_ {
+	hid_device *dev;
+	FILE *file;
+	int failed;
+
+	struct hid_report_layouts layouts;
+	size_t chunk_rows;
+	struct hid_export_table *tables;
+
+	/* Encoded column of a chunk */
+	unsigned char *encode_buf;
+	/* Input report of hid_export_read() */
+	unsigned char *read_buf;
+	size_t read_buf_size;
+};
+
+static void write_bytes(hid_export *exp, const void *data, size_t length)
+{
+	if (length > 0 && fwrite(data, 1, length, exp->file) != length)
+		exp->failed = 1;
+}
+
+static void write_u8(hid_export *exp, unsigned char value)
+{
+	write_bytes(exp, &value, 1);
+}
+
+static void write_u16(hid_export *exp, uint16_t value)
+{
+	unsigned char buf[2];
+	buf[0] = (unsigned char) value;
+	buf[1] = (unsigned char) (value >> 8);
+	write_bytes(exp, buf, sizeof(buf));
+}
+
+static void write_u32(hid_export *exp, uint32_t value)
+{
+	unsigned char buf[4];
+	buf[0] = (unsigned char) value;
+	buf[1] = (unsigned char) (value >> 8);
+	buf[2] = (unsigned char) (value >> 16);
+	buf[3] = (unsigned char) (value >> 24);
+	write_bytes(exp, buf, sizeof(buf));
+}
+
+static void write_header(hid_export *exp)
+{
+	size_t t, c;
+
+	write_bytes(exp, "HIDCOL\0\0", 8);
+	write_u32(exp, HID_EXPORT_FORMAT_VERSION);
+	write_u32(exp, (uint32_t) exp->layouts.num_reports);
+
+	for (t = 0; t < exp->layouts.num_reports; t++) {
+		const struct hid_report_layout *layout = &exp->layouts.reports[t];
+
+		write_u8(exp, layout->report_id);
+		write_u32(exp, (uint32_t) layout->num_fields);
+		for (c = 0; c < layout->num_fields; c++) {
+			const struct hid_report_field *field = &layout->fields[c];
+			write_u16(exp, field->usage_page);
+			write_u16(exp, field->usage);
+			write_u16(exp, field->bit_offset);
+			write_u8(exp, field->bit_size);
+			/* Same bits as the column flags of the file format */
+			write_u8(exp, field->flags & (HID_REPORT_FIELD_SIGNED | HID_REPORT_FIELD_ARRAY));
+		}
+	}
+}
+
+/* Write the buffered rows of a table as a chunk */
+static void flush_table(hid_export *exp, struct hid_export_table *table)
+{
+	size_t c, r;
+
+	if (table->rows == 0)
+		return;
+
+	write_bytes(exp, "CHNK", 4);
+	write_u8(exp, table->layout->report_id);
+	write_u32(exp, (uint32_t) table->rows);
+
+	for (c = 0; c <= table->layout->num_fields; c++) {
+		const int64_t *values = table->values + c * exp->chunk_rows;
+		uint64_t previous = 0;
+		size_t length = 0;
+
+		for (r = 0; r < table->rows; r++) {
+			uint64_t delta = (uint64_t) values[r] - previous;
+			/* Zigzag: small negative deltas get small codes too */
+			uint64_t code = (delta << 1) ^ ((delta >> 63)? UINT64_MAX: 0);
+
+			previous = (uint64_t) values[r];
+			while (code >= 0x80) {
+				exp->encode_buf[length++] = (unsigned char) (code | 0x80);
+				code >>= 7;
+			}
+			exp->encode_buf[length++] = (unsigned char) code;
+		}
+
+		write_u32(exp, (uint32_t) length);
+		write_bytes(exp, exp->encode_buf, length);
+	}
+
+	table->rows = 0;
+}
+
+static hid_export *export_create(const unsigned char *descriptor, size_t descriptor_length, const char *path, size_t chunk_rows)
+{
+	hid_export *exp;
+	size_t t, max_report_bits = 0;
+
+	exp = (hid_export *) calloc(1, sizeof(*exp));
+	if (!exp)
+		return NULL;
+
+	exp->chunk_rows = chunk_rows? chunk_rows: HID_API_EXPORT_DEFAULT_CHUNK_ROWS;
+
+	if (hid_report_layouts_parse(&exp->layouts, descriptor, descriptor_length, HID_REPORT_INPUT) < 0)
+		goto fail;
+	if (exp->layouts.num_reports == 0) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	exp->tables = (struct hid_export_table *) calloc(exp->layouts.num_reports, sizeof(*exp->tables));
+	if (!exp->tables)
+		goto fail;
+	for (t = 0; t < exp->layouts.num_reports; t++) {
+		struct hid_export_table *table = &exp->tables[t];
+		table->layout = &exp->layouts.reports[t];
+		table->values = (int64_t *) malloc((table->layout->num_fields + 1) * exp->chunk_rows * sizeof(int64_t));
+		if (!table->values)
+			goto fail;
+		if (table->layout->report_bits > max_report_bits)
+			max_report_bits = table->layout->report_bits;
+	}
+
+	exp->encode_buf = (unsigned char *) malloc(exp->chunk_rows * HID_EXPORT_MAX_VARINT);
+	/* The Report ID, and one more byte to not mistake a longer report for a complete one */
+	exp->read_buf_size = (max_report_bits + 7) / 8 + 2;
+	exp->read_buf = (unsigned char *) malloc(exp->read_buf_size);
+	if (!exp->encode_buf || !exp->read_buf)
+		goto fail;
+
+	exp->file = fopen(path, "wb");
+	if (!exp->file)
+		goto fail;
+
+	write_header(exp);
+	return exp;
+
+fail:
+	{
+		/* Keep the errno of the failure */
+		int error = errno;
+		hid_export_close(exp);
+		errno = error;
+	}
+	return NULL;
+}
+
+HID_API_EXPORT hid_export * HID_API_CALL hid_export_open_descriptor(const unsigned char *descriptor, size_t descriptor_length, const char *path, size_t chunk_rows)
+{
+	if (!descriptor || !path) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return export_create(descriptor, descriptor_length, path, chunk_rows);
+}
+
+HID_API_EXPORT hid_export * HID_API_CALL hid_export_open(hid_device *dev, const char *path, size_t chunk_rows)
+{
+	unsigned char descriptor[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+	hid_export *exp;
+	int res;
+
+	if (!dev || !path) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	res = hid_get_report_descriptor(dev, descriptor, sizeof(descriptor));
+	if (res < 0)
+		return NULL;
+
+	exp = export_create(descriptor, (size_t) res, path, chunk_rows);
+	if (exp)
+		exp->dev = dev;
+
+	return exp;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_export_report(hid_export *exp, const unsigned char *data, size_t length, unsigned long long timestamp_us)
+{
+	struct hid_export_table *table;
+	const struct hid_report_field *fields;
+	unsigned char report_id = 0;
+	size_t c;
+
+	if (!exp || !data)
+		return -1;
+
+	if (exp->layouts.uses_report_ids) {
+		if (length == 0)
+			return 0;
+		report_id = data[0];
+		data++;
+		length--;
+	}
+
+	if (exp->layouts.index[report_id] < 0)
+		return 0;
+	table = &exp->tables[exp->layouts.index[report_id]];
+	fields = table->layout->fields;
+
+	table->values[table->rows] = (int64_t) timestamp_us;
+	for (c = 0; c < table->layout->num_fields; c++)
+		table->values[(c + 1) * exp->chunk_rows + table->rows] = hid_report_field_get(data, length, &fields[c]);
+
+	if (++table->rows == exp->chunk_rows)
+		flush_table(exp, table);
+
+	return exp->failed? -1: 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_export_read(hid_export *exp, int milliseconds)
+{
+	struct timespec ts;
+	int res;
+
+	if (!exp || !exp->dev)
+		return -1;
+
+	res = hid_read_timeout(exp->dev, exp->read_buf, exp->read_buf_size, milliseconds);
+	if (res <= 0)
+		return res;
+
+	timespec_get(&ts, TIME_UTC);
+	if (hid_export_report(exp, exp->read_buf, (size_t) res, (unsigned long long) ts.tv_sec * 1000000ULL + (unsigned long long) ts.tv_nsec / 1000ULL) < 0)
+		return -1;
+
+	return res;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_export_close(hid_export *exp)
+{
+	int failed;
+	size_t t;
+
+	if (!exp)
+		return -1;
+
+	if (exp->file) {
+		for (t = 0; t < exp->layouts.num_reports; t++)
+			flush_table(exp, &exp->tables[t]);
+		if (fclose(exp->file) != 0)
+			exp->failed = 1;
+	}
+
+	failed = exp->failed;
+
+	if (exp->tables) {
+		for (t = 0; t < exp->layouts.num_reports; t++)
+			free(exp->tables[t].values);
+	}
+	free(exp->tables);
+	hid_report_layouts_free(&exp->layouts);
+	free(exp->encode_buf);
+	free(exp->read_buf);
+	free(exp);
+
+	return failed? -1: 0;
+}
@@ -0,0 +1,296 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hid_report_fields.h"
+
+/* Limits of the descriptor parser */
+#define HID_REPORT_MAX_USAGES 256
+#define HID_REPORT_MAX_PUSH   8
+
+/* Global items, saved by Push */
+struct hid_report_globals {
+	uint32_t usage_page;
+	int32_t logical_minimum;
+	int32_t logical_maximum;
+	/* Logical Maximum as an unsigned value, for the descriptors that
+	   encode e.g. 255 in a single byte */
+	uint32_t logical_maximum_unsigned;
+	uint32_t report_size;
+	uint32_t report_count;
+	unsigned char report_id;
+};
+
+/* Local items, reset by each Main item */
+struct hid_report_locals {
+	uint32_t usages[HID_REPORT_MAX_USAGES];
+	size_t num_usages;
+	uint32_t usage_minimum;
+	uint32_t usage_maximum;
+	int has_range;
+};
+
+static struct hid_report_layout *get_layout(struct hid_report_layouts *layouts, unsigned char report_id)
+{
+	struct hid_report_layout *reports;
+
+	if (layouts->index[report_id] >= 0)
+		return &layouts->reports[layouts->index[report_id]];
+
+	reports = (struct hid_report_layout *) realloc(layouts->reports, (layouts->num_reports + 1) * sizeof(*reports));
+	if (!reports)
+		return NULL;
+	layouts->reports = reports;
+
+	memset(&reports[layouts->num_reports], 0, sizeof(*reports));
+	reports[layouts->num_reports].report_id = report_id;
+	layouts->index[report_id] = (int) layouts->num_reports;
+
+	return &reports[layouts->num_reports++];
+}
+
+static int add_field(struct hid_report_layout *layout, uint32_t usage, const struct hid_report_globals *globals, uint8_t flags)
+{
+	struct hid_report_field *fields;
+	struct hid_report_field *field;
+
+	fields = (struct hid_report_field *) realloc(layout->fields, (layout->num_fields + 1) * sizeof(*fields));
+	if (!fields)
+		return -1;
+	layout->fields = fields;
+
+	field = &fields[layout->num_fields++];
+	/* A 4-byte usage carries its own page */
+	field->usage_page = (uint16_t) ((usage > 0xFFFF)? usage >> 16: globals->usage_page);
+	field->usage = (uint16_t) (usage & 0xFFFF);
+	field->bit_offset = (uint16_t) layout->report_bits;
+	field->bit_size = (uint8_t) globals->report_size;
+	field->flags = flags;
+	field->logical_minimum = globals->logical_minimum;
+	field->logical_maximum = globals->logical_maximum;
+	if (globals->logical_minimum < 0)
+		field->flags |= HID_REPORT_FIELD_SIGNED;
+	else if (globals->logical_maximum < 0)
+		field->logical_maximum = globals->logical_maximum_unsigned;
+
+	return 0;
+}
+
+/* Usage of the index-th field of a Main item */
+static uint32_t field_usage(const struct hid_report_locals *locals, size_t index)
+{
+	if (index < locals->num_usages)
+		return locals->usages[index];
+	if (locals->has_range) {
+		uint32_t usage = locals->usage_minimum + (uint32_t) (index - locals->num_usages);
+		return (usage > locals->usage_maximum)? locals->usage_maximum: usage;
+	}
+	if (locals->num_usages > 0)
+		return locals->usages[locals->num_usages - 1];
+	return 0;
+}
+
+static int add_main_item(struct hid_report_layouts *layouts, const struct hid_report_globals *globals, const struct hid_report_locals *locals, uint32_t data_flags)
+{
+	struct hid_report_layout *layout = get_layout(layouts, globals->report_id);
+	size_t i;
+
+	if (!layout)
+		return -1;
+
+	for (i = 0; i < globals->report_count; i++) {
+		/* Padding, and the fields that don't fit a bit offset, are skipped */
+		if (!(data_flags & 0x01) && globals->report_size > 0 && globals->report_size <= 32 && layout->report_bits + globals->report_size <= 0xFFFF) {
+			if (data_flags & 0x02) {
+				/* Variable: one usage per field */
+				if (add_field(layout, field_usage(locals, i), globals, 0) < 0)
+					return -1;
+			}
+			else {
+				/* Array: each field holds the index of a usage of the range */
+				if (add_field(layout, field_usage(locals, 0), globals, HID_REPORT_FIELD_ARRAY) < 0)
+					return -1;
+			}
+		}
+		layout->report_bits += globals->report_size;
+	}
+
+	return 0;
+}
+
+int hid_report_layouts_parse(struct hid_report_layouts *layouts, const unsigned char *descriptor, size_t length, int main_item)
+{
+	struct hid_report_globals globals;
+	struct hid_report_globals stack[HID_REPORT_MAX_PUSH];
+	struct hid_report_locals locals;
+	size_t depth = 0;
+	size_t i = 0;
+
+	memset(layouts, 0, sizeof(*layouts));
+	memset(layouts->index, -1, sizeof(layouts->index));
+	memset(&globals, 0, sizeof(globals));
+	memset(&locals, 0, sizeof(locals));
+
+	while (i < length) {
+		unsigned char prefix = descriptor[i];
+		size_t size = prefix & 0x03;
+		uint32_t value = 0;
+		int32_t signed_value;
+		size_t j;
+
+		if (prefix == 0xFE) {
+			/* Long item: no standard one is defined */
+			if (i + 1 >= length)
+				break;
+			i += 3 + (size_t) descriptor[i + 1];
+			continue;
+		}
+
+		if (size == 3)
+			size = 4;
+		if (i + 1 + size > length)
+			break;
+
+		for (j = 0; j < size; j++)
+			value |= (uint32_t) descriptor[i + 1 + j] << (8 * j);
+		if (size == 1)
+			signed_value = (int8_t) value;
+		else if (size == 2)
+			signed_value = (int16_t) value;
+		else
+			signed_value = (int32_t) value;
+
+		switch (prefix & 0xFC) {
+		case HID_REPORT_INPUT:
+		case HID_REPORT_OUTPUT:
+		case HID_REPORT_FEATURE:
+			if ((prefix & 0xFC) == main_item && add_main_item(layouts, &globals, &locals, value) < 0) {
+				errno = ENOMEM;
+				return -1;
+			}
+			memset(&locals, 0, sizeof(locals));
+			break;
+		case 0xA0: /* Collection */
+		case 0xC0: /* End Collection */
+			memset(&locals, 0, sizeof(locals));
+			break;
+		case 0x04: /* Usage Page */
+			globals.usage_page = value;
+			break;
+		case 0x14: /* Logical Minimum */
+			globals.logical_minimum = signed_value;
+			break;
+		case 0x24: /* Logical Maximum */
+			globals.logical_maximum = signed_value;
+			globals.logical_maximum_unsigned = value;
+			break;
+		case 0x74: /* Report Size */
+			globals.report_size = value;
+			break;
+		case 0x84: /* Report ID */
+			globals.report_id = (unsigned char) value;
+			layouts->uses_report_ids = 1;
+			break;
+		case 0x94: /* Report Count */
+			globals.report_count = value;
+			break;
+		case 0xA4: /* Push */
+			if (depth < HID_REPORT_MAX_PUSH)
+				stack[depth++] = globals;
+			break;
+		case 0xB4: /* Pop */
+			if (depth > 0)
+				globals = stack[--depth];
+			break;
+		case 0x08: /* Usage */
+			if (locals.num_usages < HID_REPORT_MAX_USAGES)
+				locals.usages[locals.num_usages++] = value;
+			break;
+		case 0x18: /* Usage Minimum */
+			locals.usage_minimum = value;
+			locals.has_range = 1;
+			break;
+		case 0x28: /* Usage Maximum */
+			locals.usage_maximum = value;
+			locals.has_range = 1;
+			break;
+		default:
+			break;
+		}
+
+		i += 1 + size;
+	}
+
+	return 0;
+}
+
+void hid_report_layouts_free(struct hid_report_layouts *layouts)
+{
+	size_t r;
+
+	for (r = 0; r < layouts->num_reports; r++)
+		free(layouts->reports[r].fields);
+	free(layouts->reports);
+	layouts->reports = NULL;
+	layouts->num_reports = 0;
+}
+
+const struct hid_report_layout *hid_report_layouts_find(const struct hid_report_layouts *layouts, unsigned char report_id)
+{
+	if (layouts->index[report_id] < 0)
+		return NULL;
+	return &layouts->reports[layouts->index[report_id]];
+}
+
+int64_t hid_report_field_get(const unsigned char *data, size_t length, const struct hid_report_field *field)
+{
+	size_t first = field->bit_offset / 8;
+	size_t last = ((size_t) field->bit_offset + field->bit_size - 1) / 8;
+	uint64_t mask = (field->bit_size < 64)? (((uint64_t) 1 << field->bit_size) - 1): UINT64_MAX;
+	uint64_t value = 0;
+	size_t i;
+
+	for (i = last + 1; i > first; i--)
+		value = (value << 8) | ((i - 1 < length)? data[i - 1]: 0);
+	value = (value >> (field->bit_offset % 8)) & mask;
+
+	if ((field->flags & HID_REPORT_FIELD_SIGNED) && (value >> (field->bit_size - 1)))
+		value |= ~mask;
+
+	return (int64_t) value;
+}
+
+void hid_report_field_set(unsigned char *data, const struct hid_report_field *field, int64_t value)
+{
+	size_t first = field->bit_offset / 8;
+	size_t last = ((size_t) field->bit_offset + field->bit_size - 1) / 8;
+	unsigned int shift = field->bit_offset % 8;
+	uint64_t mask = ((field->bit_size < 64)? (((uint64_t) 1 << field->bit_size) - 1): UINT64_MAX) << shift;
+	uint64_t bits = ((uint64_t) value << shift) & mask;
+	size_t i;
+
+	for (i = first; i <= last; i++) {
+		data[i] = (unsigned char) ((data[i] & ~mask) | bits);
+		mask >>= 8;
+		bits >>= 8;
+	}
+}
@@ -0,0 +1,90 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Report descriptor parser shared by the libraries of this directory (not installed).
+ *
+ * The descriptor is turned into a list of fields per Report ID, with the bit
+ * offset of each field computed once, so that decoding a report is a matter
+ * of extracting bits at known positions.
+ */
+
+#ifndef HID_REPORT_FIELDS_H__
+#define HID_REPORT_FIELDS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Field flags */
+#define HID_REPORT_FIELD_SIGNED 0x01
+/* Each field of an Array item holds the index of a usage instead of a value */
+#define HID_REPORT_FIELD_ARRAY  0x02
+
+/* Main items */
+#define HID_REPORT_INPUT   0x80
+#define HID_REPORT_OUTPUT  0x90
+#define HID_REPORT_FEATURE 0xB0
+
+struct hid_report_field {
+	uint16_t usage_page;
+	uint16_t usage;
+	/* Position in the report, after the Report ID byte */
+	uint16_t bit_offset;
+	uint8_t bit_size;
+	uint8_t flags;
+	int64_t logical_minimum;
+	int64_t logical_maximum;
+};
+
+/* The fields of the reports with a given Report ID */
+struct hid_report_layout {
+	unsigned char report_id;
+	size_t num_fields;
+	struct hid_report_field *fields;
+	/* Length of the report in bits, without the Report ID */
+	size_t report_bits;
+};
+
+struct hid_report_layouts {
+	int uses_report_ids;
+	size_t num_reports;
+	struct hid_report_layout *reports;
+	/* Index in reports by Report ID, -1 if the report is unknown */
+	int index[256];
+};
+
+/* Collect the fields of the reports of one kind (HID_REPORT_INPUT, _OUTPUT or _FEATURE).
+   Padding, and fields larger than 32 bits or past 64 Kibit, are left out.
+   Returns -1 with errno set on failure; layouts must be freed in any case. */
+int hid_report_layouts_parse(struct hid_report_layouts *layouts, const unsigned char *descriptor, size_t length, int main_item);
+
+void hid_report_layouts_free(struct hid_report_layouts *layouts);
+
+/* The layout of the reports with a given Report ID (0 without Report IDs), NULL if unknown */
+const struct hid_report_layout *hid_report_layouts_find(const struct hid_report_layouts *layouts, unsigned char report_id);
+
+/* Value of a field of a report starting after its Report ID,
+   the bits past the end of the report read as 0 */
+int64_t hid_report_field_get(const unsigned char *data, size_t length, const struct hid_report_field *field);
+
+/* Store the value of a field in a report starting after its Report ID,
+   at least (bit_offset + bit_size + 7) / 8 bytes long */
+void hid_report_field_set(unsigned char *data, const struct hid_report_field *field, int64_t value);
+
+#endif
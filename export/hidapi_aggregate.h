@@ -0,0 +1,269 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/** @file
+ * @defgroup API hidapi API
+ *
+ * Windowed aggregation of the fields of the Input reports.
+ *
+ * For a sensor streaming at several kHz, when the application only needs
+ * e.g. 100 summaries per second, the selected fields are accumulated over
+ * fixed windows, and only the minimum, maximum, mean and last value of each
+ * field over each window are delivered, through hid_aggregate_read()
+ * or a callback. The fields are found with the report descriptor of the
+ * device, once, when the aggregation is opened.
+ *
+ * hid_aggregate_read() takes the reports from hid_read_timeout(), so they
+ * still go through the queue of the backend. At high rates, hid_aggregate_dispatch()
+ * has them aggregated as they come from the backend's reader instead.
+ */
+
+#ifndef HIDAPI_AGGREGATE_H__
+#define HIDAPI_AGGREGATE_H__
+
+#include <stddef.h>
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+		struct hid_aggregate_;
+		typedef struct hid_aggregate_ hid_aggregate; /**< opaque aggregation */
+
+		/** @brief The summary of a field over a window.
+
+			@ingroup API
+		*/
+		struct hid_aggregate_summary {
+			/** Usage Page of the field */
+			unsigned short usage_page;
+			/** Usage of the field */
+			unsigned short usage;
+			/** Report ID of the report with the field, 0 if the device doesn't use Report IDs */
+			unsigned char report_id;
+			/** Index of the field in the report, to tell apart fields with the same usage */
+			unsigned short field_index;
+			/** Start of the window, in microseconds since the Unix epoch
+				(a multiple of the window length) */
+			unsigned long long window_start_us;
+			/** Number of reports in the window */
+			unsigned int count;
+			/** Smallest value in the window */
+			long long minimum;
+			/** Largest value in the window */
+			long long maximum;
+			/** Value in the last report of the window */
+			long long last;
+			/** Mean of the values in the window */
+			double mean;
+		};
+
+		/** @brief Callback receiving the summaries of a window.
+
+			@ingroup API
+			@param summaries The summaries of the selected fields that were
+				in at least one report of the window.
+			@param count The number of @p summaries.
+			@param user_data The user data given to hid_aggregate_set_callback().
+		*/
+		typedef void (HID_API_CALL *hid_aggregate_callback_fn)(const struct hid_aggregate_summary *summaries, size_t count, void *user_data);
+
+		/** @brief Start aggregating the Input reports of a device.
+
+			The report descriptor is obtained with hid_get_report_descriptor().
+			No field is selected until hid_aggregate_add_fields() is called.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param window_us The length of the windows in microseconds, e.g. 10000 for 100 Hz.
+
+			@returns
+				This function returns an aggregation on success or NULL on failure.
+				Call hid_error(dev) to get the failure reason if it comes from the device,
+				errno is set otherwise.
+		*/
+		HID_API_EXPORT hid_aggregate * HID_API_CALL hid_aggregate_open(hid_device *dev, unsigned long long window_us);
+
+		/** @brief Start aggregating reports decoded with a given report descriptor.
+
+			Same as hid_aggregate_open(), for reports that don't come from
+			an open device, to be passed to hid_aggregate_process().
+
+			@ingroup API
+			@param descriptor The report descriptor.
+			@param descriptor_length The length of @p descriptor.
+			@param window_us The length of the windows in microseconds.
+
+			@returns
+				This function returns an aggregation on success or NULL on failure,
+				with errno set (EINVAL if the descriptor has no Input report).
+		*/
+		HID_API_EXPORT hid_aggregate * HID_API_CALL hid_aggregate_open_descriptor(const unsigned char *descriptor, size_t descriptor_length, unsigned long long window_us);
+
+		/** @brief Select fields to aggregate.
+
+			Only Variable fields are aggregated: the values of an Array field
+			are usage indexes.
+
+			@ingroup API
+			@param aggregate An aggregation.
+			@param usage_page The Usage Page of the fields.
+			@param usage The Usage of the fields, 0 for every field of @p usage_page.
+
+			@returns
+				This function returns the number of fields selected by this call,
+				or -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_aggregate_add_fields(hid_aggregate *aggregate, unsigned short usage_page, unsigned short usage);
+
+		/** @brief Deliver the summaries to a callback instead of queuing them.
+
+			The callback is called by hid_aggregate_process() (and so by
+			hid_aggregate_read()) and hid_aggregate_flush(), once per window,
+			or by the threads of the dispatcher after hid_aggregate_dispatch().
+			Can't be changed while the aggregation is dispatched.
+
+			@ingroup API
+			@param aggregate An aggregation.
+			@param callback The callback, NULL to queue the summaries again.
+			@param user_data Passed to @p callback.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_aggregate_set_callback(hid_aggregate *aggregate, hid_aggregate_callback_fn callback, void *user_data);
+
+		/** @brief Accumulate an Input report.
+
+			Reports with an unknown Report ID are ignored,
+			short reports are decoded as if padded with zeros.
+			A report past the end of the current window closes it first.
+
+			@ingroup API
+			@param aggregate An aggregation.
+			@param data The report, starting with the Report ID if the device uses them.
+			@param length The length of @p data.
+			@param timestamp_us The time of the report, in microseconds since the Unix epoch.
+				Timestamps must not go backwards.
+
+			@returns
+				This function returns the number of summaries of the window closed
+				by the report, 0 if it didn't close a window, or -1 on error (out of memory).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_aggregate_process(hid_aggregate *aggregate, const unsigned char *data, size_t length, unsigned long long timestamp_us);
+
+		/** @brief Close the current window if it ended before a given time.
+
+			hid_aggregate_process() only closes a window when a later report
+			arrives. This closes it when the device stops sending, or with
+			@p now_us set to ~0ULL, at the end of a recording.
+
+			@ingroup API
+			@param aggregate An aggregation.
+			@param now_us The current time, in microseconds since the Unix epoch.
+
+			@returns
+				This function returns the number of summaries of the closed window,
+				0 if there was none, or -1 on error (out of memory).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_aggregate_flush(hid_aggregate *aggregate, unsigned long long now_us);
+
+		/** @brief Take queued summaries.
+
+			@ingroup API
+			@param aggregate An aggregation.
+			@param summaries Filled with the oldest queued summaries.
+			@param max_summaries The size of @p summaries.
+
+			@returns
+				This function returns the number of summaries copied to @p summaries,
+				the summaries left in the queue are returned by the next call.
+		*/
+		size_t HID_API_EXPORT HID_API_CALL hid_aggregate_get(hid_aggregate *aggregate, struct hid_aggregate_summary *summaries, size_t max_summaries);
+
+		/** @brief Read the device until a window closes, and take its summaries.
+
+			Queued summaries are returned first. Otherwise, Input reports are read
+			with hid_read_timeout() and accumulated until a window closes or until
+			the timeout expires. A window that ended is also closed when the device
+			is silent. With a callback, the summaries go to the callback, and this
+			function only returns at the timeout or on error.
+			Only for the aggregations opened with hid_aggregate_open(),
+			and not while they are dispatched.
+
+			@ingroup API
+			@param aggregate An aggregation.
+			@param summaries Filled with the oldest summaries.
+			@param max_summaries The size of @p summaries.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the number of summaries copied to @p summaries,
+				0 if no window closed before the timeout,
+				or -1 on error (the result of hid_read_timeout()).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_aggregate_read(hid_aggregate *aggregate, struct hid_aggregate_summary *summaries, size_t max_summaries, int milliseconds);
+
+		/** @brief Aggregate the Input reports as they are received, on the threads of a dispatcher.
+
+			The reports are passed by the backend's reader to a subscription of
+			hid_subscribe_dispatch(), whose callback accumulates them, timestamped
+			when they are dispatched. They don't go through the queue of the
+			backend, and the application isn't woken up for each of them:
+			the summaries are passed to the callback of hid_aggregate_set_callback(),
+			which must be set first. A window is closed by the first report past
+			its end, or when the device is disconnected.
+
+			While the aggregation is dispatched, hid_aggregate_process(),
+			hid_aggregate_flush(), hid_aggregate_get() and hid_aggregate_read()
+			must not be called, and hid_aggregate_close() must be called
+			before hid_close() of the device.
+
+			@note Only with the backends that support hid_subscribe_dispatch().
+
+			@ingroup API
+			@param aggregate An aggregation opened with hid_aggregate_open().
+			@param dispatcher A dispatcher returned from hid_dispatcher_create(),
+				NULL to stop (waiting for a running callback to return).
+			@param capacity The number of reports to queue while the dispatcher is busy.
+
+			@returns
+				This function returns 0 on success and -1 on error,
+				with errno set to EINVAL if there is no callback or no device.
+				Call hid_error(dev) to get the failure reason if it comes from the device.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_aggregate_dispatch(hid_aggregate *aggregate, hid_dispatcher *dispatcher, size_t capacity);
+
+		/** @brief Free an aggregation.
+
+			The current window is dropped, call hid_aggregate_flush() first to keep it.
+			A dispatched aggregation is stopped first.
+
+			@ingroup API
+			@param aggregate An aggregation.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_aggregate_close(hid_aggregate *aggregate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
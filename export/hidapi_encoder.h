@@ -0,0 +1,146 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/** @file
+ * @defgroup API hidapi API
+ *
+ * Encoding of the Output and Feature reports of a device.
+ *
+ * The report descriptor of the device is parsed once, when the encoder
+ * is opened, into the position of every field of every Output and Feature
+ * report. A report is then built from (usage page, usage, value) triplets,
+ * with the Report ID, the bit packing and the padding taken care of, ready
+ * for hid_write() or hid_send_feature_report(). Encoding a report
+ * doesn't parse the descriptor again nor allocate memory.
+ */
+
+#ifndef HIDAPI_ENCODER_H__
+#define HIDAPI_ENCODER_H__
+
+#include <stddef.h>
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+		struct hid_encoder_;
+		typedef struct hid_encoder_ hid_encoder; /**< opaque report encoder */
+
+		/** @brief Kinds of reports of an encoder.
+
+			@ingroup API
+		*/
+		typedef enum {
+			HID_ENCODER_OUTPUT,  /**< Output reports, for hid_write() */
+			HID_ENCODER_FEATURE  /**< Feature reports, for hid_send_feature_report() */
+		} hid_encoder_report_type;
+
+		/** @brief The value of a field of a report.
+
+			@ingroup API
+		*/
+		struct hid_usage_value {
+			/** Usage Page of the field */
+			unsigned short usage_page;
+			/** Usage of the field. For an Array field, the first usage of the array */
+			unsigned short usage;
+			/** The value, in logical units. For an Array field,
+				the index of a usage, written as is */
+			long long value;
+		};
+
+		/** @brief Open an encoder for the reports of a device.
+
+			The report descriptor is obtained with hid_get_report_descriptor().
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+
+			@returns
+				This function returns an encoder on success or NULL on failure.
+				Call hid_error(dev) to get the failure reason if it comes from the device,
+				errno is set otherwise.
+		*/
+		HID_API_EXPORT hid_encoder * HID_API_CALL hid_encoder_open(hid_device *dev);
+
+		/** @brief Open an encoder for the reports of a given report descriptor.
+
+			@ingroup API
+			@param descriptor The report descriptor.
+			@param descriptor_length The length of @p descriptor.
+
+			@returns
+				This function returns an encoder on success or NULL on failure,
+				with errno set.
+		*/
+		HID_API_EXPORT hid_encoder * HID_API_CALL hid_encoder_open_descriptor(const unsigned char *descriptor, size_t descriptor_length);
+
+		/** @brief Get the length of a report.
+
+			@ingroup API
+			@param encoder An encoder.
+			@param type The kind of report.
+			@param report_id The Report ID, 0 if the device doesn't use Report IDs.
+
+			@returns
+				This function returns the length of the report, including its first byte
+				(the Report ID, or 0 if the device doesn't use Report IDs),
+				or -1 if the device has no such report.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_encoder_report_length(hid_encoder *encoder, hid_encoder_report_type type, unsigned char report_id);
+
+		/** @brief Build a report from the values of its fields.
+
+			The fields not in @p values, and the padding, are set to 0.
+			When a usage is given several times, the values fill the fields
+			with this usage in order, e.g. the bytes of a vendor-defined buffer.
+			Values out of the logical range of their field are clamped.
+
+			@ingroup API
+			@param encoder An encoder.
+			@param type The kind of report.
+			@param report_id The Report ID, 0 if the device doesn't use Report IDs.
+			@param values The values of the fields.
+			@param num_values The number of @p values.
+			@param data The buffer to fill.
+			@param length The length of @p data, at least hid_encoder_report_length().
+
+			@returns
+				This function returns the length of the report on success,
+				to be passed with @p data to hid_write() or hid_send_feature_report(),
+				or -1 on error, with errno set to ENOENT if the device has no such report
+				or no such field, EINVAL if a usage is given more times than it has fields,
+				or ENOBUFS if @p length is too small.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_encoder_encode(hid_encoder *encoder, hid_encoder_report_type type, unsigned char report_id, const struct hid_usage_value *values, size_t num_values, unsigned char *data, size_t length);
+
+		/** @brief Free an encoder.
+
+			@ingroup API
+			@param encoder An encoder.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_encoder_close(hid_encoder *encoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/** @file
+ * @defgroup API hidapi API
+ *
+ * Change events derived from the Input reports of a device.
+ *
+ * Each Input report is compared, field by field, with the previous report
+ * with the same Report ID, and the fields that changed are reported as
+ * (usage page, usage, old value, new value) events, e.g. "button 7 pressed"
+ * or "X moved from 120 to 135". The fields are found with the report
+ * descriptor of the device, once, when the stream is opened.
+ */
+
+#ifndef HIDAPI_EVENTS_H__
+#define HIDAPI_EVENTS_H__
+
+#include <stddef.h>
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+		struct hid_events_;
+		typedef struct hid_events_ hid_events; /**< opaque change event stream */
+
+		/** @brief A change of a field of the Input reports.
+
+			@ingroup API
+		*/
+		struct hid_event {
+			/** Usage Page of the field */
+			unsigned short usage_page;
+			/** Usage of the field. For an Array field (e.g. the keys of a keyboard),
+				the first usage of the array, the values being indexes of usages */
+			unsigned short usage;
+			/** Report ID of the report with the field, 0 if the device doesn't use Report IDs */
+			unsigned char report_id;
+			/** Index of the field in the report, to tell apart fields with the same usage */
+			unsigned short field_index;
+			/** The value of the last event of the field (0 before the first one) */
+			long long old_value;
+			/** The value in the new report */
+			long long new_value;
+		};
+
+		/** @brief Start deriving change events from the Input reports of a device.
+
+			The report descriptor is obtained with hid_get_report_descriptor().
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+
+			@returns
+				This function returns an event stream on success or NULL on failure.
+				Call hid_error(dev) to get the failure reason if it comes from the device,
+				errno is set otherwise.
+		*/
+		HID_API_EXPORT hid_events * HID_API_CALL hid_events_open(hid_device *dev);
+
+		/** @brief Start deriving change events from reports decoded with a given report descriptor.
+
+			Same as hid_events_open(), for reports that don't come from
+			an open device, to be passed to hid_events_process().
+
+			@ingroup API
+			@param descriptor The report descriptor.
+			@param descriptor_length The length of @p descriptor.
+
+			@returns
+				This function returns an event stream on success or NULL on failure,
+				with errno set (EINVAL if the descriptor has no Input report).
+		*/
+		HID_API_EXPORT hid_events * HID_API_CALL hid_events_open_descriptor(const unsigned char *descriptor, size_t descriptor_length);
+
+		/** @brief Ignore the small changes of some fields.
+
+			An event is only emitted when the value of the field differs from the
+			value of its last event by more than @p deadband, so that the noise of
+			an axis doesn't produce a stream of events. A slow drift is still
+			reported once it adds up to more than @p deadband.
+
+			@ingroup API
+			@param events An event stream.
+			@param usage_page The Usage Page of the fields.
+			@param usage The Usage of the fields, 0 for every field of @p usage_page.
+			@param deadband The largest change to ignore, in logical units. 0 reports every change.
+
+			@returns
+				This function returns the number of fields the deadband was set on,
+				or -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_events_set_deadband(hid_events *events, unsigned short usage_page, unsigned short usage, long long deadband);
+
+		/** @brief Ignore the changes of some fields smaller than a fraction of their logical range.
+
+			Same as hid_events_set_deadband(), with the deadband given as a percentage
+			of the logical range (Logical Maximum - Logical Minimum) of each field,
+			e.g. 1.0 to ignore the changes of an axis smaller than 1%.
+
+			@ingroup API
+			@param events An event stream.
+			@param usage_page The Usage Page of the fields.
+			@param usage The Usage of the fields, 0 for every field of @p usage_page.
+			@param percent The largest change to ignore, in percent of the logical range.
+
+			@returns
+				This function returns the number of fields the deadband was set on,
+				or -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_events_set_deadband_percent(hid_events *events, unsigned short usage_page, unsigned short usage, double percent);
+
+		/** @brief Compare an Input report with the previous one and queue the change events.
+
+			Reports with an unknown Report ID are ignored,
+			short reports are decoded as if padded with zeros.
+			The events are queued, in the order of the fields in the report,
+			until they are taken by hid_events_get().
+
+			@ingroup API
+			@param events An event stream.
+			@param data The report, starting with the Report ID if the device uses them.
+			@param length The length of @p data.
+
+			@returns
+				This function returns the number of events queued for the report,
+				or -1 on error (out of memory).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_events_process(hid_events *events, const unsigned char *data, size_t length);
+
+		/** @brief Take a batch of queued events.
+
+			@ingroup API
+			@param events An event stream.
+			@param batch Filled with the oldest queued events.
+			@param max_events The size of @p batch.
+
+			@returns
+				This function returns the number of events copied to @p batch,
+				the events left in the queue are returned by the next call.
+		*/
+		size_t HID_API_EXPORT HID_API_CALL hid_events_get(hid_events *events, struct hid_event *batch, size_t max_events);
+
+		/** @brief Read the device until there are change events, and take a batch of them.
+
+			Queued events are returned first. Otherwise, Input reports are read
+			with hid_read_timeout() and processed until one of them changes a field
+			or until the timeout expires. Only for the streams opened with hid_events_open().
+
+			@ingroup API
+			@param events An event stream.
+			@param batch Filled with the oldest events.
+			@param max_events The size of @p batch.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the number of events copied to @p batch,
+				0 if there was no change before the timeout,
+				or -1 on error (the result of hid_read_timeout()).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_events_read(hid_events *events, struct hid_event *batch, size_t max_events, int milliseconds);
+
+		/** @brief Free an event stream.
+
+			@ingroup API
+			@param events An event stream.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_events_close(hid_events *events);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/** @file
+ * @defgroup API hidapi API
+ *
+ * Columnar export of the Input reports of a device.
+ *
+ * The reports are decoded with the report descriptor of the device:
+ * each field of an Input report becomes a column, next to a timestamp column.
+ * The rows are buffered per Report ID and written in chunks, so the memory
+ * use is bounded by the chunk size, whatever the length of the capture.
+ *
+ * File format (all integers little endian):
+ *
+ *     File    := Header Table* Chunk*
+ *     Header  := "HIDCOL\0\0"  u32 version (1)  u32 number of tables
+ *     Table   := u8 report ID (0 if the device doesn't use Report IDs)
+ *                u32 number of columns  Column*
+ *     Column  := u16 usage page  u16 usage  u16 bit offset in the report
+ *                (after the Report ID byte)  u8 bit size  u8 flags
+ *                (bit 0: signed, bit 1: array field)
+ *     Chunk   := "CHNK"  u8 report ID  u32 number of rows
+ *                (u32 byte length  Values)  for the timestamp column,
+ *                then for each column of the table
+ *     Values  := one varint per row: the difference with the value
+ *                of the previous row (0 for the first row of the chunk),
+ *                zigzag encoded, as an unsigned LEB128
+ *
+ * The timestamp column holds microseconds since the Unix epoch.
+ * Every chunk starts from 0, so a reader can skip a chunk using
+ * the byte lengths alone. The table of a chunk is the one with the
+ * same Report ID.
+ */
+
+#ifndef HIDAPI_EXPORT_H__
+#define HIDAPI_EXPORT_H__
+
+#include <stddef.h>
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+		struct hid_export_;
+		typedef struct hid_export_ hid_export; /**< opaque export stream */
+
+		/** @brief Default number of rows per chunk of hid_export_open(). */
+		#define HID_API_EXPORT_DEFAULT_CHUNK_ROWS 4096
+
+		/** @brief Start exporting the Input reports of a device to a file.
+
+			The report descriptor is obtained with hid_get_report_descriptor().
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param path The file to create (overwritten if it exists).
+			@param chunk_rows The number of rows buffered per Report ID before
+				they are written, 0 for #HID_API_EXPORT_DEFAULT_CHUNK_ROWS.
+
+			@returns
+				This function returns an export stream on success or NULL on failure.
+				Call hid_error(dev) to get the failure reason if it comes from the device,
+				errno is set otherwise.
+		*/
+		HID_API_EXPORT hid_export * HID_API_CALL hid_export_open(hid_device *dev, const char *path, size_t chunk_rows);
+
+		/** @brief Start exporting reports decoded with a given report descriptor.
+
+			Same as hid_export_open(), for reports that don't come from
+			an open device, e.g. replayed from a capture.
+
+			@ingroup API
+			@param descriptor The report descriptor.
+			@param descriptor_length The length of @p descriptor.
+			@param path The file to create (overwritten if it exists).
+			@param chunk_rows The number of rows buffered per Report ID before
+				they are written, 0 for #HID_API_EXPORT_DEFAULT_CHUNK_ROWS.
+
+			@returns
+				This function returns an export stream on success or NULL on failure,
+				with errno set (EINVAL if the descriptor has no Input report).
+		*/
+		HID_API_EXPORT hid_export * HID_API_CALL hid_export_open_descriptor(const unsigned char *descriptor, size_t descriptor_length, const char *path, size_t chunk_rows);
+
+		/** @brief Add an Input report to the export.
+
+			Reports with an unknown Report ID are ignored,
+			short reports are decoded as if padded with zeros.
+
+			@ingroup API
+			@param exp An export stream.
+			@param data The report, starting with the Report ID if the device uses them.
+			@param length The length of @p data.
+			@param timestamp_us The time the report was received,
+				in microseconds since the Unix epoch.
+
+			@returns
+				This function returns 0 on success (including for an ignored report)
+				and -1 if writing a chunk failed.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_export_report(hid_export *exp, const unsigned char *data, size_t length, unsigned long long timestamp_us);
+
+		/** @brief Read an Input report from the device and add it to the export.
+
+			Convenience wrapper around hid_read_timeout() and hid_export_report(),
+			timestamping the report with the current time.
+			Only for the streams opened with hid_export_open().
+
+			@ingroup API
+			@param exp An export stream.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the result of hid_read_timeout(),
+				or -1 if writing a chunk failed.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_export_read(hid_export *exp, int milliseconds);
+
+		/** @brief Write the buffered rows and close the file.
+
+			@ingroup API
+			@param exp An export stream.
+
+			@returns
+				This function returns 0 on success and -1 if writing failed
+				(at any point of the export).
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_export_close(hid_export *exp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Feeds 8 kHz reports to hid_aggregate_process() and checks the
+ * summaries of the 100 Hz windows, queued and through a callback.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <hidapi_aggregate.h>
+
+#include "hid_test_checks.h"
+
+/* Report 1: X, Y and Z from -32767 to 32767, and a counter.
+   Report 2: a vendor value, not aggregated. */
+static const unsigned char descriptor[] = {
+	0x05, 0x01,       /* Usage Page (Generic Desktop) */
+	0x09, 0x04,       /* Usage (Joystick) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x85, 0x01,       /*   Report ID (1) */
+	0x09, 0x30,       /*   Usage (X) */
+	0x09, 0x31,       /*   Usage (Y) */
+	0x09, 0x32,       /*   Usage (Z) */
+	0x16, 0x01, 0x80, /*   Logical Minimum (-32767) */
+	0x26, 0xFF, 0x7F, /*   Logical Maximum (32767) */
+	0x75, 0x10,       /*   Report Size (16) */
+	0x95, 0x03,       /*   Report Count (3) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0x06, 0x00, 0xFF, /*   Usage Page (Vendor) */
+	0x09, 0x01,       /*   Usage (1) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x26, 0xFF, 0x00, /*   Logical Maximum (255) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x95, 0x01,       /*   Report Count (1) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0xC0,             /* End Collection */
+	0x06, 0x00, 0xFF, /* Usage Page (Vendor) */
+	0x09, 0x02,       /* Usage (2) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x85, 0x02,       /*   Report ID (2) */
+	0x09, 0x10,       /*   Usage (0x10) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x95, 0x01,       /*   Report Count (1) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0xC0              /* End Collection */
+};
+
+#define START_US   1700000000000000ULL
+#define PERIOD_US  125ULL   /* 8 kHz */
+#define WINDOW_US  10000ULL /* 100 Hz */
+#define NUM_REPORTS 8000
+
+/* X ramps from 0 within each window, Y is -X, Z is constant */
+static void make_report(unsigned char *report, unsigned int i)
+{
+	short x = (short) (i % 80);
+	short y = (short) -x;
+
+	report[0] = 1;
+	report[1] = (unsigned char) (x & 0xFF); report[2] = (unsigned char) ((x >> 8) & 0xFF);
+	report[3] = (unsigned char) (y & 0xFF); report[4] = (unsigned char) ((y >> 8) & 0xFF);
+	report[5] = 0x34; report[6] = 0x12;
+	report[7] = (unsigned char) i;
+}
+
+static void check_window(const struct hid_aggregate_summary *summaries, size_t count, unsigned long long window)
+{
+	check_count("summaries per window", (long long) count, 3);
+	if (count != 3)
+		return;
+
+	check_count("window start", (long long) (summaries[0].window_start_us - START_US), (long long) (window * WINDOW_US));
+	check_count("X usage", summaries[0].usage, 0x30);
+	check_count("X count", summaries[0].count, 80);
+	check_count("X minimum", summaries[0].minimum, 0);
+	check_count("X maximum", summaries[0].maximum, 79);
+	check_count("X last", summaries[0].last, 79);
+	check_count("X mean * 2", (long long) (summaries[0].mean * 2), 79);
+	check_count("Y usage", summaries[1].usage, 0x31);
+	check_count("Y minimum", summaries[1].minimum, -79);
+	check_count("Y maximum", summaries[1].maximum, 0);
+	check_count("Z minimum", summaries[2].minimum, 0x1234);
+	check_count("Z maximum", summaries[2].maximum, 0x1234);
+}
+
+static unsigned long long callback_windows = 0;
+
+static void HID_API_CALL on_window(const struct hid_aggregate_summary *summaries, size_t count, void *user_data)
+{
+	(void) user_data;
+	check_window(summaries, count, callback_windows++);
+}
+
+int main(void)
+{
+	struct hid_aggregate_summary summaries[8];
+	unsigned char report[8];
+	hid_aggregate *aggregate;
+	unsigned long long windows = 0;
+	unsigned int i;
+	size_t n;
+
+	aggregate = hid_aggregate_open_descriptor(descriptor, sizeof(descriptor), WINDOW_US);
+	if (!aggregate) {
+		perror("hid_aggregate_open_descriptor");
+		return 1;
+	}
+	check_count("selected fields", hid_aggregate_add_fields(aggregate, 0x01, 0), 3);
+	check_count("selected again", hid_aggregate_add_fields(aggregate, 0x01, 0x30), 0);
+
+	/* Queued: a window is closed by the first report of the next one */
+	for (i = 0; i < NUM_REPORTS; i++) {
+		make_report(report, i);
+		if (hid_aggregate_process(aggregate, report, sizeof(report), START_US + i * PERIOD_US) < 0)
+			failures++;
+		/* Report 2 is ignored */
+		report[0] = 2;
+		hid_aggregate_process(aggregate, report, 2, START_US + i * PERIOD_US);
+
+		while ((n = hid_aggregate_get(aggregate, summaries, 8)) > 0)
+			check_window(summaries, n, windows++);
+	}
+	check_count("windows before the flush", (long long) windows, NUM_REPORTS / 80 - 1);
+
+	/* The last window isn't over yet */
+	check_count("early flush", hid_aggregate_flush(aggregate, START_US + NUM_REPORTS * PERIOD_US - 1), 0);
+	check_count("flush", hid_aggregate_flush(aggregate, START_US + NUM_REPORTS * PERIOD_US), 3);
+	n = hid_aggregate_get(aggregate, summaries, 8);
+	check_window(summaries, n, windows++);
+	check_count("windows", (long long) windows, NUM_REPORTS / 80);
+
+	/* Through a callback */
+	hid_aggregate_set_callback(aggregate, on_window, NULL);
+	for (i = 0; i < NUM_REPORTS; i++) {
+		make_report(report, i);
+		hid_aggregate_process(aggregate, report, sizeof(report), START_US + i * PERIOD_US);
+	}
+	hid_aggregate_flush(aggregate, ~0ULL);
+	check_count("callback windows", (long long) callback_windows, NUM_REPORTS / 80);
+	check_count("nothing queued", (long long) hid_aggregate_get(aggregate, summaries, 8), 0);
+
+	/* Not dispatched, and can't be without a device */
+	check_count("undispatch", hid_aggregate_dispatch(aggregate, NULL, 0), 0);
+	check_count("callback while not dispatched", hid_aggregate_set_callback(aggregate, on_window, NULL), 0);
+
+	hid_aggregate_close(aggregate);
+
+	if (failures == 0)
+		printf("aggregation OK: %d reports, %llu summaries\n", NUM_REPORTS, windows * 3);
+	return failures? 1: 0;
+}
@@ -0,0 +1,137 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Encodes Output and Feature reports with hid_encoder_encode()
+ * and checks their bytes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <hidapi_encoder.h>
+
+#include "hid_test_checks.h"
+
+/* Output report 1: 5 LEDs and 3 bits of padding.
+   Feature report 2: a gain from -1000 to 1000 on 12 bits, 4 bits of padding,
+   then a 4-byte vendor buffer. */
+static const unsigned char descriptor[] = {
+	0x05, 0x01,       /* Usage Page (Generic Desktop) */
+	0x09, 0x06,       /* Usage (Keyboard) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x85, 0x01,       /*   Report ID (1) */
+	0x05, 0x08,       /*   Usage Page (LEDs) */
+	0x19, 0x01,       /*   Usage Minimum (Num Lock) */
+	0x29, 0x05,       /*   Usage Maximum (Kana) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x25, 0x01,       /*   Logical Maximum (1) */
+	0x75, 0x01,       /*   Report Size (1) */
+	0x95, 0x05,       /*   Report Count (5) */
+	0x91, 0x02,       /*   Output (Data, Variable, Absolute) */
+	0x95, 0x03,       /*   Report Count (3) */
+	0x91, 0x01,       /*   Output (Constant) */
+	0x06, 0x00, 0xFF, /*   Usage Page (Vendor) */
+	0x85, 0x02,       /*   Report ID (2) */
+	0x09, 0x20,       /*   Usage (0x20) */
+	0x16, 0x18, 0xFC, /*   Logical Minimum (-1000) */
+	0x26, 0xE8, 0x03, /*   Logical Maximum (1000) */
+	0x75, 0x0C,       /*   Report Size (12) */
+	0x95, 0x01,       /*   Report Count (1) */
+	0xB1, 0x02,       /*   Feature (Data, Variable, Absolute) */
+	0x75, 0x04,       /*   Report Size (4) */
+	0xB1, 0x01,       /*   Feature (Constant) */
+	0x09, 0x21,       /*   Usage (0x21) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x26, 0xFF, 0x00, /*   Logical Maximum (255) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x95, 0x04,       /*   Report Count (4) */
+	0xB1, 0x02,       /*   Feature (Data, Variable, Absolute) */
+	0xC0              /* End Collection */
+};
+
+int main(void)
+{
+	hid_encoder *encoder;
+	unsigned char data[16];
+	int res;
+
+	encoder = hid_encoder_open_descriptor(descriptor, sizeof(descriptor));
+	if (!encoder) {
+		perror("hid_encoder_open_descriptor");
+		return 1;
+	}
+
+	if (hid_encoder_report_length(encoder, HID_ENCODER_OUTPUT, 1) != 2
+	 || hid_encoder_report_length(encoder, HID_ENCODER_FEATURE, 2) != 7
+	 || hid_encoder_report_length(encoder, HID_ENCODER_OUTPUT, 2) != -1) {
+		fprintf(stderr, "wrong report lengths\n");
+		failures++;
+	}
+
+	/* Caps Lock and Scroll Lock on */
+	{
+		const struct hid_usage_value leds[] = { { 0x08, 0x02, 1 }, { 0x08, 0x03, 1 } };
+		const unsigned char expected[] = { 0x01, 0x06 };
+
+		memset(data, 0xAA, sizeof(data));
+		res = hid_encoder_encode(encoder, HID_ENCODER_OUTPUT, 1, leds, 2, data, sizeof(data));
+		check_report("LEDs", res, data, expected, (int) sizeof(expected));
+	}
+
+	/* A negative 12-bit gain, and the buffer filled in order */
+	{
+		const struct hid_usage_value feature[] = {
+			{ 0xFF00, 0x21, 0x11 }, { 0xFF00, 0x21, 0x22 },
+			{ 0xFF00, 0x20, -2 },
+			{ 0xFF00, 0x21, 0x33 }, { 0xFF00, 0x21, 0x44 }
+		};
+		const unsigned char expected[] = { 0x02, 0xFE, 0x0F, 0x11, 0x22, 0x33, 0x44 };
+
+		res = hid_encoder_encode(encoder, HID_ENCODER_FEATURE, 2, feature, 5, data, sizeof(data));
+		check_report("feature", res, data, expected, (int) sizeof(expected));
+	}
+
+	/* Out of range values are clamped */
+	{
+		const struct hid_usage_value gain[] = { { 0xFF00, 0x20, 5000 } };
+		const unsigned char expected[] = { 0x02, 0xE8, 0x03, 0x00, 0x00, 0x00, 0x00 };
+
+		res = hid_encoder_encode(encoder, HID_ENCODER_FEATURE, 2, gain, 1, data, sizeof(data));
+		check_report("clamped", res, data, expected, (int) sizeof(expected));
+	}
+
+	/* Errors */
+	{
+		const struct hid_usage_value unknown[] = { { 0x08, 0x10, 1 } };
+		const struct hid_usage_value twice[] = { { 0x08, 0x01, 1 }, { 0x08, 0x01, 0 } };
+
+		check_error("unknown report", hid_encoder_encode(encoder, HID_ENCODER_FEATURE, 1, NULL, 0, data, sizeof(data)), ENOENT);
+		check_error("unknown usage", hid_encoder_encode(encoder, HID_ENCODER_OUTPUT, 1, unknown, 1, data, sizeof(data)), ENOENT);
+		check_error("usage twice", hid_encoder_encode(encoder, HID_ENCODER_OUTPUT, 1, twice, 2, data, sizeof(data)), EINVAL);
+		check_error("short buffer", hid_encoder_encode(encoder, HID_ENCODER_FEATURE, 2, NULL, 0, data, 6), ENOBUFS);
+	}
+
+	hid_encoder_close(encoder);
+
+	if (failures == 0)
+		printf("report encoder OK\n");
+	return failures? 1: 0;
+}
@@ -0,0 +1,156 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Feeds reports to hid_events_process() and checks the change events,
+ * with and without deadbands.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <hidapi_events.h>
+
+#include "hid_test_checks.h"
+
+/* Report 1: 8 buttons, X and Y from -127 to 127.
+   Report 2: an unsigned 16-bit vendor value. */
+static const unsigned char descriptor[] = {
+	0x05, 0x01,       /* Usage Page (Generic Desktop) */
+	0x09, 0x05,       /* Usage (Game Pad) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x85, 0x01,       /*   Report ID (1) */
+	0x05, 0x09,       /*   Usage Page (Button) */
+	0x19, 0x01,       /*   Usage Minimum (1) */
+	0x29, 0x08,       /*   Usage Maximum (8) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x25, 0x01,       /*   Logical Maximum (1) */
+	0x75, 0x01,       /*   Report Size (1) */
+	0x95, 0x08,       /*   Report Count (8) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0x05, 0x01,       /*   Usage Page (Generic Desktop) */
+	0x09, 0x30,       /*   Usage (X) */
+	0x09, 0x31,       /*   Usage (Y) */
+	0x15, 0x81,       /*   Logical Minimum (-127) */
+	0x25, 0x7F,       /*   Logical Maximum (127) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x95, 0x02,       /*   Report Count (2) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0xC0,             /* End Collection */
+	0x06, 0x00, 0xFF, /* Usage Page (Vendor) */
+	0x09, 0x01,       /* Usage (1) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x85, 0x02,       /*   Report ID (2) */
+	0x09, 0x10,       /*   Usage (0x10) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x27, 0xFF, 0xFF, 0x00, 0x00, /* Logical Maximum (65535) */
+	0x75, 0x10,       /*   Report Size (16) */
+	0x95, 0x01,       /*   Report Count (1) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0xC0              /* End Collection */
+};
+
+static void check_event(const struct hid_event *event, unsigned short usage_page, unsigned short usage, long long old_value, long long new_value)
+{
+	if (event->usage_page != usage_page || event->usage != usage || event->old_value != old_value || event->new_value != new_value) {
+		fprintf(stderr, "got %04x:%04x %lld -> %lld, expected %04x:%04x %lld -> %lld\n",
+			event->usage_page, event->usage, event->old_value, event->new_value,
+			usage_page, usage, old_value, new_value);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	struct hid_event batch[16];
+	hid_events *events;
+	unsigned char report[4];
+	size_t n;
+	int i;
+
+	events = hid_events_open_descriptor(descriptor, sizeof(descriptor));
+	if (!events) {
+		perror("hid_events_open_descriptor");
+		return 1;
+	}
+
+	/* Button 3 pressed, X moves to -5 */
+	report[0] = 1; report[1] = 0x04; report[2] = (unsigned char) -5; report[3] = 0;
+	check_count("first report", hid_events_process(events, report, 4), 2);
+	n = hid_events_get(events, batch, 16);
+	check_count("first batch", (long long) n, 2);
+	check_event(&batch[0], 0x09, 3, 0, 1);
+	check_event(&batch[1], 0x01, 0x30, 0, -5);
+
+	/* The same report again: nothing */
+	check_count("same report", hid_events_process(events, report, 4), 0);
+
+	/* An unknown Report ID is ignored */
+	report[0] = 9;
+	check_count("unknown report", hid_events_process(events, report, 4), 0);
+
+	/* Report 2 doesn't disturb the state of report 1 */
+	report[0] = 2; report[1] = 0x34; report[2] = 0x12;
+	check_count("report 2", hid_events_process(events, report, 3), 1);
+	n = hid_events_get(events, batch, 16);
+	check_event(&batch[0], 0xFF00, 0x10, 0, 0x1234);
+
+	/* Deadband of 1% of the range of the axes (254): changes up to 2 are ignored */
+	check_count("deadband fields", hid_events_set_deadband_percent(events, 0x01, 0, 1.0), 2);
+	report[0] = 1; report[1] = 0x04;
+	for (i = 1; i <= 3; i++) {
+		report[2] = (unsigned char) (-5 + i);
+		hid_events_process(events, report, 4);
+	}
+	/* -5 -> -4 -> -3 ignored, -2 is 3 away from the last event */
+	n = hid_events_get(events, batch, 16);
+	check_count("drift", (long long) n, 1);
+	check_event(&batch[0], 0x01, 0x30, -5, -2);
+
+	/* Button 3 released, button 8 pressed, Y to 100: taken in two batches */
+	report[1] = 0x80; report[3] = 100;
+	check_count("three changes", hid_events_process(events, report, 4), 3);
+	n = hid_events_get(events, batch, 2);
+	check_count("first part", (long long) n, 2);
+	check_event(&batch[0], 0x09, 3, 1, 0);
+	check_event(&batch[1], 0x09, 8, 0, 1);
+	n = hid_events_get(events, batch, 2);
+	check_count("second part", (long long) n, 1);
+	check_event(&batch[0], 0x01, 0x31, 0, 100);
+
+	/* Many reports queued before they are taken */
+	for (i = 0; i < 100; i++) {
+		report[1] = (unsigned char) (i & 1);
+		hid_events_process(events, report, 4);
+	}
+	n = 0;
+	{
+		size_t got;
+		while ((got = hid_events_get(events, batch, 16)) > 0)
+			n += got;
+	}
+	/* Button 8 released by the first report, then button 1 toggles 99 times */
+	check_count("queued", (long long) n, 100);
+
+	hid_events_close(events);
+
+	if (failures == 0)
+		printf("change events OK\n");
+	return failures? 1: 0;
+}
@@ -0,0 +1,312 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Exports generated reports with hid_export_open_descriptor(), then reads the
+ * file back following the format documented in hidapi_export.h and checks
+ * every decoded value.
+ */
+
+#if defined(_MSC_VER) && !defined(_CRT_SECURE_NO_WARNINGS)
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <hidapi_export.h>
+
+#define NUM_REPORTS 10000
+#define CHUNK_ROWS 1000
+
+/* Report 1: 3 buttons, 5 bits of padding, signed X and Y.
+   Report 2: two unsigned 16-bit vendor values. */
+static const unsigned char descriptor[] = {
+	0x05, 0x01,       /* Usage Page (Generic Desktop) */
+	0x09, 0x02,       /* Usage (Mouse) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x85, 0x01,       /*   Report ID (1) */
+	0x05, 0x09,       /*   Usage Page (Button) */
+	0x19, 0x01,       /*   Usage Minimum (1) */
+	0x29, 0x03,       /*   Usage Maximum (3) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x25, 0x01,       /*   Logical Maximum (1) */
+	0x75, 0x01,       /*   Report Size (1) */
+	0x95, 0x03,       /*   Report Count (3) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0x75, 0x05,       /*   Report Size (5) */
+	0x95, 0x01,       /*   Report Count (1) */
+	0x81, 0x01,       /*   Input (Constant) */
+	0x05, 0x01,       /*   Usage Page (Generic Desktop) */
+	0x09, 0x30,       /*   Usage (X) */
+	0x09, 0x31,       /*   Usage (Y) */
+	0x15, 0x81,       /*   Logical Minimum (-127) */
+	0x25, 0x7F,       /*   Logical Maximum (127) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x95, 0x02,       /*   Report Count (2) */
+	0x81, 0x06,       /*   Input (Data, Variable, Relative) */
+	0xC0,             /* End Collection */
+	0x06, 0x00, 0xFF, /* Usage Page (Vendor) */
+	0x09, 0x01,       /* Usage (1) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x85, 0x02,       /*   Report ID (2) */
+	0x09, 0x10,       /*   Usage (0x10) */
+	0x09, 0x11,       /*   Usage (0x11) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x27, 0xFF, 0xFF, 0x00, 0x00, /* Logical Maximum (65535) */
+	0x75, 0x10,       /*   Report Size (16) */
+	0x95, 0x02,       /*   Report Count (2) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0xC0              /* End Collection */
+};
+
+struct table {
+	unsigned report_id;
+	unsigned num_columns;
+	long checked;
+};
+
+static uint32_t get_le(const unsigned char *p, int bytes)
+{
+	uint32_t value = 0;
+	int i;
+	for (i = bytes - 1; i >= 0; i--)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+static int read_exact(FILE *f, unsigned char *buf, size_t length)
+{
+	return fread(buf, 1, length, f) == length? 0: -1;
+}
+
+/* Decode one column of a chunk into values[] */
+static int read_column(FILE *f, uint32_t rows, int64_t *values)
+{
+	unsigned char buf[4];
+	unsigned char *data;
+	uint32_t length, r;
+	size_t pos = 0;
+	uint64_t previous = 0;
+
+	if (read_exact(f, buf, 4) < 0)
+		return -1;
+	length = get_le(buf, 4);
+	data = (unsigned char *) malloc(length);
+	if (!data || read_exact(f, data, length) < 0) {
+		free(data);
+		return -1;
+	}
+
+	for (r = 0; r < rows; r++) {
+		uint64_t code = 0;
+		int shift = 0;
+		uint64_t delta;
+
+		do {
+			if (pos >= length) {
+				free(data);
+				return -1;
+			}
+			code |= (uint64_t) (data[pos] & 0x7F) << shift;
+			shift += 7;
+		} while (data[pos++] & 0x80);
+
+		delta = (code >> 1) ^ ((code & 1)? UINT64_MAX: 0);
+		previous += delta;
+		values[r] = (int64_t) previous;
+	}
+
+	free(data);
+	return (pos == length)? 0: -1;
+}
+
+/* The values generate_report() puts in the n-th report */
+static void expected_values(long n, int64_t *values)
+{
+	if (n % 3 != 2) {
+		values[0] = n & 1;
+		values[1] = (n >> 1) & 1;
+		values[2] = (n >> 2) & 1;
+		values[3] = (int64_t) (n % 255) - 127;
+		values[4] = 127 - (int64_t) (n % 200);
+	}
+	else {
+		values[0] = n % 65536;
+		values[1] = 65535 - n % 65536;
+	}
+}
+
+static size_t generate_report(long n, unsigned char *report)
+{
+	int64_t values[5];
+
+	expected_values(n, values);
+	if (n % 3 != 2) {
+		report[0] = 1;
+		report[1] = (unsigned char) (values[0] | (values[1] << 1) | (values[2] << 2) | 0xF8);
+		report[2] = (unsigned char) (int8_t) values[3];
+		report[3] = (unsigned char) (int8_t) values[4];
+		return 4;
+	}
+
+	report[0] = 2;
+	report[1] = (unsigned char) values[0];
+	report[2] = (unsigned char) (values[0] >> 8);
+	report[3] = (unsigned char) values[1];
+	report[4] = (unsigned char) (values[1] >> 8);
+	return 5;
+}
+
+int main(int argc, char *argv[])
+{
+	struct table tables[2];
+	unsigned char buf[16];
+	int64_t *columns[6];
+	long next[3] = { 0, 0, 0 };
+	hid_export *exp;
+	FILE *f;
+	uint32_t num_tables, t, c;
+	long n;
+	int i, result = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <output file>\n", argv[0]);
+		return 1;
+	}
+
+	exp = hid_export_open_descriptor(descriptor, sizeof(descriptor), argv[1], CHUNK_ROWS);
+	if (!exp) {
+		perror("hid_export_open_descriptor");
+		return 1;
+	}
+
+	for (n = 0; n < NUM_REPORTS; n++) {
+		unsigned char report[8];
+		size_t length = generate_report(n, report);
+		if (hid_export_report(exp, report, length, 1700000000000000ULL + (unsigned long long) n * 1000ULL) < 0) {
+			fprintf(stderr, "hid_export_report failed at report %ld\n", n);
+			return 1;
+		}
+	}
+	/* An unknown Report ID is ignored */
+	buf[0] = 7;
+	hid_export_report(exp, buf, 4, 0);
+
+	if (hid_export_close(exp) < 0) {
+		fprintf(stderr, "hid_export_close failed\n");
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror("fopen");
+		return 1;
+	}
+
+	if (read_exact(f, buf, 16) < 0 || memcmp(buf, "HIDCOL\0\0", 8) != 0 || get_le(buf + 8, 4) != 1) {
+		fprintf(stderr, "bad header\n");
+		return 1;
+	}
+	num_tables = get_le(buf + 12, 4);
+	if (num_tables != 2) {
+		fprintf(stderr, "expected 2 tables, got %u\n", (unsigned) num_tables);
+		return 1;
+	}
+
+	for (t = 0; t < num_tables; t++) {
+		if (read_exact(f, buf, 5) < 0)
+			return 1;
+		tables[t].report_id = buf[0];
+		tables[t].num_columns = get_le(buf + 1, 4);
+		tables[t].checked = 0;
+		for (c = 0; c < tables[t].num_columns; c++) {
+			if (read_exact(f, buf, 8) < 0)
+				return 1;
+			printf("table %u column %u: usage %04x:%04x, bits %u+%u, flags %u\n", tables[t].report_id, (unsigned) c,
+				(unsigned) get_le(buf, 2), (unsigned) get_le(buf + 2, 2), (unsigned) get_le(buf + 4, 2), buf[6], buf[7]);
+		}
+	}
+	if (tables[0].report_id != 1 || tables[0].num_columns != 5 || tables[1].report_id != 2 || tables[1].num_columns != 2) {
+		fprintf(stderr, "unexpected tables\n");
+		return 1;
+	}
+
+	for (i = 0; i < 6; i++)
+		columns[i] = (int64_t *) malloc(CHUNK_ROWS * sizeof(int64_t));
+
+	while (read_exact(f, buf, 9) == 0) {
+		struct table *table;
+		uint32_t rows, r;
+
+		if (memcmp(buf, "CHNK", 4) != 0) {
+			fprintf(stderr, "bad chunk\n");
+			result = 1;
+			break;
+		}
+		table = (buf[4] == 1)? &tables[0]: &tables[1];
+		rows = get_le(buf + 5, 4);
+
+		for (c = 0; c <= table->num_columns; c++) {
+			if (read_column(f, rows, columns[c]) < 0) {
+				fprintf(stderr, "bad column\n");
+				return 1;
+			}
+		}
+
+		for (r = 0; r < rows; r++) {
+			int64_t expected[5];
+			long *report = &next[table->report_id];
+
+			/* The n-th report goes to table 1 unless n % 3 == 2 */
+			while ((*report % 3 == 2) != (table->report_id == 2))
+				(*report)++;
+			expected_values(*report, expected);
+
+			if (columns[0][r] != (int64_t) (1700000000000000LL + *report * 1000LL)) {
+				fprintf(stderr, "report %ld: bad timestamp\n", *report);
+				result = 1;
+			}
+			for (c = 0; c < table->num_columns; c++) {
+				if (columns[c + 1][r] != expected[c]) {
+					fprintf(stderr, "report %ld column %u: got %lld, expected %lld\n", *report, (unsigned) c,
+						(long long) columns[c + 1][r], (long long) expected[c]);
+					result = 1;
+				}
+			}
+			(*report)++;
+			table->checked++;
+		}
+	}
+	fclose(f);
+
+	for (i = 0; i < 6; i++)
+		free(columns[i]);
+
+	if (tables[0].checked + tables[1].checked != NUM_REPORTS) {
+		fprintf(stderr, "decoded %ld reports, expected %d\n", tables[0].checked + tables[1].checked, NUM_REPORTS);
+		result = 1;
+	}
+
+	if (result == 0)
+		printf("%d reports exported and decoded\n", NUM_REPORTS);
+	return result;
+}
@@ -0,0 +1,63 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Checks shared by the tests of hidapi-export: each failed check prints
+ * what it got and counts a failure, the test returns failures? 1: 0.
+ */
+
+#ifndef HID_TEST_CHECKS_H__
+#define HID_TEST_CHECKS_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static int failures = 0;
+
+static inline void check_count(const char *what, long long got, long long expected)
+{
+	if (got != expected) {
+		fprintf(stderr, "%s: got %lld, expected %lld\n", what, got, expected);
+		failures++;
+	}
+}
+
+/* res is the length returned by the call that filled data */
+static inline void check_report(const char *what, int res, const unsigned char *data, const unsigned char *expected, int expected_length)
+{
+	if (res != expected_length || memcmp(data, expected, (size_t) expected_length) != 0) {
+		int i;
+		fprintf(stderr, "%s: got %d bytes:", what, res);
+		for (i = 0; i < res; i++)
+			fprintf(stderr, " %02x", data[i]);
+		fprintf(stderr, "\n");
+		failures++;
+	}
+}
+
+static inline void check_error(const char *what, int res, int expected_errno)
+{
+	if (res != -1 || errno != expected_errno) {
+		fprintf(stderr, "%s: got %d (errno %d), expected -1 (errno %d)\n", what, res, errno, expected_errno);
+		failures++;
+	}
+}
+
+#endif
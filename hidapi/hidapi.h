@@ -28,6 +28,7 @@
 #define HIDAPI_H__
 
 #include <wchar.h>
+#include <time.h>
 
 /* #480: this is to be refactored properly for v1.0 */
 #ifdef _WIN32
@@ -102,6 +103,13 @@
 */
 #define HID_API_MAX_REPORT_DESCRIPTOR_SIZE 4096
 
+/** @brief Value returned by hid_read() and hid_read_timeout() when the read was
+	interrupted by hid_interrupt_read().
+
+	@ingroup API
+*/
+#define HID_API_READ_INTERRUPTED (-2)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -217,6 +225,110 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_exit(void);
 
+		/** @brief Memory allocation functions used by HIDAPI.
+			See hid_set_allocator().
+
+			@ingroup API
+		*/
+		struct hid_allocator {
+			/** Same contract as malloc() */
+			void *(HID_API_CALL *malloc_fn)(size_t size, void *user_data);
+			/** Same contract as realloc() */
+			void *(HID_API_CALL *realloc_fn)(void *ptr, size_t size, void *user_data);
+			/** Same contract as free(), @p ptr may be NULL */
+			void (HID_API_CALL *free_fn)(void *ptr, void *user_data);
+			/** Passed as is to each of the functions above. (Optionally NULL). */
+			void *user_data;
+		};
+
+		/** @brief Set the memory allocation functions used by HIDAPI.
+
+			Every buffer HIDAPI allocates by itself is allocated with these functions:
+			hid_device objects, the struct hid_device_info lists and their strings,
+			error strings, queued input reports, transfer buffers
+			and the strings converted from the devices' descriptors.
+			Memory allocated internally by the OS or by the libraries HIDAPI uses
+			(libusb, libudev, iconv, IOKit, etc.) is not affected.
+
+			The functions may be called from any thread, including the internal
+			threads of HIDAPI, and must be thread-safe.
+
+			This function must be called before any other HIDAPI function,
+			or after hid_exit() once every object returned by HIDAPI was released,
+			since memory allocated with one allocator is freed with the current one.
+
+			@ingroup API
+			@param allocator The functions to use. All the functions must be set.
+				The structure is copied.
+				NULL restores the C runtime malloc(), realloc() and free().
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_allocator(const struct hid_allocator *allocator);
+
+		/** @brief A task run by an executor. See struct hid_executor.
+
+			@ingroup API
+		*/
+		typedef void (HID_API_CALL *hid_executor_task_fn)(void *arg);
+
+		/** @brief Threads supplied by the application to run the work of HIDAPI.
+			See hid_set_executor().
+
+			@ingroup API
+		*/
+		struct hid_executor {
+			/** Run a long-lived task on a thread of its own, until the task returns.
+				Used for the loops of HIDAPI: the read and libusb event loops,
+				the hotplug monitor, the fan-out of input reports, and the
+				health monitor without @p timer. These tasks block, so each one must
+				start right away on a thread that isn't needed by the other tasks.
+				Returns 0 and sets @p handle (passed to @p join) on success, -1 on failure. */
+			int (HID_API_CALL *spawn)(void *context, hid_executor_task_fn task, void *arg, void **handle);
+			/** Wait for a task started by @p spawn to return. Called once per task. */
+			void (HID_API_CALL *join)(void *context, void *handle);
+			/** Run a short task soon, on any thread (optionally NULL, to use @p spawn).
+				Used to release several devices in parallel in hid_close_many().
+				Returns 0 on success, -1 on failure. */
+			int (HID_API_CALL *post)(void *context, hid_executor_task_fn task, void *arg);
+			/** Run a short task once, after @p delay_ms milliseconds, on any thread
+				(optionally NULL, to use a task started with @p spawn).
+				Used for the periodic checks of hid_set_health_monitor().
+				The task must not be run from within this call.
+				Returns 0 on success, -1 on failure. */
+			int (HID_API_CALL *timer)(void *context, unsigned int delay_ms, hid_executor_task_fn task, void *arg);
+			/** Passed as is to each of the functions above. (Optionally NULL). */
+			void *context;
+		};
+
+		/** @brief Run the internal threads of HIDAPI on the threads of the application.
+
+			By default, HIDAPI creates its threads itself with pthread_create().
+			With an executor, every one of them is obtained from the executor
+			instead, e.g. from a thread pool with a tuned affinity and priority.
+
+			The functions of the executor may be called from any thread, including
+			the threads of HIDAPI, and must be thread-safe. The tasks given to the
+			executor must all be run until hid_exit() (or hid_close() for the tasks
+			of a device) returns.
+
+			This function must be called before any other HIDAPI function,
+			or after hid_exit() once every device was closed: the threads
+			already running are joined with the executor in use.
+
+			@ingroup API
+			@param executor The executor to use. @p spawn and @p join must be set.
+				The structure is copied.
+				NULL goes back to the threads created by HIDAPI.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+
+			@note Supported by the hidraw and libusb backends only.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_executor(const struct hid_executor *executor);
+
 		/** @brief Enumerate the HID Devices.
 
 			This function returns a linked list of all the HID devices
@@ -254,6 +366,110 @@ extern "C" {
 		*/
 		void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs);
 
+		/** @brief Enumeration callback function type.
+			Used by hid_enumerate_foreach() to report the devices one by one.
+
+			@ingroup API
+
+			@param device The hid_device_info of the enumerated device.
+				The structure is owned by HIDAPI and is only valid until the callback returns
+				(copy the fields you need, e.g. the path, to use them later).
+				@p device->next is always NULL.
+			@param user_data User data provided to hid_enumerate_foreach().
+				(Optionally NULL).
+
+			@returns bool
+				Whether the enumeration should stop.
+				Returning non-zero value will stop the enumeration:
+				the remaining devices are not probed and the callback is not called anymore.
+		 */
+		typedef int (HID_API_CALL *hid_enumerate_callback_fn)(
+			struct hid_device_info *device,
+			void *user_data);
+
+		/** @brief Enumerate the HID Devices, reporting each device as soon as it is discovered.
+
+			Same as hid_enumerate(), but instead of building a list of all the devices,
+			@p callback is called for each matching device right after it has been probed.
+			This allows to find a specific device without waiting for (potentially slow)
+			probing of all other devices in the system.
+
+			@note On the Windows, macOS and NetBSD backends the devices are probed all at once
+				and reported afterwards, so stopping early only saves the callback calls.
+
+			@ingroup API
+			@param vendor_id The Vendor ID (VID) of the types of device
+				to enumerate (0 matches any vendor).
+			@param product_id The Product ID (PID) of the types of
+				device to enumerate (0 matches any product).
+			@param callback The function called for each matching device.
+				See \ref hid_enumerate_callback_fn.
+			@param user_data The user data you wanted to provide to your callback function.
+
+			@returns
+				This function returns 0 when all of the devices were enumerated,
+				1 when the enumeration was stopped by the callback,
+				or -1 on error.
+				Not finding any matching device is not an error.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_enumerate_foreach(unsigned short vendor_id, unsigned short product_id, hid_enumerate_callback_fn callback, void *user_data);
+
+		/** @brief Get a value which changes when HID devices may have been connected or disconnected.
+
+			A cheap alternative to hid_enumerate() for clients that poll for device changes
+			and can't use hotplug callbacks: compare the value with the one from the previous call
+			and only enumerate the devices again if it has changed.
+			The value may also change when no HID device was added or removed
+			(the check is conservative), but it never stays the same if one was.
+
+			On the hidraw backend creation/removal of /dev/hidraw* nodes is tracked
+			(starting from the first call). On the libusb backend the kernel uevent sequence
+			number is used, which is available on Linux only.
+
+			Call this function before hid_enumerate() to not miss the changes in between.
+
+			@ingroup API
+			@param generation Pointer to store the current value.
+
+			@returns
+				This function returns 0 on success and -1 on error
+				or if it is not supported by the backend.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_enumerate_generation(unsigned int *generation);
+
+		/** @brief Update an enumeration with the devices added and removed since it was made.
+
+			Enumerates the HID devices which match @p vendor_id and @p product_id
+			and compares them with the entries of @p devs.
+			Entries are considered the same if their path, VID/PID, interface number,
+			usage page and usage match.
+
+			@ingroup API
+			@param vendor_id The Vendor ID (VID) of the types of device
+				to enumerate (0 matches any vendor).
+			@param product_id The Product ID (PID) of the types of
+				device to enumerate (0 matches any product).
+			@param devs Pointer to the previous enumeration,
+				as returned by hid_enumerate() or by a previous call (may point to NULL).
+				On success it is updated to the current enumeration: the entries that are
+				still present (the same structures as before, in the same order) followed by
+				the added entries.
+			@param added Pointer to store the first added entry. The added entries are
+				the tail of the updated @p devs list and must not be freed separately.
+				NULL if no device was added.
+			@param removed Pointer to store the list of entries removed from @p devs.
+				It must be freed by calling hid_free_enumeration().
+				NULL if no device was removed.
+
+			@returns
+				This function returns the number of added and removed entries on success
+				and -1 on error (in which case @p devs is not modified).
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_enumerate_diff(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs, struct hid_device_info **added, struct hid_device_info **removed);
+
 		/** @brief Callback handle.
 
 			Callbacks handles are generated by hid_hotplug_register_callback()
@@ -430,6 +646,48 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *data, size_t length);
 
+		/** @brief An Output report to write with hid_write_many().
+
+			@ingroup API
+		*/
+		struct hid_write_request {
+			/** A device handle returned from hid_open(). */
+			hid_device *dev;
+			/** The data to send, including the report number as the first byte,
+				same as for hid_write(). */
+			const unsigned char *data;
+			/** The length in bytes of the data to send. */
+			size_t length;
+			/** Set by hid_write_many() to the result hid_write() would return:
+				the number of bytes written or -1 on error. */
+			int result;
+		};
+
+		/** @brief Write Output reports to several HID devices at once.
+
+			Same as calling hid_write() for each of the requests, but all the writes
+			are started back-to-back, so that the devices receive their reports
+			as close together in time as possible, e.g. to update them in the same frame.
+			On the libusb backend the interrupt transfers of all the requests are
+			prepared first, then submitted together, and the function waits
+			for all of them to complete.
+			On the other backends the reports are written one after another
+			without any other work in between.
+
+			@ingroup API
+			@param requests The reports to write. The same device may appear
+				several times: its reports are sent in order.
+			@param count The number of entries in @p requests.
+			@param spread If not NULL, set to the time elapsed between the first
+				and the last successful write completion.
+
+			@returns
+				This function returns 0 if all the reports were written
+				and -1 if any of the writes failed: check the result of each request,
+				call hid_error(requests[i].dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_write_many(struct hid_write_request *requests, size_t count, struct timespec *spread);
+
 		/** @brief Read an Input report from a HID device with timeout.
 
 			Input reports are returned
@@ -450,9 +708,57 @@ extern "C" {
 				Call hid_error(dev) to get the failure reason.
 				If no packet was available to be read within
 				the timeout period, this function returns 0.
+				If the read was interrupted by hid_interrupt_read(),
+				this function returns @ref HID_API_READ_INTERRUPTED.
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds);
 
+		/** @brief Read an Input report from a HID device with a timeout
+			of sub-millisecond resolution.
+
+			Same as hid_read_timeout(), but the timeout is a struct timespec.
+
+			@note The hidraw and libusb backends use the full resolution,
+				other backends round the timeout up to whole milliseconds.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read. For devices with
+				multiple reports, make sure to read an extra byte for
+				the report number.
+			@param timeout The timeout, NULL for blocking wait.
+				A zero timeout makes a non-blocking read.
+
+			@returns
+				Same as hid_read_timeout().
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_timeout_ts(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout);
+
+		/** @brief Read an Input report from a HID device, waiting until an absolute deadline.
+
+			Same as hid_read_timeout_ts(), but waits until @p deadline,
+			a point in time of the CLOCK_MONOTONIC clock (see clock_gettime()).
+			A periodic loop can advance its deadline by a fixed period on each iteration,
+			so the time spent between the reads doesn't accumulate.
+			If the deadline has already passed, only a report which is already
+			available is returned.
+
+			@note Not supported on Windows.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param data A buffer to put the read data into.
+			@param length The number of bytes to read. For devices with
+				multiple reports, make sure to read an extra byte for
+				the report number.
+			@param deadline The CLOCK_MONOTONIC deadline, NULL for blocking wait.
+
+			@returns
+				Same as hid_read_timeout().
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline);
+
 		/** @brief Read an Input report from a HID device.
 
 			Input reports are returned
@@ -472,9 +778,373 @@ extern "C" {
 				Call hid_error(dev) to get the failure reason.
 				If no packet was available to be read and
 				the handle is in non-blocking mode, this function returns 0.
+				If the read was interrupted by hid_interrupt_read(),
+				this function returns @ref HID_API_READ_INTERRUPTED.
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length);
 
+		/** @brief Interrupt a read from a HID device.
+
+			Wakes up a thread blocked in hid_read() or hid_read_timeout() on @p dev,
+			which then returns @ref HID_API_READ_INTERRUPTED, regardless of its timeout.
+			If no read is in progress, the next read returns @ref HID_API_READ_INTERRUPTED
+			right away instead, so the request can't be lost to a race with the reader.
+			Calls made before the reader wakes up count as one interruption.
+			Pending Input reports are not discarded.
+
+			This allows readers to use infinite timeouts and still be stopped
+			immediately (e.g. before calling hid_close() from another thread).
+			This function is safe to call from any thread.
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int  HID_API_EXPORT HID_API_CALL hid_interrupt_read(hid_device *dev);
+
+		struct hid_subscription_;
+		typedef struct hid_subscription_ hid_subscription; /**< opaque subscription to the Input reports of a device */
+
+		/** @brief What a subscription does with a new Input report when its queue is full.
+
+			@ingroup API
+		*/
+		typedef enum {
+			/** Discard the new report */
+			HID_API_SUBSCRIPTION_DROP_NEWEST = 0,
+			/** Discard the oldest queued report to make room for the new one */
+			HID_API_SUBSCRIPTION_DROP_OLDEST = 1
+		} hid_subscription_overflow;
+
+		/** @brief Subscribe to the Input reports of a HID device.
+
+			Each subscription receives its own copy of every Input report
+			received from the device after the subscription was made,
+			so that several threads can consume the same input stream.
+			The reports are queued in a lock-free ring per subscription,
+			fed by the backend's reader: a slow subscriber only loses
+			its own reports, according to @p overflow, and never delays
+			the other subscribers.
+
+			hid_read() keeps working on the libusb backend, but while the device
+			has subscriptions, its reports are only queued for hid_read() once
+			hid_read() was called, so that they are not copied for nobody.
+			On the hidraw backend a background thread reads the device
+			while it has subscriptions, so hid_read() should not be used then,
+			unless the device has a read buffer (see hid_hidraw_set_read_buffer()).
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param capacity The number of reports the subscription can queue.
+			@param report_length The maximum length of a report,
+				longer reports are truncated.
+			@param overflow What to do when a report arrives and the queue is full.
+
+			@returns
+				This function returns a subscription to be read with
+				hid_subscription_read_timeout() and released with
+				hid_unsubscribe(), or NULL on failure.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		HID_API_EXPORT hid_subscription * HID_API_CALL hid_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow);
+
+		/** @brief Read the next Input report of a subscription.
+
+			Only one thread at a time may read from a given subscription.
+
+			@ingroup API
+			@param subscription A subscription returned from hid_subscribe().
+			@param data A buffer to put the read data into.
+			@param length The size of @p data, longer reports are truncated.
+			@param milliseconds timeout in milliseconds or -1 for blocking wait.
+
+			@returns
+				This function returns the actual number of bytes read,
+				0 if no report was queued before the timeout,
+				or -1 once the device was disconnected or closed
+				and all the queued reports were read.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_subscription_read_timeout(hid_subscription *subscription, unsigned char *data, size_t length, int milliseconds);
+
+		/** @brief Get the number of reports a subscription discarded because its queue was full.
+
+			@ingroup API
+			@param subscription A subscription returned from hid_subscribe().
+
+			@returns
+				The number of discarded reports since hid_subscribe().
+		*/
+		size_t HID_API_EXPORT HID_API_CALL hid_subscription_dropped(hid_subscription *subscription);
+
+		/** @brief Release a subscription.
+
+			Must not be called while the subscription is being read.
+			The subscriptions still active when the device is closed
+			are released by hid_close().
+
+			For a subscription of hid_subscribe_dispatch(), waits for its
+			running callback to return, so it must not be called
+			(nor hid_close() for its device) from that callback.
+
+			@ingroup API
+			@param subscription A subscription returned from hid_subscribe()
+				or hid_subscribe_dispatch().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_unsubscribe(hid_subscription *subscription);
+
+		struct hid_dispatcher_;
+		typedef struct hid_dispatcher_ hid_dispatcher; /**< opaque thread pool running input callbacks */
+
+		/** @brief Callback receiving the Input reports of a subscription of hid_subscribe_dispatch().
+
+			@ingroup API
+			@param dev The device of the subscription.
+			@param data The report, valid until the callback returns.
+				NULL once the device was disconnected, after its last report.
+			@param length The length of @p data, 0 once the device was disconnected.
+			@param user_data The user_data given to hid_subscribe_dispatch().
+		*/
+		typedef void (HID_API_CALL *hid_input_callback_fn)(hid_device *dev, const unsigned char *data, size_t length, void *user_data);
+
+		/** @brief Create a thread pool running the input callbacks of many devices.
+
+			The reports of each subscription are queued by the backend's reader
+			and handed to the callback by one thread of the pool at a time,
+			in the order they were received. The subscriptions with queued
+			reports are shared among the threads of the pool, an idle thread
+			taking work from the busy ones, so that a slow callback of one
+			device never delays the callbacks of the other devices.
+
+			The threads come from the executor of hid_set_executor(), if any.
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param num_threads The number of threads of the pool,
+				0 for one per online CPU.
+
+			@returns
+				This function returns a dispatcher to be released with
+				hid_dispatcher_destroy(), or NULL on failure.
+		*/
+		HID_API_EXPORT hid_dispatcher * HID_API_CALL hid_dispatcher_create(unsigned int num_threads);
+
+		/** @brief Subscribe to the Input reports of a HID device, delivered to a callback.
+
+			Same as hid_subscribe(), but instead of being read with
+			hid_subscription_read_timeout(), the queued reports are passed
+			to @p callback by the threads of @p dispatcher: in order, and never
+			to two calls at once for a given subscription.
+			hid_subscription_dropped() and hid_unsubscribe() apply as usual.
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param dispatcher A dispatcher returned from hid_dispatcher_create().
+			@param dev A device handle returned from hid_open().
+			@param capacity The number of reports the subscription can queue
+				while its callback is busy.
+			@param report_length The maximum length of a report,
+				longer reports are truncated.
+			@param overflow What to do when a report arrives and the queue is full.
+			@param callback The function to call for each report.
+			@param user_data Passed to @p callback.
+
+			@returns
+				This function returns a subscription to be released with
+				hid_unsubscribe(), or NULL on failure.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		HID_API_EXPORT hid_subscription * HID_API_CALL hid_subscribe_dispatch(hid_dispatcher *dispatcher, hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_input_callback_fn callback, void *user_data);
+
+		/** @brief Stop the threads of a dispatcher and free it.
+
+			Every subscription of the dispatcher must be released first,
+			with hid_unsubscribe() or hid_close().
+
+			@ingroup API
+			@param dispatcher A dispatcher returned from hid_dispatcher_create().
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_dispatcher_destroy(hid_dispatcher *dispatcher);
+
+		/** @brief Inter-report gap statistics of a monitored device.
+
+			All the durations are in microseconds. The statistics cover
+			the reports received since hid_set_health_monitor() was called.
+
+			@ingroup API
+		*/
+		struct hid_health_stats {
+			/** Number of Input reports received */
+			unsigned long long reports;
+			/** Number of reports that came later than twice the expected interval */
+			unsigned long long late_reports;
+			/** Gap between the last two reports */
+			unsigned long long last_gap_us;
+			/** Smallest gap between two reports */
+			unsigned long long min_gap_us;
+			/** Mean gap between two reports */
+			unsigned long long mean_gap_us;
+			/** Largest gap between two reports */
+			unsigned long long max_gap_us;
+			/** Time since the last report, or since monitoring started if none was received */
+			unsigned long long silence_us;
+		};
+
+		/** @brief Health monitor events.
+
+			@ingroup API
+		*/
+		typedef enum {
+			/** The device didn't send any report for longer than the silence threshold */
+			HID_API_HEALTH_STALLED = (1 << 0),
+			/** A stalled device sent a report again */
+			HID_API_HEALTH_RECOVERED = (1 << 1)
+		} hid_health_event;
+
+		/** @brief Health monitor callback function type.
+
+			The callbacks of all the monitored devices are called from a single
+			library thread, one at a time. A callback may call
+			hid_set_health_monitor(), but must not block for long:
+			the other devices are not checked meanwhile.
+
+			@ingroup API
+
+			@param dev The monitored device.
+			@param event The event that occurred.
+			@param stats The gap statistics of the device when the event was detected.
+			@param user_data User data provided to hid_set_health_monitor().
+		 */
+		typedef void (HID_API_CALL *hid_health_callback_fn)(
+			hid_device *dev,
+			hid_health_event event,
+			const struct hid_health_stats *stats,
+			void *user_data);
+
+		/** @brief Detect when a device stops sending Input reports.
+
+			The arrival time of each Input report is recorded by the backend's reader
+			(hid_read() and friends on hidraw, the read thread on libusb),
+			without a thread per device: a single library thread checks all the
+			monitored devices on a timer wheel with a millisecond resolution.
+
+			@p callback is called with #HID_API_HEALTH_STALLED when no report was received
+			for @p silence_threshold_ms, and with #HID_API_HEALTH_RECOVERED when
+			a report is received afterwards. The recovery is noticed within
+			@p silence_threshold_ms of the report.
+
+			On hidraw, reports only arrive while the device is being read
+			(with hid_read() or hid_subscribe()).
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param expected_interval_us The usual interval between two reports,
+				used to count the late reports. 0 to not count them.
+			@param silence_threshold_ms How long the device may stay silent
+				before it is reported as stalled. 0 to stop monitoring the device.
+			@param callback The function to call on the health events.
+			@param user_data User data passed to @p callback.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_health_monitor(hid_device *dev, unsigned int expected_interval_us, unsigned int silence_threshold_ms, hid_health_callback_fn callback, void *user_data);
+
+		/** @brief Get the gap statistics of a monitored device.
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param stats Filled with the current statistics.
+
+			@returns
+				This function returns 0 on success and -1 on error,
+				including when the device is not monitored.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_health_stats(hid_device *dev, struct hid_health_stats *stats);
+
+		/** @brief Maximum number of bytes covered by hid_input_filter::mask. */
+		#define HID_API_INPUT_FILTER_MASK_SIZE 64
+
+		/** @brief Which Input reports of a device to deliver, see hid_set_input_filter().
+
+			@ingroup API
+		*/
+		struct hid_input_filter {
+			/** Non-zero if the first byte of the reports is a Report ID:
+				the reports are then filtered by @p report_ids
+				and compared per Report ID by @p ignore_unchanged */
+			int numbered_reports;
+			/** The Report IDs to deliver when @p numbered_reports is set:
+				Report ID n is bit (n % 8) of report_ids[n / 8] */
+			unsigned char report_ids[32];
+			/** Non-zero to drop the reports equal to the last delivered
+				report (with the same Report ID), as compared through @p mask */
+			int ignore_unchanged;
+			/** ANDed with the first @p mask_length bytes of the reports before they
+				are compared, so that the 0 bits (e.g. a counter or a timestamp) are
+				ignored. The bytes after @p mask_length are compared as they are. */
+			unsigned char mask[HID_API_INPUT_FILTER_MASK_SIZE];
+			/** Number of bytes of @p mask in use */
+			size_t mask_length;
+			/** Deliver only the first @p trim_length bytes of the reports, 0 to deliver them whole */
+			size_t trim_length;
+			/** Non-zero to also drop the reports in the kernel, with HID-BPF, where available:
+				see hid_set_input_filter(). Ignored by the other backends. */
+			int kernel_filter;
+		};
+
+		/** @brief Drop or trim Input reports before they are delivered.
+
+			The filter is applied by the backend's reader, as early as the backend allows:
+			on libusb, the dropped reports are never queued and don't wake up
+			the readers of the device. On hidraw, the filter runs in user space:
+			the kernel still wakes up the reader (hid_read() or the subscriptions'
+			fan-out thread) for every report, hid_read() and friends then keep
+			waiting (within their timeout) when a report is dropped, and the
+			dropped reports are not passed to the subscriptions.
+			The reports are still counted by hid_set_health_monitor().
+
+			With hid_input_filter::kernel_filter, the hidraw backend also attaches
+			a HID-BPF program to the device, which drops the reports before they
+			reach hidraw, so that they cost no wakeup and no read() at all.
+			This requires a backend built with HIDAPI_WITH_HID_BPF, Linux 6.11
+			or newer and the privileges to load BPF programs (usually root);
+			otherwise the filter only runs in user space, as above.
+			The kernel drops the reports for every user of the HID device
+			(other hidraw readers, input drivers), not only for @p dev,
+			until the filter is replaced or @p dev is closed. Trimming, and
+			comparing the reports longer than 64 bytes, is left to user space.
+
+			May be called while other threads read from @p dev.
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param filter The reports to deliver, copied by the function.
+				NULL to deliver all the reports again.
+
+			@returns
+				This function returns 1 if the filter also runs in the kernel,
+				0 if it only runs in user space, and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_input_filter(hid_device *dev, const struct hid_input_filter *filter);
+
 		/** @brief Set the device handle to be non-blocking.
 
 			In non-blocking mode calls to hid_read() will return
@@ -551,6 +1221,32 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned char *data, size_t length);
 
+		/** @brief Enable or disable caching of the Feature reports of a device.
+
+			With the cache enabled, the result of hid_get_feature_report() is kept
+			per Report ID and returned by the following hid_get_feature_report() calls
+			for the same Report ID for @p ttl_milliseconds, without a request to the device.
+			Useful for static reports (e.g. firmware version or calibration data)
+			which are read often.
+
+			A cached report is dropped when hid_send_feature_report() is called with
+			the same Report ID. The whole cache is dropped when a request fails
+			or when the device is detected as disconnected.
+			The cache is disabled by default.
+
+			@note Supported by the hidraw and libusb backends only.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param ttl_milliseconds How long a cached report stays valid,
+				0 disables the cache (and drops the cached reports).
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_milliseconds);
+
 		/** @brief Get a input report from a HID device.
 
 			Since version 0.10.0, @ref HID_API_VERSION >= HID_API_MAKE_VERSION(0, 10, 0)
@@ -586,6 +1282,22 @@ extern "C" {
 		*/
 		void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev);
 
+		/** @brief Close several HID devices at once.
+
+			Same as calling hid_close() for each of the devices,
+			but faster when many devices are closed together:
+			on the libusb backend, the read threads of all the devices are stopped first
+			and then the interfaces are released (and the kernel drivers reattached)
+			in parallel.
+
+			@ingroup API
+
+			@param devs An array of device handles returned from hid_open().
+				NULL entries are ignored.
+			@param count The number of entries in @p devs.
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_close_many(hid_device **devs, size_t count);
+
 		/** @brief Get The Manufacturer String from a HID device.
 
 			@ingroup API
@@ -700,6 +1412,54 @@ extern "C" {
 		*/
 		HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device *dev);
 
+		/** @brief Turn the debug log of the library on or off.
+
+			The debug log records what the library does internally (devices
+			opened, transfer and read errors, hotplug events, ...). Recording
+			doesn't format anything nor take a lock: each thread writes binary
+			records to its own ring, which are only formatted by
+			hid_debug_log_read(). The log can so be kept on in release builds,
+			without disturbing the timing of the reads.
+
+			The log is off by default. It is turned on at hid_init() if the
+			HIDAPI_DEBUG_LOG environment variable is set and not "0",
+			and always in the libusb builds with DEBUG_PRINTF, which also
+			write the records not read to stderr at hid_exit().
+
+			This function is thread-safe.
+
+			@ingroup API
+			@param enable 1 to record, 0 to stop recording.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+
+			@note Supported by the hidraw and libusb backends only.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_debug_log_enable(int enable);
+
+		/** @brief Format the oldest records of the debug log.
+
+			The records of all the threads are returned in the order they were
+			written, one per line, prefixed with a monotonic timestamp in seconds
+			and the number of the thread, and removed from the log. When a ring is
+			full, the new records are dropped, and their number is reported first.
+
+			This function is thread-safe.
+
+			@ingroup API
+			@param buffer The buffer to fill with complete lines, NUL terminated.
+				512 bytes or more make sure a record fits.
+			@param size The size of @p buffer.
+
+			@returns
+				This function returns the number of characters written to @p buffer
+				(0 if the log is empty), or -1 on error.
+
+			@note Supported by the hidraw and libusb backends only.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_debug_log_read(char *buffer, size_t size);
+
 		/** @brief Get a runtime version of the library.
 
 			This function is thread-safe.
@@ -29,6 +29,7 @@
 #include <ctype.h>
 #include <locale.h>
 #include <errno.h>
+#include <limits.h>
 
 /* Unix */
 #include <unistd.h>
@@ -49,6 +50,8 @@
 #endif
 
 #include "hidapi_libusb.h"
+#include "hid_debug_log.h"
+#include "hid_enumerate_diff.h"
 
 #ifndef HIDAPI_THREAD_MODEL_INCLUDE
 #define HIDAPI_THREAD_MODEL_INCLUDE "hidapi_thread_pthread.h"
@@ -64,11 +67,8 @@
 extern "C" {
 #endif
 
-#ifdef DEBUG_PRINTF
-#define LOG(...) fprintf(stderr, __VA_ARGS__)
-#else
-#define LOG(...) do {} while (0)
-#endif
+/* Recorded to the debug log, see hid_debug_log_enable() */
+#define LOG(...) HID_DEBUG_LOG(__VA_ARGS__)
 
 #ifndef __FreeBSD__
 #define DETACH_KERNEL_DRIVER
@@ -90,6 +90,48 @@ struct input_report {
 };
 
 
+/* A thread of the library, started by the executor of hid_set_executor() if any */
+struct hid_internal_thread {
+	pthread_t thread;
+	/* Handle given by executor.spawn, when on_executor */
+	void *handle;
+	int on_executor;
+	void *(*func)(void *);
+	void *arg;
+};
+
+/* Set by hid_set_executor(), all NULL to create the threads with pthread_create() */
+static struct hid_executor executor = { NULL, NULL, NULL, NULL, NULL };
+
+static void HID_API_CALL hid_internal_thread_task(void *param)
+{
+	struct hid_internal_thread *t = (struct hid_internal_thread *) param;
+	t->func(t->arg);
+}
+
+/* Returns 0 on success, -1 on failure */
+static int hid_internal_thread_start(struct hid_internal_thread *t, void *(*func)(void *), void *arg)
+{
+	t->func = func;
+	t->arg = arg;
+	t->on_executor = (executor.spawn != NULL);
+
+	if (t->on_executor)
+		return (executor.spawn(executor.context, hid_internal_thread_task, t, &t->handle) == 0)? 0: -1;
+
+	return (pthread_create(&t->thread, NULL, func, arg) == 0)? 0: -1;
+}
+
+static void hid_internal_thread_join(struct hid_internal_thread *t)
+{
+	if (t->on_executor)
+		executor.join(executor.context, t->handle);
+	else
+		pthread_join(t->thread, NULL);
+}
+
+#include "hid_health.h"
+
 struct hid_device_ {
 	/* Handle to the actual device. */
 	libusb_device_handle *device_handle;
@@ -105,6 +147,7 @@ struct hid_device_ {
 	int input_endpoint;
 	int output_endpoint;
 	int input_ep_max_packet_size;
+	int output_ep_max_packet_size;
 
 	/* Indexes of Strings */
 	int manufacturer_index;
@@ -117,12 +160,39 @@ struct hid_device_ {
 
 	/* Read thread objects */
 	hidapi_thread_state thread_state;
+	/* The read thread, when started by the executor of hid_set_executor() */
+	struct hid_internal_thread executor_thread;
 	int shutdown_thread;
 	int transfer_loop_finished;
+	/* Set by hid_interrupt_read(), cleared by the interrupted read */
+	int read_interrupted;
 	struct libusb_transfer *transfer;
+	/* The buffer of transfer is in device memory, see hid_internal_transfer_buffer_alloc() */
+	int transfer_dev_mem;
+
+	/* Device memory for the interrupt OUT transfers of hid_write(),
+	   NULL if not available. Used by one hid_write() at a time. */
+	unsigned char *out_buffer;
+	pthread_mutex_t out_buffer_mutex;
 
 	/* List of received input reports. */
 	struct input_report *input_reports;
+	/* Set by the first hid_read(): from then on, the reports are queued
+	   for hid_read() even while the device has subscriptions */
+	int read_used;
+
+	/* Subscriptions to the input reports, protected by the thread_state mutex */
+	struct hid_subscription_ *subscriptions;
+
+	/* See hid_set_health_monitor() */
+	struct hid_health_monitor health;
+
+	/* Opt-in cache of the Feature reports, NULL if disabled */
+	struct hid_feature_report_cache *feature_cache;
+
+	/* Set by hid_set_input_filter(), NULL to deliver all the reports.
+	   Protected by the thread_state mutex. */
+	struct hid_input_filter_state *input_filter;
 
 	/* Was kernel driver detached by libusb */
 #ifdef DETACH_KERNEL_DRIVER
@@ -149,6 +219,12 @@ static struct hid_hotplug_context {
 
 	int mutex_ready;
 
+	/* Thread that handles libusb events, so hotplug notifications
+	   are delivered even when no device is open */
+	struct hid_internal_thread thread;
+
+	int thread_running;
+
 	/* Linked list of the hotplug callbacks */
 	struct hid_hotplug_callback *hotplug_cbs;
 
@@ -157,32 +233,108 @@ static struct hid_hotplug_context {
 } hid_hotplug_context = {
 	.next_handle = FIRST_HOTPLUG_CALLBACK_HANDLE,
 	.mutex_ready = 0,
+	.thread_running = 0,
 	.hotplug_cbs = NULL,
 	.devs = NULL
 };
 
+/* Set by hid_set_allocator(), all NULL to use the C runtime */
+static struct hid_allocator allocator = { NULL, NULL, NULL, NULL };
+
+static void *hid_internal_malloc(size_t size)
+{
+	if (allocator.malloc_fn)
+		return allocator.malloc_fn(size, allocator.user_data);
+	return malloc(size);
+}
+
+static void *hid_internal_calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (!allocator.malloc_fn)
+		return calloc(count, size);
+
+	if (size != 0 && count > (size_t) -1 / size)
+		return NULL;
+	ptr = hid_internal_malloc(count * size);
+	if (ptr)
+		memset(ptr, 0, count * size);
+	return ptr;
+}
+
+static void hid_internal_free(void *ptr)
+{
+	if (allocator.free_fn)
+		allocator.free_fn(ptr, allocator.user_data);
+	else
+		free(ptr);
+}
+
+#include "hid_dispatcher.h"
+#include "hid_feature_cache.h"
+#include "hid_input_filter.h"
+
+/* The consumer of a subscription sleeps on it while its ring is empty, see hid_subscription.h */
+typedef hidapi_thread_state hid_internal_wait_state;
+
+static void hid_internal_wait_notify(hid_internal_wait_state *state)
+{
+	hidapi_thread_mutex_lock(state);
+	hidapi_thread_cond_broadcast(state);
+	hidapi_thread_mutex_unlock(state);
+}
+
+#include "hid_subscription.h"
+
+static char *hid_internal_strdup(const char *s)
+{
+	size_t size = strlen(s) + 1;
+	char *ret = (char*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
+static wchar_t *hid_internal_wcsdup(const wchar_t *s)
+{
+	size_t size = (wcslen(s) + 1) * sizeof(wchar_t);
+	wchar_t *ret = (wchar_t*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
 uint16_t get_usb_code_for_current_locale(void);
 static int return_data(hid_device *dev, unsigned char *data, size_t length);
 
 static hid_device *new_hid_device(void)
 {
-	hid_device *dev = (hid_device*) calloc(1, sizeof(hid_device));
+	hid_device *dev = (hid_device*) hid_internal_calloc(1, sizeof(hid_device));
 	dev->blocking = 1;
 
 	hidapi_thread_state_init(&dev->thread_state);
+	pthread_mutex_init(&dev->out_buffer_mutex, NULL);
 
 	return dev;
 }
 
 static void free_hid_device(hid_device *dev)
 {
+	while (dev->subscriptions)
+		hid_unsubscribe(dev->subscriptions);
+
+	hid_set_feature_report_cache(dev, 0);
+	hid_set_input_filter(dev, NULL);
+
 	/* Clean up the thread objects */
 	hidapi_thread_state_destroy(&dev->thread_state);
+	pthread_mutex_destroy(&dev->out_buffer_mutex);
 
 	hid_free_enumeration(dev->device_info);
 
 	/* Free the device itself */
-	free(dev);
+	hid_internal_free(dev);
 }
 
 #if 0
@@ -371,7 +523,7 @@ static int is_language_supported(libusb_device_handle *dev, uint16_t lang)
 
 /* This function returns a newly allocated wide string containing the USB
    device string numbered by the index. The returned string must be freed
-   by using free(). */
+   by using hid_internal_free(). */
 static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 {
 	char buf[512];
@@ -414,7 +566,7 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 
 	   Skip over the first character (2-bytes).  */
 	len -= 2;
-	str = (wchar_t*) malloc((len / 2 + 1) * sizeof(wchar_t));
+	str = (wchar_t*) hid_internal_malloc((len / 2 + 1) * sizeof(wchar_t));
 	int i;
 	for (i = 0; i < len / 2; i++) {
 		str[i] = buf[i * 2 + 2] | (buf[i * 2 + 3] << 8);
@@ -451,7 +603,7 @@ static wchar_t *get_usb_string(libusb_device_handle *dev, uint8_t idx)
 		*((wchar_t*)outptr) = 0x00000000;
 
 	/* Allocate and copy the string. */
-	str = wcsdup(wbuf);
+	str = hid_internal_wcsdup(wbuf);
 
 err:
 	iconv_close(ic);
@@ -495,7 +647,7 @@ static char *make_path(libusb_device *dev, int config_number, int interface_numb
 {
 	char str[64];
 	get_path(&str, dev, config_number, interface_number);
-	return strdup(str);
+	return hid_internal_strdup(str);
 }
 
 HID_API_EXPORT const struct hid_api_version* HID_API_CALL hid_version(void)
@@ -551,17 +703,27 @@ static void hid_internal_hotplug_exit()
 	/* Remove all callbacks from the list */
 	while (*current) {
 		struct hid_hotplug_callback* next = (*current)->next;
-		free(*current);
+		hid_internal_free(*current);
 		*current = next;
 	}
 	hid_internal_hotplug_cleanup();
 	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	/* The event thread may be inside a hotplug callback waiting for the mutex,
+	   so it can only be joined after the mutex is released */
+	if (__atomic_load_n(&hid_hotplug_context.thread_running, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&hid_hotplug_context.thread_running, 0, __ATOMIC_RELEASE);
+		hid_internal_thread_join(&hid_hotplug_context.thread);
+	}
+
 	hid_hotplug_context.mutex_ready = 0;
 	pthread_mutex_destroy(&hid_hotplug_context.mutex);
 }
 
 int HID_API_EXPORT hid_init(void)
 {
+	hid_debug_log_init();
+
 	if (!usb_context) {
 		const char *locale;
 
@@ -580,12 +742,45 @@ int HID_API_EXPORT hid_init(void)
 
 int HID_API_EXPORT hid_exit(void)
 {
+	hid_internal_health_exit();
+
 	if (usb_context) {
+		/* Hotplug cleanup still needs a valid libusb context */
+		hid_internal_hotplug_exit();
 		libusb_exit(usb_context);
 		usb_context = NULL;
-		hid_internal_hotplug_exit();
 	}
 
+	hid_debug_log_exit();
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_allocator(const struct hid_allocator *new_allocator)
+{
+	if (new_allocator && (!new_allocator->malloc_fn || !new_allocator->realloc_fn || !new_allocator->free_fn)) {
+		return -1;
+	}
+
+	if (new_allocator)
+		allocator = *new_allocator;
+	else
+		memset(&allocator, 0, sizeof(allocator));
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_executor(const struct hid_executor *new_executor)
+{
+	if (new_executor && (!new_executor->spawn || !new_executor->join)) {
+		return -1;
+	}
+
+	if (new_executor)
+		executor = *new_executor;
+	else
+		memset(&executor, 0, sizeof(executor));
+
 	return 0;
 }
 
@@ -683,7 +878,7 @@ static void invasive_fill_device_info_usage(struct hid_device_info *cur_dev, lib
  */
 static struct hid_device_info * create_device_info_for_device(libusb_device *device, libusb_device_handle *handle, struct libusb_device_descriptor *desc, int config_number, int interface_num)
 {
-	struct hid_device_info *cur_dev = calloc(1, sizeof(struct hid_device_info));
+	struct hid_device_info *cur_dev = hid_internal_calloc(1, sizeof(struct hid_device_info));
 	if (cur_dev == NULL) {
 		return NULL;
 	}
@@ -880,12 +1075,17 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 	int j, k;
 
 	int res = libusb_get_device_descriptor(dev, &desc);
+	if (res < 0)
+		return NULL;
+
 	unsigned short dev_vid = desc.idVendor;
 	unsigned short dev_pid = desc.idProduct;
 
-	if (hid_internal_match_device_id(dev_vid, dev_pid, vendor_id, product_id)) {
+	if (!hid_internal_match_device_id(dev_vid, dev_pid, vendor_id, product_id)) {
 		return NULL;
 	}
+
+	res = libusb_get_active_config_descriptor(dev, &conf_desc);
 	if (res < 0)
 		libusb_get_config_descriptor(dev, 0, &conf_desc);
 	if (conf_desc) {
@@ -894,7 +1094,7 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 			for (k = 0; k < intf->num_altsetting; k++) {
 				const struct libusb_interface_descriptor *intf_desc;
 				intf_desc = &intf->altsetting[k];
-				if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
+				if (should_enumerate_interface(dev_vid, intf_desc)) {
 					struct hid_device_info *tmp;
 
 					res = libusb_open(dev, &handle);
@@ -961,43 +1161,151 @@ static struct hid_device_info* hid_enumerate_from_libusb(libusb_device *dev, uns
 	return root;
 }
 
-struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Called by hid_internal_enumerate() for each matching USB device, with the list of
+   hid_device_info created for its HID interfaces.
+   The callback takes ownership of the list.
+   Returns non-zero to stop the enumeration. */
+typedef int (*hid_internal_enumerate_fn)(struct hid_device_info *devs, void *user_data);
+
+/* Returns 0 if all devices were enumerated, 1 if the enumeration was stopped by the callback
+   or -1 on error. */
+static int hid_internal_enumerate(unsigned short vendor_id, unsigned short product_id, hid_internal_enumerate_fn callback, void *user_data)
 {
 	libusb_device **devs;
 	libusb_device *dev;
 	ssize_t num_devs;
 	int i = 0;
-
-	struct hid_device_info *root = NULL; /* return object */
-	struct hid_device_info *cur_dev = NULL;
+	int stopped = 0;
 
 	if (hid_init() < 0)
-		return NULL;
+		return -1;
 
 	num_devs = libusb_get_device_list(usb_context, &devs);
 	if (num_devs < 0)
-		return NULL;
+		return -1;
 
 	while ((dev = devs[i++]) != NULL) {
 		struct hid_device_info *tmp = hid_enumerate_from_libusb(dev, vendor_id, product_id);
-		if (cur_dev) {
-			cur_dev->next = tmp;
-		}
-		else {
-			root = tmp;
-			cur_dev = tmp;
-		}
-		/* Traverse to the end of newly attached tail */
-		if (cur_dev) {
-			while (cur_dev->next) {
-				cur_dev = cur_dev->next;
-			}
+		if (tmp && callback(tmp, user_data)) {
+			stopped = 1;
+			break;
 		}
 	}
 
 	libusb_free_device_list(devs, 1);
 
-	return root;
+	return stopped;
+}
+
+struct hid_internal_enumerate_list {
+	struct hid_device_info *root;
+	struct hid_device_info *tail;
+};
+
+static int hid_internal_enumerate_append(struct hid_device_info *devs, void *user_data)
+{
+	struct hid_internal_enumerate_list *list = (struct hid_internal_enumerate_list *) user_data;
+
+	if (list->tail) {
+		list->tail->next = devs;
+	}
+	else {
+		list->root = devs;
+	}
+	list->tail = devs;
+
+	/* Traverse to the end of newly attached tail */
+	while (list->tail->next) {
+		list->tail = list->tail->next;
+	}
+
+	return 0;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_internal_enumerate_list list = { NULL, NULL };
+
+	if (hid_internal_enumerate(vendor_id, product_id, hid_internal_enumerate_append, &list) < 0)
+		return NULL;
+
+	return list.root;
+}
+
+struct hid_internal_enumerate_foreach_data {
+	hid_enumerate_callback_fn callback;
+	void *user_data;
+};
+
+static int hid_internal_enumerate_foreach(struct hid_device_info *devs, void *user_data)
+{
+	struct hid_internal_enumerate_foreach_data *data = (struct hid_internal_enumerate_foreach_data *) user_data;
+	int stop = 0;
+
+	/* Report the interfaces one by one, each of them is released right after the callback */
+	while (devs) {
+		struct hid_device_info *next = devs->next;
+		devs->next = NULL;
+		if (!stop)
+			stop = data->callback(devs, data->user_data);
+		hid_free_enumeration(devs);
+		devs = next;
+	}
+
+	return stop;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_foreach(unsigned short vendor_id, unsigned short product_id, hid_enumerate_callback_fn callback, void *user_data)
+{
+	struct hid_internal_enumerate_foreach_data data;
+
+	if (!callback)
+		return -1;
+
+	data.callback = callback;
+	data.user_data = user_data;
+
+	return hid_internal_enumerate(vendor_id, product_id, hid_internal_enumerate_foreach, &data);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_generation(unsigned int *generation)
+{
+	/* libusb has no such counter. On Linux every USB device addition/removal
+	   emits a kernel uevent, so the uevent sequence number is used instead.
+	   It also changes on unrelated events, which only costs a needless re-enumeration. */
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	if (!generation)
+		return -1;
+
+	fd = open("/sys/kernel/uevent_seqnum", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+
+	buf[len] = '\0';
+	*generation = (unsigned int) strtoull(buf, NULL, 10);
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_diff(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs, struct hid_device_info **added, struct hid_device_info **removed)
+{
+	struct hid_internal_enumerate_list list = { NULL, NULL };
+
+	if (!devs || !added || !removed)
+		return -1;
+
+	if (hid_internal_enumerate(vendor_id, product_id, hid_internal_enumerate_append, &list) < 0)
+		return -1;
+
+	return hid_internal_enumerate_merge(list.root, devs, added, removed);
 }
 
 void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
@@ -1005,11 +1313,11 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	struct hid_device_info *d = devs;
 	while (d) {
 		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
+		hid_internal_free(d->path);
+		hid_internal_free(d->serial_number);
+		hid_internal_free(d->manufacturer_string);
+		hid_internal_free(d->product_string);
+		hid_internal_free(d);
 		d = next;
 	}
 }
@@ -1037,7 +1345,7 @@ static void hid_internal_invoke_callbacks(struct hid_device_info* info, hid_hotp
 			if (result) {
 				struct hid_hotplug_callback *callback = *current;
 				*current = (*current)->next;
-				free(callback);
+				hid_internal_free(callback);
 				continue;
 			}
 		}
@@ -1057,6 +1365,7 @@ static int hid_libusb_hotplug_callback(libusb_context *ctx, libusb_device *devic
 		while (info_cur) {
 			/* For each device, call all matching callbacks */
 			/* TODO: possibly make the `next` field NULL to match the behavior on other systems */
+			LOG("hotplug: %s arrived (%04hx:%04hx, interface %d)\n", info_cur->path, info_cur->vendor_id, info_cur->product_id, info_cur->interface_number);
 			hid_internal_invoke_callbacks(info_cur, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED);
 			info_cur = info_cur->next;
 		}
@@ -1082,9 +1391,10 @@ static int hid_libusb_hotplug_callback(libusb_context *ctx, libusb_device *devic
 				/* If the libusb device that's left matches this HID device, we detach it from the list */
 				*current = (*current)->next;
 				info->next = NULL;
+				LOG("hotplug: %s left\n", info->path);
 				hid_internal_invoke_callbacks(info, HID_API_HOTPLUG_EVENT_DEVICE_LEFT);
 				/* Free every removed device */
-				free(info);
+				hid_free_enumeration(info);
 			} else {
 				current = &info->next;
 			}
@@ -1098,6 +1408,25 @@ static int hid_libusb_hotplug_callback(libusb_context *ctx, libusb_device *devic
 	return 0;
 }
 
+static void* hotplug_thread(void* user_data)
+{
+	(void)user_data;
+
+	/* Cleared by hid_internal_hotplug_exit() from another thread */
+	while (__atomic_load_n(&hid_hotplug_context.thread_running, __ATOMIC_ACQUIRE)) {
+		struct timeval tv;
+
+		/* 5 msec timeout seems reasonable; don't set too low to avoid high CPU usage */
+		/* This timeout only affects how much time it takes to stop the thread */
+		tv.tv_sec = 0;
+		tv.tv_usec = 5000;
+
+		libusb_handle_events_timeout_completed(usb_context, &tv, NULL);
+	}
+
+	return NULL;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short vendor_id, unsigned short product_id, int events, int flags, hid_hotplug_callback_fn callback, void *user_data, hid_hotplug_callback_handle *callback_handle)
 {
 	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
@@ -1112,7 +1441,7 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short ven
 		return -1;
 	}
 
-	struct hid_hotplug_callback* hotplug_cb = (struct hid_hotplug_callback*)calloc(1, sizeof(struct hid_hotplug_callback));
+	struct hid_hotplug_callback* hotplug_cb = (struct hid_hotplug_callback*)hid_internal_calloc(1, sizeof(struct hid_hotplug_callback));
 
 	if (hotplug_cb == NULL) {
 		return -1;
@@ -1157,16 +1486,33 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short ven
 		hid_hotplug_context.devs = hid_enumerate(0, 0);
 		hid_hotplug_context.hotplug_cbs = hotplug_cb;
 
-		/* Arm or global callback to receive ALL notifications for HID class devices */
+		/* Arm or global callback to receive ALL notifications */
+		/* HID is usually declared on the interface level (bDeviceClass is 0),
+		   so the device class can't be used as a filter here;
+		   hid_enumerate_from_libusb() picks HID interfaces on arrival */
 		int result = libusb_hotplug_register_callback(usb_context,
 													  LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
-													  0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_CLASS_HID, &hid_libusb_hotplug_callback, NULL,
+													  0, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, &hid_libusb_hotplug_callback, NULL,
 													  &hid_hotplug_context.callback_handle);
 		if (result) {
 			/* Major failure */
 			pthread_mutex_unlock(&hid_hotplug_context.mutex);
 			return -1;
 		}
+
+		/* Nobody handles libusb events while no device is open; start the thread that does */
+		if (!__atomic_load_n(&hid_hotplug_context.thread_running, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&hid_hotplug_context.thread_running, 1, __ATOMIC_RELEASE);
+			if (hid_internal_thread_start(&hid_hotplug_context.thread, &hotplug_thread, NULL) < 0) {
+				/* Without the thread no notification would be delivered: undo the registration */
+				__atomic_store_n(&hid_hotplug_context.thread_running, 0, __ATOMIC_RELEASE);
+				hid_hotplug_context.hotplug_cbs = NULL;
+				hid_internal_hotplug_cleanup();
+				pthread_mutex_unlock(&hid_hotplug_context.mutex);
+				hid_internal_free(hotplug_cb);
+				return -1;
+			}
+		}
 	}
 
 	if ((flags & HID_API_HOTPLUG_ENUMERATE) && (events & HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED)) {
@@ -1207,7 +1553,7 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_call
 			struct hid_hotplug_callback *next = (*current)->next;
 			hotplug_cb = *current;
 			*current = next;
-			free(hotplug_cb);
+			hid_internal_free(hotplug_cb);
 			break;
 		}
 	}
@@ -1219,42 +1565,121 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_call
 	return 0;
 }
 
+struct hid_internal_open_data {
+	unsigned short vendor_id;
+	unsigned short product_id;
+	const wchar_t *serial_number;
+	char *path_to_open;
+};
+
+static int HID_API_CALL hid_internal_find_device_to_open(struct hid_device_info *dev, void *user_data)
+{
+	struct hid_internal_open_data *data = (struct hid_internal_open_data *) user_data;
+
+	if (dev->vendor_id != data->vendor_id || dev->product_id != data->product_id)
+		return 0;
+
+	if (data->serial_number) {
+		if (!dev->serial_number ||
+			wcscmp(data->serial_number, dev->serial_number) != 0)
+			return 0;
+	}
+
+	data->path_to_open = hid_internal_strdup(dev->path);
+	return 1;
+}
+
 hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
-	struct hid_device_info *devs, *cur_dev;
-	const char *path_to_open = NULL;
+	struct hid_internal_open_data data;
 	hid_device *handle = NULL;
 
-	devs = hid_enumerate(vendor_id, product_id);
-	cur_dev = devs;
-	while (cur_dev) {
-		if (cur_dev->vendor_id == vendor_id &&
-			cur_dev->product_id == product_id) {
-			if (serial_number) {
-				if (cur_dev->serial_number &&
-					wcscmp(serial_number, cur_dev->serial_number) == 0) {
-					path_to_open = cur_dev->path;
-					break;
-				}
-			}
-			else {
-				path_to_open = cur_dev->path;
-				break;
-			}
-		}
-		cur_dev = cur_dev->next;
-	}
+	data.vendor_id = vendor_id;
+	data.product_id = product_id;
+	data.serial_number = serial_number;
+	data.path_to_open = NULL;
+
+	/* Stop at the first match, so devices that are slow to answer
+	   their string descriptors don't delay opening the requested one */
+	hid_enumerate_foreach(vendor_id, product_id, hid_internal_find_device_to_open, &data);
 
-	if (path_to_open) {
+	if (data.path_to_open) {
 		/* Open the device */
-		handle = hid_open_path(path_to_open);
+		handle = hid_open_path(data.path_to_open);
 	}
 
-	hid_free_enumeration(devs);
+	hid_internal_free(data.path_to_open);
 
 	return handle;
 }
 
+int HID_API_EXPORT hid_set_health_monitor(hid_device *dev, unsigned int expected_interval_us, unsigned int silence_threshold_ms, hid_health_callback_fn callback, void *user_data)
+{
+	if (silence_threshold_ms > 0 && !callback) {
+		return -1;
+	}
+
+	return hid_internal_health_set(&dev->health, dev, expected_interval_us, silence_threshold_ms, callback, user_data);
+}
+
+int HID_API_EXPORT hid_get_health_stats(hid_device *dev, struct hid_health_stats *stats)
+{
+	if (!stats) {
+		return -1;
+	}
+	if (!__atomic_load_n(&dev->health.enabled, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+
+	hid_internal_health_stats(&dev->health, stats);
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_input_filter(hid_device *dev, const struct hid_input_filter *filter)
+{
+	struct hid_input_filter_state *f = NULL, *old;
+
+	if (filter) {
+		if (filter->mask_length > HID_API_INPUT_FILTER_MASK_SIZE)
+			return -1;
+
+		f = (struct hid_input_filter_state *) hid_internal_calloc(1, sizeof(*f));
+		if (!f)
+			return -1;
+		f->spec = *filter;
+	}
+
+	hidapi_thread_mutex_lock(&dev->thread_state);
+	old = dev->input_filter;
+	dev->input_filter = f;
+	hidapi_thread_mutex_unlock(&dev->thread_state);
+
+	hid_internal_input_filter_free(old);
+	return 0;
+}
+
+/* Copy of a report for the hid_read() queue, NULL if out of memory
+   (the allocator of hid_set_allocator() may run out) */
+static struct input_report *hid_internal_input_report_new(const unsigned char *data, size_t length)
+{
+	struct input_report *rpt = (struct input_report*) hid_internal_malloc(sizeof(*rpt));
+
+	if (!rpt)
+		return NULL;
+
+	rpt->data = (uint8_t*) hid_internal_malloc(length);
+	if (!rpt->data && length > 0) {
+		hid_internal_free(rpt);
+		return NULL;
+	}
+	if (length > 0)
+		memcpy(rpt->data, data, length);
+	rpt->len = length;
+	rpt->next = NULL;
+
+	return rpt;
+}
+
 static void LIBUSB_CALL read_callback(struct libusb_transfer *transfer)
 {
 	hid_device *dev = transfer->user_data;
@@ -1262,35 +1687,58 @@ static void LIBUSB_CALL read_callback(struct libusb_transfer *transfer)
 
 	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
 
-		struct input_report *rpt = (struct input_report*) malloc(sizeof(*rpt));
-		rpt->data = (uint8_t*) malloc(transfer->actual_length);
-		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-		rpt->len = transfer->actual_length;
-		rpt->next = NULL;
+		struct input_report *rpt;
+		size_t length = (size_t) transfer->actual_length;
+		int dropped = 0;
+
+		if (transfer->actual_length > 0)
+			hid_internal_health_report(&dev->health);
 
 		hidapi_thread_mutex_lock(&dev->thread_state);
 
-		/* Attach the new report object to the end of the list. */
-		if (dev->input_reports == NULL) {
-			/* The list is empty. Put it at the root. */
-			dev->input_reports = rpt;
-			hidapi_thread_cond_signal(&dev->thread_state);
+		/* A dropped report is neither queued nor passed to the subscriptions,
+		   so nobody is woken up for it */
+		if (length > 0 && dev->input_filter) {
+			length = hid_internal_input_filter(dev->input_filter, transfer->buffer, length);
+			dropped = (length == 0);
 		}
-		else {
-			/* Find the end of the list and attach. */
-			struct input_report *cur = dev->input_reports;
-			int num_queued = 0;
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
-			}
-			cur->next = rpt;
 
-			/* Pop one off if we've reached 30 in the queue. This
-			   way we don't grow forever if the user never reads
-			   anything from the device. */
-			if (num_queued > 30) {
-				return_data(dev, NULL, 0);
+		if (!dropped && length > 0) {
+			hid_subscription *sub;
+			for (sub = dev->subscriptions; sub; sub = sub->next)
+				hid_internal_subscription_push(sub, transfer->buffer, length);
+		}
+
+		/* The subscribers have their own copy: the reports are only queued
+		   for hid_read() once it is used */
+		if (!dropped && (!dev->subscriptions || dev->read_used)) {
+			rpt = hid_internal_input_report_new(transfer->buffer, length);
+			if (!rpt) {
+				LOG("Couldn't allocate an input report, dropping it\n");
+			}
+			/* Attach the new report object to the end of the list. */
+			else if (dev->input_reports == NULL) {
+				/* The list is empty. Put it at the root. */
+				dev->input_reports = rpt;
+				hidapi_thread_cond_signal(&dev->thread_state);
+			}
+			else {
+				/* Find the end of the list and attach. */
+				struct input_report *cur = dev->input_reports;
+				int num_queued = 0;
+				while (cur->next != NULL) {
+					cur = cur->next;
+					num_queued++;
+				}
+				cur->next = rpt;
+
+				/* Pop one off if we've reached 30 in the queue. This
+				   way we don't grow forever if the user never reads
+				   anything from the device. */
+				if (num_queued > 30) {
+					LOG("Input report queue full, dropping the oldest report\n");
+					return_data(dev, NULL, 0);
+				}
 			}
 		}
 		hidapi_thread_mutex_unlock(&dev->thread_state);
@@ -1299,13 +1747,14 @@ static void LIBUSB_CALL read_callback(struct libusb_transfer *transfer)
 		dev->shutdown_thread = 1;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
+		LOG("Device disconnected, stopping read_thread\n");
 		dev->shutdown_thread = 1;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
 		//LOG("Timeout (normal)\n");
 	}
 	else {
-		LOG("Unknown transfer code: %d\n", transfer->status);
+		LOG("Unknown transfer code: %d\n", (int) transfer->status);
 	}
 
 	if (dev->shutdown_thread) {
@@ -1323,6 +1772,54 @@ static void LIBUSB_CALL read_callback(struct libusb_transfer *transfer)
 }
 
 
+/* 0x01000105 is a LIBUSB_API_VERSION for 1.0.21 - version when libusb_dev_mem_alloc was introduced */
+#if (!defined(HIDAPI_TARGET_LIBUSB_API_VERSION) || HIDAPI_TARGET_LIBUSB_API_VERSION >= 0x01000105) && (LIBUSB_API_VERSION >= 0x01000105)
+#define HIDAPI_LIBUSB_DEV_MEM
+#endif
+
+/* Buffer for the transfers of dev, in device memory when the platform has it
+   (usbfs on Linux maps it, and then transfers to and from it without copying
+   the data to a kernel buffer of its own). With heap_fallback, a heap buffer
+   is returned instead of NULL when device memory can't be allocated.
+   *dev_mem tells which one it is.
+   Device memory isn't used while the HIDAPI_LIBUSB_NO_DEV_MEM environment
+   variable is set and not "0" (checked when the device is opened), to
+   compare both with the same build. */
+static unsigned char *hid_internal_transfer_buffer_alloc(hid_device *dev, size_t length, int heap_fallback, int *dev_mem)
+{
+	unsigned char *buffer = NULL;
+
+#ifdef HIDAPI_LIBUSB_DEV_MEM
+	const char *no_dev_mem = getenv("HIDAPI_LIBUSB_NO_DEV_MEM");
+
+	if (!no_dev_mem || !*no_dev_mem || strcmp(no_dev_mem, "0") == 0)
+		buffer = libusb_dev_mem_alloc(dev->device_handle, length);
+#else
+	(void) dev;
+#endif
+
+	*dev_mem = (buffer != NULL);
+	if (!buffer && heap_fallback)
+		buffer = (unsigned char*) hid_internal_malloc(length);
+
+	return buffer;
+}
+
+static void hid_internal_transfer_buffer_free(hid_device *dev, unsigned char *buffer, size_t length, int dev_mem)
+{
+#ifdef HIDAPI_LIBUSB_DEV_MEM
+	if (dev_mem) {
+		libusb_dev_mem_free(dev->device_handle, buffer, length);
+		return;
+	}
+#else
+	(void) dev;
+	(void) length;
+	(void) dev_mem;
+#endif
+	hid_internal_free(buffer);
+}
+
 static void *read_thread(void *param)
 {
 	int res;
@@ -1331,7 +1828,7 @@ static void *read_thread(void *param)
 	const size_t length = dev->input_ep_max_packet_size;
 
 	/* Set up the transfer object. */
-	buf = (uint8_t*) malloc(length);
+	buf = hid_internal_transfer_buffer_alloc(dev, length, 1, &dev->transfer_dev_mem);
 	dev->transfer = libusb_alloc_transfer(0);
 	libusb_fill_interrupt_transfer(dev->transfer,
 		dev->device_handle,
@@ -1386,6 +1883,8 @@ static void *read_thread(void *param)
 	   signaled. */
 	hidapi_thread_mutex_lock(&dev->thread_state);
 	hidapi_thread_cond_broadcast(&dev->thread_state);
+	for (hid_subscription *sub = dev->subscriptions; sub; sub = sub->next)
+		hid_internal_subscription_finish(sub);
 	hidapi_thread_mutex_unlock(&dev->thread_state);
 
 	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
@@ -1524,6 +2023,7 @@ static int hidapi_initialize_device(hid_device *dev, const struct libusb_interfa
 	dev->input_endpoint = 0;
 	dev->input_ep_max_packet_size = 0;
 	dev->output_endpoint = 0;
+	dev->output_ep_max_packet_size = 0;
 
 	/* Find the INPUT and OUTPUT endpoints. An
 	   OUTPUT endpoint is not required. */
@@ -1554,13 +2054,30 @@ static int hidapi_initialize_device(hid_device *dev, const struct libusb_interfa
 			is_interrupt && is_output) {
 			/* Use this endpoint for OUTPUT */
 			dev->output_endpoint = ep->bEndpointAddress;
+			dev->output_ep_max_packet_size = ep->wMaxPacketSize;
 		}
 	}
 
-	hidapi_thread_create(&dev->thread_state, read_thread, dev);
-
-	/* Wait here for the read thread to be initialized. */
-	hidapi_thread_barrier_wait(&dev->thread_state);
+	if (executor.spawn) {
+		if (hid_internal_thread_start(&dev->executor_thread, read_thread, dev) < 0) {
+			LOG("the executor failed to start read_thread\n");
+			libusb_release_interface(dev->device_handle, dev->interface);
+			return 0;
+		}
+	}
+	else {
+		hidapi_thread_create(&dev->thread_state, read_thread, dev);
+	}
+
+	/* Wait here for the read thread to be initialized. */
+	hidapi_thread_barrier_wait(&dev->thread_state);
+
+	/* Only worth it in device memory: hid_write() copies the report to it */
+	if (dev->output_endpoint) {
+		int dev_mem;
+		dev->out_buffer = hid_internal_transfer_buffer_alloc(dev, dev->output_ep_max_packet_size, 0, &dev_mem);
+	}
+
 	return 1;
 }
 
@@ -1750,11 +2267,26 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	else {
 		/* Use the interrupt out endpoint */
 		int actual_length;
-		res = libusb_interrupt_transfer(dev->device_handle,
-			dev->output_endpoint,
-			(unsigned char*)data,
-			length,
-			&actual_length, 1000);
+
+		/* From device memory when it is free, so that the kernel doesn't have to
+		   allocate and fill a buffer of its own; hid_write() is rarely concurrent */
+		if (dev->out_buffer && length <= (size_t) dev->output_ep_max_packet_size &&
+		    pthread_mutex_trylock(&dev->out_buffer_mutex) == 0) {
+			memcpy(dev->out_buffer, data, length);
+			res = libusb_interrupt_transfer(dev->device_handle,
+				dev->output_endpoint,
+				dev->out_buffer,
+				length,
+				&actual_length, 1000);
+			pthread_mutex_unlock(&dev->out_buffer_mutex);
+		}
+		else {
+			res = libusb_interrupt_transfer(dev->device_handle,
+				dev->output_endpoint,
+				(unsigned char*)data,
+				length,
+				&actual_length, 1000);
+		}
 
 		if (res < 0)
 			return -1;
@@ -1766,6 +2298,162 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	}
 }
 
+/* State of a hid_write_many() call, shared by all of its transfers.
+   The transfer callbacks are serialized by the libusb event handling. */
+struct hid_write_many_state {
+	int remaining;
+	/* Set once remaining drops to zero, for libusb_handle_events_completed() */
+	int completed;
+	int written;
+	struct timespec first;
+	struct timespec last;
+};
+
+struct hid_write_many_transfer {
+	struct hid_write_many_state *state;
+	struct hid_write_request *request;
+	struct libusb_transfer *transfer;
+	int skipped_report_id;
+};
+
+static void hid_write_many_completed(struct hid_write_many_state *state)
+{
+	clock_gettime(CLOCK_MONOTONIC, &state->last);
+	if (!state->written++)
+		state->first = state->last;
+}
+
+static void LIBUSB_CALL write_many_callback(struct libusb_transfer *transfer)
+{
+	struct hid_write_many_transfer *ctx = (struct hid_write_many_transfer *) transfer->user_data;
+	struct hid_write_many_state *state = ctx->state;
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		ctx->request->result = transfer->actual_length + ctx->skipped_report_id;
+		hid_write_many_completed(state);
+	}
+	else {
+		LOG("hid_write_many: transfer failed with status %d\n", (int) transfer->status);
+		ctx->request->result = -1;
+	}
+
+	if (--state->remaining == 0)
+		state->completed = 1;
+}
+
+int HID_API_EXPORT hid_write_many(struct hid_write_request *requests, size_t count, struct timespec *spread)
+{
+	struct hid_write_many_state state;
+	struct hid_write_many_transfer *transfers;
+	int cancelled = 0;
+	int res = 0;
+	size_t i;
+
+	if (!requests && count > 0)
+		return -1;
+
+	memset(&state, 0, sizeof(state));
+
+	transfers = (struct hid_write_many_transfer *) hid_internal_calloc(count ? count : 1, sizeof(*transfers));
+	if (!transfers)
+		return -1;
+
+	/* Prepare all the interrupt transfers first, so that nothing but
+	   the submission itself happens between the writes.
+	   Devices without an interrupt OUT endpoint use a synchronous control
+	   transfer: send those before the batch, which is waited for afterwards. */
+	for (i = 0; i < count; i++) {
+		struct hid_write_request *request = &requests[i];
+		hid_device *dev = request->dev;
+		unsigned char *data = (unsigned char *) request->data;
+		size_t length = request->length;
+
+		request->result = -1;
+
+		if (!dev || !data || length == 0)
+			continue;
+
+		if (dev->output_endpoint <= 0) {
+			request->result = hid_write(dev, request->data, request->length);
+			if (request->result >= 0)
+				hid_write_many_completed(&state);
+			continue;
+		}
+
+		if (data[0] == 0x0) {
+			data++;
+			length--;
+			transfers[i].skipped_report_id = 1;
+		}
+
+		transfers[i].transfer = libusb_alloc_transfer(0);
+		if (!transfers[i].transfer)
+			continue;
+
+		transfers[i].state = &state;
+		transfers[i].request = request;
+		libusb_fill_interrupt_transfer(transfers[i].transfer,
+			dev->device_handle,
+			dev->output_endpoint,
+			data,
+			(int) length,
+			write_many_callback,
+			&transfers[i],
+			1000/*timeout millis*/);
+	}
+
+	/* Submit them back-to-back */
+	for (i = 0; i < count; i++) {
+		if (!transfers[i].transfer)
+			continue;
+
+		if (libusb_submit_transfer(transfers[i].transfer) < 0) {
+			libusb_free_transfer(transfers[i].transfer);
+			transfers[i].transfer = NULL;
+			continue;
+		}
+		state.remaining++;
+	}
+
+	if (state.remaining == 0)
+		state.completed = 1;
+
+	while (!state.completed) {
+		int r = libusb_handle_events_completed(usb_context, &state.completed);
+		if (r < 0 && r != LIBUSB_ERROR_INTERRUPTED && !cancelled) {
+			/* Same as libusb's own synchronous transfers: cancel, then wait for the cancellations */
+			LOG("hid_write_many: libusb_handle_events_completed() failed: %d\n", r);
+			for (i = 0; i < count; i++) {
+				if (transfers[i].transfer)
+					libusb_cancel_transfer(transfers[i].transfer);
+			}
+			cancelled = 1;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		libusb_free_transfer(transfers[i].transfer);
+		if (requests[i].result < 0)
+			res = -1;
+	}
+	hid_internal_free(transfers);
+
+	if (spread) {
+		spread->tv_sec = 0;
+		spread->tv_nsec = 0;
+		if (state.written > 1) {
+			spread->tv_sec = state.last.tv_sec - state.first.tv_sec;
+			spread->tv_nsec = state.last.tv_nsec - state.first.tv_nsec;
+			if (spread->tv_nsec < 0) {
+				spread->tv_sec--;
+				spread->tv_nsec += 1000000000L;
+			}
+		}
+	}
+
+	return res;
+}
+
 /* Helper function, to simplify hid_read().
    This should be called with dev->mutex locked. */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
@@ -1777,8 +2465,8 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 	if (len > 0)
 		memcpy(data, rpt->data, len);
 	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+	hid_internal_free(rpt->data);
+	hid_internal_free(rpt);
 	return len;
 }
 
@@ -1789,7 +2477,8 @@ static void cleanup_mutex(void *param)
 }
 
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+/* timeout: NULL to block, zero for a non-blocking read */
+static int hid_internal_read(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
 {
 #if 0
 	int transferred;
@@ -1805,6 +2494,14 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	hidapi_thread_cleanup_push(cleanup_mutex, dev);
 
 	bytes_read = -1;
+	dev->read_used = 1;
+
+	/* An interruption takes precedence over the queued input reports */
+	if (dev->read_interrupted) {
+		dev->read_interrupted = 0;
+		bytes_read = HID_API_READ_INTERRUPTED;
+		goto ret;
+	}
 
 	/* There's an input report queued up. Return it. */
 	if (dev->input_reports) {
@@ -1820,25 +2517,42 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 		goto ret;
 	}
 
-	if (milliseconds == -1) {
+	if (timeout == NULL) {
 		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while (!dev->input_reports && !dev->shutdown_thread && !dev->read_interrupted) {
 			hidapi_thread_cond_wait(&dev->thread_state);
 		}
-		if (dev->input_reports) {
+		if (dev->read_interrupted) {
+			dev->read_interrupted = 0;
+			bytes_read = HID_API_READ_INTERRUPTED;
+		}
+		else if (dev->input_reports) {
 			bytes_read = return_data(dev, data, length);
 		}
 	}
-	else if (milliseconds > 0) {
+	else if (timeout->tv_sec > 0 || timeout->tv_nsec > 0) {
 		/* Non-blocking, but called with timeout. */
 		int res;
 		hidapi_timespec ts;
 		hidapi_thread_gettime(&ts);
-		hidapi_thread_addtime(&ts, milliseconds);
+#ifdef HIDAPI_THREAD_ADDTIME_TS
+		hidapi_thread_addtime_ts(&ts, timeout);
+#else
+		/* A custom thread model may only have the millisecond helper */
+		if (timeout->tv_sec >= INT_MAX / 1000)
+			hidapi_thread_addtime(&ts, INT_MAX);
+		else
+			hidapi_thread_addtime(&ts, (int) (timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000));
+#endif
 
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while (!dev->input_reports && !dev->shutdown_thread && !dev->read_interrupted) {
 			res = hidapi_thread_cond_timedwait(&dev->thread_state, &ts);
 			if (res == 0) {
+				if (dev->read_interrupted) {
+					dev->read_interrupted = 0;
+					bytes_read = HID_API_READ_INTERRUPTED;
+					break;
+				}
 				if (dev->input_reports) {
 					bytes_read = return_data(dev, data, length);
 					break;
@@ -1872,11 +2586,240 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	struct timespec timeout;
+
+	if (milliseconds == -1)
+		return hid_internal_read(dev, data, length, NULL);
+
+	/* Any other negative value means a non-blocking read, as it always did */
+	if (milliseconds < 0)
+		milliseconds = 0;
+
+	timeout.tv_sec = milliseconds / 1000;
+	timeout.tv_nsec = (milliseconds % 1000) * 1000000L;
+	return hid_internal_read(dev, data, length, &timeout);
+}
+
+int HID_API_EXPORT hid_read_timeout_ts(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	if (timeout && (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000L))
+		return -1;
+
+	return hid_internal_read(dev, data, length, timeout);
+}
+
+int HID_API_EXPORT hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline)
+{
+	struct timespec now, remaining;
+
+	if (!deadline)
+		return hid_internal_read(dev, data, length, NULL);
+
+	/* The remaining time is converted back to an absolute time of the condition clock
+	   right away, so only the time between the two clock readings is lost */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining.tv_sec = deadline->tv_sec - now.tv_sec;
+	remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (remaining.tv_nsec < 0) {
+		remaining.tv_sec--;
+		remaining.tv_nsec += 1000000000L;
+	}
+	if (remaining.tv_sec < 0) {
+		/* Already expired, only return a report that is already there */
+		remaining.tv_sec = 0;
+		remaining.tv_nsec = 0;
+	}
+
+	return hid_internal_read(dev, data, length, &remaining);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
 }
 
+int HID_API_EXPORT hid_interrupt_read(hid_device *dev)
+{
+	hidapi_thread_mutex_lock(&dev->thread_state);
+	dev->read_interrupted = 1;
+	/* Wake up every waiting reader, the first one to get the mutex takes the interruption */
+	hidapi_thread_cond_broadcast(&dev->thread_state);
+	hidapi_thread_mutex_unlock(&dev->thread_state);
+
+	return 0;
+}
+
+/* hid_subscribe(), and hid_subscribe_dispatch() with a dispatcher */
+static hid_subscription *hid_internal_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_dispatcher *dispatcher, hid_input_callback_fn callback, void *user_data)
+{
+	hid_subscription *sub;
+
+	if (capacity == 0 || report_length == 0 || capacity >= (size_t) -1 / report_length - 1)
+		return NULL;
+	if (overflow != HID_API_SUBSCRIPTION_DROP_NEWEST && overflow != HID_API_SUBSCRIPTION_DROP_OLDEST)
+		return NULL;
+
+	sub = (hid_subscription *) hid_internal_calloc(1, sizeof(*sub));
+	if (!sub)
+		return NULL;
+
+	sub->dev = dev;
+	sub->overflow = overflow;
+	sub->report_length = report_length;
+	sub->num_slots = capacity + 1;
+	sub->lengths = (size_t *) hid_internal_calloc(sub->num_slots, sizeof(*sub->lengths));
+	sub->reports = (unsigned char *) hid_internal_calloc(sub->num_slots, report_length);
+	if (dispatcher)
+		sub->dispatch_buf = (unsigned char *) hid_internal_malloc(report_length);
+	if (!sub->lengths || !sub->reports || (dispatcher && !sub->dispatch_buf)) {
+		hid_internal_free(sub->lengths);
+		hid_internal_free(sub->reports);
+		hid_internal_free(sub->dispatch_buf);
+		hid_internal_free(sub);
+		return NULL;
+	}
+	hidapi_thread_state_init(&sub->wait_state);
+
+	if (dispatcher) {
+		sub->dispatcher = dispatcher;
+		sub->callback = callback;
+		sub->user_data = user_data;
+		hid_dispatch_queue_attach(dispatcher, &sub->dispatch_queue, &hid_internal_subscription_dispatch, sub);
+	}
+
+	hidapi_thread_mutex_lock(&dev->thread_state);
+	/* The read thread has already stopped if the device is gone */
+	sub->finished = dev->shutdown_thread;
+	sub->next = dev->subscriptions;
+	dev->subscriptions = sub;
+	/* Already finished: the callback is told right away */
+	if (dispatcher && sub->finished)
+		hid_dispatch_notify(&sub->dispatch_queue);
+	hidapi_thread_mutex_unlock(&dev->thread_state);
+
+	return sub;
+}
+
+hid_subscription * HID_API_EXPORT hid_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow)
+{
+	return hid_internal_subscribe(dev, capacity, report_length, overflow, NULL, NULL, NULL);
+}
+
+hid_subscription * HID_API_EXPORT hid_subscribe_dispatch(hid_dispatcher *dispatcher, hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_input_callback_fn callback, void *user_data)
+{
+	if (!dispatcher || !callback)
+		return NULL;
+
+	return hid_internal_subscribe(dev, capacity, report_length, overflow, dispatcher, callback, user_data);
+}
+
+int HID_API_EXPORT hid_subscription_read_timeout(hid_subscription *sub, unsigned char *data, size_t length, int milliseconds)
+{
+	hidapi_timespec ts;
+	int res;
+
+	/* The reports of a dispatched subscription are read by its dispatcher */
+	if (!sub || !data || !length || sub->dispatcher)
+		return -1;
+
+	res = hid_internal_subscription_pop(sub, data, length);
+	if (res > 0)
+		return res;
+	if (__atomic_load_n(&sub->finished, __ATOMIC_SEQ_CST))
+		return -1;
+	if (milliseconds == 0)
+		return 0;
+
+	if (milliseconds > 0) {
+		hidapi_thread_gettime(&ts);
+		hidapi_thread_addtime(&ts, milliseconds);
+	}
+
+	hidapi_thread_mutex_lock(&sub->wait_state);
+	__atomic_store_n(&sub->waiting, 1, __ATOMIC_SEQ_CST);
+	for (;;) {
+		/* Checked with waiting set: a report pushed from now on wakes this thread up */
+		res = hid_internal_subscription_pop(sub, data, length);
+		if (res > 0)
+			break;
+		if (__atomic_load_n(&sub->finished, __ATOMIC_SEQ_CST)) {
+			res = -1;
+			break;
+		}
+
+		if (milliseconds < 0) {
+			hidapi_thread_cond_wait(&sub->wait_state);
+		}
+		else if (hidapi_thread_cond_timedwait(&sub->wait_state, &ts) == HIDAPI_THREAD_TIMED_OUT) {
+			res = hid_internal_subscription_pop(sub, data, length);
+			break;
+		}
+	}
+	__atomic_store_n(&sub->waiting, 0, __ATOMIC_SEQ_CST);
+	hidapi_thread_mutex_unlock(&sub->wait_state);
+
+	return res;
+}
+
+size_t HID_API_EXPORT hid_subscription_dropped(hid_subscription *sub)
+{
+	if (!sub)
+		return 0;
+
+	return __atomic_load_n(&sub->dropped, __ATOMIC_RELAXED);
+}
+
+void HID_API_EXPORT hid_unsubscribe(hid_subscription *sub)
+{
+	hid_device *dev;
+	hid_subscription **cur;
+
+	if (!sub)
+		return;
+
+	dev = sub->dev;
+
+	/* Once unlinked, read_callback() doesn't see the subscription anymore */
+	hidapi_thread_mutex_lock(&dev->thread_state);
+	for (cur = &dev->subscriptions; *cur; cur = &(*cur)->next) {
+		if (*cur == sub) {
+			*cur = sub->next;
+			break;
+		}
+	}
+	hidapi_thread_mutex_unlock(&dev->thread_state);
+
+	/* Not notified anymore: wait for the running callback */
+	if (sub->dispatcher)
+		hid_dispatch_queue_detach(&sub->dispatch_queue);
+
+	hidapi_thread_state_destroy(&sub->wait_state);
+	hid_internal_free(sub->lengths);
+	hid_internal_free(sub->reports);
+	hid_internal_free(sub->dispatch_buf);
+	hid_internal_free(sub);
+}
+
+hid_dispatcher * HID_API_EXPORT hid_dispatcher_create(unsigned int num_threads)
+{
+	if (num_threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = (cpus > 0)? (unsigned int) cpus: 1;
+	}
+
+	return hid_dispatcher_new(num_threads);
+}
+
+void HID_API_EXPORT hid_dispatcher_destroy(hid_dispatcher *dispatcher)
+{
+	if (!dispatcher)
+		return;
+
+	hid_dispatcher_free(dispatcher, dispatcher->num_workers);
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -1885,12 +2828,24 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 }
 
 
+int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_milliseconds)
+{
+	if (hid_internal_feature_cache_set(&dev->feature_cache, ttl_milliseconds) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	int res = -1;
 	int skipped_report_id = 0;
 	int report_number = data[0];
 
+	/* The report may change the state reported by the Feature report with the same ID */
+	hid_internal_feature_cache_invalidate(dev->feature_cache, data[0]);
+
 	if (report_number == 0x0) {
 		data++;
 		length--;
@@ -1920,6 +2875,14 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 	int res = -1;
 	int skipped_report_id = 0;
 	int report_number = data[0];
+	unsigned char *report = data;
+
+	/* The reports of a device that is gone are not served anymore; the request fails and clears the cache */
+	if (!__atomic_load_n(&dev->shutdown_thread, __ATOMIC_ACQUIRE)) {
+		res = hid_internal_feature_cache_get(dev->feature_cache, data, length);
+		if (res >= 0)
+			return res;
+	}
 
 	if (report_number == 0x0) {
 		/* Offset the return buffer by 1, so that the report ID
@@ -1936,12 +2899,16 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 		(unsigned char *)data, length,
 		1000/*timeout millis*/);
 
-	if (res < 0)
+	if (res < 0) {
+		hid_internal_feature_cache_clear(dev->feature_cache);
 		return -1;
+	}
 
 	if (skipped_report_id)
 		res++;
 
+	hid_internal_feature_cache_put(dev->feature_cache, report, (size_t)res);
+
 	return res;
 }
 
@@ -1975,23 +2942,47 @@ int HID_API_EXPORT HID_API_CALL hid_get_input_report(hid_device *dev, unsigned c
 	return res;
 }
 
-void HID_API_EXPORT hid_close(hid_device *dev)
+/* First stage of closing a device: stop its read_thread() without waiting for it. */
+static void hid_internal_close_begin(hid_device *dev)
 {
-	if (!dev)
-		return;
+	/* No more health callbacks for the device */
+	hid_set_health_monitor(dev, 0, 0, NULL, NULL);
 
 	/* Cause read_thread() to stop. */
 	dev->shutdown_thread = 1;
 	libusb_cancel_transfer(dev->transfer);
+}
+
+/* Wake up the threads that wait for libusb events, so the stopping read_thread()s
+   don't have to wait for an event of their own (or a timeout) to notice it. */
+static void hid_internal_close_wakeup(void)
+{
+/* 0x01000105 is a LIBUSB_API_VERSION for 1.0.21 - version when libusb_interrupt_event_handler was introduced */
+#if (!defined(HIDAPI_TARGET_LIBUSB_API_VERSION) || HIDAPI_TARGET_LIBUSB_API_VERSION >= 0x01000105) && (LIBUSB_API_VERSION >= 0x01000105)
+	libusb_interrupt_event_handler(usb_context);
+#endif
+}
 
+/* Second stage of closing a device: wait for read_thread() and release everything. */
+static void hid_internal_close_finish(hid_device *dev)
+{
 	/* Wait for read_thread() to end. */
-	hidapi_thread_join(&dev->thread_state);
+	if (dev->executor_thread.on_executor)
+		hid_internal_thread_join(&dev->executor_thread);
+	else
+		hidapi_thread_join(&dev->thread_state);
 
-	/* Clean up the Transfer objects allocated in read_thread(). */
-	free(dev->transfer->buffer);
+	/* Clean up the Transfer objects allocated in read_thread(). Device memory
+	   goes with the handle, so this comes before libusb_close(). */
+	hid_internal_transfer_buffer_free(dev, dev->transfer->buffer, dev->input_ep_max_packet_size, dev->transfer_dev_mem);
 	dev->transfer->buffer = NULL;
 	libusb_free_transfer(dev->transfer);
 
+	if (dev->out_buffer) {
+		hid_internal_transfer_buffer_free(dev, dev->out_buffer, dev->output_ep_max_packet_size, 1);
+		dev->out_buffer = NULL;
+	}
+
 	/* release the interface */
 	libusb_release_interface(dev->device_handle, dev->interface);
 
@@ -2017,6 +3008,127 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	free_hid_device(dev);
 }
 
+void HID_API_EXPORT hid_close(hid_device *dev)
+{
+	if (!dev)
+		return;
+
+	hid_internal_close_begin(dev);
+	hid_internal_close_wakeup();
+	hid_internal_close_finish(dev);
+}
+
+/* Maximum number of threads hid_close_many() uses to release the devices */
+#define HID_CLOSE_MANY_MAX_THREADS 8
+
+struct hid_close_many_context {
+	hid_device **devs;
+	size_t count;
+
+	/* Index of the next device to release, protected by mutex */
+	size_t next;
+	pthread_mutex_t mutex;
+
+	/* Workers posted to executor.post that haven't returned yet, protected by mutex */
+	size_t posted;
+	pthread_cond_t condition;
+};
+
+static void *hid_close_many_worker(void *param)
+{
+	struct hid_close_many_context *ctx = (struct hid_close_many_context *) param;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&ctx->mutex);
+		i = ctx->next++;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		if (i >= ctx->count)
+			break;
+
+		if (ctx->devs[i])
+			hid_internal_close_finish(ctx->devs[i]);
+	}
+
+	return NULL;
+}
+
+static void HID_API_CALL hid_close_many_posted_worker(void *param)
+{
+	struct hid_close_many_context *ctx = (struct hid_close_many_context *) param;
+
+	hid_close_many_worker(ctx);
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (--ctx->posted == 0)
+		pthread_cond_signal(&ctx->condition);
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+void HID_API_EXPORT hid_close_many(hid_device **devs, size_t count)
+{
+	struct hid_close_many_context ctx;
+	struct hid_internal_thread threads[HID_CLOSE_MANY_MAX_THREADS - 1];
+	size_t num_threads = 0;
+	size_t i;
+
+	if (!devs || count == 0)
+		return;
+
+	/* Stop all of the read threads at once, instead of waiting for them one by one */
+	for (i = 0; i < count; i++) {
+		if (devs[i])
+			hid_internal_close_begin(devs[i]);
+	}
+	hid_internal_close_wakeup();
+
+	/* Releasing the interfaces and reattaching the kernel drivers are synchronous
+	   requests to the OS, so run them in parallel. The calling thread is one of the workers. */
+	ctx.devs = devs;
+	ctx.count = count;
+	ctx.next = 0;
+	ctx.posted = 0;
+	pthread_mutex_init(&ctx.mutex, NULL);
+	pthread_cond_init(&ctx.condition, NULL);
+
+	if (executor.post) {
+		/* Short tasks: no need for dedicated threads of the executor */
+		while (ctx.posted < HID_CLOSE_MANY_MAX_THREADS - 1 && ctx.posted + 1 < count) {
+			pthread_mutex_lock(&ctx.mutex);
+			ctx.posted++;
+			pthread_mutex_unlock(&ctx.mutex);
+			if (executor.post(executor.context, hid_close_many_posted_worker, &ctx) != 0) {
+				pthread_mutex_lock(&ctx.mutex);
+				ctx.posted--;
+				pthread_mutex_unlock(&ctx.mutex);
+				break;
+			}
+		}
+	}
+	else {
+		while (num_threads < HID_CLOSE_MANY_MAX_THREADS - 1 && num_threads + 1 < count) {
+			if (hid_internal_thread_start(&threads[num_threads], hid_close_many_worker, &ctx) < 0)
+				break;
+			num_threads++;
+		}
+	}
+
+	hid_close_many_worker(&ctx);
+
+	for (i = 0; i < num_threads; i++)
+		hid_internal_thread_join(&threads[i]);
+
+	pthread_mutex_lock(&ctx.mutex);
+	while (ctx.posted > 0)
+		pthread_cond_wait(&ctx.condition, &ctx.mutex);
+	pthread_mutex_unlock(&ctx.mutex);
+
+	pthread_cond_destroy(&ctx.condition);
+	pthread_mutex_destroy(&ctx.mutex);
+}
+
 
 int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
 {
@@ -2058,7 +3170,7 @@ int HID_API_EXPORT_CALL hid_get_indexed_string(hid_device *dev, int string_index
 	if (str) {
 		wcsncpy(string, str, maxlen);
 		string[maxlen-1] = L'\0';
-		free(str);
+		hid_internal_free(str);
 		return 0;
 	}
 	else
@@ -2078,6 +3190,17 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 	return L"hid_error is not implemented yet";
 }
 
+int HID_API_EXPORT hid_debug_log_enable(int enable)
+{
+	__atomic_store_n(&hid_debug_log_enabled, enable? 1: 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int HID_API_EXPORT hid_debug_log_read(char *buffer, size_t size)
+{
+	return hid_debug_log_read_records(buffer, size);
+}
+
 
 struct lang_map_entry {
 	const char *name;
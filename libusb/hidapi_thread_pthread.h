@@ -85,6 +85,16 @@ static int pthread_barrier_wait(pthread_barrier_t *barrier)
 
 #define HIDAPI_THREAD_TIMED_OUT	ETIMEDOUT
 
+/* Clock of the timed condition waits.
+   A monotonic one isn't affected by the system time changes,
+   but not every platform allows to choose the clock of a condition variable. */
+#if defined(CLOCK_MONOTONIC) && !defined(__APPLE__) && !defined(__HAIKU__)
+#define HIDAPI_THREAD_CLOCK CLOCK_MONOTONIC
+#define HIDAPI_THREAD_CONDATTR_SETCLOCK
+#else
+#define HIDAPI_THREAD_CLOCK CLOCK_REALTIME
+#endif
+
 typedef struct timespec hidapi_timespec;
 
 typedef struct
@@ -98,8 +108,17 @@ typedef struct
 
 static void hidapi_thread_state_init(hidapi_thread_state *state)
 {
+	pthread_condattr_t attr;
+
 	pthread_mutex_init(&state->mutex, NULL);
-	pthread_cond_init(&state->condition, NULL);
+
+	pthread_condattr_init(&attr);
+#ifdef HIDAPI_THREAD_CONDATTR_SETCLOCK
+	pthread_condattr_setclock(&attr, HIDAPI_THREAD_CLOCK);
+#endif
+	pthread_cond_init(&state->condition, &attr);
+	pthread_condattr_destroy(&attr);
+
 	pthread_barrier_init(&state->barrier, NULL, 2);
 }
 
@@ -160,7 +179,7 @@ static void hidapi_thread_join(hidapi_thread_state *state)
 
 static void hidapi_thread_gettime(hidapi_timespec *ts)
 {
-	clock_gettime(CLOCK_REALTIME, ts);
+	clock_gettime(HIDAPI_THREAD_CLOCK, ts);
 }
 
 static void hidapi_thread_addtime(hidapi_timespec *ts, int milliseconds)
@@ -172,3 +191,15 @@ static void hidapi_thread_addtime(hidapi_timespec *ts, int milliseconds)
         ts->tv_nsec -= 1000000000L;
     }
 }
+
+/* Optional: without it, the timeouts of hid_read_timeout_ts() are rounded up to milliseconds */
+#define HIDAPI_THREAD_ADDTIME_TS
+static void hidapi_thread_addtime_ts(hidapi_timespec *ts, const struct timespec *duration)
+{
+    ts->tv_sec += duration->tv_sec;
+    ts->tv_nsec += duration->tv_nsec;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
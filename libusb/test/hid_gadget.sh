@@ -0,0 +1,288 @@
+#!/bin/sh
+#
+# HIDAPI - Multi-Platform library for
+# communication with HID devices.
+#
+# libusb/hidapi Team
+#
+# Creates a USB HID gadget on the kernel's dummy_hcd (a virtual USB host
+# and device controller pair), so the libusb backend can be exercised on a
+# plain Linux machine or VM without real hardware.
+#
+# Requires root, configfs and the dummy_hcd, libcomposite and usb_f_hid
+# kernel modules. Exits with 77 (the "skip" code used by CTest) when the
+# environment can't host the gadget.
+#
+# Usage:
+#   hid_gadget.sh setup [options]
+#       Create and bind the gadget. Prints the variables described below.
+#   hid_gadget.sh teardown
+#       Unbind and remove the gadget.
+#   hid_gadget.sh run [options] -- <command> [args...]
+#       Setup, run <command> with the variables below in its environment,
+#       teardown. The exit code of <command> is returned.
+#
+# Options:
+#   -f <n>        Number of HID functions (interfaces) in the composite
+#                 device. Default: 1.
+#   -d <files>    Comma-separated list of binary report descriptors, one per
+#                 function; the last one is reused for remaining functions.
+#                 Default: a vendor-defined Input and Output report of
+#                 <length> bytes, without Report ID.
+#   -l <bytes>    Report length. Default: 64.
+#   -i <interval> Endpoint interval (only if the kernel's f_hid exposes
+#                 the 'interval' attribute).
+#   -n            Don't create an OUT endpoint (Output reports go through
+#                 the control endpoint).
+#   -v <vid>      Vendor ID. Default: 0x1d6b.
+#   -p <pid>      Product ID. Default: 0x0104.
+#
+# Variables:
+#   HIDAPI_GADGET_VID, HIDAPI_GADGET_PID
+#   HIDAPI_GADGET_HIDG           Comma-separated /dev/hidgN nodes, in interface order
+#   HIDAPI_GADGET_REPORT_LENGTH
+#   HIDAPI_GADGET_DIR            configfs directory of the gadget
+#   HIDAPI_GADGET_UDC            UDC the gadget is bound to
+
+SKIP=77
+
+GADGET_NAME=hidapi_test
+CONFIGFS=/sys/kernel/config
+GADGET_DIR="$CONFIGFS/usb_gadget/$GADGET_NAME"
+
+functions=1
+descriptors=
+report_length=64
+interval=
+no_out_endpoint=0
+vid=0x1d6b
+pid=0x0104
+
+skip() {
+	echo "hid_gadget.sh: $*, skipping" >&2
+	exit $SKIP
+}
+
+fail() {
+	echo "hid_gadget.sh: $*" >&2
+	exit 1
+}
+
+# Print a byte given as a number, portable across shells
+put_byte() {
+	printf "\\$(printf '%03o' "$1")"
+}
+
+# Vendor-defined Input and Output report of $1 bytes
+default_descriptor() {
+	len=$1
+	for b in \
+		0x06 0x00 0xff \
+		0x09 0x01 \
+		0xa1 0x01 \
+		0x15 0x00 \
+		0x26 0xff 0x00 \
+		0x75 0x08 \
+		0x96 $((len & 0xff)) $((len >> 8)) \
+		0x09 0x01 \
+		0x81 0x02 \
+		0x96 $((len & 0xff)) $((len >> 8)) \
+		0x09 0x01 \
+		0x91 0x02 \
+		0xc0; do
+		put_byte $((b))
+	done
+}
+
+descriptor_for() {
+	index=$1
+	if [ -z "$descriptors" ]; then
+		default_descriptor "$report_length"
+		return
+	fi
+
+	file=
+	di=0
+	old_ifs=$IFS
+	IFS=,
+	for f in $descriptors; do
+		file=$f
+		[ $di -eq "$index" ] && break
+		di=$((di + 1))
+	done
+	IFS=$old_ifs
+
+	cat "$file" || fail "can't read report descriptor '$file'"
+}
+
+parse_options() {
+	while getopts "f:d:l:i:nv:p:" opt; do
+		case $opt in
+			f) functions=$OPTARG ;;
+			d) descriptors=$OPTARG ;;
+			l) report_length=$OPTARG ;;
+			i) interval=$OPTARG ;;
+			n) no_out_endpoint=1 ;;
+			v) vid=$OPTARG ;;
+			p) pid=$OPTARG ;;
+			*) fail "unknown option" ;;
+		esac
+	done
+	return $((OPTIND - 1))
+}
+
+check_environment() {
+	[ "$(id -u)" -eq 0 ] || skip "root privileges are required"
+
+	if [ ! -d "$CONFIGFS/usb_gadget" ]; then
+		modprobe libcomposite 2>/dev/null
+		grep -q " $CONFIGFS " /proc/mounts || mount -t configfs none "$CONFIGFS" 2>/dev/null
+		[ -d "$CONFIGFS/usb_gadget" ] || skip "configfs USB gadget support is not available"
+	fi
+
+	modprobe usb_f_hid 2>/dev/null
+
+	if [ ! -e /sys/class/udc/dummy_udc.0 ]; then
+		modprobe dummy_hcd 2>/dev/null || skip "dummy_hcd kernel module is not available"
+		[ -e /sys/class/udc/dummy_udc.0 ] || skip "dummy_udc.0 did not appear"
+	fi
+}
+
+# /dev node of a function's hidg character device
+hidg_node() {
+	devnum=$(cat "$1/dev")
+	for d in /sys/class/hidg/*; do
+		if [ "$(cat "$d/dev")" = "$devnum" ]; then
+			echo "/dev/$(basename "$d")"
+			return
+		fi
+	done
+	fail "no /dev node for $1"
+}
+
+print_variables() {
+	hidg=
+	i=0
+	while [ $i -lt "$functions" ]; do
+		node=$(hidg_node "$GADGET_DIR/functions/hid.usb$i")
+		# udev may need a moment to create the node
+		n=0
+		while [ ! -e "$node" ] && [ $n -lt 50 ]; do
+			sleep 0.1
+			n=$((n + 1))
+		done
+		hidg="${hidg:+$hidg,}$node"
+		i=$((i + 1))
+	done
+
+	echo "HIDAPI_GADGET_VID=$vid"
+	echo "HIDAPI_GADGET_PID=$pid"
+	echo "HIDAPI_GADGET_HIDG=$hidg"
+	echo "HIDAPI_GADGET_REPORT_LENGTH=$report_length"
+	echo "HIDAPI_GADGET_DIR=$GADGET_DIR"
+	echo "HIDAPI_GADGET_UDC=dummy_udc.0"
+}
+
+setup() {
+	check_environment
+
+	[ -d "$GADGET_DIR" ] && teardown
+
+	mkdir "$GADGET_DIR" || fail "can't create $GADGET_DIR"
+	cd "$GADGET_DIR" || fail "can't enter $GADGET_DIR"
+
+	echo "$vid" > idVendor
+	echo "$pid" > idProduct
+	echo 0x0100 > bcdDevice
+	echo 0x0200 > bcdUSB
+
+	mkdir -p strings/0x409
+	echo "hidapi" > strings/0x409/manufacturer
+	echo "hidapi test gadget" > strings/0x409/product
+	echo "0123456789" > strings/0x409/serialnumber
+
+	mkdir -p configs/c.1/strings/0x409
+	echo "hidapi test configuration" > configs/c.1/strings/0x409/configuration
+	echo 100 > configs/c.1/MaxPower
+
+	i=0
+	while [ $i -lt "$functions" ]; do
+		fn="functions/hid.usb$i"
+		mkdir "$fn" || fail "can't create $fn, is usb_f_hid available?"
+		echo 0 > "$fn/protocol"
+		echo 0 > "$fn/subclass"
+		echo "$report_length" > "$fn/report_length"
+		descriptor_for $i > "$fn/report_desc"
+
+		if [ -n "$interval" ]; then
+			if [ -e "$fn/interval" ]; then
+				echo "$interval" > "$fn/interval"
+			else
+				echo "hid_gadget.sh: f_hid has no 'interval' attribute, using the kernel default" >&2
+			fi
+		fi
+		if [ "$no_out_endpoint" -eq 1 ]; then
+			[ -e "$fn/no_out_endpoint" ] || skip "f_hid has no 'no_out_endpoint' attribute"
+			echo 1 > "$fn/no_out_endpoint"
+		fi
+
+		ln -s "$fn" configs/c.1/
+		i=$((i + 1))
+	done
+
+	echo dummy_udc.0 > UDC || fail "can't bind the gadget to dummy_udc.0"
+
+	print_variables
+}
+
+teardown() {
+	[ -d "$GADGET_DIR" ] || return 0
+	cd "$GADGET_DIR" || return 1
+
+	echo "" > UDC 2>/dev/null
+
+	for link in configs/c.1/hid.usb*; do
+		[ -L "$link" ] && rm "$link"
+	done
+	rmdir configs/c.1/strings/0x409 2>/dev/null
+	rmdir configs/c.1 2>/dev/null
+	for fn in functions/hid.usb*; do
+		[ -d "$fn" ] && rmdir "$fn"
+	done
+	rmdir strings/0x409 2>/dev/null
+
+	cd / && rmdir "$GADGET_DIR"
+}
+
+command=$1
+[ $# -gt 0 ] && shift
+
+case $command in
+	setup)
+		parse_options "$@"
+		setup
+		;;
+	teardown)
+		teardown
+		;;
+	run)
+		parse_options "$@"
+		shift $?
+		[ "$1" = "--" ] && shift
+		[ $# -gt 0 ] || fail "no command to run"
+
+		variables=$(setup) || exit $?
+		for v in $variables; do
+			export "${v?}"
+		done
+
+		"$@"
+		result=$?
+
+		teardown
+		exit $result
+		;;
+	*)
+		fail "usage: hid_gadget.sh setup|teardown|run [options] [-- command]"
+		;;
+esac
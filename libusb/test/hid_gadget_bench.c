@@ -0,0 +1,1381 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2026, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Test and benchmark driver for the libusb backend, running against a HID
+ * gadget created by hid_gadget.sh on the kernel's dummy_hcd.
+ *
+ * The device side is driven through the /dev/hidgN nodes of the gadget,
+ * the host side through HIDAPI. Generated Input reports carry a sequence
+ * number and a CLOCK_MONOTONIC timestamp, so both ends can be matched:
+ *   bytes 0..3  - sequence number (little endian)
+ *   bytes 4..11 - send time in nanoseconds (little endian)
+ *   byte 12     - interface index
+ *
+ * Usage: hid_gadget_bench <mode> [options]
+ *
+ * Modes:
+ *   throughput  Input reports, device to host, as fast as possible
+ *   write       Output reports, host to device, as fast as possible
+ *   latency     Paced Input reports, device write to hid_read() return
+ *   composite   Concurrent Input reports on every interface
+ *   hotplug     Unbind/bind the gadget, time the hotplug notifications
+ *   detach      hid_open_path()/hid_close() cycles with the kernel
+ *               driver attached (detach and re-attach of usbhid)
+ *   enumerate   hid_enumerate() vs. time to the first device reported
+ *               by hid_enumerate_foreach()
+ *   diff        Unbind/bind the gadget, time the changes seen by polling
+ *               hid_enumerate_generation() and hid_enumerate_diff()
+ *   interrupt   Blocked hid_read_timeout(-1) calls, time hid_interrupt_read()
+ *   deadline    Periodic hid_read_deadline() with a -u usec period,
+ *               time how late the reads return
+ *   close       Close all interfaces with hid_close() vs. hid_close_many()
+ *   group       Write a frame of Output reports to all interfaces with
+ *               hid_write() vs. hid_write_many(), compare the spread between
+ *               the first and the last completion
+ *   fanout      Input reports from one interface delivered to several
+ *               hid_subscribe() consumer threads, check each one sees
+ *               the whole stream
+ *   health      Paced Input reports with a -u usec period, then silence:
+ *               time the stall detection of hid_set_health_monitor()
+ *   dispatch    Input reports read with hid_read(), then delivered to a
+ *               hid_subscribe_dispatch() callback: compare the rate and the
+ *               CPU time per report of both (the callback gets the only
+ *               copy of each report), with the transfers in device
+ *               memory (when libusb has it), then on the heap
+ *               (HIDAPI_LIBUSB_NO_DEV_MEM)
+ *
+ * Options (defaults come from the HIDAPI_GADGET_* variables):
+ *   -n <count>     Number of reports or iterations
+ *   -s <file>      Scripted input: replay the reports from <file> instead of
+ *                  generated ones. One report per line as hex bytes,
+ *                  "sleep <usec>" lines insert delays, '#' starts a comment.
+ *   -u <usec>      Pause between reports in the latency mode
+ *
+ * Exit code is 0 on success, 1 on failure and 77 when no gadget is present.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <pthread.h>
+
+#include <hidapi.h>
+
+#define SKIP 77
+#define MAX_INTERFACES 8
+#define MAX_REPORT_LENGTH 1024
+
+struct bench_config {
+	unsigned short vendor_id;
+	unsigned short product_id;
+	char *hidg[MAX_INTERFACES];
+	int num_interfaces;
+	size_t report_length;
+	const char *gadget_dir;
+	const char *udc;
+	const char *script;
+	long count;
+	long pause_usec;
+};
+
+struct stream {
+	const struct bench_config *config;
+	int index;
+
+	/* device side */
+	int hidg_fd;
+	pthread_t feeder;
+
+	/* host side */
+	hid_device *dev;
+	long received;
+	long lost;
+	long bad;
+	double *latencies;
+	long num_latencies;
+	int64_t start_ns;
+	int64_t end_ns;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void put_le(unsigned char *p, uint64_t value, int bytes)
+{
+	int i;
+	for (i = 0; i < bytes; i++)
+		p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint64_t get_le(const unsigned char *p, int bytes)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < bytes; i++)
+		value |= (uint64_t)p[i] << (8 * i);
+	return value;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* Write one report to the device side. f_hid accepts one report per write. */
+static int gadget_write(int fd, const unsigned char *data, size_t length)
+{
+	ssize_t res;
+
+	do {
+		res = write(fd, data, length);
+	} while (res < 0 && errno == EINTR);
+
+	return (res == (ssize_t)length)? 0: -1;
+}
+
+static int replay_script(struct stream *s)
+{
+	unsigned char report[MAX_REPORT_LENGTH];
+	char line[4096];
+	FILE *f = fopen(s->config->script, "r");
+	if (!f) {
+		fprintf(stderr, "can't open script '%s': %s\n", s->config->script, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line;
+		size_t len = 0;
+		long usec;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "sleep %ld", &usec) == 1) {
+			usleep((useconds_t)usec);
+			continue;
+		}
+
+		while (len < sizeof(report)) {
+			char *end;
+			unsigned long byte = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+			report[len++] = (unsigned char)byte;
+			p = end;
+		}
+
+		/* Pad short lines to the report length of the gadget */
+		if (len < s->config->report_length) {
+			memset(report + len, 0, s->config->report_length - len);
+			len = s->config->report_length;
+		}
+
+		if (gadget_write(s->hidg_fd, report, len) < 0)
+			break;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void *feeder_thread(void *param)
+{
+	struct stream *s = param;
+	unsigned char report[MAX_REPORT_LENGTH];
+	long seq;
+
+	if (s->config->script) {
+		replay_script(s);
+		return NULL;
+	}
+
+	memset(report, 0, sizeof(report));
+	for (seq = 0; seq < s->config->count; seq++) {
+		put_le(report, (uint64_t)seq, 4);
+		put_le(report + 4, (uint64_t)now_ns(), 8);
+		report[12] = (unsigned char)s->index;
+
+		if (gadget_write(s->hidg_fd, report, s->config->report_length) < 0) {
+			fprintf(stderr, "write to %s failed: %s\n", s->config->hidg[s->index], strerror(errno));
+			break;
+		}
+
+		if (s->config->pause_usec > 0)
+			usleep((useconds_t)s->config->pause_usec);
+	}
+
+	return NULL;
+}
+
+/* Open the HIDAPI device for the N-th HID interface of the gadget. */
+static hid_device *open_interface(const struct bench_config *config, int index)
+{
+	struct hid_device_info *devs, *cur;
+	hid_device *dev = NULL;
+
+	devs = hid_enumerate(config->vendor_id, config->product_id);
+	for (cur = devs; cur; cur = cur->next) {
+		if (cur->interface_number == index) {
+			dev = hid_open_path(cur->path);
+			break;
+		}
+	}
+	hid_free_enumeration(devs);
+
+	return dev;
+}
+
+static int stream_open(struct stream *s, const struct bench_config *config, int index)
+{
+	memset(s, 0, sizeof(*s));
+	s->config = config;
+	s->index = index;
+
+	s->hidg_fd = open(config->hidg[index], O_RDWR | O_CLOEXEC);
+	if (s->hidg_fd < 0) {
+		fprintf(stderr, "can't open %s: %s\n", config->hidg[index], strerror(errno));
+		return -1;
+	}
+
+	s->dev = open_interface(config, index);
+	if (!s->dev) {
+		fprintf(stderr, "can't open HID interface %d of %04hx:%04hx\n", index, config->vendor_id, config->product_id);
+		close(s->hidg_fd);
+		return -1;
+	}
+
+	s->latencies = calloc((size_t)config->count, sizeof(double));
+	return 0;
+}
+
+static void stream_close(struct stream *s)
+{
+	hid_close(s->dev);
+	close(s->hidg_fd);
+	free(s->latencies);
+}
+
+/* Read until every generated report arrived or the stream went quiet. */
+static void stream_receive(struct stream *s)
+{
+	unsigned char buf[MAX_REPORT_LENGTH];
+	long expected = 0;
+
+	s->start_ns = now_ns();
+	s->end_ns = s->start_ns;
+
+	while (s->config->script || expected < s->config->count) {
+		int res = hid_read_timeout(s->dev, buf, sizeof(buf), 1000);
+		int64_t t = now_ns();
+
+		if (res <= 0)
+			break;
+
+		s->received++;
+		s->end_ns = t;
+
+		if (s->config->script)
+			continue;
+
+		if ((size_t)res < 13 || buf[12] != s->index) {
+			s->bad++;
+			continue;
+		}
+
+		long seq = (long)get_le(buf, 4);
+		if (seq > expected)
+			s->lost += seq - expected;
+		expected = seq + 1;
+
+		if (s->num_latencies < s->config->count)
+			s->latencies[s->num_latencies++] = (double)(t - (int64_t)get_le(buf + 4, 8)) / 1000.0;
+	}
+}
+
+static void *reader_thread(void *param)
+{
+	stream_receive(param);
+	return NULL;
+}
+
+static void stream_report(struct stream *s, const char *name)
+{
+	double seconds = (double)(s->end_ns - s->start_ns) / 1e9;
+	double rate = (seconds > 0)? (double)s->received / seconds: 0.0;
+
+	printf("%s[%d]: %ld reports, %ld lost, %ld bad, %.0f reports/s, %.0f bytes/s\n",
+		name, s->index, s->received, s->lost, s->bad, rate, rate * (double)s->config->report_length);
+
+	if (s->num_latencies > 0) {
+		qsort(s->latencies, (size_t)s->num_latencies, sizeof(double), compare_double);
+		printf("%s[%d]: latency usec min %.1f p50 %.1f p99 %.1f max %.1f\n", name, s->index,
+			s->latencies[0],
+			s->latencies[s->num_latencies / 2],
+			s->latencies[(s->num_latencies * 99) / 100],
+			s->latencies[s->num_latencies - 1]);
+	}
+}
+
+static int run_input(const struct bench_config *config, int num_interfaces, const char *name)
+{
+	struct stream streams[MAX_INTERFACES];
+	pthread_t readers[MAX_INTERFACES];
+	int i, opened, result = 0;
+
+	for (opened = 0; opened < num_interfaces; opened++) {
+		if (stream_open(&streams[opened], config, opened) < 0) {
+			result = 1;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < num_interfaces; i++)
+		pthread_create(&streams[i].feeder, NULL, feeder_thread, &streams[i]);
+
+	for (i = 0; i < num_interfaces; i++)
+		pthread_create(&readers[i], NULL, reader_thread, &streams[i]);
+
+	for (i = 0; i < num_interfaces; i++) {
+		pthread_join(readers[i], NULL);
+		pthread_join(streams[i].feeder, NULL);
+		stream_report(&streams[i], name);
+
+		if (streams[i].bad > 0 || streams[i].received == 0)
+			result = 1;
+	}
+
+out:
+	for (i = 0; i < opened; i++)
+		stream_close(&streams[i]);
+	return result;
+}
+
+static void *drain_thread(void *param)
+{
+	struct stream *s = param;
+	unsigned char buf[MAX_REPORT_LENGTH];
+
+	while (s->received < s->config->count) {
+		struct pollfd fds;
+		ssize_t res;
+
+		/* Give up when the host stopped writing */
+		fds.fd = s->hidg_fd;
+		fds.events = POLLIN;
+		if (poll(&fds, 1, 1000) <= 0)
+			break;
+
+		res = read(s->hidg_fd, buf, sizeof(buf));
+		if (res <= 0)
+			break;
+		s->received++;
+		s->end_ns = now_ns();
+	}
+
+	return NULL;
+}
+
+static int run_output(const struct bench_config *config)
+{
+	struct stream s;
+	unsigned char report[MAX_REPORT_LENGTH + 1];
+	pthread_t drain;
+	long i;
+
+	if (stream_open(&s, config, 0) < 0)
+		return 1;
+
+	memset(report, 0, sizeof(report));
+	pthread_create(&drain, NULL, drain_thread, &s);
+
+	s.start_ns = now_ns();
+	for (i = 0; i < config->count; i++) {
+		/* Report ID 0 followed by the report */
+		put_le(report + 1, (uint64_t)i, 4);
+		if (hid_write(s.dev, report, config->report_length + 1) < 0) {
+			fprintf(stderr, "hid_write failed at report %ld: %ls\n", i, hid_error(s.dev));
+			break;
+		}
+	}
+
+	pthread_join(drain, NULL);
+	stream_report(&s, "write");
+	stream_close(&s);
+
+	return (s.received == config->count)? 0: 1;
+}
+
+struct hotplug_state {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int arrived;
+	int left;
+};
+
+static int HID_API_CALL hotplug_callback(hid_hotplug_callback_handle callback_handle, struct hid_device_info *device, hid_hotplug_event event, void *user_data)
+{
+	struct hotplug_state *state = user_data;
+	(void)callback_handle;
+	(void)device;
+
+	pthread_mutex_lock(&state->mutex);
+	if (event == HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED)
+		state->arrived++;
+	else if (event == HID_API_HOTPLUG_EVENT_DEVICE_LEFT)
+		state->left++;
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+
+	return 0;
+}
+
+static int write_udc(const struct bench_config *config, const char *value)
+{
+	char path[512];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/UDC", config->gadget_dir);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, "%s\n", value);
+	return fclose(f);
+}
+
+/* Wait until *counter reaches target, return the time it took in usec or -1 on timeout */
+static double wait_for_event(struct hotplug_state *state, int *counter, int target, int64_t since)
+{
+	struct timespec deadline;
+	int res = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 5;
+
+	pthread_mutex_lock(&state->mutex);
+	while (*counter < target && res == 0)
+		res = pthread_cond_timedwait(&state->cond, &state->mutex, &deadline);
+	pthread_mutex_unlock(&state->mutex);
+
+	if (res != 0)
+		return -1;
+	return (double)(now_ns() - since) / 1000.0;
+}
+
+static int run_hotplug(const struct bench_config *config)
+{
+	struct hotplug_state state;
+	hid_hotplug_callback_handle handle;
+	long i;
+	int result = 0;
+
+	if (!config->gadget_dir || !config->udc) {
+		fprintf(stderr, "hotplug: HIDAPI_GADGET_DIR/HIDAPI_GADGET_UDC are not set\n");
+		return SKIP;
+	}
+
+	memset(&state, 0, sizeof(state));
+	pthread_mutex_init(&state.mutex, NULL);
+	pthread_cond_init(&state.cond, NULL);
+
+	if (hid_hotplug_register_callback(config->vendor_id, config->product_id,
+			HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED | HID_API_HOTPLUG_EVENT_DEVICE_LEFT,
+			0, hotplug_callback, &state, &handle) < 0) {
+		fprintf(stderr, "hotplug: hid_hotplug_register_callback failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < config->count && result == 0; i++) {
+		int64_t t;
+		double left_usec, arrived_usec;
+
+		/* Every interface is reported separately */
+		t = now_ns();
+		write_udc(config, "");
+		left_usec = wait_for_event(&state, &state.left, (int)(i + 1) * config->num_interfaces, t);
+
+		t = now_ns();
+		write_udc(config, config->udc);
+		arrived_usec = wait_for_event(&state, &state.arrived, (int)(i + 1) * config->num_interfaces, t);
+
+		printf("hotplug[%ld]: left after %.0f usec, arrived after %.0f usec\n", i, left_usec, arrived_usec);
+		if (left_usec < 0 || arrived_usec < 0)
+			result = 1;
+	}
+
+	hid_hotplug_deregister_callback(handle);
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.mutex);
+
+	return result;
+}
+
+static int run_detach(const struct bench_config *config)
+{
+	struct hid_device_info *devs;
+	char *path;
+	double total = 0, worst = 0;
+	long i;
+
+	devs = hid_enumerate(config->vendor_id, config->product_id);
+	if (!devs) {
+		fprintf(stderr, "detach: gadget not found\n");
+		return 1;
+	}
+	path = strdup(devs->path);
+	hid_free_enumeration(devs);
+
+	for (i = 0; i < config->count; i++) {
+		int64_t t = now_ns();
+		hid_device *dev = hid_open_path(path);
+		double usec;
+
+		if (!dev) {
+			fprintf(stderr, "detach: hid_open_path failed at iteration %ld\n", i);
+			free(path);
+			return 1;
+		}
+		hid_close(dev);
+
+		usec = (double)(now_ns() - t) / 1000.0;
+		total += usec;
+		if (usec > worst)
+			worst = usec;
+	}
+
+	printf("detach: %ld open/close cycles, avg %.0f usec, max %.0f usec\n", config->count, total / (double)config->count, worst);
+	free(path);
+	return 0;
+}
+
+/* Poll hid_enumerate_generation() until it changes, then update the snapshot */
+static int poll_diff(const struct bench_config *config, unsigned int *generation, struct hid_device_info **devs, int *added, int *removed)
+{
+	int64_t deadline = now_ns() + 2000000000LL;
+	struct hid_device_info *new_devs, *gone, *d;
+	unsigned int current = *generation;
+
+	while (current == *generation) {
+		if (now_ns() > deadline)
+			return -1;
+		usleep(1000);
+		if (hid_enumerate_generation(&current) < 0)
+			return -1;
+	}
+	*generation = current;
+
+	/* udev/libusb may take a moment to see the change, retry until the diff is not empty */
+	*added = *removed = 0;
+	while (*added == 0 && *removed == 0) {
+		if (now_ns() > deadline)
+			return -1;
+		if (hid_enumerate_diff(config->vendor_id, config->product_id, devs, &new_devs, &gone) < 0)
+			return -1;
+		for (d = new_devs; d; d = d->next)
+			(*added)++;
+		for (d = gone; d; d = d->next)
+			(*removed)++;
+		hid_free_enumeration(gone);
+		if (*added == 0 && *removed == 0)
+			usleep(1000);
+	}
+	return 0;
+}
+
+static int run_diff(const struct bench_config *config)
+{
+	struct hid_device_info *devs;
+	unsigned int generation;
+	long i;
+	int result = 0;
+
+	if (!config->gadget_dir || !config->udc) {
+		fprintf(stderr, "diff: HIDAPI_GADGET_DIR/HIDAPI_GADGET_UDC are not set\n");
+		return SKIP;
+	}
+	if (hid_enumerate_generation(&generation) < 0) {
+		fprintf(stderr, "diff: hid_enumerate_generation is not supported\n");
+		return SKIP;
+	}
+	devs = hid_enumerate(config->vendor_id, config->product_id);
+
+	for (i = 0; i < config->count && result == 0; i++) {
+		int added, removed;
+		int64_t t;
+
+		t = now_ns();
+		write_udc(config, "");
+		if (poll_diff(config, &generation, &devs, &added, &removed) < 0 || removed != config->num_interfaces || added != 0) {
+			fprintf(stderr, "diff[%ld]: unbind wasn't reported as %d removed entries\n", i, config->num_interfaces);
+			result = 1;
+			break;
+		}
+		printf("diff[%ld]: removed after %.0f usec", i, (double)(now_ns() - t) / 1000.0);
+
+		t = now_ns();
+		write_udc(config, config->udc);
+		if (poll_diff(config, &generation, &devs, &added, &removed) < 0 || added != config->num_interfaces || removed != 0) {
+			fprintf(stderr, "\ndiff[%ld]: bind wasn't reported as %d added entries\n", i, config->num_interfaces);
+			result = 1;
+			break;
+		}
+		printf(", added after %.0f usec\n", (double)(now_ns() - t) / 1000.0);
+	}
+
+	hid_free_enumeration(devs);
+	return result;
+}
+
+struct interrupt_state {
+	hid_device *dev;
+	int result;
+	int64_t returned;
+};
+
+static void *blocked_reader_thread(void *param)
+{
+	struct interrupt_state *state = (struct interrupt_state *) param;
+	unsigned char report[MAX_REPORT_LENGTH];
+
+	state->result = hid_read_timeout(state->dev, report, sizeof(report), -1);
+	state->returned = now_ns();
+	return NULL;
+}
+
+static int run_interrupt(const struct bench_config *config)
+{
+	struct interrupt_state state;
+	double total = 0, worst = 0;
+	long i;
+
+	state.dev = open_interface(config, 0);
+	if (!state.dev) {
+		fprintf(stderr, "interrupt: gadget not found\n");
+		return 1;
+	}
+
+	/* Nothing is fed to the gadget, so the reader only returns when interrupted */
+	for (i = 0; i < config->count; i++) {
+		pthread_t thread;
+		int64_t t;
+		double usec;
+
+		pthread_create(&thread, NULL, blocked_reader_thread, &state);
+		usleep((useconds_t)config->pause_usec);
+
+		t = now_ns();
+		if (hid_interrupt_read(state.dev) < 0) {
+			fprintf(stderr, "interrupt: hid_interrupt_read failed: %ls\n", hid_error(state.dev));
+			pthread_join(thread, NULL);
+			hid_close(state.dev);
+			return 1;
+		}
+		pthread_join(thread, NULL);
+
+		if (state.result != HID_API_READ_INTERRUPTED) {
+			fprintf(stderr, "interrupt[%ld]: hid_read_timeout returned %d\n", i, state.result);
+			hid_close(state.dev);
+			return 1;
+		}
+		usec = (double)(state.returned - t) / 1000.0;
+		total += usec;
+		if (usec > worst)
+			worst = usec;
+	}
+
+	printf("interrupt: %ld blocked reads, woken up after avg %.0f usec, max %.0f usec\n", config->count, total / (double)config->count, worst);
+	hid_close(state.dev);
+	return 0;
+}
+
+static int run_deadline(const struct bench_config *config)
+{
+	unsigned char report[MAX_REPORT_LENGTH];
+	struct timespec deadline;
+	double total = 0, worst = 0;
+	hid_device *dev;
+	long i;
+
+	dev = open_interface(config, 0);
+	if (!dev) {
+		fprintf(stderr, "deadline: gadget not found\n");
+		return 1;
+	}
+
+	/* Nothing is fed to the gadget, so every read waits until its deadline */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	for (i = 0; i < config->count; i++) {
+		double late_usec;
+		int res;
+
+		deadline.tv_nsec += config->pause_usec * 1000L;
+		while (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		res = hid_read_deadline(dev, report, sizeof(report), &deadline);
+		if (res != 0) {
+			fprintf(stderr, "deadline[%ld]: hid_read_deadline returned %d\n", i, res);
+			hid_close(dev);
+			return 1;
+		}
+
+		late_usec = (double)(now_ns() - ((int64_t)deadline.tv_sec * 1000000000LL + deadline.tv_nsec)) / 1000.0;
+		total += late_usec;
+		if (late_usec > worst)
+			worst = late_usec;
+	}
+
+	printf("deadline: %ld periods of %ld usec, woken up late by avg %.1f usec, max %.1f usec\n",
+		config->count, config->pause_usec, total / (double)config->count, worst);
+	hid_close(dev);
+	return 0;
+}
+
+static int open_all_interfaces(const struct bench_config *config, hid_device **devs)
+{
+	int i;
+
+	for (i = 0; i < config->num_interfaces; i++) {
+		devs[i] = open_interface(config, i);
+		if (!devs[i]) {
+			fprintf(stderr, "close: can't open interface %d\n", i);
+			while (i-- > 0)
+				hid_close(devs[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int run_close(const struct bench_config *config)
+{
+	hid_device *devs[MAX_INTERFACES];
+	double sequential = 0, many = 0;
+	long i;
+	int j;
+
+	for (i = 0; i < config->count; i++) {
+		int64_t t;
+
+		if (open_all_interfaces(config, devs) < 0)
+			return 1;
+		t = now_ns();
+		for (j = 0; j < config->num_interfaces; j++)
+			hid_close(devs[j]);
+		sequential += (double)(now_ns() - t) / 1000.0;
+
+		if (open_all_interfaces(config, devs) < 0)
+			return 1;
+		t = now_ns();
+		hid_close_many(devs, (size_t)config->num_interfaces);
+		many += (double)(now_ns() - t) / 1000.0;
+	}
+
+	printf("close: %d interfaces, hid_close() avg %.0f usec, hid_close_many() avg %.0f usec\n",
+		config->num_interfaces, sequential / (double)config->count, many / (double)config->count);
+	return 0;
+}
+
+static double spread_usec(const struct timespec *spread)
+{
+	return (double)spread->tv_sec * 1000000.0 + (double)spread->tv_nsec / 1000.0;
+}
+
+static int run_group(const struct bench_config *config)
+{
+	struct bench_config drain_config = *config;
+	struct stream streams[MAX_INTERFACES];
+	pthread_t drains[MAX_INTERFACES];
+	struct hid_write_request requests[MAX_INTERFACES];
+	unsigned char reports[MAX_INTERFACES][MAX_REPORT_LENGTH + 1];
+	double sequential = 0, sequential_max = 0, many = 0, many_max = 0;
+	int n = config->num_interfaces;
+	int opened = 0, result = 1;
+	long i;
+	int j;
+
+	/* Every frame is sent twice: once with hid_write(), once with hid_write_many() */
+	drain_config.count = config->count * 2;
+
+	for (j = 0; j < n; j++) {
+		if (stream_open(&streams[j], &drain_config, j) < 0)
+			goto out;
+		opened++;
+	}
+
+	memset(reports, 0, sizeof(reports));
+	for (j = 0; j < n; j++)
+		pthread_create(&drains[j], NULL, drain_thread, &streams[j]);
+
+	for (i = 0; i < config->count; i++) {
+		struct timespec spread;
+		int64_t first = 0, last = 0;
+		double usec;
+
+		for (j = 0; j < n; j++) {
+			/* Report ID 0 followed by the report */
+			put_le(reports[j] + 1, (uint64_t)i, 4);
+			reports[j][13] = (unsigned char)j;
+			if (hid_write(streams[j].dev, reports[j], config->report_length + 1) < 0) {
+				fprintf(stderr, "hid_write failed at frame %ld: %ls\n", i, hid_error(streams[j].dev));
+				goto join;
+			}
+			last = now_ns();
+			if (j == 0)
+				first = last;
+		}
+		usec = (double)(last - first) / 1000.0;
+		sequential += usec;
+		if (usec > sequential_max)
+			sequential_max = usec;
+
+		for (j = 0; j < n; j++) {
+			requests[j].dev = streams[j].dev;
+			requests[j].data = reports[j];
+			requests[j].length = config->report_length + 1;
+		}
+		if (hid_write_many(requests, (size_t)n, &spread) < 0) {
+			fprintf(stderr, "hid_write_many failed at frame %ld\n", i);
+			goto join;
+		}
+		usec = spread_usec(&spread);
+		many += usec;
+		if (usec > many_max)
+			many_max = usec;
+	}
+	result = 0;
+
+join:
+	for (j = 0; j < n; j++) {
+		pthread_join(drains[j], NULL);
+		if (streams[j].received != drain_config.count) {
+			fprintf(stderr, "group: interface %d received %ld of %ld reports\n", j, streams[j].received, drain_config.count);
+			result = 1;
+		}
+	}
+
+	printf("group: %d interfaces, completion spread hid_write() avg %.0f usec (max %.0f), hid_write_many() avg %.0f usec (max %.0f)\n",
+		n, sequential / (double)config->count, sequential_max, many / (double)config->count, many_max);
+
+out:
+	for (j = 0; j < opened; j++)
+		stream_close(&streams[j]);
+	return result;
+}
+
+#define FANOUT_SUBSCRIBERS 4
+
+struct subscriber {
+	hid_subscription *subscription;
+	const struct bench_config *config;
+	long received;
+	long lost;
+};
+
+static void *subscriber_thread(void *param)
+{
+	struct subscriber *sub = (struct subscriber *) param;
+	unsigned char buf[MAX_REPORT_LENGTH];
+	long expected = 0;
+
+	while (expected < sub->config->count) {
+		int res = hid_subscription_read_timeout(sub->subscription, buf, sizeof(buf), 1000);
+		long seq;
+
+		if (res < 13)
+			break;
+
+		sub->received++;
+		seq = (long)get_le(buf, 4);
+		if (seq > expected)
+			sub->lost += seq - expected;
+		expected = seq + 1;
+	}
+
+	return NULL;
+}
+
+static int run_fanout(const struct bench_config *config)
+{
+	struct subscriber subs[FANOUT_SUBSCRIBERS];
+	pthread_t threads[FANOUT_SUBSCRIBERS];
+	struct stream s;
+	int i, result = 0;
+
+	if (stream_open(&s, config, 0) < 0)
+		return 1;
+
+	for (i = 0; i < FANOUT_SUBSCRIBERS; i++) {
+		subs[i].config = config;
+		subs[i].received = 0;
+		subs[i].lost = 0;
+		/* Large enough to absorb the scheduling jitter of the consumers */
+		subs[i].subscription = hid_subscribe(s.dev, 4096, config->report_length, HID_API_SUBSCRIPTION_DROP_OLDEST);
+		if (!subs[i].subscription) {
+			fprintf(stderr, "fanout: hid_subscribe failed: %ls\n", hid_error(s.dev));
+			while (i-- > 0)
+				hid_unsubscribe(subs[i].subscription);
+			stream_close(&s);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < FANOUT_SUBSCRIBERS; i++)
+		pthread_create(&threads[i], NULL, subscriber_thread, &subs[i]);
+
+	s.start_ns = now_ns();
+	pthread_create(&s.feeder, NULL, feeder_thread, &s);
+	pthread_join(s.feeder, NULL);
+
+	for (i = 0; i < FANOUT_SUBSCRIBERS; i++) {
+		size_t dropped;
+
+		pthread_join(threads[i], NULL);
+		dropped = hid_subscription_dropped(subs[i].subscription);
+		printf("fanout[%d]: %ld reports, %ld lost, %zu dropped\n", i, subs[i].received, subs[i].lost, dropped);
+
+		if (subs[i].received == 0)
+			result = 1;
+		hid_unsubscribe(subs[i].subscription);
+	}
+	printf("fanout: %d subscribers, %.1f ms\n", FANOUT_SUBSCRIBERS, (double)(now_ns() - s.start_ns) / 1e6);
+
+	stream_close(&s);
+	return result;
+}
+
+struct dispatch_state {
+	const struct bench_config *config;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	long received;
+	long lost;
+	long expected;
+	int64_t end_ns;
+};
+
+static void HID_API_CALL dispatch_callback(hid_device *dev, const unsigned char *data, size_t length, void *user_data)
+{
+	struct dispatch_state *state = (struct dispatch_state *) user_data;
+	long seq;
+	(void) dev;
+
+	if (!data || length < 13)
+		return;
+
+	pthread_mutex_lock(&state->mutex);
+	state->received++;
+	state->end_ns = now_ns();
+	seq = (long)get_le(data, 4);
+	if (seq > state->expected)
+		state->lost += seq - state->expected;
+	state->expected = seq + 1;
+	if (state->expected >= state->config->count)
+		pthread_cond_signal(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+/* User and system CPU time of the whole process, device side included */
+static int64_t cpu_ns(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return ((int64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000
+		+ ((int64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+static void dispatch_report(const char *name, const char *memory, long received, long lost, int64_t start_ns, int64_t end_ns, int64_t cpu)
+{
+	double seconds = (double)(end_ns - start_ns) / 1e9;
+
+	printf("dispatch[%s, %s]: %ld reports, %ld lost, %.0f reports/s, %.2f usec CPU/report\n", name, memory, received, lost,
+		(seconds > 0)? (double)received / seconds: 0.0,
+		(received > 0)? (double)cpu / 1000.0 / (double)received: 0.0);
+}
+
+/* memory names the transfer buffers of the device opened by the pass */
+static int run_dispatch_pass(const struct bench_config *config, const char *memory)
+{
+	struct dispatch_state state;
+	hid_dispatcher *dispatcher;
+	hid_subscription *subscription;
+	struct stream s;
+	int64_t cpu;
+	int result = 0;
+
+	if (stream_open(&s, config, 0) < 0)
+		return 1;
+
+	/* Baseline: the reports copied out by hid_read() */
+	cpu = cpu_ns();
+	pthread_create(&s.feeder, NULL, feeder_thread, &s);
+	stream_receive(&s);
+	pthread_join(s.feeder, NULL);
+	dispatch_report("read", memory, s.received, s.lost, s.start_ns, s.end_ns, cpu_ns() - cpu);
+	if (s.received == 0)
+		result = 1;
+
+	/* Once hid_read() was used, the reports would also be queued for it:
+	   the callback gets a device that was never read */
+	stream_close(&s);
+	if (stream_open(&s, config, 0) < 0)
+		return 1;
+
+	dispatcher = hid_dispatcher_create(1);
+	if (!dispatcher) {
+		fprintf(stderr, "dispatch: hid_dispatcher_create failed: %ls\n", hid_error(NULL));
+		stream_close(&s);
+		return 1;
+	}
+
+	memset(&state, 0, sizeof(state));
+	state.config = config;
+	pthread_mutex_init(&state.mutex, NULL);
+	pthread_cond_init(&state.cond, NULL);
+
+	subscription = hid_subscribe_dispatch(dispatcher, s.dev, 4096, config->report_length, HID_API_SUBSCRIPTION_DROP_OLDEST, dispatch_callback, &state);
+	if (!subscription) {
+		fprintf(stderr, "dispatch: hid_subscribe_dispatch failed: %ls\n", hid_error(s.dev));
+		result = 1;
+	}
+	else {
+		int64_t start_ns = now_ns();
+
+		cpu = cpu_ns();
+		pthread_create(&s.feeder, NULL, feeder_thread, &s);
+
+		/* Until every report arrived or the stream went quiet for a second */
+		pthread_mutex_lock(&state.mutex);
+		while (state.expected < config->count) {
+			long received = state.received;
+			struct timespec deadline;
+
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += 1;
+			pthread_cond_timedwait(&state.cond, &state.mutex, &deadline);
+			if (state.received == received)
+				break;
+		}
+		pthread_mutex_unlock(&state.mutex);
+
+		pthread_join(s.feeder, NULL);
+		hid_unsubscribe(subscription);
+		dispatch_report("callback", memory, state.received, state.lost, start_ns, state.end_ns, cpu_ns() - cpu);
+		if (state.received == 0)
+			result = 1;
+	}
+
+	hid_dispatcher_destroy(dispatcher);
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.mutex);
+	stream_close(&s);
+	return result;
+}
+
+static int run_dispatch(const struct bench_config *config)
+{
+	const char *no_dev_mem = getenv("HIDAPI_LIBUSB_NO_DEV_MEM");
+	char *saved = no_dev_mem? strdup(no_dev_mem): NULL;
+	int result;
+
+	/* The variable is read when the device is opened, by each pass */
+	unsetenv("HIDAPI_LIBUSB_NO_DEV_MEM");
+	result = run_dispatch_pass(config, "dev mem");
+
+	setenv("HIDAPI_LIBUSB_NO_DEV_MEM", "1", 1);
+	result |= run_dispatch_pass(config, "heap");
+
+	if (saved)
+		setenv("HIDAPI_LIBUSB_NO_DEV_MEM", saved, 1);
+	else
+		unsetenv("HIDAPI_LIBUSB_NO_DEV_MEM");
+	free(saved);
+	return result;
+}
+
+struct health_state {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int stalled;
+	struct hid_health_stats stats;
+};
+
+static void HID_API_CALL health_callback(hid_device *dev, hid_health_event event, const struct hid_health_stats *stats, void *user_data)
+{
+	struct health_state *state = (struct health_state *) user_data;
+	(void) dev;
+
+	if (event != HID_API_HEALTH_STALLED)
+		return;
+
+	pthread_mutex_lock(&state->mutex);
+	state->stalled++;
+	state->stats = *stats;
+	pthread_cond_signal(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+static int run_health(const struct bench_config *config)
+{
+	/* Stalled after 10 missed periods, at least 5 ms */
+	const unsigned int threshold_ms = (config->pause_usec * 10 > 5000)? (unsigned int)(config->pause_usec * 10 / 1000): 5;
+	struct health_state state;
+	struct timespec deadline;
+	struct stream s;
+	int result = 0;
+
+	if (stream_open(&s, config, 0) < 0)
+		return 1;
+
+	pthread_mutex_init(&state.mutex, NULL);
+	pthread_cond_init(&state.cond, NULL);
+	state.stalled = 0;
+
+	if (hid_set_health_monitor(s.dev, (unsigned int)config->pause_usec, threshold_ms, health_callback, &state) < 0) {
+		fprintf(stderr, "health: hid_set_health_monitor failed: %ls\n", hid_error(s.dev));
+		stream_close(&s);
+		return 1;
+	}
+
+	pthread_create(&s.feeder, NULL, feeder_thread, &s);
+	stream_receive(&s);
+	pthread_join(s.feeder, NULL);
+
+	if (state.stalled > 0) {
+		fprintf(stderr, "health: stalled while the reports were flowing\n");
+		result = 1;
+	}
+
+	/* The gadget is silent from now on */
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 5;
+	pthread_mutex_lock(&state.mutex);
+	while (state.stalled == 0 && pthread_cond_timedwait(&state.cond, &state.mutex, &deadline) == 0)
+		;
+	pthread_mutex_unlock(&state.mutex);
+
+	if (state.stalled == 0) {
+		fprintf(stderr, "health: no stall detected\n");
+		result = 1;
+	}
+	else {
+		printf("health: %llu reports, %llu late, gap usec min %llu mean %llu max %llu\n",
+			state.stats.reports, state.stats.late_reports,
+			state.stats.min_gap_us, state.stats.mean_gap_us, state.stats.max_gap_us);
+		printf("health: stall detected after %.1f ms of silence (threshold %u ms)\n",
+			(double)state.stats.silence_us / 1000.0, threshold_ms);
+	}
+
+	hid_set_health_monitor(s.dev, 0, 0, NULL, NULL);
+	stream_close(&s);
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.mutex);
+	return result;
+}
+
+static int HID_API_CALL first_device_callback(struct hid_device_info *device, void *user_data)
+{
+	(void)device;
+	*(int64_t *)user_data = now_ns();
+	return 1;
+}
+
+static int run_enumerate(const struct bench_config *config)
+{
+	double full_total = 0, first_total = 0;
+	long i;
+
+	for (i = 0; i < config->count; i++) {
+		struct hid_device_info *devs;
+		int64_t t, found = 0;
+
+		t = now_ns();
+		devs = hid_enumerate(config->vendor_id, config->product_id);
+		full_total += (double)(now_ns() - t) / 1000.0;
+		if (!devs) {
+			fprintf(stderr, "enumerate: gadget not found\n");
+			return 1;
+		}
+		hid_free_enumeration(devs);
+
+		t = now_ns();
+		if (hid_enumerate_foreach(config->vendor_id, config->product_id, first_device_callback, &found) != 1) {
+			fprintf(stderr, "enumerate: hid_enumerate_foreach didn't stop at the gadget\n");
+			return 1;
+		}
+		first_total += (double)(found - t) / 1000.0;
+	}
+
+	printf("enumerate: %ld rounds, hid_enumerate avg %.0f usec, first device (hid_enumerate_foreach) avg %.0f usec\n",
+		config->count, full_total / (double)config->count, first_total / (double)config->count);
+	return 0;
+}
+
+static void load_environment(struct bench_config *config)
+{
+	const char *value;
+
+	memset(config, 0, sizeof(*config));
+	config->vendor_id = 0x1d6b;
+	config->product_id = 0x0104;
+	config->report_length = 64;
+	config->count = 10000;
+	config->pause_usec = 1000;
+
+	if ((value = getenv("HIDAPI_GADGET_VID")))
+		config->vendor_id = (unsigned short)strtoul(value, NULL, 0);
+	if ((value = getenv("HIDAPI_GADGET_PID")))
+		config->product_id = (unsigned short)strtoul(value, NULL, 0);
+	if ((value = getenv("HIDAPI_GADGET_REPORT_LENGTH")))
+		config->report_length = strtoul(value, NULL, 0);
+	config->gadget_dir = getenv("HIDAPI_GADGET_DIR");
+	config->udc = getenv("HIDAPI_GADGET_UDC");
+
+	if ((value = getenv("HIDAPI_GADGET_HIDG"))) {
+		char *list = strdup(value);
+		char *saveptr = NULL;
+		char *node = strtok_r(list, ",", &saveptr);
+		while (node && config->num_interfaces < MAX_INTERFACES) {
+			config->hidg[config->num_interfaces++] = strdup(node);
+			node = strtok_r(NULL, ",", &saveptr);
+		}
+		free(list);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_config config;
+	const char *mode;
+	int opt, result;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s throughput|write|latency|composite|hotplug|detach|enumerate|diff|interrupt|deadline|close|group|fanout|health|dispatch [-n count] [-s script] [-u usec]\n", argv[0]);
+		return 1;
+	}
+	mode = argv[1];
+
+	load_environment(&config);
+
+	optind = 2;
+	while ((opt = getopt(argc, argv, "n:s:u:")) != -1) {
+		switch (opt) {
+		case 'n': config.count = strtol(optarg, NULL, 0); break;
+		case 's': config.script = optarg; break;
+		case 'u': config.pause_usec = strtol(optarg, NULL, 0); break;
+		default: return 1;
+		}
+	}
+
+	if (config.num_interfaces == 0) {
+		fprintf(stderr, "no gadget: HIDAPI_GADGET_HIDG is not set, run through hid_gadget.sh\n");
+		return SKIP;
+	}
+	if (config.report_length < 13 || config.report_length > MAX_REPORT_LENGTH) {
+		fprintf(stderr, "report length %zu is out of the supported range\n", config.report_length);
+		return 1;
+	}
+	if (config.count <= 0) {
+		fprintf(stderr, "invalid count %ld\n", config.count);
+		return 1;
+	}
+
+	if (hid_init() < 0)
+		return 1;
+
+	if (!strcmp(mode, "throughput")) {
+		config.pause_usec = 0;
+		result = run_input(&config, 1, mode);
+	}
+	else if (!strcmp(mode, "latency")) {
+		result = run_input(&config, 1, mode);
+	}
+	else if (!strcmp(mode, "composite")) {
+		config.pause_usec = 0;
+		result = run_input(&config, config.num_interfaces, mode);
+	}
+	else if (!strcmp(mode, "write")) {
+		result = run_output(&config);
+	}
+	else if (!strcmp(mode, "hotplug")) {
+		result = run_hotplug(&config);
+	}
+	else if (!strcmp(mode, "detach")) {
+		result = run_detach(&config);
+	}
+	else if (!strcmp(mode, "enumerate")) {
+		result = run_enumerate(&config);
+	}
+	else if (!strcmp(mode, "diff")) {
+		result = run_diff(&config);
+	}
+	else if (!strcmp(mode, "interrupt")) {
+		result = run_interrupt(&config);
+	}
+	else if (!strcmp(mode, "deadline")) {
+		result = run_deadline(&config);
+	}
+	else if (!strcmp(mode, "close")) {
+		result = run_close(&config);
+	}
+	else if (!strcmp(mode, "group")) {
+		result = run_group(&config);
+	}
+	else if (!strcmp(mode, "fanout")) {
+		config.pause_usec = 0;
+		result = run_fanout(&config);
+	}
+	else if (!strcmp(mode, "health")) {
+		result = run_health(&config);
+	}
+	else if (!strcmp(mode, "dispatch")) {
+		config.pause_usec = 0;
+		result = run_dispatch(&config);
+	}
+	else {
+		fprintf(stderr, "unknown mode '%s'\n", mode);
+		result = 1;
+	}
+
+	hid_exit();
+
+	for (i = 0; i < config.num_interfaces; i++)
+		free(config.hidg[i]);
+
+	return result;
+}
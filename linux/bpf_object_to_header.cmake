@@ -0,0 +1,11 @@
+# Writes the BPF object INPUT as the C array NAME into the header OUTPUT:
+#   cmake -DINPUT=<file.o> -DOUTPUT=<file.h> -DNAME=<array> -P bpf_object_to_header.cmake
+
+file(READ "${INPUT}" HEX_CONTENT HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${HEX_CONTENT}")
+string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n\t" BYTES "${BYTES}")
+
+file(WRITE "${OUTPUT}"
+    "/* Generated from ${INPUT}, do not edit */\n"
+    "static const unsigned char ${NAME}[] = {\n\t${BYTES}\n};\n"
+)
@@ -20,12 +20,17 @@
         https://github.com/libusb/hidapi .
 ********************************************************/
 
+#define _GNU_SOURCE /* needed for ppoll() */
+
 /* C */
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <locale.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 /* Unix */
 #include <unistd.h>
@@ -36,6 +41,8 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
 
 /* Linux */
 #include <linux/hidraw.h>
@@ -43,7 +50,19 @@
 #include <linux/input.h>
 #include <libudev.h>
 
-#include "hidapi.h"
+#ifdef HIDAPI_HID_BPF
+#include <bpf/libbpf.h>
+#include "hid_input_filter_bpf.h"
+/* Generated from hid_input_filter.bpf.c: hid_input_filter_bpf_object[] */
+#include "hid_input_filter.bpf.h"
+#endif
+
+#include "hidapi_hidraw.h"
+#include "hid_debug_log.h"
+#include "hid_enumerate_diff.h"
+
+/* Recorded to the debug log, see hid_debug_log_enable() */
+#define LOG(...) HID_DEBUG_LOG(__VA_ARGS__)
 
 #ifdef HIDAPI_ALLOW_BUILD_WORKAROUND_KERNEL_2_6_39
 /* This definitions first appeared in Linux Kernel 2.6.39 in linux/hidraw.h.
@@ -73,39 +92,278 @@
 /* Can be any arbitrary positive integer */
 #define FIRST_HOTPLUG_CALLBACK_HANDLE 1
 
+#ifdef HIDAPI_NO_HEAP
+/* Maximum length of an error message, including the terminating null character */
+#define HIDAPI_ERROR_STRING_LENGTH 128
+#endif
+
+/* The last error message */
+struct hid_error_str {
+	/* NULL if there is no error */
+	wchar_t *str;
+#ifdef HIDAPI_NO_HEAP
+	/* Error messages are truncated into buf rather than allocated, str points to it */
+	wchar_t buf[HIDAPI_ERROR_STRING_LENGTH];
+#endif
+};
+
+/* A thread of the library, started by the executor of hid_set_executor() if any */
+struct hid_internal_thread {
+	pthread_t thread;
+	/* Handle given by executor.spawn, when on_executor */
+	void *handle;
+	int on_executor;
+	void *(*func)(void *);
+	void *arg;
+};
+
+/* Set by hid_set_executor(), all NULL to create the threads with pthread_create() */
+static struct hid_executor executor = { NULL, NULL, NULL, NULL, NULL };
+
+static void HID_API_CALL hid_internal_thread_task(void *param)
+{
+	struct hid_internal_thread *t = (struct hid_internal_thread *) param;
+	t->func(t->arg);
+}
+
+/* Returns 0 on success, -1 on failure */
+static int hid_internal_thread_start(struct hid_internal_thread *t, void *(*func)(void *), void *arg)
+{
+	t->func = func;
+	t->arg = arg;
+	t->on_executor = (executor.spawn != NULL);
+
+	if (t->on_executor)
+		return (executor.spawn(executor.context, hid_internal_thread_task, t, &t->handle) == 0)? 0: -1;
+
+	return (pthread_create(&t->thread, NULL, func, arg) == 0)? 0: -1;
+}
+
+static void hid_internal_thread_join(struct hid_internal_thread *t)
+{
+	if (t->on_executor)
+		executor.join(executor.context, t->handle);
+	else
+		pthread_join(t->thread, NULL);
+}
+
+#include "hid_health.h"
+
 struct hid_device_ {
 	int device_handle;
+	/* eventfd signalled by hid_interrupt_read(), polled along with device_handle */
+	int interrupt_fd;
 	int blocking;
-	wchar_t *last_error_str;
+	/* Set by hid_read_timeout() once the device is gone */
+	int disconnected;
+	/* Opt-in cache of the Feature reports, NULL if disabled */
+	struct hid_feature_report_cache *feature_cache;
+	/* Set by hid_set_input_filter(), NULL to deliver all the reports.
+	   Replaced and used under subscriptions_mutex, by the readers and the fan-out thread. */
+	struct hid_input_filter_state *input_filter;
+#ifdef HIDAPI_HID_BPF
+	/* The BPF program dropping the filtered reports in the kernel,
+	   see hid_input_filter::kernel_filter. NULL if not attached. */
+	struct bpf_object *bpf_filter;
+	struct bpf_link *bpf_filter_link;
+#endif
+	struct hid_error_str last_error;
 	struct hid_device_info* device_info;
+	/* Opened with hid_open_path_into(), the object is not freed by hid_close() */
+	int external_storage;
+	/* Set when device_info was built into the rest of that storage, not freed either */
+	int device_info_in_storage;
+
+	/* Subscriptions to the input reports, see hid_subscribe().
+	   subscriptions_mutex protects the list and is taken by the fan-out thread
+	   for each report; fanout_mutex serializes starting and stopping the thread. */
+	struct hid_subscription_ *subscriptions;
+	pthread_mutex_t subscriptions_mutex;
+	pthread_mutex_t fanout_mutex;
+	struct hid_internal_thread fanout_thread;
+	int fanout_running;
+	/* Set by the fan-out thread once the device is gone */
+	int fanout_finished;
+	/* eventfd telling the fan-out thread to exit */
+	int fanout_stop_fd;
+
+	/* Set by hid_hidraw_set_read_buffer(): a subscription that hid_read() and friends
+	   are served from, NULL to read the device directly */
+	struct hid_subscription_ *read_buffer;
+	/* Set by hid_interrupt_read() while reading from read_buffer */
+	int read_buffer_interrupted;
+
+	/* See hid_set_health_monitor() */
+	struct hid_health_monitor health;
 };
 
+_Static_assert(sizeof(struct hid_device_) <= HID_API_HIDRAW_DEVICE_STORAGE_SIZE, "HID_API_HIDRAW_DEVICE_STORAGE_SIZE is too small");
+
 static struct hid_api_version api_version = {
 	.major = HID_API_VERSION_MAJOR,
 	.minor = HID_API_VERSION_MINOR,
 	.patch = HID_API_VERSION_PATCH
 };
 
-static wchar_t *last_global_error_str = NULL;
+static struct hid_error_str last_global_error = { NULL };
 
 
-static hid_device *new_hid_device(void)
+/* Set by hid_set_allocator(), all NULL to use the C runtime */
+static struct hid_allocator allocator = { NULL, NULL, NULL, NULL };
+
+/* Caller-provided storage, see hid_enumerate_into() */
+struct hid_internal_arena {
+	unsigned char *buf;
+	size_t size;
+	size_t used;
+	/* The last allocation and the value of used before it,
+	   so that a temporary buffer freed right away is given back */
+	void *last;
+	size_t used_before_last;
+	/* Set once an allocation didn't fit */
+	int exhausted;
+};
+
+/* While set, the allocations of the current thread are carved out of this arena
+   and freeing them is a no-op */
+static __thread struct hid_internal_arena *current_arena = NULL;
+
+static void *hid_internal_arena_alloc(struct hid_internal_arena *arena, size_t size)
 {
-	hid_device *dev = (hid_device*) calloc(1, sizeof(hid_device));
-	if (dev == NULL) {
+	/* Enough for everything allocated by this backend: pointers, integers and wchar_t */
+	const uintptr_t alignment = sizeof(void *);
+	uintptr_t start = ((uintptr_t) (arena->buf + arena->used) + alignment - 1) & ~(alignment - 1);
+	size_t offset = (size_t) (start - (uintptr_t) arena->buf);
+
+	if (offset > arena->size || size > arena->size - offset) {
+		arena->exhausted = 1;
 		return NULL;
 	}
 
+	arena->last = arena->buf + offset;
+	arena->used_before_last = arena->used;
+	arena->used = offset + size;
+
+	return arena->last;
+}
+
+/* Returns 1 if ptr belongs to the arena (which is then the only thing to do to free it) */
+static int hid_internal_arena_free(struct hid_internal_arena *arena, void *ptr)
+{
+	if ((unsigned char *) ptr < arena->buf || (unsigned char *) ptr >= arena->buf + arena->size)
+		return 0;
+
+	if (ptr == arena->last) {
+		arena->used = arena->used_before_last;
+		arena->last = NULL;
+	}
+
+	return 1;
+}
+
+static void *hid_internal_malloc(size_t size)
+{
+	if (current_arena)
+		return hid_internal_arena_alloc(current_arena, size);
+	if (allocator.malloc_fn)
+		return allocator.malloc_fn(size, allocator.user_data);
+	return malloc(size);
+}
+
+static void *hid_internal_calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (!current_arena && !allocator.malloc_fn)
+		return calloc(count, size);
+
+	if (size != 0 && count > (size_t) -1 / size)
+		return NULL;
+	ptr = hid_internal_malloc(count * size);
+	if (ptr)
+		memset(ptr, 0, count * size);
+	return ptr;
+}
+
+static void hid_internal_free(void *ptr)
+{
+	if (!ptr || (current_arena && hid_internal_arena_free(current_arena, ptr)))
+		return;
+
+	if (allocator.free_fn)
+		allocator.free_fn(ptr, allocator.user_data);
+	else
+		free(ptr);
+}
+
+#include "hid_dispatcher.h"
+#include "hid_feature_cache.h"
+#include "hid_input_filter.h"
+
+/* The consumer of a subscription sleeps on it while its ring is empty, see hid_subscription.h */
+typedef struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+} hid_internal_wait_state;
+
+static void hid_internal_wait_notify(hid_internal_wait_state *state)
+{
+	pthread_mutex_lock(&state->mutex);
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->mutex);
+}
+
+#include "hid_subscription.h"
+
+static char *hid_internal_strdup(const char *s)
+{
+	size_t size = strlen(s) + 1;
+	char *ret = (char*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
+static wchar_t *hid_internal_wcsdup(const wchar_t *s)
+{
+	size_t size = (wcslen(s) + 1) * sizeof(wchar_t);
+	wchar_t *ret = (wchar_t*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
+static void init_hid_device(hid_device *dev)
+{
+	memset(dev, 0, sizeof(*dev));
+
 	dev->device_handle = -1;
+	dev->interrupt_fd = -1;
 	dev->blocking = 1;
-	dev->last_error_str = NULL;
+	dev->last_error.str = NULL;
 	dev->device_info = NULL;
+	dev->subscriptions = NULL;
+	dev->fanout_stop_fd = -1;
+	pthread_mutex_init(&dev->subscriptions_mutex, NULL);
+	pthread_mutex_init(&dev->fanout_mutex, NULL);
+}
+
+static hid_device *new_hid_device(void)
+{
+	hid_device *dev = (hid_device*) hid_internal_malloc(sizeof(hid_device));
+	if (dev == NULL) {
+		return NULL;
+	}
+
+	init_hid_device(dev);
 
 	return dev;
 }
 
+static int hid_internal_read_buffered(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout);
+
 
-/* The caller must free the returned string with free(). */
+/* The caller must free the returned string with hid_internal_free(). */
 static wchar_t *utf8_to_wchar_t(const char *utf8)
 {
 	wchar_t *ret = NULL;
@@ -113,9 +371,9 @@ static wchar_t *utf8_to_wchar_t(const char *utf8)
 	if (utf8) {
 		size_t wlen = mbstowcs(NULL, utf8, 0);
 		if ((size_t) -1 == wlen) {
-			return wcsdup(L"");
+			return hid_internal_wcsdup(L"");
 		}
-		ret = (wchar_t*) calloc(wlen+1, sizeof(wchar_t));
+		ret = (wchar_t*) hid_internal_calloc(wlen+1, sizeof(wchar_t));
 		if (ret == NULL) {
 			/* as much as we can do at this point */
 			return NULL;
@@ -129,22 +387,41 @@ static wchar_t *utf8_to_wchar_t(const char *utf8)
 
 
 /* Makes a copy of the given error message (and decoded according to the
- * currently locale) into the wide string pointer pointed by error_str.
+ * currently locale) into error.
  * The last stored error string is freed.
  * Use register_error_str(NULL) to free the error message completely. */
-static void register_error_str(wchar_t **error_str, const char *msg)
+static void register_error_str(struct hid_error_str *error, const char *msg)
 {
-	free(*error_str);
-	*error_str = utf8_to_wchar_t(msg);
+#ifdef HIDAPI_NO_HEAP
+	size_t wlen;
+
+	error->str = NULL;
+	if (!msg)
+		return;
+
+	wlen = mbstowcs(error->buf, msg, HIDAPI_ERROR_STRING_LENGTH - 1);
+	if ((size_t) -1 == wlen)
+		wlen = 0;
+	error->buf[wlen] = 0x0000;
+	error->str = error->buf;
+#else
+	/* Error messages outlive the storage given to hid_enumerate_into() */
+	struct hid_internal_arena *arena = current_arena;
+
+	current_arena = NULL;
+	hid_internal_free(error->str);
+	error->str = utf8_to_wchar_t(msg);
+	current_arena = arena;
+#endif
 }
 
 /* Semilar to register_error_str, but allows passing a format string with va_list args into this function. */
-static void register_error_str_vformat(wchar_t **error_str, const char *format, va_list args)
+static void register_error_str_vformat(struct hid_error_str *error, const char *format, va_list args)
 {
 	char msg[256];
 	vsnprintf(msg, sizeof(msg), format, args);
 
-	register_error_str(error_str, msg);
+	register_error_str(error, msg);
 }
 
 /* Set the last global error to be reported by hid_error(NULL).
@@ -154,7 +431,7 @@ static void register_error_str_vformat(wchar_t **error_str, const char *format,
  * Use register_global_error(NULL) to indicate "no error". */
 static void register_global_error(const char *msg)
 {
-	register_error_str(&last_global_error_str, msg);
+	register_error_str(&last_global_error, msg);
 }
 
 /* Similar to register_global_error, but allows passing a format string into this function. */
@@ -162,7 +439,7 @@ static void register_global_error_format(const char *format, ...)
 {
 	va_list args;
 	va_start(args, format);
-	register_error_str_vformat(&last_global_error_str, format, args);
+	register_error_str_vformat(&last_global_error, format, args);
 	va_end(args);
 }
 
@@ -173,7 +450,7 @@ static void register_global_error_format(const char *format, ...)
  * Use register_device_error(dev, NULL) to indicate "no error". */
 static void register_device_error(hid_device *dev, const char *msg)
 {
-	register_error_str(&dev->last_error_str, msg);
+	register_error_str(&dev->last_error, msg);
 }
 
 /* Similar to register_device_error, but you can pass a format string into this function. */
@@ -181,12 +458,12 @@ static void register_device_error_format(hid_device *dev, const char *format, ..
 {
 	va_list args;
 	va_start(args, format);
-	register_error_str_vformat(&dev->last_error_str, format, args);
+	register_error_str_vformat(&dev->last_error, format, args);
 	va_end(args);
 }
 
 /* Get an attribute value from a udev_device and return it as a whar_t
-   string. The returned string must be freed with free() when done.*/
+   string. The returned string must be freed with hid_internal_free() when done.*/
 static wchar_t *copy_udev_string(struct udev_device *dev, const char *udev_name)
 {
 	return utf8_to_wchar_t(udev_device_get_sysattr_value(dev, udev_name));
@@ -447,11 +724,11 @@ static int get_hid_report_descriptor_from_sysfs(const char *sysfs_path, struct h
 	int res = -1;
 	/* Construct <sysfs_path>/device/report_descriptor */
 	size_t rpt_path_len = strlen(sysfs_path) + 25 + 1;
-	char* rpt_path = (char*) calloc(1, rpt_path_len);
+	char* rpt_path = (char*) hid_internal_calloc(1, rpt_path_len);
 	snprintf(rpt_path, rpt_path_len, "%s/device/report_descriptor", sysfs_path);
 
 	res = get_hid_report_descriptor(rpt_path, rpt_desc);
-	free(rpt_path);
+	hid_internal_free(rpt_path);
 
 	return res;
 }
@@ -532,11 +809,11 @@ static int parse_hid_vid_pid_from_sysfs(const char *sysfs_path, unsigned *bus_ty
 	int res = 0;
 	/* Construct <sysfs_path>/device/uevent */
 	size_t uevent_path_len = strlen(sysfs_path) + 14 + 1;
-	char* uevent_path = (char*) calloc(1, uevent_path_len);
+	char* uevent_path = (char*) hid_internal_calloc(1, uevent_path_len);
 	snprintf(uevent_path, uevent_path_len, "%s/device/uevent", sysfs_path);
 
 	res = parse_hid_vid_pid_from_uevent_path(uevent_path, bus_type, vendor_id, product_id);
-	free(uevent_path);
+	hid_internal_free(uevent_path);
 
 	return res;
 }
@@ -564,7 +841,7 @@ static int get_hid_report_descriptor_from_hidraw(hid_device *dev, struct hidraw_
 }
 
 /*
- * The caller is responsible for free()ing the (newly-allocated) character
+ * The caller is responsible for hid_internal_free()ing the (newly-allocated) character
  * strings pointed to by serial_number_utf8 and product_name_utf8 after use.
  */
 static int parse_uevent_info(const char *uevent, unsigned *bus_type,
@@ -614,11 +891,11 @@ static int parse_uevent_info(const char *uevent, unsigned *bus_type,
 			}
 		} else if (strcmp(key, "HID_NAME") == 0) {
 			/* The caller has to free the product name */
-			*product_name_utf8 = strdup(value);
+			*product_name_utf8 = hid_internal_strdup(value);
 			found_name = 1;
 		} else if (strcmp(key, "HID_UNIQ") == 0) {
 			/* The caller has to free the serial number */
-			*serial_number_utf8 = strdup(value);
+			*serial_number_utf8 = hid_internal_strdup(value);
 			found_serial = 1;
 		}
 
@@ -688,7 +965,7 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 	}
 
 	/* Create the record. */
-	root = (struct hid_device_info*) calloc(1, sizeof(struct hid_device_info));
+	root = (struct hid_device_info*) hid_internal_calloc(1, sizeof(struct hid_device_info));
 	if (!root)
 		goto end;
 
@@ -696,7 +973,7 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 
 	/* Fill out the record */
 	cur_dev->next = NULL;
-	cur_dev->path = dev_path? strdup(dev_path): NULL;
+	cur_dev->path = dev_path? hid_internal_strdup(dev_path): NULL;
 
 	/* VID/PID */
 	cur_dev->vendor_id = dev_vid;
@@ -729,7 +1006,7 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 			 * be available. */
 			if (!usb_dev) {
 				/* Manufacturer and Product strings */
-				cur_dev->manufacturer_string = wcsdup(L"");
+				cur_dev->manufacturer_string = hid_internal_wcsdup(L"");
 				cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
 				break;
 			}
@@ -755,14 +1032,14 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 			break;
 
 		case BUS_BLUETOOTH:
-			cur_dev->manufacturer_string = wcsdup(L"");
+			cur_dev->manufacturer_string = hid_internal_wcsdup(L"");
 			cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
 
 			cur_dev->bus_type = HID_API_BUS_BLUETOOTH;
 
 			break;
 		case BUS_I2C:
-			cur_dev->manufacturer_string = wcsdup(L"");
+			cur_dev->manufacturer_string = hid_internal_wcsdup(L"");
 			cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
 
 			cur_dev->bus_type = HID_API_BUS_I2C;
@@ -770,7 +1047,7 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 			break;
 
 		case BUS_SPI:
-			cur_dev->manufacturer_string = wcsdup(L"");
+			cur_dev->manufacturer_string = hid_internal_wcsdup(L"");
 			cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
 
 			cur_dev->bus_type = HID_API_BUS_SPI;
@@ -805,7 +1082,7 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 		 */
 		while (!get_next_hid_usage(report_desc.value, report_desc.size, &usage_iterator, &page, &usage)) {
 			/* Create new record for additional usage pairs */
-			struct hid_device_info *tmp = (struct hid_device_info*) calloc(1, sizeof(struct hid_device_info));
+			struct hid_device_info *tmp = (struct hid_device_info*) hid_internal_calloc(1, sizeof(struct hid_device_info));
 			struct hid_device_info *prev_dev = cur_dev;
 
 			if (!tmp)
@@ -814,14 +1091,14 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 			cur_dev = tmp;
 
 			/* Update fields */
-			cur_dev->path = dev_path? strdup(dev_path): NULL;
+			cur_dev->path = dev_path? hid_internal_strdup(dev_path): NULL;
 			cur_dev->vendor_id = dev_vid;
 			cur_dev->product_id = dev_pid;
-			cur_dev->serial_number = prev_dev->serial_number? wcsdup(prev_dev->serial_number): NULL;
+			cur_dev->serial_number = prev_dev->serial_number? hid_internal_wcsdup(prev_dev->serial_number): NULL;
 			cur_dev->release_number = prev_dev->release_number;
 			cur_dev->interface_number = prev_dev->interface_number;
-			cur_dev->manufacturer_string = prev_dev->manufacturer_string? wcsdup(prev_dev->manufacturer_string): NULL;
-			cur_dev->product_string = prev_dev->product_string? wcsdup(prev_dev->product_string): NULL;
+			cur_dev->manufacturer_string = prev_dev->manufacturer_string? hid_internal_wcsdup(prev_dev->manufacturer_string): NULL;
+			cur_dev->product_string = prev_dev->product_string? hid_internal_wcsdup(prev_dev->product_string): NULL;
 			cur_dev->usage_page = page;
 			cur_dev->usage = usage;
 			cur_dev->bus_type = prev_dev->bus_type;
@@ -829,8 +1106,8 @@ static struct hid_device_info * create_device_info_for_device(struct udev_device
 	}
 
 end:
-	free(serial_number_utf8);
-	free(product_name_utf8);
+	hid_internal_free(serial_number_utf8);
+	hid_internal_free(product_name_utf8);
 
 	return root;
 }
@@ -889,14 +1166,19 @@ static struct hid_hotplug_context {
 	/* UDEV context that handles the monitor */
 	struct udev* udev_ctx;
 
-	/* UDEV monitor that receives events */
+	/* UDEV monitor that receives events (NULL if udevd isn't running) */
 	struct udev_monitor* mon;
 
-	/* File descriptor for the UDEV monitor that allows to check for new events with select() */
+	/* inotify instance watching /dev for hidraw nodes, used when udevd isn't running (-1 otherwise) */
+	int inotify_fd;
+
+	/* File descriptor of the event source (UDEV monitor or inotify) that allows to check for new events with select() */
 	int monitor_fd;
 
-	/* Thread for the UDEV monitor */
-	pthread_t thread;
+	/* Thread for the event source */
+	struct hid_internal_thread thread;
+
+	int thread_running;
 
 	pthread_mutex_t mutex;
 	
@@ -912,7 +1194,10 @@ static struct hid_hotplug_context {
 	struct hid_device_info *devs;
 } hid_hotplug_context = {
 	.udev_ctx = NULL,
+	.mon = NULL,
+	.inotify_fd = -1,
 	.monitor_fd = -1,
+	.thread_running = 0,
 	.next_handle = FIRST_HOTPLUG_CALLBACK_HANDLE,
 	.mutex_ready = 0,
 	.hotplug_cbs = NULL,
@@ -940,9 +1225,6 @@ static void hid_internal_hotplug_cleanup()
 	/* Cleanup connected device list */
 	hid_free_enumeration(hid_hotplug_context.devs);
 	hid_hotplug_context.devs = NULL;
-	/* Disarm the udev monitor */
-	udev_monitor_unref(hid_hotplug_context.mon);
-	udev_unref(hid_hotplug_context.udev_ctx);
 }
 
 static void hid_internal_hotplug_init()
@@ -953,6 +1235,20 @@ static void hid_internal_hotplug_init()
 	}
 }
 
+/* Close the event source; its thread must not be running */
+static void hid_internal_hotplug_close_monitor()
+{
+	if (hid_hotplug_context.mon) {
+		udev_monitor_unref(hid_hotplug_context.mon);
+		hid_hotplug_context.mon = NULL;
+	}
+	if (hid_hotplug_context.inotify_fd >= 0) {
+		close(hid_hotplug_context.inotify_fd);
+		hid_hotplug_context.inotify_fd = -1;
+	}
+	hid_hotplug_context.monitor_fd = -1;
+}
+
 static void hid_internal_hotplug_exit()
 {
 	if (!hid_hotplug_context.mutex_ready) {
@@ -964,15 +1260,54 @@ static void hid_internal_hotplug_exit()
 	/* Remove all callbacks from the list */
 	while (*current) {
 		struct hid_hotplug_callback* next = (*current)->next;
-		free(*current);
+		hid_internal_free(*current);
 		*current = next;
 	}
 	hid_internal_hotplug_cleanup();
 	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	/* The event thread may be inside a hotplug callback waiting for the mutex,
+	   so it can only be joined after the mutex is released */
+	if (__atomic_load_n(&hid_hotplug_context.thread_running, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&hid_hotplug_context.thread_running, 0, __ATOMIC_RELEASE);
+		hid_internal_thread_join(&hid_hotplug_context.thread);
+	}
+
+	/* Disarm the event source */
+	hid_internal_hotplug_close_monitor();
+	if (hid_hotplug_context.udev_ctx) {
+		udev_unref(hid_hotplug_context.udev_ctx);
+		hid_hotplug_context.udev_ctx = NULL;
+	}
+
 	hid_hotplug_context.mutex_ready = 0;
 	pthread_mutex_destroy(&hid_hotplug_context.mutex);
 }
 
+/* Counts creations/removals of /dev/hidraw* nodes for hid_enumerate_generation() */
+static struct hid_generation_context {
+	pthread_mutex_t mutex;
+
+	/* inotify instance watching /dev, -1 until hid_enumerate_generation() is called */
+	int inotify_fd;
+
+	unsigned int generation;
+} hid_generation_context = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.inotify_fd = -1,
+	.generation = 0
+};
+
+static void hid_internal_generation_exit()
+{
+	pthread_mutex_lock(&hid_generation_context.mutex);
+	if (hid_generation_context.inotify_fd >= 0) {
+		close(hid_generation_context.inotify_fd);
+		hid_generation_context.inotify_fd = -1;
+	}
+	pthread_mutex_unlock(&hid_generation_context.mutex);
+}
+
 int HID_API_EXPORT hid_init(void)
 {
 	const char *locale;
@@ -980,6 +1315,8 @@ int HID_API_EXPORT hid_init(void)
 	/* indicate no error */
 	register_global_error(NULL);
 
+	hid_debug_log_init();
+
 	/* Set the locale if it's not set. */
 	locale = setlocale(LC_CTYPE, NULL);
 	if (!locale)
@@ -995,7 +1332,44 @@ int HID_API_EXPORT hid_exit(void)
 	register_global_error(NULL);
 
 	hid_internal_hotplug_exit();
-	
+	hid_internal_generation_exit();
+	hid_internal_health_exit();
+
+	hid_debug_log_exit();
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_allocator(const struct hid_allocator *new_allocator)
+{
+	if (new_allocator && (!new_allocator->malloc_fn || !new_allocator->realloc_fn || !new_allocator->free_fn)) {
+		register_global_error("hid_set_allocator: malloc_fn, realloc_fn and free_fn must all be set");
+		return -1;
+	}
+
+	/* The global error message was allocated with the previous allocator */
+	register_global_error(NULL);
+
+	if (new_allocator)
+		allocator = *new_allocator;
+	else
+		memset(&allocator, 0, sizeof(allocator));
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_executor(const struct hid_executor *new_executor)
+{
+	if (new_executor && (!new_executor->spawn || !new_executor->join)) {
+		register_global_error("hid_set_executor: spawn and join must be set");
+		return -1;
+	}
+
+	if (new_executor)
+		executor = *new_executor;
+	else
+		memset(&executor, 0, sizeof(executor));
+
 	return 0;
 }
 
@@ -1004,23 +1378,26 @@ static int hid_internal_match_device_id(unsigned short vendor_id, unsigned short
     return (expected_vendor_id == 0x0 || vendor_id == expected_vendor_id) && (expected_product_id == 0x0 || product_id == expected_product_id);
 }
 
-struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Called by hid_internal_enumerate() for each matching hidraw node, with the list of
+   hid_device_info created for it (one entry per top-level usage).
+   The callback takes ownership of the list.
+   Returns non-zero to stop the enumeration. */
+typedef int (*hid_internal_enumerate_fn)(struct hid_device_info *devs, void *user_data);
+
+/* Returns 0 if all devices were enumerated, 1 if the enumeration was stopped by the callback
+   or -1 on error. */
+static int hid_internal_enumerate(unsigned short vendor_id, unsigned short product_id, hid_internal_enumerate_fn callback, void *user_data)
 {
 	struct udev *udev;
 	struct udev_enumerate *enumerate;
 	struct udev_list_entry *devices, *dev_list_entry;
-
-	struct hid_device_info *root = NULL; /* return object */
-	struct hid_device_info *cur_dev = NULL;
-
-	hid_init();
-	/* register_global_error: global error is reset by hid_init */
+	int stopped = 0;
 
 	/* Create the udev object */
 	udev = udev_new();
 	if (!udev) {
 		register_global_error("Couldn't create udev context");
-		return NULL;
+		return -1;
 	}
 
 	/* Create a list of the devices in the 'hidraw' subsystem. */
@@ -1059,28 +1436,57 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 			continue;
 
 		tmp = create_device_info_for_device(raw_dev);
-		if (tmp) {
-			if (cur_dev) {
-				cur_dev->next = tmp;
-			}
-			else {
-				root = tmp;
-			}
-			cur_dev = tmp;
-
-			/* move the pointer to the tail of returned list */
-			while (cur_dev->next != NULL) {
-				cur_dev = cur_dev->next;
-			}
-		}
 
 		udev_device_unref(raw_dev);
+
+		if (tmp && callback(tmp, user_data)) {
+			stopped = 1;
+			break;
+		}
 	}
 	/* Free the enumerator and udev objects. */
 	udev_enumerate_unref(enumerate);
 	udev_unref(udev);
 
-	if (root == NULL) {
+	return stopped;
+}
+
+struct hid_internal_enumerate_list {
+	struct hid_device_info *root;
+	struct hid_device_info *tail;
+};
+
+static int hid_internal_enumerate_append(struct hid_device_info *devs, void *user_data)
+{
+	struct hid_internal_enumerate_list *list = (struct hid_internal_enumerate_list *) user_data;
+
+	if (list->tail) {
+		list->tail->next = devs;
+	}
+	else {
+		list->root = devs;
+	}
+	list->tail = devs;
+
+	/* move the pointer to the tail of returned list */
+	while (list->tail->next != NULL) {
+		list->tail = list->tail->next;
+	}
+
+	return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_internal_enumerate_list list = { NULL, NULL };
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	if (hid_internal_enumerate(vendor_id, product_id, hid_internal_enumerate_append, &list) < 0)
+		return NULL;
+
+	if (list.root == NULL) {
 		if (vendor_id == 0 && product_id == 0) {
 			register_global_error("No HID devices found in the system.");
 		} else {
@@ -1088,139 +1494,431 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 		}
 	}
 
-	return root;
+	return list.root;
 }
 
-void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+struct hid_internal_enumerate_foreach_data {
+	hid_enumerate_callback_fn callback;
+	void *user_data;
+};
+
+static int hid_internal_enumerate_foreach(struct hid_device_info *devs, void *user_data)
 {
-	struct hid_device_info *d = devs;
-	while (d) {
-		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
-		d = next;
+	struct hid_internal_enumerate_foreach_data *data = (struct hid_internal_enumerate_foreach_data *) user_data;
+	int stop = 0;
+
+	/* Report the entries one by one, each of them is released right after the callback */
+	while (devs) {
+		struct hid_device_info *next = devs->next;
+		devs->next = NULL;
+		if (!stop)
+			stop = data->callback(devs, data->user_data);
+		hid_free_enumeration(devs);
+		devs = next;
 	}
+
+	return stop;
 }
 
-static void hid_internal_invoke_callbacks(struct hid_device_info *info, hid_hotplug_event event)
+int HID_API_EXPORT HID_API_CALL hid_enumerate_foreach(unsigned short vendor_id, unsigned short product_id, hid_enumerate_callback_fn callback, void *user_data)
 {
-	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
-	while (*current) {
-		struct hid_hotplug_callback *callback = *current;
-		if ((callback->events & event) && hid_internal_match_device_id(info->vendor_id, info->product_id,
-																	   callback->vendor_id, callback->product_id)) {
-			int result = callback->callback(callback->handle, info, event, callback->user_data);
-			/* If the result is non-zero, we remove the callback and proceed */
-			/* Do not use the deregister call as it locks the mutex, and we are currently in a lock */
-			if (result) {
-				struct hid_hotplug_callback *callback = *current;
-				*current = (*current)->next;
-				free(callback);
-				continue;
-			}
-		}
-		current = &callback->next;
+	struct hid_internal_enumerate_foreach_data data;
+
+	if (!callback) {
+		register_global_error("Enumeration callback is NULL");
+		return -1;
 	}
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	data.callback = callback;
+	data.user_data = user_data;
+
+	return hid_internal_enumerate(vendor_id, product_id, hid_internal_enumerate_foreach, &data);
 }
 
-static int match_udev_to_info(struct udev_device* raw_dev, struct hid_device_info *info)
+struct hid_internal_enumerate_into_data {
+	struct hid_internal_arena *arena;
+	struct hid_internal_enumerate_list list;
+	/* Arena usage after the last complete device */
+	size_t used;
+	int count;
+};
+
+static int hid_internal_enumerate_into(struct hid_device_info *devs, void *user_data)
 {
-	const char *path = udev_device_get_devnode(raw_dev);
-	if (!strcmp(path, info->path)) {
+	struct hid_internal_enumerate_into_data *data = (struct hid_internal_enumerate_into_data *) user_data;
+
+	/* Don't return a device with some of its strings or usages missing */
+	if (data->arena->exhausted) {
+		data->arena->used = data->used;
 		return 1;
 	}
+
+	hid_internal_enumerate_append(devs, &data->list);
+	for (; devs; devs = devs->next)
+		data->count++;
+	data->used = data->arena->used;
+
 	return 0;
 }
 
-static void* hotplug_thread(void* user_data)
+int HID_API_EXPORT hid_enumerate_into(unsigned short vendor_id, unsigned short product_id, void *storage, size_t size, struct hid_device_info **devs)
 {
-	while (hid_hotplug_context.monitor_fd > 0) {
-		fd_set fds;
-		struct timeval tv;
-		int ret;
+	struct hid_internal_arena arena;
+	struct hid_internal_enumerate_into_data data;
+	int res;
 
-		FD_ZERO(&fds);
-		FD_SET(hid_hotplug_context.monitor_fd, &fds);
-		/* 5 msec timeout seems reasonable; don't set too low to avoid high CPU usage */
-		/* This timeout only affects how much time it takes to stop the thread */
-		tv.tv_sec = 0;
-		tv.tv_usec = 5000;
+	if (!devs) {
+		register_global_error("devs is NULL");
+		return -1;
+	}
+	*devs = NULL;
 
-		ret = select(hid_hotplug_context.monitor_fd+1, &fds, NULL, NULL, &tv);
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
 
-		/* Check if our file descriptor has received data. */
-		if (ret > 0 && FD_ISSET(hid_hotplug_context.monitor_fd, &fds)) {
+	memset(&arena, 0, sizeof(arena));
+	arena.buf = (unsigned char *) storage;
+	arena.size = storage ? size : 0;
 
-			/* Make the call to receive the device.
-			   select() ensured that this will not block. */
-			struct udev_device *raw_dev = udev_monitor_receive_device(hid_hotplug_context.mon);
-			if (raw_dev) {
-				/* Lock the mutex so callback/device lists don't change elsewhere from here on */
-				pthread_mutex_lock(&hid_hotplug_context.mutex);
-
-				const char* action = udev_device_get_action(raw_dev);
-				if (!strcmp(action, "add")) {
-					// We create a list of all usages on this UDEV device
-					struct hid_device_info *info = create_device_info_for_device(raw_dev);
-					struct hid_device_info *info_cur = info;
-					while (info_cur) {
-						/* For each device, call all matching callbacks */
-						/* TODO: possibly make the `next` field NULL to match the behavior on other systems */
-						hid_internal_invoke_callbacks(info_cur, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED);
-						info_cur = info_cur->next;
-					}
-
-					/* Append all we got to the end of the device list */
-					if (info) {
-						if (hid_hotplug_context.devs != NULL) {
-							struct hid_device_info *last = hid_hotplug_context.devs;
-							while (last->next != NULL) {
-								last = last->next;
-							}
-							last->next = info;
-						} else {
-							hid_hotplug_context.devs = info;
-						}
-					}
-				} else if (!strcmp(action, "remove")) {
-					for (struct hid_device_info **current = &hid_hotplug_context.devs; *current;) {
-						struct hid_device_info* info = *current;
-						if (match_udev_to_info(raw_dev, *current)) {
-							/* If the libusb device that's left matches this HID device, we detach it from the list */
-							*current = (*current)->next;
-							info->next = NULL;
-							hid_internal_invoke_callbacks(info, HID_API_HOTPLUG_EVENT_DEVICE_LEFT);
-							/* Free every removed device */
-							free(info);
-						} else {
-							current = &info->next;
-						}
-					}
-				}
-				udev_device_unref(raw_dev);
-				pthread_mutex_unlock(&hid_hotplug_context.mutex);
-			}
-		}
+	memset(&data, 0, sizeof(data));
+	data.arena = &arena;
+
+	current_arena = &arena;
+	res = hid_internal_enumerate(vendor_id, product_id, hid_internal_enumerate_into, &data);
+	current_arena = NULL;
+
+	*devs = data.list.root;
+
+	if (res < 0)
+		return -1;
+
+	if (arena.exhausted) {
+		register_global_error("The storage is too small for all the devices");
+		return -1;
 	}
-	return NULL;
+
+	return data.count;
 }
 
-int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short vendor_id, unsigned short product_id, int events, int flags, hid_hotplug_callback_fn callback, void *user_data, hid_hotplug_callback_handle *callback_handle)
+int HID_API_EXPORT HID_API_CALL hid_enumerate_generation(unsigned int *generation)
 {
-	struct hid_hotplug_callback* hotplug_cb;
-
-	/* Check params */
-	if (events == 0
-		|| (events & ~(HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED | HID_API_HOTPLUG_EVENT_DEVICE_LEFT))
-		|| (flags & ~(HID_API_HOTPLUG_ENUMERATE))
-		|| callback == NULL) {
+	union {
+		struct inotify_event event;
+		char buf[4096];
+	} events;
+	ssize_t len;
+
+	if (!generation) {
+		register_global_error("Invalid parameters for hid_enumerate_generation");
 		return -1;
 	}
 
-	hotplug_cb = (struct hid_hotplug_callback*)calloc(1, sizeof(struct hid_hotplug_callback));
+	pthread_mutex_lock(&hid_generation_context.mutex);
+
+	if (hid_generation_context.inotify_fd < 0) {
+		int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0) {
+			register_global_error_format("Failed to create inotify instance: %s", strerror(errno));
+			pthread_mutex_unlock(&hid_generation_context.mutex);
+			return -1;
+		}
+		/* /dev/hidraw* nodes are created by devtmpfs, so this works without udevd as well */
+		if (inotify_add_watch(fd, "/dev", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+			register_global_error_format("Failed to watch /dev: %s", strerror(errno));
+			close(fd);
+			pthread_mutex_unlock(&hid_generation_context.mutex);
+			return -1;
+		}
+		hid_generation_context.inotify_fd = fd;
+
+		/* Nothing was watching before, so the previous value (if any) can't be trusted */
+		hid_generation_context.generation++;
+	}
+
+	/* Drain the pending events; only the hidraw nodes matter */
+	while ((len = read(hid_generation_context.inotify_fd, events.buf, sizeof(events.buf))) > 0) {
+		const char *p = events.buf;
+		while (p < events.buf + len) {
+			const struct inotify_event *event = (const struct inotify_event *) p;
+			if ((event->mask & IN_Q_OVERFLOW) ||
+			    (event->len && strncmp(event->name, "hidraw", 6) == 0)) {
+				hid_generation_context.generation++;
+			}
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	*generation = hid_generation_context.generation;
+
+	pthread_mutex_unlock(&hid_generation_context.mutex);
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_diff(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs, struct hid_device_info **added, struct hid_device_info **removed)
+{
+	struct hid_internal_enumerate_list list = { NULL, NULL };
+
+	if (!devs || !added || !removed) {
+		register_global_error("Invalid parameters for hid_enumerate_diff");
+		return -1;
+	}
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	if (hid_internal_enumerate(vendor_id, product_id, hid_internal_enumerate_append, &list) < 0)
+		return -1;
+
+	return hid_internal_enumerate_merge(list.root, devs, added, removed);
+}
+
+void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
+{
+	struct hid_device_info *d = devs;
+	while (d) {
+		struct hid_device_info *next = d->next;
+		hid_internal_free(d->path);
+		hid_internal_free(d->serial_number);
+		hid_internal_free(d->manufacturer_string);
+		hid_internal_free(d->product_string);
+		hid_internal_free(d);
+		d = next;
+	}
+}
+
+static void hid_internal_invoke_callbacks(struct hid_device_info *info, hid_hotplug_event event)
+{
+	struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs;
+	while (*current) {
+		struct hid_hotplug_callback *callback = *current;
+		if ((callback->events & event) && hid_internal_match_device_id(info->vendor_id, info->product_id,
+																	   callback->vendor_id, callback->product_id)) {
+			int result = callback->callback(callback->handle, info, event, callback->user_data);
+			/* If the result is non-zero, we remove the callback and proceed */
+			/* Do not use the deregister call as it locks the mutex, and we are currently in a lock */
+			if (result) {
+				struct hid_hotplug_callback *callback = *current;
+				*current = (*current)->next;
+				hid_internal_free(callback);
+				continue;
+			}
+		}
+		current = &callback->next;
+	}
+}
+
+/* Must be called with the hotplug mutex locked */
+static void hid_internal_hotplug_device_added(struct udev_device *raw_dev)
+{
+	// We create a list of all usages on this UDEV device
+	struct hid_device_info *info = create_device_info_for_device(raw_dev);
+	struct hid_device_info *info_cur = info;
+	while (info_cur) {
+		/* For each device, call all matching callbacks */
+		/* TODO: possibly make the `next` field NULL to match the behavior on other systems */
+		LOG("hotplug: %s arrived (%04hx:%04hx, interface %d)\n", info_cur->path, info_cur->vendor_id, info_cur->product_id, info_cur->interface_number);
+		hid_internal_invoke_callbacks(info_cur, HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED);
+		info_cur = info_cur->next;
+	}
+
+	/* Append all we got to the end of the device list */
+	if (info) {
+		if (hid_hotplug_context.devs != NULL) {
+			struct hid_device_info *last = hid_hotplug_context.devs;
+			while (last->next != NULL) {
+				last = last->next;
+			}
+			last->next = info;
+		} else {
+			hid_hotplug_context.devs = info;
+		}
+	}
+}
+
+/* Must be called with the hotplug mutex locked */
+static void hid_internal_hotplug_device_removed(const char *devnode)
+{
+	if (!devnode) {
+		return;
+	}
+
+	for (struct hid_device_info **current = &hid_hotplug_context.devs; *current;) {
+		struct hid_device_info* info = *current;
+		if (info->path && !strcmp(devnode, info->path)) {
+			/* If the hidraw node that's left matches this HID device, we detach it from the list */
+			*current = (*current)->next;
+			info->next = NULL;
+			LOG("hotplug: %s left\n", devnode);
+			hid_internal_invoke_callbacks(info, HID_API_HOTPLUG_EVENT_DEVICE_LEFT);
+			/* Free every removed device */
+			hid_free_enumeration(info);
+		} else {
+			current = &info->next;
+		}
+	}
+}
+
+static void hid_internal_hotplug_process_udev_event(void)
+{
+	/* Make the call to receive the device.
+	   select() ensured that this will not block. */
+	struct udev_device *raw_dev = udev_monitor_receive_device(hid_hotplug_context.mon);
+	if (!raw_dev) {
+		return;
+	}
+
+	/* Lock the mutex so callback/device lists don't change elsewhere from here on */
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	/* Events that arrive while no callback is registered are dropped,
+	   the device list is enumerated again on the next registration */
+	if (hid_hotplug_context.hotplug_cbs != NULL) {
+		const char* action = udev_device_get_action(raw_dev);
+		if (!strcmp(action, "add")) {
+			hid_internal_hotplug_device_added(raw_dev);
+		} else if (!strcmp(action, "remove")) {
+			hid_internal_hotplug_device_removed(udev_device_get_devnode(raw_dev));
+		}
+	}
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+	udev_device_unref(raw_dev);
+}
+
+static void hid_internal_hotplug_process_inotify_events(void)
+{
+	union {
+		struct inotify_event event;
+		char buf[4096];
+	} events;
+	ssize_t len;
+
+	len = read(hid_hotplug_context.inotify_fd, events.buf, sizeof(events.buf));
+	if (len <= 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	for (const char *p = events.buf; p < events.buf + len; p += sizeof(struct inotify_event) + ((const struct inotify_event *) p)->len) {
+		const struct inotify_event *event = (const struct inotify_event *) p;
+		char devnode[sizeof("/dev/") + NAME_MAX];
+
+		if (hid_hotplug_context.hotplug_cbs == NULL || !event->len || strncmp(event->name, "hidraw", 6) != 0) {
+			continue;
+		}
+
+		if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+			/* devtmpfs creates the node once the device is registered,
+			   so its sysfs attributes are already available */
+			struct udev_device *raw_dev = udev_device_new_from_subsystem_sysname(hid_hotplug_context.udev_ctx, "hidraw", event->name);
+			if (raw_dev) {
+				hid_internal_hotplug_device_added(raw_dev);
+				udev_device_unref(raw_dev);
+			}
+		} else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			snprintf(devnode, sizeof(devnode), "/dev/%s", event->name);
+			hid_internal_hotplug_device_removed(devnode);
+		}
+	}
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+}
+
+static void* hotplug_thread(void* user_data)
+{
+	(void)user_data;
+
+	/* Cleared by hid_internal_hotplug_exit() from another thread */
+	while (__atomic_load_n(&hid_hotplug_context.thread_running, __ATOMIC_ACQUIRE)) {
+		fd_set fds;
+		struct timeval tv;
+		int ret;
+
+		FD_ZERO(&fds);
+		FD_SET(hid_hotplug_context.monitor_fd, &fds);
+		/* 5 msec timeout seems reasonable; don't set too low to avoid high CPU usage */
+		/* This timeout only affects how much time it takes to stop the thread */
+		tv.tv_sec = 0;
+		tv.tv_usec = 5000;
+
+		ret = select(hid_hotplug_context.monitor_fd+1, &fds, NULL, NULL, &tv);
+
+		/* Check if our file descriptor has received data. */
+		if (ret > 0 && FD_ISSET(hid_hotplug_context.monitor_fd, &fds)) {
+			if (hid_hotplug_context.mon) {
+				hid_internal_hotplug_process_udev_event();
+			} else {
+				hid_internal_hotplug_process_inotify_events();
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Must be called with the hotplug mutex locked */
+static int hid_internal_hotplug_start_thread()
+{
+	// Prepare a UDEV context to run monitoring on
+	if (!hid_hotplug_context.udev_ctx) {
+		hid_hotplug_context.udev_ctx = udev_new();
+		if (!hid_hotplug_context.udev_ctx) {
+			return -1;
+		}
+	}
+
+	if (access("/run/udev/control", F_OK) == 0) {
+		/* udevd is running: get its events, which are sent once the node is ready to use */
+		hid_hotplug_context.mon = udev_monitor_new_from_netlink(hid_hotplug_context.udev_ctx, "udev");
+		if (!hid_hotplug_context.mon) {
+			return -1;
+		}
+		udev_monitor_filter_add_match_subsystem_devtype(hid_hotplug_context.mon, "hidraw", NULL);
+		udev_monitor_enable_receiving(hid_hotplug_context.mon);
+		hid_hotplug_context.monitor_fd = udev_monitor_get_fd(hid_hotplug_context.mon);
+	} else {
+		/* No udevd (e.g. in a container) - nobody would send the "udev" events.
+		   Watch the hidraw nodes created by devtmpfs instead, the device info is read from sysfs. */
+		hid_hotplug_context.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (hid_hotplug_context.inotify_fd < 0) {
+			return -1;
+		}
+		if (inotify_add_watch(hid_hotplug_context.inotify_fd, "/dev", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+			hid_internal_hotplug_close_monitor();
+			return -1;
+		}
+		hid_hotplug_context.monitor_fd = hid_hotplug_context.inotify_fd;
+	}
+
+	/* Start the thread that will be doing the event scanning */
+	__atomic_store_n(&hid_hotplug_context.thread_running, 1, __ATOMIC_RELEASE);
+	if (hid_internal_thread_start(&hid_hotplug_context.thread, &hotplug_thread, NULL) < 0) {
+		__atomic_store_n(&hid_hotplug_context.thread_running, 0, __ATOMIC_RELEASE);
+		/* A retry sets up a new event source */
+		hid_internal_hotplug_close_monitor();
+		return -1;
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short vendor_id, unsigned short product_id, int events, int flags, hid_hotplug_callback_fn callback, void *user_data, hid_hotplug_callback_handle *callback_handle)
+{
+	struct hid_hotplug_callback* hotplug_cb;
+
+	/* Check params */
+	if (events == 0
+		|| (events & ~(HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED | HID_API_HOTPLUG_EVENT_DEVICE_LEFT))
+		|| (flags & ~(HID_API_HOTPLUG_ENUMERATE))
+		|| callback == NULL) {
+		return -1;
+	}
+
+	hotplug_cb = (struct hid_hotplug_callback*)hid_internal_calloc(1, sizeof(struct hid_hotplug_callback));
 
 	if (hotplug_cb == NULL) {
 		return -1;
@@ -1237,245 +1935,1105 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short ven
 	/* Ensure we are ready to actually use the mutex */
 	hid_internal_hotplug_init();
 
-	/* Lock the mutex to avoid race conditions */
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
+	/* Lock the mutex to avoid race conditions */
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	hotplug_cb->handle = hid_hotplug_context.next_handle++;
+
+	/* handle the unlikely case of handle overflow */
+	if (hid_hotplug_context.next_handle < 0)
+	{
+		hid_hotplug_context.next_handle = 1;
+	}
+
+	/* Return allocated handle */
+	if (callback_handle != NULL) {
+		*callback_handle = hotplug_cb->handle;
+	}
+
+	/* Append a new callback to the end */
+	if (hid_hotplug_context.hotplug_cbs != NULL) {
+		struct hid_hotplug_callback *last = hid_hotplug_context.hotplug_cbs;
+		while (last->next != NULL) {
+			last = last->next;
+		}
+		last->next = hotplug_cb;
+	}
+	else {
+		/* The event source and its thread live until hid_exit() */
+		if (!__atomic_load_n(&hid_hotplug_context.thread_running, __ATOMIC_ACQUIRE) && hid_internal_hotplug_start_thread() < 0) {
+			pthread_mutex_unlock(&hid_hotplug_context.mutex);
+			hid_internal_free(hotplug_cb);
+			return -1;
+		}
+
+		/* After monitoring is all set up, enumerate all devices */
+		hid_hotplug_context.devs = hid_enumerate(0, 0);
+
+		/* Don't forget to actually register the callback */
+		hid_hotplug_context.hotplug_cbs = hotplug_cb;
+	}
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+	
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_callback_handle callback_handle)
+{
+	if (!hid_hotplug_context.mutex_ready) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&hid_hotplug_context.mutex);
+
+	if (hid_hotplug_context.hotplug_cbs == NULL) {
+		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+		return -1;
+	}
+
+	int result = -1;
+
+	/* Remove this notification */
+	for (struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs; *current != NULL; current = &(*current)->next) {
+		if ((*current)->handle == callback_handle) {
+			struct hid_hotplug_callback *next = (*current)->next;
+			hid_internal_free(*current);
+			*current = next;
+			result = 0;
+			break;
+		}
+	}
+
+	hid_internal_hotplug_cleanup();
+
+	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+
+	return result;
+}
+
+struct hid_internal_open_data {
+	unsigned short vendor_id;
+	unsigned short product_id;
+	const wchar_t *serial_number;
+	char *path_to_open;
+};
+
+static int HID_API_CALL hid_internal_find_device_to_open(struct hid_device_info *dev, void *user_data)
+{
+	struct hid_internal_open_data *data = (struct hid_internal_open_data *) user_data;
+
+	if (dev->vendor_id != data->vendor_id || dev->product_id != data->product_id)
+		return 0;
+
+	if (data->serial_number && (!dev->serial_number || wcscmp(data->serial_number, dev->serial_number) != 0))
+		return 0;
+
+	data->path_to_open = hid_internal_strdup(dev->path);
+	return 1;
+}
+
+hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+{
+	struct hid_internal_open_data data;
+	hid_device *handle = NULL;
+
+	data.vendor_id = vendor_id;
+	data.product_id = product_id;
+	data.serial_number = serial_number;
+	data.path_to_open = NULL;
+
+	/* Stop at the first match, instead of probing all of the remaining devices */
+	/* register_global_error: global error is reset by hid_enumerate_foreach/hid_init */
+	if (hid_enumerate_foreach(vendor_id, product_id, hid_internal_find_device_to_open, &data) < 0) {
+		/* register_global_error: global error is already set by hid_enumerate_foreach */
+		return NULL;
+	}
+
+	if (data.path_to_open) {
+		/* Open the device */
+		handle = hid_open_path(data.path_to_open);
+	} else {
+		register_global_error("Device with requested VID/PID/(SerialNumber) not found");
+	}
+
+	hid_internal_free(data.path_to_open);
+
+	return handle;
+}
+
+/* Makes the hidraw fd the handle of an initialized dev, name is for the messages.
+   On failure dev is closed, but not fd, and NULL is returned */
+static hid_device *hid_internal_adopt_fd(hid_device *dev, int fd, const char *name)
+{
+	int res, desc_size = 0;
+
+	/* Make sure this is a HIDRAW device - responds to HIDIOCGRDESCSIZE */
+	res = ioctl(fd, HIDIOCGRDESCSIZE, &desc_size);
+	if (res < 0) {
+		int error = errno;
+		LOG("%s: ioctl(GRDESCSIZE) failed: %s\n", name, strerror(error));
+		hid_close(dev);
+		register_global_error_format("ioctl(GRDESCSIZE) error for '%s', not a HIDRAW device?: %s", name, strerror(error));
+		return NULL;
+	}
+
+	dev->interrupt_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (dev->interrupt_fd < 0) {
+		register_global_error_format("Failed to create eventfd for '%s': %s", name, strerror(errno));
+		hid_close(dev);
+		return NULL;
+	}
+
+	dev->device_handle = fd;
+	LOG("%s: opened as fd %d\n", name, fd);
+	return dev;
+}
+
+/* Opens path into an initialized dev. On failure dev is closed and NULL is returned */
+static hid_device *hid_internal_open_path(hid_device *dev, const char *path)
+{
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+
+	if (fd < 0) {
+		/* Unable to open a device. */
+		LOG("%s: open() failed: %s\n", path, strerror(errno));
+		register_global_error_format("Failed to open a device with path '%s': %s", path, strerror(errno));
+		hid_close(dev);
+		return NULL;
+	}
+
+	if (!hid_internal_adopt_fd(dev, fd, path)) {
+		close(fd);
+		return NULL;
+	}
+
+	return dev;
+}
+
+hid_device * HID_API_EXPORT hid_open_path(const char *path)
+{
+	hid_device *dev = NULL;
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	dev = new_hid_device();
+	if (!dev) {
+		register_global_error("Couldn't allocate memory");
+		return NULL;
+	}
+
+	return hid_internal_open_path(dev, path);
+}
+
+hid_device * HID_API_EXPORT hid_open_path_into(const char *path, void *storage, size_t size)
+{
+	hid_device *dev = (hid_device*) storage;
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	if (!storage || size < sizeof(hid_device) || (uintptr_t) storage % sizeof(void *) != 0) {
+		register_global_error("The storage for the device is too small or misaligned");
+		return NULL;
+	}
+
+	init_hid_device(dev);
+	dev->external_storage = 1;
+
+	if (!hid_internal_open_path(dev, path))
+		return NULL;
+
+	/* Build the device information into the rest of the storage now, so that
+	   hid_get_device_info() and the string functions don't allocate it later */
+	if (size >= HID_API_HIDRAW_DEVICE_STORAGE_SIZE + HID_API_HIDRAW_DEVICE_INFO_STORAGE_SIZE) {
+		struct hid_internal_arena arena;
+		struct hid_device_info *info;
+
+		memset(&arena, 0, sizeof(arena));
+		arena.buf = (unsigned char *) storage + sizeof(hid_device);
+		arena.size = size - sizeof(hid_device);
+
+		current_arena = &arena;
+		info = create_device_info_for_hid_device(dev);
+		current_arena = NULL;
+
+		/* Otherwise it is allocated on the first call, as with a smaller storage */
+		if (info && !arena.exhausted) {
+			dev->device_info = info;
+			dev->device_info_in_storage = 1;
+		}
+		register_device_error(dev, NULL);
+	}
+
+	return dev;
+}
+
+hid_device * HID_API_EXPORT hid_hidraw_wrap_fd(int fd)
+{
+	hid_device *dev;
+	char name[32];
+
+	hid_init();
+	/* register_global_error: global error is reset by hid_init */
+
+	if (fd < 0) {
+		register_global_error("hid_hidraw_wrap_fd: invalid file descriptor");
+		return NULL;
+	}
+
+	dev = new_hid_device();
+	if (!dev) {
+		register_global_error("Couldn't allocate memory");
+		return NULL;
+	}
+
+	snprintf(name, sizeof(name), "fd %d", fd);
+	return hid_internal_adopt_fd(dev, fd, name);
+}
+
+
+int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+{
+	int bytes_written;
+
+	if (!data || (length == 0)) {
+		errno = EINVAL;
+		register_device_error(dev, strerror(errno));
+		return -1;
+	}
+
+	bytes_written = write(dev->device_handle, data, length);
+	if (bytes_written == -1)
+		LOG("fd %d: write() of %zu bytes failed: %s\n", dev->device_handle, length, strerror(errno));
+
+	register_device_error(dev, (bytes_written == -1)? strerror(errno): NULL);
+
+	return bytes_written;
+}
+
+int HID_API_EXPORT hid_write_many(struct hid_write_request *requests, size_t count, struct timespec *spread)
+{
+	/* Each write is a single syscall, there is nothing to batch:
+	   just issue them back-to-back and note when the first and the last completed */
+	struct timespec first = { 0, 0 }, last = { 0, 0 };
+	int written = 0;
+	int res = 0;
+	size_t i;
+
+	if (!requests && count > 0) {
+		register_global_error("requests is NULL");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!requests[i].dev) {
+			requests[i].result = -1;
+			res = -1;
+			continue;
+		}
+
+		requests[i].result = hid_write(requests[i].dev, requests[i].data, requests[i].length);
+		if (requests[i].result < 0) {
+			res = -1;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &last);
+		if (!written++)
+			first = last;
+	}
+
+	if (spread) {
+		spread->tv_sec = 0;
+		spread->tv_nsec = 0;
+		if (written > 1) {
+			spread->tv_sec = last.tv_sec - first.tv_sec;
+			spread->tv_nsec = last.tv_nsec - first.tv_nsec;
+			if (spread->tv_nsec < 0) {
+				spread->tv_sec--;
+				spread->tv_nsec += 1000000000L;
+			}
+		}
+	}
+
+	return res;
+}
+
+
+int HID_API_EXPORT hid_set_health_monitor(hid_device *dev, unsigned int expected_interval_us, unsigned int silence_threshold_ms, hid_health_callback_fn callback, void *user_data)
+{
+	if (silence_threshold_ms > 0 && !callback) {
+		register_device_error(dev, "hid_set_health_monitor: callback is NULL");
+		return -1;
+	}
+
+	if (hid_internal_health_set(&dev->health, dev, expected_interval_us, silence_threshold_ms, callback, user_data) < 0) {
+		register_device_error(dev, "hid_set_health_monitor: failed to start the health thread");
+		return -1;
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_get_health_stats(hid_device *dev, struct hid_health_stats *stats)
+{
+	if (!stats) {
+		register_device_error(dev, "hid_get_health_stats: stats is NULL");
+		return -1;
+	}
+	if (!__atomic_load_n(&dev->health.enabled, __ATOMIC_ACQUIRE)) {
+		register_device_error(dev, "hid_get_health_stats: the device is not monitored");
+		return -1;
+	}
+
+	hid_internal_health_stats(&dev->health, stats);
+	return 0;
+}
+
+#ifdef HIDAPI_HID_BPF
+/* The ID of the HID device of dev in HID-BPF: the hexadecimal suffix
+   of its name in sysfs (e.g. 0003:1209:0001.000A), -1 if not found */
+static int hid_internal_bpf_hid_id(hid_device *dev)
+{
+	struct udev *udev;
+	struct udev_device *raw_dev, *hid_dev;
+	struct stat s;
+	const char *name = NULL;
+	int id = -1;
+
+	if (fstat(dev->device_handle, &s) < 0)
+		return -1;
+
+	udev = udev_new();
+	if (!udev)
+		return -1;
+
+	raw_dev = udev_device_new_from_devnum(udev, 'c', s.st_rdev);
+	if (raw_dev) {
+		hid_dev = udev_device_get_parent_with_subsystem_devtype(raw_dev, "hid", NULL);
+		if (hid_dev)
+			name = udev_device_get_sysname(hid_dev);
+		if (name)
+			name = strrchr(name, '.');
+		if (name)
+			id = (int) strtol(name + 1, NULL, 16);
+		udev_device_unref(raw_dev);
+	}
+	udev_unref(udev);
+
+	return id;
+}
+
+static void hid_internal_bpf_filter_detach(hid_device *dev)
+{
+	if (dev->bpf_filter_link) {
+		bpf_link__destroy(dev->bpf_filter_link);
+		dev->bpf_filter_link = NULL;
+	}
+	if (dev->bpf_filter) {
+		bpf_object__close(dev->bpf_filter);
+		dev->bpf_filter = NULL;
+	}
+}
+
+/* Returns 0 once the reports are filtered in the kernel, -1 if HID-BPF can't be
+   used (e.g. before Linux 6.11, or without the privileges to load the program) */
+static int hid_internal_bpf_filter_attach(hid_device *dev, const struct hid_input_filter *filter)
+{
+	struct hid_bpf_filter_config config;
+	struct bpf_map *ops, *config_map;
+	size_t ops_size = 0;
+	int *hid_id;
+	__u32 key = 0;
+	int id;
+
+	id = hid_internal_bpf_hid_id(dev);
+	if (id < 0)
+		return -1;
+
+	dev->bpf_filter = bpf_object__open_mem(hid_input_filter_bpf_object, sizeof(hid_input_filter_bpf_object), NULL);
+	if (!dev->bpf_filter)
+		return -1;
+
+	/* hid_id is the first member of the program's struct hid_bpf_ops */
+	ops = bpf_object__find_map_by_name(dev->bpf_filter, "hid_input_filter_ops");
+	hid_id = ops? (int *) bpf_map__initial_value(ops, &ops_size): NULL;
+	if (!hid_id || ops_size < sizeof(*hid_id))
+		goto fail;
+	*hid_id = id;
+
+	if (bpf_object__load(dev->bpf_filter) < 0) {
+		LOG("hid_set_input_filter: couldn't load the HID-BPF program: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.numbered_reports = filter->numbered_reports? 1: 0;
+	config.ignore_unchanged = filter->ignore_unchanged? 1: 0;
+	config.mask_length = (__u32) filter->mask_length;
+	memcpy(config.report_ids, filter->report_ids, sizeof(config.report_ids));
+	memcpy(config.mask, filter->mask, filter->mask_length);
+
+	config_map = bpf_object__find_map_by_name(dev->bpf_filter, "hid_filter_config");
+	if (!config_map || bpf_map__update_elem(config_map, &key, sizeof(key), &config, sizeof(config), BPF_ANY) < 0)
+		goto fail;
+
+	dev->bpf_filter_link = bpf_map__attach_struct_ops(ops);
+	if (!dev->bpf_filter_link) {
+		LOG("hid_set_input_filter: couldn't attach the HID-BPF program: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	hid_internal_bpf_filter_detach(dev);
+	return -1;
+}
+#endif
+
+int HID_API_EXPORT hid_set_input_filter(hid_device *dev, const struct hid_input_filter *filter)
+{
+	struct hid_input_filter_state *f = NULL, *old;
+	int kernel_filter = 0;
+
+	if (filter) {
+		if (filter->mask_length > HID_API_INPUT_FILTER_MASK_SIZE) {
+			register_device_error(dev, "hid_set_input_filter: mask_length is too large");
+			return -1;
+		}
+
+		f = (struct hid_input_filter_state *) hid_internal_calloc(1, sizeof(*f));
+		if (!f) {
+			register_device_error(dev, "Couldn't allocate memory");
+			return -1;
+		}
+		f->spec = *filter;
+	}
+
+#ifdef HIDAPI_HID_BPF
+	/* The user-space filter below still runs after the kernel one: it trims the
+	   reports, handles the longer ones, and takes over if HID-BPF can't be used */
+	hid_internal_bpf_filter_detach(dev);
+	if (filter && filter->kernel_filter)
+		kernel_filter = (hid_internal_bpf_filter_attach(dev, filter) == 0);
+#endif
+
+	pthread_mutex_lock(&dev->subscriptions_mutex);
+	old = dev->input_filter;
+	__atomic_store_n(&dev->input_filter, f, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&dev->subscriptions_mutex);
+
+	hid_internal_input_filter_free(old);
+	return kernel_filter;
+}
+
+static int hid_internal_read_report(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	/* Set device error to none */
+	register_device_error(dev, NULL);
+
+	int bytes_read;
+	int ret;
+	struct pollfd fds[2];
+
+	/* Timeout is either 0 (non-blocking), > 0 (contains
+	   a valid timeout) or NULL (blocking). In all cases we want to call ppoll()
+	   and wait for data to arrive or for hid_interrupt_read().
+	   Don't rely on non-blocking operation (O_NONBLOCK) since
+	   some kernels don't seem to properly report device disconnection
+	   through read() when in non-blocking mode.  */
+	fds[0].fd = dev->device_handle;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	fds[1].fd = dev->interrupt_fd;
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;
+	ret = ppoll(fds, 2, timeout, NULL);
+	if (ret == 0) {
+		/* Timeout */
+		return ret;
+	}
+	if (ret == -1) {
+		/* Error */
+		register_device_error(dev, strerror(errno));
+		return ret;
+	}
+	else {
+		/* An interruption takes precedence over the available data */
+		if (fds[1].revents & POLLIN) {
+			uint64_t count;
+			/* Reset the eventfd counter; another reader may have already done it */
+			if (read(dev->interrupt_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+				register_device_error(dev, strerror(errno));
+				return -1;
+			}
+			return HID_API_READ_INTERRUPTED;
+		}
+
+		/* Check for errors on the file descriptor. This will
+		   indicate a device disconnection. */
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+			// We cannot use strerror() here as no -1 was returned from ppoll().
+			register_device_error(dev, "hid_read_timeout: unexpected poll error (device disconnected)");
+			LOG("fd %d: disconnected (poll events 0x%x)\n", dev->device_handle, (unsigned) fds[0].revents);
+			__atomic_store_n(&dev->disconnected, 1, __ATOMIC_RELEASE);
+			return -1;
+		}
+	}
+
+	bytes_read = read(dev->device_handle, data, length);
+	if (bytes_read < 0) {
+		if (errno == EAGAIN || errno == EINPROGRESS)
+			bytes_read = 0;
+		else {
+			LOG("fd %d: read() failed: %s\n", dev->device_handle, strerror(errno));
+			register_device_error(dev, strerror(errno));
+		}
+	}
+	else if (bytes_read > 0) {
+		hid_internal_health_report(&dev->health);
+	}
+
+	return bytes_read;
+}
+
+/* timeout: NULL to block, zero for a non-blocking read */
+static int hid_internal_read(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	struct timespec deadline, now, remaining;
+	int res;
+
+	/* The fan-out thread has already applied the filter */
+	if (dev->read_buffer)
+		return hid_internal_read_buffered(dev, data, length, timeout);
+
+	if (!__atomic_load_n(&dev->input_filter, __ATOMIC_ACQUIRE))
+		return hid_internal_read_report(dev, data, length, timeout);
+
+	/* The dropped reports don't count as a result: wait again
+	   for the rest of the timeout */
+	if (timeout) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		remaining = *timeout;
+	}
+
+	for (;;) {
+		size_t filtered;
+
+		res = hid_internal_read_report(dev, data, length, timeout? &remaining: NULL);
+		if (res <= 0)
+			return res;
+
+		/* The same lock as the fan-out thread, which shares the filter state,
+		   and as hid_set_input_filter(), which frees it */
+		pthread_mutex_lock(&dev->subscriptions_mutex);
+		filtered = dev->input_filter? hid_internal_input_filter(dev->input_filter, data, (size_t)res): (size_t)res;
+		pthread_mutex_unlock(&dev->subscriptions_mutex);
+		if (filtered > 0)
+			return (int)filtered;
+
+		if (timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+			remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (remaining.tv_nsec < 0) {
+				remaining.tv_sec--;
+				remaining.tv_nsec += 1000000000L;
+			}
+			if (remaining.tv_sec < 0) {
+				/* Expired, only take the reports that are already there */
+				remaining.tv_sec = 0;
+				remaining.tv_nsec = 0;
+			}
+		}
+	}
+}
+
+int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+{
+	struct timespec timeout;
+
+	if (milliseconds < 0)
+		return hid_internal_read(dev, data, length, NULL);
+
+	timeout.tv_sec = milliseconds / 1000;
+	timeout.tv_nsec = (milliseconds % 1000) * 1000000L;
+	return hid_internal_read(dev, data, length, &timeout);
+}
+
+int HID_API_EXPORT hid_read_timeout_ts(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	if (timeout && (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000L)) {
+		register_device_error(dev, "hid_read_timeout_ts: invalid timeout");
+		return -1;
+	}
+
+	return hid_internal_read(dev, data, length, timeout);
+}
 
-	hotplug_cb->handle = hid_hotplug_context.next_handle++;
+int HID_API_EXPORT hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline)
+{
+	struct timespec now, remaining;
 
-	/* handle the unlikely case of handle overflow */
-	if (hid_hotplug_context.next_handle < 0)
-	{
-		hid_hotplug_context.next_handle = 1;
+	if (!deadline)
+		return hid_internal_read(dev, data, length, NULL);
+
+	/* ppoll() turns the remaining time back into a CLOCK_MONOTONIC deadline,
+	   so only the time between the two clock readings is lost */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining.tv_sec = deadline->tv_sec - now.tv_sec;
+	remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (remaining.tv_nsec < 0) {
+		remaining.tv_sec--;
+		remaining.tv_nsec += 1000000000L;
+	}
+	if (remaining.tv_sec < 0) {
+		/* Already expired, only return a report that is already there */
+		remaining.tv_sec = 0;
+		remaining.tv_nsec = 0;
 	}
 
-	/* Return allocated handle */
-	if (callback_handle != NULL) {
-		*callback_handle = hotplug_cb->handle;
+	return hid_internal_read(dev, data, length, &remaining);
+}
+
+int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
+{
+	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
+}
+
+int HID_API_EXPORT hid_interrupt_read(hid_device *dev)
+{
+	uint64_t one = 1;
+
+	/* The reader is waiting on the ring, not polling interrupt_fd */
+	if (dev->read_buffer) {
+		__atomic_store_n(&dev->read_buffer_interrupted, 1, __ATOMIC_SEQ_CST);
+		hid_internal_subscription_wakeup(dev->read_buffer);
+		return 0;
 	}
 
-	/* Append a new callback to the end */
-	if (hid_hotplug_context.hotplug_cbs != NULL) {
-		struct hid_hotplug_callback *last = hid_hotplug_context.hotplug_cbs;
-		while (last->next != NULL) {
-			last = last->next;
+	if (write(dev->interrupt_fd, &one, sizeof(one)) < 0) {
+		/* EAGAIN means the counter is saturated, i.e. a reader is going to be interrupted anyway */
+		if (errno != EAGAIN) {
+			register_device_error_format(dev, "hid_interrupt_read: %s", strerror(errno));
+			return -1;
 		}
-		last->next = hotplug_cb;
 	}
-	else {
-		// Prepare a UDEV context to run monitoring on
-		hid_hotplug_context.udev_ctx = udev_new();
-		if(!hid_hotplug_context.udev_ctx)
-		{
-			pthread_mutex_unlock(&hid_hotplug_context.mutex);
-			return -1;
+
+	return 0;
+}
+
+/* Reads the device on behalf of all the subscriptions, until fanout_stop_fd is signalled
+   or the device is gone */
+static void *fanout_thread(void *param)
+{
+	hid_device *dev = (hid_device *) param;
+	unsigned char buf[4096];
+	struct pollfd fds[2];
+
+	fds[0].fd = dev->device_handle;
+	fds[0].events = POLLIN;
+	fds[1].fd = dev->fanout_stop_fd;
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		hid_subscription *sub;
+		ssize_t bytes_read;
+		size_t length;
+
+		fds[0].revents = 0;
+		fds[1].revents = 0;
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
 		}
 
-		hid_hotplug_context.mon = udev_monitor_new_from_netlink(hid_hotplug_context.udev_ctx, "udev");
-		udev_monitor_filter_add_match_subsystem_devtype(hid_hotplug_context.mon, "hidraw", NULL);
-		udev_monitor_enable_receiving(hid_hotplug_context.mon);
-		hid_hotplug_context.monitor_fd = udev_monitor_get_fd(hid_hotplug_context.mon);
+		if (fds[1].revents)
+			return NULL;
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
 
-		/* After monitoring is all set up, enumerate all devices */
-		hid_hotplug_context.devs = hid_enumerate(0, 0);
+		bytes_read = read(dev->device_handle, buf, sizeof(buf));
+		if (bytes_read < 0) {
+			if (errno == EAGAIN || errno == EINPROGRESS || errno == EINTR)
+				continue;
+			break;
+		}
+		if (bytes_read == 0)
+			continue;
 
-		/* Don't forget to actually register the callback */
-		hid_hotplug_context.hotplug_cbs = hotplug_cb;
+		hid_internal_health_report(&dev->health);
 
-		/* Start the thread that will be doing the event scanning */
-		pthread_create(&hid_hotplug_context.thread, NULL, &hotplug_thread, NULL);
+		pthread_mutex_lock(&dev->subscriptions_mutex);
+		length = (size_t) bytes_read;
+		if (dev->input_filter)
+			length = hid_internal_input_filter(dev->input_filter, buf, length);
+		if (length > 0) {
+			for (sub = dev->subscriptions; sub; sub = sub->next)
+				hid_internal_subscription_push(sub, buf, length);
+		}
+		pthread_mutex_unlock(&dev->subscriptions_mutex);
 	}
 
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
-	
-	return 0;
+	/* The device is gone */
+	LOG("fd %d: fan-out thread stopped, the device is gone\n", dev->device_handle);
+	/* Without a read buffer, hid_read() may never be called to notice it */
+	__atomic_store_n(&dev->disconnected, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&dev->subscriptions_mutex);
+	dev->fanout_finished = 1;
+	for (hid_subscription *sub = dev->subscriptions; sub; sub = sub->next)
+		hid_internal_subscription_finish(sub);
+	pthread_mutex_unlock(&dev->subscriptions_mutex);
+
+	return NULL;
 }
 
-int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_callback_handle callback_handle)
+/* Called with fanout_mutex held */
+static int hid_internal_fanout_start(hid_device *dev)
 {
-	if (!hid_hotplug_context.mutex_ready) {
+	if (dev->fanout_running)
+		return 0;
+
+	dev->fanout_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (dev->fanout_stop_fd < 0) {
+		register_device_error_format(dev, "hid_subscribe: eventfd: %s", strerror(errno));
 		return -1;
 	}
 
-	pthread_mutex_lock(&hid_hotplug_context.mutex);
-
-	if (hid_hotplug_context.hotplug_cbs == NULL) {
-		pthread_mutex_unlock(&hid_hotplug_context.mutex);
+	dev->fanout_finished = 0;
+	if (hid_internal_thread_start(&dev->fanout_thread, &fanout_thread, dev) < 0) {
+		register_device_error(dev, "hid_subscribe: failed to start the fan-out thread");
+		close(dev->fanout_stop_fd);
+		dev->fanout_stop_fd = -1;
 		return -1;
 	}
 
-	int result = -1;
+	dev->fanout_running = 1;
+	return 0;
+}
 
-	/* Remove this notification */
-	for (struct hid_hotplug_callback **current = &hid_hotplug_context.hotplug_cbs; *current != NULL; current = &(*current)->next) {
-		if ((*current)->handle == callback_handle) {
-			struct hid_hotplug_callback *next = (*current)->next;
-			free(*current);
-			*current = next;
-			result = 0;
-			break;
-		}
-	}
+/* Called with fanout_mutex held */
+static void hid_internal_fanout_stop(hid_device *dev)
+{
+	uint64_t one = 1;
+	ssize_t res;
 
-	hid_internal_hotplug_cleanup();
+	if (!dev->fanout_running)
+		return;
 
-	pthread_mutex_unlock(&hid_hotplug_context.mutex);
+	/* Can't fail: the eventfd is only written once */
+	res = write(dev->fanout_stop_fd, &one, sizeof(one));
+	(void) res;
+	hid_internal_thread_join(&dev->fanout_thread);
 
-	return result;
+	close(dev->fanout_stop_fd);
+	dev->fanout_stop_fd = -1;
+	dev->fanout_running = 0;
 }
 
-hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
+/* hid_subscribe(), and hid_subscribe_dispatch() with a dispatcher */
+static hid_subscription *hid_internal_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_dispatcher *dispatcher, hid_input_callback_fn callback, void *user_data)
 {
-	struct hid_device_info *devs, *cur_dev;
-	const char *path_to_open = NULL;
-	hid_device *handle = NULL;
+	hid_subscription *sub;
+	pthread_condattr_t attr;
 
-	/* register_global_error: global error is reset by hid_enumerate/hid_init */
-	devs = hid_enumerate(vendor_id, product_id);
-	if (devs == NULL) {
-		/* register_global_error: global error is already set by hid_enumerate */
+	if (capacity == 0 || report_length == 0 || capacity >= (size_t) -1 / report_length - 1) {
+		register_device_error(dev, "hid_subscribe: invalid capacity or report length");
+		return NULL;
+	}
+	if (overflow != HID_API_SUBSCRIPTION_DROP_NEWEST && overflow != HID_API_SUBSCRIPTION_DROP_OLDEST) {
+		register_device_error(dev, "hid_subscribe: invalid overflow policy");
 		return NULL;
 	}
 
-	cur_dev = devs;
-	while (cur_dev) {
-		if (cur_dev->vendor_id == vendor_id &&
-		    cur_dev->product_id == product_id) {
-			if (serial_number) {
-				if (wcscmp(serial_number, cur_dev->serial_number) == 0) {
-					path_to_open = cur_dev->path;
-					break;
-				}
-			}
-			else {
-				path_to_open = cur_dev->path;
-				break;
-			}
-		}
-		cur_dev = cur_dev->next;
+	sub = (hid_subscription *) hid_internal_calloc(1, sizeof(*sub));
+	if (!sub) {
+		register_device_error(dev, "hid_subscribe: out of memory");
+		return NULL;
 	}
 
-	if (path_to_open) {
-		/* Open the device */
-		handle = hid_open_path(path_to_open);
-	} else {
-		register_global_error("Device with requested VID/PID/(SerialNumber) not found");
+	sub->dev = dev;
+	sub->overflow = overflow;
+	sub->report_length = report_length;
+	sub->num_slots = capacity + 1;
+	sub->lengths = (size_t *) hid_internal_calloc(sub->num_slots, sizeof(*sub->lengths));
+	sub->reports = (unsigned char *) hid_internal_calloc(sub->num_slots, report_length);
+	if (dispatcher)
+		sub->dispatch_buf = (unsigned char *) hid_internal_malloc(report_length);
+	if (!sub->lengths || !sub->reports || (dispatcher && !sub->dispatch_buf)) {
+		register_device_error(dev, "hid_subscribe: out of memory");
+		hid_internal_free(sub->lengths);
+		hid_internal_free(sub->reports);
+		hid_internal_free(sub->dispatch_buf);
+		hid_internal_free(sub);
+		return NULL;
+	}
+
+	if (dispatcher) {
+		sub->dispatcher = dispatcher;
+		sub->callback = callback;
+		sub->user_data = user_data;
+		hid_dispatch_queue_attach(dispatcher, &sub->dispatch_queue, &hid_internal_subscription_dispatch, sub);
 	}
 
-	hid_free_enumeration(devs);
+	pthread_mutex_init(&sub->wait_state.mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sub->wait_state.cond, &attr);
+	pthread_condattr_destroy(&attr);
 
-	return handle;
+	pthread_mutex_lock(&dev->fanout_mutex);
+
+	pthread_mutex_lock(&dev->subscriptions_mutex);
+	/* The fan-out thread has already stopped if the device is gone */
+	sub->finished = dev->fanout_running && dev->fanout_finished;
+	sub->next = dev->subscriptions;
+	dev->subscriptions = sub;
+	pthread_mutex_unlock(&dev->subscriptions_mutex);
+
+	if (hid_internal_fanout_start(dev) < 0) {
+		pthread_mutex_unlock(&dev->fanout_mutex);
+		hid_unsubscribe(sub);
+		return NULL;
+	}
+
+	/* Already finished: the callback is told right away */
+	if (dispatcher && sub->finished)
+		hid_dispatch_notify(&sub->dispatch_queue);
+
+	pthread_mutex_unlock(&dev->fanout_mutex);
+
+	return sub;
 }
 
-hid_device * HID_API_EXPORT hid_open_path(const char *path)
+hid_subscription * HID_API_EXPORT hid_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow)
 {
-	hid_device *dev = NULL;
-
-	hid_init();
-	/* register_global_error: global error is reset by hid_init */
+	return hid_internal_subscribe(dev, capacity, report_length, overflow, NULL, NULL, NULL);
+}
 
-	dev = new_hid_device();
-	if (!dev) {
-		register_global_error("Couldn't allocate memory");
+hid_subscription * HID_API_EXPORT hid_subscribe_dispatch(hid_dispatcher *dispatcher, hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_input_callback_fn callback, void *user_data)
+{
+	if (!dispatcher || !callback) {
+		register_device_error(dev, "hid_subscribe_dispatch: dispatcher and callback must be set");
 		return NULL;
 	}
 
-	dev->device_handle = open(path, O_RDWR | O_CLOEXEC);
+	return hid_internal_subscribe(dev, capacity, report_length, overflow, dispatcher, callback, user_data);
+}
 
-	if (dev->device_handle >= 0) {
-		int res, desc_size = 0;
+/* Wait for a report of the subscription until the CLOCK_MONOTONIC deadline, or forever if NULL.
+   Returns the length of the report, 0 on timeout, -1 once the stream is over,
+   or HID_API_READ_INTERRUPTED when *interrupted (if not NULL) gets set. */
+static int hid_internal_subscription_wait(hid_subscription *sub, unsigned char *data, size_t length, const struct timespec *deadline, int *interrupted)
+{
+	int res;
 
-		/* Make sure this is a HIDRAW device - responds to HIDIOCGRDESCSIZE */
-		res = ioctl(dev->device_handle, HIDIOCGRDESCSIZE, &desc_size);
-		if (res < 0) {
-			hid_close(dev);
-			register_global_error_format("ioctl(GRDESCSIZE) error for '%s', not a HIDRAW device?: %s", path, strerror(errno));
-			return NULL;
+	pthread_mutex_lock(&sub->wait_state.mutex);
+	__atomic_store_n(&sub->waiting, 1, __ATOMIC_SEQ_CST);
+	for (;;) {
+		/* Checked with waiting set: a report pushed from now on wakes this thread up */
+		if (interrupted && __atomic_exchange_n(interrupted, 0, __ATOMIC_SEQ_CST)) {
+			res = HID_API_READ_INTERRUPTED;
+			break;
+		}
+		res = hid_internal_subscription_pop(sub, data, length);
+		if (res > 0)
+			break;
+		if (__atomic_load_n(&sub->finished, __ATOMIC_SEQ_CST)) {
+			res = -1;
+			break;
 		}
 
-		return dev;
-	}
-	else {
-		/* Unable to open a device. */
-		free(dev);
-		register_global_error_format("Failed to open a device with path '%s': %s", path, strerror(errno));
-		return NULL;
+		if (!deadline) {
+			pthread_cond_wait(&sub->wait_state.cond, &sub->wait_state.mutex);
+		}
+		else if (pthread_cond_timedwait(&sub->wait_state.cond, &sub->wait_state.mutex, deadline) == ETIMEDOUT) {
+			res = hid_internal_subscription_pop(sub, data, length);
+			break;
+		}
 	}
+	__atomic_store_n(&sub->waiting, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&sub->wait_state.mutex);
+
+	return res;
 }
 
+static void hid_internal_deadline_after(struct timespec *deadline, const struct timespec *timeout)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += timeout->tv_sec;
+	deadline->tv_nsec += timeout->tv_nsec;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
 
-int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
+int HID_API_EXPORT hid_subscription_read_timeout(hid_subscription *sub, unsigned char *data, size_t length, int milliseconds)
 {
-	int bytes_written;
+	struct timespec timeout, deadline;
+	int res;
 
-	if (!data || (length == 0)) {
-		errno = EINVAL;
-		register_device_error(dev, strerror(errno));
+	/* The reports of a dispatched subscription are read by its dispatcher */
+	if (!sub || !data || !length || sub->dispatcher)
+		return -1;
+
+	res = hid_internal_subscription_pop(sub, data, length);
+	if (res > 0)
+		return res;
+	if (__atomic_load_n(&sub->finished, __ATOMIC_SEQ_CST))
 		return -1;
+	if (milliseconds == 0)
+		return 0;
+	if (milliseconds < 0)
+		return hid_internal_subscription_wait(sub, data, length, NULL, NULL);
+
+	timeout.tv_sec = milliseconds / 1000;
+	timeout.tv_nsec = (milliseconds % 1000) * 1000000L;
+	hid_internal_deadline_after(&deadline, &timeout);
+	return hid_internal_subscription_wait(sub, data, length, &deadline, NULL);
+}
+
+size_t HID_API_EXPORT hid_subscription_dropped(hid_subscription *sub)
+{
+	if (!sub)
+		return 0;
+
+	return __atomic_load_n(&sub->dropped, __ATOMIC_RELAXED);
+}
+
+void HID_API_EXPORT hid_unsubscribe(hid_subscription *sub)
+{
+	hid_device *dev;
+	hid_subscription **cur;
+
+	if (!sub)
+		return;
+
+	dev = sub->dev;
+
+	pthread_mutex_lock(&dev->fanout_mutex);
+
+	/* Once unlinked, the fan-out thread doesn't see the subscription anymore */
+	pthread_mutex_lock(&dev->subscriptions_mutex);
+	for (cur = &dev->subscriptions; *cur; cur = &(*cur)->next) {
+		if (*cur == sub) {
+			*cur = sub->next;
+			break;
+		}
 	}
+	pthread_mutex_unlock(&dev->subscriptions_mutex);
 
-	bytes_written = write(dev->device_handle, data, length);
+	/* Nobody left to read for */
+	if (!dev->subscriptions)
+		hid_internal_fanout_stop(dev);
 
-	register_device_error(dev, (bytes_written == -1)? strerror(errno): NULL);
+	pthread_mutex_unlock(&dev->fanout_mutex);
 
-	return bytes_written;
+	/* Not notified anymore: wait for the running callback */
+	if (sub->dispatcher)
+		hid_dispatch_queue_detach(&sub->dispatch_queue);
+
+	pthread_cond_destroy(&sub->wait_state.cond);
+	pthread_mutex_destroy(&sub->wait_state.mutex);
+	hid_internal_free(sub->lengths);
+	hid_internal_free(sub->reports);
+	hid_internal_free(sub->dispatch_buf);
+	hid_internal_free(sub);
 }
 
+hid_dispatcher * HID_API_EXPORT hid_dispatcher_create(unsigned int num_threads)
+{
+	hid_dispatcher *dispatcher;
 
-int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
+	if (num_threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = (cpus > 0)? (unsigned int) cpus: 1;
+	}
+
+	dispatcher = hid_dispatcher_new(num_threads);
+	if (!dispatcher)
+		register_global_error("hid_dispatcher_create: failed to start the threads");
+
+	return dispatcher;
+}
+
+void HID_API_EXPORT hid_dispatcher_destroy(hid_dispatcher *dispatcher)
 {
-	/* Set device error to none */
+	if (!dispatcher)
+		return;
+
+	hid_dispatcher_free(dispatcher, dispatcher->num_workers);
+}
+
+int HID_API_EXPORT hid_hidraw_set_read_buffer(hid_device *dev, size_t num_reports, size_t report_length)
+{
+	hid_subscription *old = dev->read_buffer;
+
+	dev->read_buffer = NULL;
+	/* The queued reports go away with the old buffer */
+	hid_unsubscribe(old);
+
+	if (num_reports == 0)
+		return 0;
+
+	/* Keep the latest reports, as the reader is going to catch up anyway */
+	dev->read_buffer = hid_subscribe(dev, num_reports, report_length, HID_API_SUBSCRIPTION_DROP_OLDEST);
+	if (!dev->read_buffer)
+		return -1;
+	__atomic_store_n(&dev->read_buffer_interrupted, 0, __ATOMIC_SEQ_CST);
+
+	return 0;
+}
+
+size_t HID_API_EXPORT hid_hidraw_get_read_overruns(hid_device *dev)
+{
+	return hid_subscription_dropped(dev->read_buffer);
+}
+
+static int hid_internal_read_buffered(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	hid_subscription *sub = dev->read_buffer;
+	struct timespec deadline;
+	int res;
+
 	register_device_error(dev, NULL);
 
-	int bytes_read;
+	/* An interruption takes precedence over the available data */
+	if (__atomic_exchange_n(&dev->read_buffer_interrupted, 0, __ATOMIC_SEQ_CST))
+		return HID_API_READ_INTERRUPTED;
 
-	if (milliseconds >= 0) {
-		/* Milliseconds is either 0 (non-blocking) or > 0 (contains
-		   a valid timeout). In both cases we want to call poll()
-		   and wait for data to arrive.  Don't rely on non-blocking
-		   operation (O_NONBLOCK) since some kernels don't seem to
-		   properly report device disconnection through read() when
-		   in non-blocking mode.  */
-		int ret;
-		struct pollfd fds;
-
-		fds.fd = dev->device_handle;
-		fds.events = POLLIN;
-		fds.revents = 0;
-		ret = poll(&fds, 1, milliseconds);
-		if (ret == 0) {
-			/* Timeout */
-			return ret;
+	res = hid_internal_subscription_pop(sub, data, length);
+	if (res == 0 && !__atomic_load_n(&sub->finished, __ATOMIC_SEQ_CST)) {
+		if (!timeout) {
+			res = hid_internal_subscription_wait(sub, data, length, NULL, &dev->read_buffer_interrupted);
 		}
-		if (ret == -1) {
-			/* Error */
-			register_device_error(dev, strerror(errno));
-			return ret;
-		}
-		else {
-			/* Check for errors on the file descriptor. This will
-			   indicate a device disconnection. */
-			if (fds.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-				// We cannot use strerror() here as no -1 was returned from poll().
-				register_device_error(dev, "hid_read_timeout: unexpected poll error (device disconnected)");
-				return -1;
-			}
+		else if (timeout->tv_sec != 0 || timeout->tv_nsec != 0) {
+			hid_internal_deadline_after(&deadline, timeout);
+			res = hid_internal_subscription_wait(sub, data, length, &deadline, &dev->read_buffer_interrupted);
 		}
 	}
-
-	bytes_read = read(dev->device_handle, data, length);
-	if (bytes_read < 0) {
-		if (errno == EAGAIN || errno == EINPROGRESS)
-			bytes_read = 0;
-		else
-			register_device_error(dev, strerror(errno));
+	else if (res == 0) {
+		res = -1;
 	}
 
-	return bytes_read;
-}
+	if (res == -1) {
+		/* The fan-out thread stopped and the ring is empty */
+		register_device_error(dev, "hid_read_timeout: device disconnected");
+		__atomic_store_n(&dev->disconnected, 1, __ATOMIC_RELEASE);
+	}
 
-int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
-{
-	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
+	return res;
 }
 
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
@@ -1488,12 +3046,27 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0; /* Success */
 }
 
+int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_milliseconds)
+{
+	if (hid_internal_feature_cache_set(&dev->feature_cache, ttl_milliseconds) < 0) {
+		register_device_error(dev, "Couldn't allocate memory");
+		return -1;
+	}
+
+	return 0;
+}
+
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	int res;
 
 	register_device_error(dev, NULL);
 
+	/* The report may change the state reported by the Feature report with the same ID.
+	   A NULL or empty data is left to the ioctl to reject. */
+	if (dev->feature_cache && data && length > 0)
+		hid_internal_feature_cache_invalidate(dev->feature_cache, data[0]);
+
 	res = ioctl(dev->device_handle, HIDIOCSFEATURE(length), data);
 	if (res < 0)
 		register_device_error_format(dev, "ioctl (SFEATURE): %s", strerror(errno));
@@ -1507,9 +3080,25 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 
 	register_device_error(dev, NULL);
 
+	/* The reports of a device that is gone are not served anymore. disconnected is
+	   also set by the fan-out thread, which leaves the cache to the API calls. */
+	if (__atomic_load_n(&dev->disconnected, __ATOMIC_ACQUIRE)) {
+		hid_internal_feature_cache_clear(dev->feature_cache);
+	}
+	else {
+		res = hid_internal_feature_cache_get(dev->feature_cache, data, length);
+		if (res >= 0)
+			return res;
+	}
+
 	res = ioctl(dev->device_handle, HIDIOCGFEATURE(length), data);
-	if (res < 0)
+	if (res < 0) {
 		register_device_error_format(dev, "ioctl (GFEATURE): %s", strerror(errno));
+		hid_internal_feature_cache_clear(dev->feature_cache);
+	}
+	else {
+		hid_internal_feature_cache_put(dev->feature_cache, data, (size_t)res);
+	}
 
 	return res;
 }
@@ -1532,14 +3121,45 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	if (!dev)
 		return;
 
-	close(dev->device_handle);
+	/* No more health callbacks for the device */
+	hid_set_health_monitor(dev, 0, 0, NULL, NULL);
+
+	/* Stops the fan-out thread before the device handle goes away */
+	hid_hidraw_set_read_buffer(dev, 0, 0);
+	while (dev->subscriptions)
+		hid_unsubscribe(dev->subscriptions);
+
+	if (dev->device_handle >= 0)
+		close(dev->device_handle);
+	if (dev->interrupt_fd >= 0)
+		close(dev->interrupt_fd);
+
+	hid_set_feature_report_cache(dev, 0);
+	hid_set_input_filter(dev, NULL);
 
 	/* Free the device error message */
 	register_device_error(dev, NULL);
 
-	hid_free_enumeration(dev->device_info);
+	if (!dev->device_info_in_storage)
+		hid_free_enumeration(dev->device_info);
+
+	pthread_mutex_destroy(&dev->subscriptions_mutex);
+	pthread_mutex_destroy(&dev->fanout_mutex);
+
+	if (!dev->external_storage)
+		hid_internal_free(dev);
+}
+
+void HID_API_EXPORT hid_close_many(hid_device **devs, size_t count)
+{
+	/* Closing a device is cheap on this backend, nothing to gain from doing it in parallel */
+	size_t i;
+
+	if (!devs)
+		return;
 
-	free(dev);
+	for (i = 0; i < count; i++)
+		hid_close(devs[i]);
 }
 
 
@@ -1661,12 +3281,23 @@ int HID_API_EXPORT_CALL hid_get_report_descriptor(hid_device *dev, unsigned char
 HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 {
 	if (dev) {
-		if (dev->last_error_str == NULL)
+		if (dev->last_error.str == NULL)
 			return L"Success";
-		return dev->last_error_str;
+		return dev->last_error.str;
 	}
 
-	if (last_global_error_str == NULL)
+	if (last_global_error.str == NULL)
 		return L"Success";
-	return last_global_error_str;
+	return last_global_error.str;
+}
+
+int HID_API_EXPORT hid_debug_log_enable(int enable)
+{
+	__atomic_store_n(&hid_debug_log_enabled, enable? 1: 0, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int HID_API_EXPORT hid_debug_log_read(char *buffer, size_t size)
+{
+	return hid_debug_log_read_records(buffer, size);
 }
@@ -0,0 +1,137 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * HID-BPF side of hid_set_input_filter(), built with HIDAPI_WITH_HID_BPF
+ * and embedded in the hidraw backend, which loads it for a device when
+ * hid_input_filter::kernel_filter is set.
+ *
+ * Attached to the HID device through the hid_bpf_ops struct_ops (Linux 6.11
+ * and newer), it drops the Input reports that the user-space filter would
+ * drop, before they reach hidraw and wake up its readers. Trimming is left
+ * to user space, so that the other users of the device see whole reports.
+ */
+
+#include <linux/types.h>
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+
+#include "hid_input_filter_bpf.h"
+
+/* Members used here of the kernel's struct hid_bpf_ctx (include/linux/hid_bpf.h),
+   relocated against the kernel's BTF */
+struct hid_device;
+struct hid_bpf_ctx {
+	struct hid_device *hid;
+	__u32 allocated_size;
+	union {
+		__s32 retval;
+		__s32 size;
+	};
+} __attribute__((preserve_access_index));
+
+/* Members used here of the kernel's struct hid_bpf_ops, matched by name by libbpf.
+   hid.c sets hid_id, which has to stay the first member. */
+struct hid_bpf_ops {
+	int hid_id;
+	int (*hid_device_event)(struct hid_bpf_ctx *ctx, int report_type, __u64 source);
+};
+
+/* enum hid_report_type */
+#define HID_INPUT_REPORT 0
+
+extern __u8 *hid_bpf_get_data(struct hid_bpf_ctx *ctx, unsigned int offset, const __u64 size) __ksym;
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct hid_bpf_filter_config);
+} hid_filter_config SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 256);
+	__type(key, __u32);
+	__type(value, struct hid_bpf_filter_last);
+} hid_filter_last SEC(".maps");
+
+/* Returns 0 to deliver the report as it is, a negative value to drop it */
+SEC("struct_ops/hid_device_event")
+int hid_input_filter_event(unsigned long long *ctx)
+{
+	struct hid_bpf_ctx *hctx = (struct hid_bpf_ctx *) ctx[0];
+	struct hid_bpf_filter_config *config;
+	struct hid_bpf_filter_last *last;
+	__u32 key = 0, id = 0, size, i;
+	int changed;
+	__u8 *data;
+
+	if ((int) ctx[1] != HID_INPUT_REPORT)
+		return 0;
+
+	config = bpf_map_lookup_elem(&hid_filter_config, &key);
+	if (!config)
+		return 0;
+
+	size = (__u32) hctx->size;
+	data = hid_bpf_get_data(hctx, 0, HID_BPF_FILTER_REPORT_SIZE);
+	if (!data || size == 0)
+		return 0;
+
+	if (config->numbered_reports) {
+		id = data[0];
+		if (!(config->report_ids[(id / 8) & 31] & (1 << (id % 8))))
+			return -1;
+	}
+
+	if (!config->ignore_unchanged)
+		return 0;
+
+	last = bpf_map_lookup_elem(&hid_filter_last, &id);
+	if (!last)
+		return 0;
+
+	if (size > HID_BPF_FILTER_REPORT_SIZE) {
+		/* Compared in user space, the next short report counts as changed */
+		last->length = 0;
+		return 0;
+	}
+
+	changed = (last->length != size);
+	for (i = 0; i < HID_BPF_FILTER_REPORT_SIZE && i < size && !changed; i++) {
+		__u8 mask = (i < config->mask_length)? config->mask[i]: 0xFF;
+		changed = ((data[i] ^ last->data[i]) & mask) != 0;
+	}
+	if (!changed)
+		return -1;
+
+	for (i = 0; i < HID_BPF_FILTER_REPORT_SIZE; i++)
+		last->data[i] = data[i];
+	last->length = size;
+
+	return 0;
+}
+
+SEC(".struct_ops.link")
+struct hid_bpf_ops hid_input_filter_ops = {
+	.hid_device_event = (void *) hid_input_filter_event,
+};
+
+char _license[] SEC("license") = "Dual BSD/GPL";
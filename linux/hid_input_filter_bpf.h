@@ -0,0 +1,50 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Layout of the maps of the HID-BPF input filter (internal, not installed).
+ *
+ * Included by hid.c and by the BPF program hid_input_filter.bpf.c,
+ * built with HIDAPI_WITH_HID_BPF. Uses the types of <linux/types.h>.
+ */
+
+#ifndef HID_INPUT_FILTER_BPF_H__
+#define HID_INPUT_FILTER_BPF_H__
+
+/* Bytes of a report seen by the BPF program: the longer reports
+   are compared by the user-space filter only */
+#define HID_BPF_FILTER_REPORT_SIZE 64
+
+/* The single entry of the hid_filter_config map, from struct hid_input_filter */
+struct hid_bpf_filter_config {
+	__u32 numbered_reports;
+	__u32 ignore_unchanged;
+	__u32 mask_length;
+	__u8 report_ids[32];
+	__u8 mask[HID_BPF_FILTER_REPORT_SIZE];
+};
+
+/* The entries of the hid_filter_last map, the last delivered report per Report ID */
+struct hid_bpf_filter_last {
+	/* 0 if there is none */
+	__u32 length;
+	__u8 data[HID_BPF_FILTER_REPORT_SIZE];
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/** @file
+ * @defgroup API hidapi API
+ */
+
+#ifndef HIDAPI_HIDRAW_H__
+#define HIDAPI_HIDRAW_H__
+
+#include <stddef.h>
+
+#include "hidapi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+		/** @brief Size of the storage required by hid_open_path_into().
+
+			@ingroup API
+		*/
+		#define HID_API_HIDRAW_DEVICE_STORAGE_SIZE 1024
+
+		/** @brief Additional storage for hid_open_path_into() to build the
+			device information into, see hid_open_path_into().
+
+			@ingroup API
+		*/
+		#define HID_API_HIDRAW_DEVICE_INFO_STORAGE_SIZE 1024
+
+		/** @brief Open a HID device by its path name, using caller-provided storage
+			for the #hid_device object.
+
+			Same as hid_open_path(), but the device object lives in @p storage
+			instead of being allocated. hid_close() closes the device and
+			leaves the storage to the caller, who may reuse it afterwards.
+
+			With a @p size of at least #HID_API_HIDRAW_DEVICE_STORAGE_SIZE +
+			#HID_API_HIDRAW_DEVICE_INFO_STORAGE_SIZE, the device information
+			returned by hid_get_device_info() (and used by the hid_get_*_string()
+			functions) is built into the rest of @p storage when the device is
+			opened. Otherwise, or if it doesn't fit (e.g. with very long strings),
+			it is allocated on the first call of these functions.
+
+			@note When the library is built with `HIDAPI_NO_HEAP`, the error messages
+				are stored in fixed buffers (and truncated if needed), so reading, writing
+				and the other I/O functions don't allocate memory with such a device.
+				With the additional storage above, neither do hid_get_device_info() and
+				the hid_get_*_string() functions; libudev still allocates memory
+				of its own while the device information is built.
+
+			@ingroup API
+			@param path The path name of the device to open.
+			@param storage Storage for the device object, aligned at least as a pointer.
+				It must stay valid until hid_close() is called.
+			@param size The size of @p storage, at least #HID_API_HIDRAW_DEVICE_STORAGE_SIZE
+				(+ #HID_API_HIDRAW_DEVICE_INFO_STORAGE_SIZE for the device information).
+
+			@returns
+				This function returns a pointer to a #hid_device object (placed at @p storage) on
+				success or NULL on failure.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		HID_API_EXPORT hid_device * HID_API_CALL hid_open_path_into(const char *path, void *storage, size_t size);
+
+		/** @brief Open a HID device from an already open hidraw file descriptor.
+
+			Same as hid_open_path(), without resolving or opening any path:
+			for a process that receives the file descriptors of its devices
+			from a more privileged one (e.g. over a UNIX socket with
+			SCM_RIGHTS), or for a hidraw node opened beforehand.
+			Only the HIDIOCGRDESCSIZE ioctl is made, to check that @p fd
+			is a hidraw device.
+
+			The device takes ownership of @p fd, which is closed by hid_close().
+			On failure @p fd is left open.
+
+			hid_get_device_info() and the hid_get_*_string() functions still
+			look the device up in udev by the device number of @p fd,
+			on their first call.
+
+			@ingroup API
+			@param fd A file descriptor of a hidraw node (/dev/hidrawN),
+				opened for reading and writing.
+
+			@returns
+				This function returns a pointer to a #hid_device object on
+				success or NULL on failure.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		HID_API_EXPORT hid_device * HID_API_CALL hid_hidraw_wrap_fd(int fd);
+
+		/** @brief Enumerate the HID Devices into caller-provided storage.
+
+			Same as hid_enumerate(), but the hid_device_info structures and their strings
+			are placed in @p storage instead of being allocated.
+			The list must not be freed with hid_free_enumeration(), it stays valid as long as
+			@p storage does.
+
+			Each device takes roughly 200 to 500 bytes, depending on the length of its path
+			and strings, and once more for each additional top-level usage.
+
+			@note libudev still allocates memory internally during the enumeration.
+
+			@ingroup API
+			@param vendor_id The Vendor ID (VID) of the types of device to open,
+				0 to match any vendor.
+			@param product_id The Product ID (PID) of the types of device to open,
+				0 to match any product.
+			@param storage Storage for the enumeration results.
+			@param size The size of @p storage.
+			@param devs Set to the list of the enumerated devices, NULL if none.
+				If @p storage is too small, contains the devices that fit.
+
+			@returns
+				This function returns the number of entries in @p devs on success, or -1 on error,
+				including when @p storage is too small for all the devices.
+				Call hid_error(NULL) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_enumerate_into(unsigned short vendor_id, unsigned short product_id, void *storage, size_t size, struct hid_device_info **devs);
+
+		/** @brief Drain the Input reports of a device into a user-space ring.
+
+			The kernel only queues a few dozen reports per hidraw reader and
+			silently drops the next ones, e.g. while the reading thread
+			is paused. With a read buffer, a background thread (the one of
+			hid_subscribe()) reads the reports as soon as they arrive into a
+			preallocated ring of @p num_reports reports, and hid_read() and friends
+			(including hid_interrupt_read()) are served from the ring.
+			hid_subscribe() can then be used along with hid_read().
+
+			When the ring is full, the oldest report is dropped and counted
+			by hid_hidraw_get_read_overruns(). The reports dropped by the
+			kernel before the thread reads them can't be detected.
+
+			Must not be called while another thread is in hid_read() on @p dev.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+			@param num_reports The number of reports the ring can hold,
+				0 to read the device directly again. The queued reports
+				are discarded when the buffer is replaced or removed.
+			@param report_length The maximum length of a report,
+				longer reports are truncated.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+				Call hid_error(dev) to get the failure reason.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hidraw_set_read_buffer(hid_device *dev, size_t num_reports, size_t report_length);
+
+		/** @brief Get the number of reports the read buffer dropped because it was full.
+
+			@ingroup API
+			@param dev A device handle returned from hid_open().
+
+			@returns
+				The number of reports dropped since hid_hidraw_set_read_buffer(),
+				0 if the device has no read buffer.
+		*/
+		size_t HID_API_EXPORT HID_API_CALL hid_hidraw_get_read_overruns(hid_device *dev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
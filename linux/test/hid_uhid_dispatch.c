@@ -0,0 +1,392 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Scaling benchmark of hid_dispatcher_create() on the hidraw backend,
+ * with virtual devices created through /dev/uhid.
+ *
+ * Every device sends the same number of reports, each handled by a callback
+ * spinning for a fixed time, with 1, 2, 4, ... threads in the dispatcher.
+ * The reports of each device must reach its callback in order and
+ * never in two callbacks at once. The throughput and the speedup over
+ * a single thread are printed for each pass. Reports are 9 bytes long:
+ *   byte 0      - Report ID (1)
+ *   bytes 1..4  - sequence number (little endian)
+ *   bytes 5..8  - 0
+ *
+ * Usage: hid_uhid_dispatch [-d devices] [-n count] [-w usec] [-t threads] [-u usec]
+ *   -d <devices>   Number of virtual devices
+ *   -n <count>     Number of reports per device and per pass
+ *   -w <usec>      Work of the callback for each report
+ *   -t <threads>   Largest number of threads, default: the online CPUs
+ *   -u <usec>      Pause between reports, so that the hidraw queues don't overflow
+ *
+ * Exit code is 0 on success, 1 on failure and 77 when /dev/uhid
+ * can't be used (e.g. not root, or no uhid module).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <wchar.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <linux/uhid.h>
+
+#include <hidapi.h>
+
+#define SKIP 77
+#define VENDOR_ID 0x1209
+#define PRODUCT_ID 0x0002
+#define REPORT_LENGTH 9
+#define MAX_DEVICES 32
+
+static const unsigned char descriptor[] = {
+	0x06, 0x00, 0xFF, /* Usage Page (Vendor) */
+	0x09, 0x01,       /* Usage (1) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x26, 0xFF, 0x00, /*   Logical Maximum (255) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x95, 0x08,       /*   Report Count (8) */
+	0x85, 0x01,       /*   Report ID (1) */
+	0x09, 0x10,       /*   Usage (0x10) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0xC0              /* End Collection */
+};
+
+struct virtual_device {
+	int uhid_fd;
+	hid_device *dev;
+
+	/* Reports expected in the pass */
+	unsigned long count;
+
+	/* Written by the callbacks only */
+	unsigned long next_seq;
+	long out_of_order;
+	int busy;
+	long overlapping;
+	/* Time of the last report of the pass */
+	double finished_at;
+};
+
+struct feeder {
+	struct virtual_device *device;
+	long count;
+	long pause_usec;
+};
+
+static long work_usec = 100;
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+	ssize_t res;
+
+	do {
+		res = write(fd, ev, sizeof(*ev));
+	} while (res < 0 && errno == EINTR);
+
+	return (res == (ssize_t)sizeof(*ev))? 0: -1;
+}
+
+static void *feeder_thread(void *param)
+{
+	struct feeder *f = (struct feeder *) param;
+	struct uhid_event ev;
+	long seq;
+
+	for (seq = 0; seq < f->count; seq++) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_INPUT2;
+		ev.u.input2.size = REPORT_LENGTH;
+		ev.u.input2.data[0] = 1;
+		ev.u.input2.data[1] = (unsigned char)seq;
+		ev.u.input2.data[2] = (unsigned char)(seq >> 8);
+		ev.u.input2.data[3] = (unsigned char)(seq >> 16);
+		ev.u.input2.data[4] = (unsigned char)(seq >> 24);
+
+		if (uhid_write(f->device->uhid_fd, &ev) < 0) {
+			fprintf(stderr, "UHID_INPUT2 failed: %s\n", strerror(errno));
+			break;
+		}
+		if (f->pause_usec > 0)
+			usleep((useconds_t)f->pause_usec);
+	}
+
+	return NULL;
+}
+
+static void device_name(int index, char *name, size_t size)
+{
+	snprintf(name, size, "hidapi uhid dispatch test %d", index);
+}
+
+static int uhid_create(int fd, int index)
+{
+	struct uhid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	device_name(index, (char *) ev.u.create2.name, sizeof(ev.u.create2.name));
+	memcpy(ev.u.create2.rd_data, descriptor, sizeof(descriptor));
+	ev.u.create2.rd_size = sizeof(descriptor);
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = VENDOR_ID;
+	ev.u.create2.product = PRODUCT_ID;
+
+	return uhid_write(fd, &ev);
+}
+
+/* The hidraw node shows up asynchronously after UHID_CREATE2 */
+static hid_device *open_virtual_device(int index)
+{
+	char name[64];
+	wchar_t wname[64];
+	int tries;
+
+	device_name(index, name, sizeof(name));
+	swprintf(wname, sizeof(wname) / sizeof(wname[0]), L"%s", name);
+
+	for (tries = 0; tries < 100; tries++) {
+		struct hid_device_info *devs = hid_enumerate(VENDOR_ID, PRODUCT_ID), *cur;
+		hid_device *dev = NULL;
+
+		for (cur = devs; cur; cur = cur->next) {
+			if (cur->product_string && !wcscmp(cur->product_string, wname)) {
+				dev = hid_open_path(cur->path);
+				break;
+			}
+		}
+		hid_free_enumeration(devs);
+		if (dev)
+			return dev;
+
+		usleep(20000);
+	}
+
+	return NULL;
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void HID_API_CALL report_callback(hid_device *dev, const unsigned char *data, size_t length, void *user_data)
+{
+	struct virtual_device *device = (struct virtual_device *) user_data;
+	unsigned long seq;
+	double end;
+
+	(void) dev;
+	if (!data || length < 5)
+		return;
+
+	if (__atomic_exchange_n(&device->busy, 1, __ATOMIC_ACQ_REL))
+		device->overlapping++;
+
+	seq = (unsigned long)data[1] | (unsigned long)data[2] << 8 | (unsigned long)data[3] << 16 | (unsigned long)data[4] << 24;
+	if (seq != device->next_seq)
+		device->out_of_order++;
+
+	/* The work of the application */
+	end = now_seconds() + (double)work_usec / 1e6;
+	while (now_seconds() < end)
+		;
+
+	if (seq + 1 == device->count)
+		device->finished_at = end;
+	__atomic_store_n(&device->busy, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&device->next_seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns the reports per second, or a negative value on failure */
+static double run_pass(struct virtual_device *devices, int num_devices, unsigned int num_threads, long count, long pause_usec)
+{
+	hid_dispatcher *dispatcher;
+	hid_subscription *subs[MAX_DEVICES];
+	struct feeder feeders[MAX_DEVICES];
+	pthread_t threads[MAX_DEVICES];
+	double start, seconds = 0;
+	long received = 0, out_of_order = 0, overlapping = 0;
+	int i, done;
+
+	dispatcher = hid_dispatcher_create(num_threads);
+	if (!dispatcher) {
+		fprintf(stderr, "hid_dispatcher_create failed: %ls\n", hid_error(NULL));
+		return -1;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		devices[i].count = (unsigned long)count;
+		devices[i].next_seq = 0;
+		devices[i].out_of_order = 0;
+		devices[i].overlapping = 0;
+		devices[i].finished_at = 0;
+		subs[i] = hid_subscribe_dispatch(dispatcher, devices[i].dev, (size_t)count, REPORT_LENGTH, HID_API_SUBSCRIPTION_DROP_NEWEST, report_callback, &devices[i]);
+		if (!subs[i]) {
+			fprintf(stderr, "hid_subscribe_dispatch failed: %ls\n", hid_error(devices[i].dev));
+			while (i-- > 0)
+				hid_unsubscribe(subs[i]);
+			hid_dispatcher_destroy(dispatcher);
+			return -1;
+		}
+	}
+
+	start = now_seconds();
+	for (i = 0; i < num_devices; i++) {
+		feeders[i].device = &devices[i];
+		feeders[i].count = count;
+		feeders[i].pause_usec = pause_usec;
+		pthread_create(&threads[i], NULL, feeder_thread, &feeders[i]);
+	}
+	for (i = 0; i < num_devices; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Wait for the callbacks, as long as they make progress */
+	do {
+		long before = received;
+
+		usleep(100000);
+		received = 0;
+		done = 1;
+		for (i = 0; i < num_devices; i++) {
+			unsigned long seq = __atomic_load_n(&devices[i].next_seq, __ATOMIC_ACQUIRE);
+			received += (long)seq;
+			if (seq < (unsigned long)count)
+				done = 0;
+		}
+		if (!done && received == before)
+			break;
+	} while (!done);
+
+	for (i = 0; i < num_devices; i++) {
+		hid_unsubscribe(subs[i]);
+		out_of_order += devices[i].out_of_order;
+		overlapping += devices[i].overlapping;
+		if (devices[i].finished_at - start > seconds)
+			seconds = devices[i].finished_at - start;
+	}
+	hid_dispatcher_destroy(dispatcher);
+
+	if (!done || out_of_order > 0 || overlapping > 0) {
+		fprintf(stderr, "%u threads: %ld of %ld reports, %ld out of order, %ld overlapping callbacks\n",
+			num_threads, received, count * num_devices, out_of_order, overlapping);
+		return -1;
+	}
+
+	return (double)received / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+	struct virtual_device devices[MAX_DEVICES];
+	struct uhid_event ev;
+	long count = 2000, pause_usec = 50;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int max_threads = (cpus > 0)? (unsigned int)cpus: 1, num_threads;
+	double single = 0;
+	int num_devices = 8, opt, i, result = 0;
+
+	while ((opt = getopt(argc, argv, "d:n:w:t:u:")) != -1) {
+		switch (opt) {
+		case 'd': num_devices = (int)strtol(optarg, NULL, 0); break;
+		case 'n': count = strtol(optarg, NULL, 0); break;
+		case 'w': work_usec = strtol(optarg, NULL, 0); break;
+		case 't': max_threads = (unsigned int)strtoul(optarg, NULL, 0); break;
+		case 'u': pause_usec = strtol(optarg, NULL, 0); break;
+		default: return 1;
+		}
+	}
+	if (num_devices < 1 || num_devices > MAX_DEVICES || count < 1 || max_threads < 1) {
+		fprintf(stderr, "invalid arguments\n");
+		return 1;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		devices[i].dev = NULL;
+		devices[i].busy = 0;
+		devices[i].uhid_fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+		if (devices[i].uhid_fd < 0 || uhid_create(devices[i].uhid_fd, i) < 0) {
+			fprintf(stderr, "can't create a device through /dev/uhid: %s\n", strerror(errno));
+			while (i >= 0) {
+				if (devices[i].uhid_fd >= 0)
+					close(devices[i].uhid_fd);
+				i--;
+			}
+			return SKIP;
+		}
+	}
+
+	if (hid_init() < 0)
+		return 1;
+
+	for (i = 0; i < num_devices && result == 0; i++) {
+		devices[i].dev = open_virtual_device(i);
+		if (!devices[i].dev) {
+			fprintf(stderr, "can't open virtual device %d\n", i);
+			result = 1;
+		}
+	}
+
+	for (num_threads = 1; result == 0; num_threads *= 2) {
+		double rate;
+
+		if (num_threads > max_threads)
+			num_threads = max_threads;
+
+		rate = run_pass(devices, num_devices, num_threads, count, pause_usec);
+		if (rate < 0) {
+			result = 1;
+			break;
+		}
+		if (num_threads == 1)
+			single = rate;
+		printf("%2u threads: %.0f reports/s, speedup %.2f\n", num_threads, rate, rate / single);
+
+		if (num_threads == max_threads)
+			break;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		if (devices[i].dev)
+			hid_close(devices[i].dev);
+	}
+	hid_exit();
+
+	for (i = 0; i < num_devices; i++) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_DESTROY;
+		uhid_write(devices[i].uhid_fd, &ev);
+		close(devices[i].uhid_fd);
+	}
+
+	return result;
+}
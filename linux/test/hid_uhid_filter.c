@@ -0,0 +1,378 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * End-to-end test of hid_set_input_filter() on the hidraw backend,
+ * with a virtual device created through /dev/uhid.
+ *
+ * The device sends the same stream three times, read without a filter,
+ * with a filter keeping the changed reports of Report ID 1 only, trimmed
+ * to 6 bytes, and with the same filter also run in the kernel with HID-BPF
+ * (hid_input_filter::kernel_filter). Reports are 9 bytes long:
+ *   byte 0      - Report ID: 2 for every 8th report, 1 otherwise
+ *   bytes 1..4  - sequence number (little endian), masked by the filter
+ *   byte 5      - state, changes every 4th report
+ *   bytes 6..8  - 0
+ *
+ * The CPU time and the wakeups (voluntary context switches) of the reading
+ * thread are printed for each pass. When the kernel filter is attached, its
+ * pass must wake up the reader less than the user-space filter, which sees
+ * every report; otherwise the pass is skipped. The device is opened from its
+ * hidraw file descriptor with hid_hidraw_wrap_fd().
+ *
+ * Usage: hid_uhid_filter [-n count] [-u usec]
+ *   -n <count>     Number of reports per pass
+ *   -u <usec>      Pause between reports, so that the hidraw queue doesn't overflow
+ *
+ * Exit code is 0 on success, 1 on failure and 77 when /dev/uhid
+ * can't be used (e.g. not root, or no uhid module).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <wchar.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <linux/uhid.h>
+
+#include <hidapi.h>
+#include <hidapi_hidraw.h>
+
+#define SKIP 77
+#define VENDOR_ID 0x1209
+#define PRODUCT_ID 0x0001
+#define REPORT_LENGTH 9
+
+static const unsigned char descriptor[] = {
+	0x06, 0x00, 0xFF, /* Usage Page (Vendor) */
+	0x09, 0x01,       /* Usage (1) */
+	0xA1, 0x01,       /* Collection (Application) */
+	0x15, 0x00,       /*   Logical Minimum (0) */
+	0x26, 0xFF, 0x00, /*   Logical Maximum (255) */
+	0x75, 0x08,       /*   Report Size (8) */
+	0x95, 0x08,       /*   Report Count (8) */
+	0x85, 0x01,       /*   Report ID (1) */
+	0x09, 0x10,       /*   Usage (0x10) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0x85, 0x02,       /*   Report ID (2) */
+	0x09, 0x11,       /*   Usage (0x11) */
+	0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+	0xC0              /* End Collection */
+};
+
+struct feeder {
+	int uhid_fd;
+	long count;
+	long pause_usec;
+};
+
+struct pass {
+	long received;
+	long bad;
+	double cpu_ms;
+	long wakeups;
+	double seconds;
+};
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+	ssize_t res;
+
+	do {
+		res = write(fd, ev, sizeof(*ev));
+	} while (res < 0 && errno == EINTR);
+
+	return (res == (ssize_t)sizeof(*ev))? 0: -1;
+}
+
+static void make_report(long seq, unsigned char *report)
+{
+	memset(report, 0, REPORT_LENGTH);
+	report[0] = (seq % 8 == 7)? 2: 1;
+	report[1] = (unsigned char)seq;
+	report[2] = (unsigned char)(seq >> 8);
+	report[3] = (unsigned char)(seq >> 16);
+	report[4] = (unsigned char)(seq >> 24);
+	report[5] = (unsigned char)(seq / 4);
+}
+
+static void *feeder_thread(void *param)
+{
+	struct feeder *f = (struct feeder *) param;
+	struct uhid_event ev;
+	long seq;
+
+	for (seq = 0; seq < f->count; seq++) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_INPUT2;
+		ev.u.input2.size = REPORT_LENGTH;
+		make_report(seq, ev.u.input2.data);
+
+		if (uhid_write(f->uhid_fd, &ev) < 0) {
+			fprintf(stderr, "UHID_INPUT2 failed: %s\n", strerror(errno));
+			break;
+		}
+		if (f->pause_usec > 0)
+			usleep((useconds_t)f->pause_usec);
+	}
+
+	return NULL;
+}
+
+static int uhid_create(int fd)
+{
+	struct uhid_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	strcpy((char *) ev.u.create2.name, "hidapi uhid filter test");
+	memcpy(ev.u.create2.rd_data, descriptor, sizeof(descriptor));
+	ev.u.create2.rd_size = sizeof(descriptor);
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = VENDOR_ID;
+	ev.u.create2.product = PRODUCT_ID;
+
+	return uhid_write(fd, &ev);
+}
+
+/* The hidraw node shows up asynchronously after UHID_CREATE2 */
+static hid_device *open_virtual_device(void)
+{
+	int tries;
+
+	for (tries = 0; tries < 100; tries++) {
+		struct hid_device_info *devs = hid_enumerate(VENDOR_ID, PRODUCT_ID), *cur;
+		hid_device *dev = NULL;
+
+		for (cur = devs; cur; cur = cur->next) {
+			if (cur->product_string && !wcscmp(cur->product_string, L"hidapi uhid filter test")) {
+				/* As a sandboxed process given the hidraw node by a broker would */
+				int fd = open(cur->path, O_RDWR | O_CLOEXEC);
+				if (fd >= 0) {
+					dev = hid_hidraw_wrap_fd(fd);
+					if (!dev)
+						close(fd);
+				}
+				break;
+			}
+		}
+		hid_free_enumeration(devs);
+		if (dev)
+			return dev;
+
+		usleep(20000);
+	}
+
+	return NULL;
+}
+
+static double thread_cpu_ms(long *wakeups)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_THREAD, &usage);
+	/* The reader switches out voluntarily when it waits for a report */
+	*wakeups = usage.ru_nvcsw;
+	return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0
+		+ (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+/* Feed the stream and read it. With a filter, check every delivered report against it. */
+static void run_pass(hid_device *dev, struct feeder *feeder, int filtered, struct pass *p)
+{
+	unsigned char buf[64];
+	unsigned char last_state = 0;
+	int have_last = 0;
+	long wakeups_before, wakeups_after;
+	double cpu_before;
+	struct timespec start, end;
+	pthread_t thread;
+
+	memset(p, 0, sizeof(*p));
+
+	cpu_before = thread_cpu_ms(&wakeups_before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_create(&thread, NULL, feeder_thread, feeder);
+
+	for (;;) {
+		int res = hid_read_timeout(dev, buf, sizeof(buf), 500);
+		if (res <= 0)
+			break;
+
+		p->received++;
+		if (!filtered)
+			continue;
+
+		if (res != 6 || buf[0] != 1 || (have_last && buf[5] == last_state))
+			p->bad++;
+		last_state = buf[5];
+		have_last = 1;
+	}
+
+	pthread_join(thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	p->cpu_ms = thread_cpu_ms(&wakeups_after) - cpu_before;
+	p->wakeups = wakeups_after - wakeups_before;
+	/* Without the final timeout of the reads */
+	p->seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9 - 0.5;
+}
+
+/* The number of reports the filter of main() lets through */
+static long expected_filtered(long count)
+{
+	unsigned char report[REPORT_LENGTH];
+	unsigned char last_state = 0;
+	int have_last = 0;
+	long seq, n = 0;
+
+	for (seq = 0; seq < count; seq++) {
+		make_report(seq, report);
+		if (report[0] != 1 || (have_last && report[5] == last_state))
+			continue;
+		last_state = report[5];
+		have_last = 1;
+		n++;
+	}
+
+	return n;
+}
+
+static void print_pass(const char *name, const struct pass *p)
+{
+	printf("%s: %ld reports, %.1f ms CPU, %ld wakeups (%.0f/s) in the reading thread\n",
+		name, p->received, p->cpu_ms, p->wakeups,
+		(p->seconds > 0)? (double)p->wakeups / p->seconds: 0.0);
+}
+
+/* Check the reports of a filtered pass */
+static int check_filtered(const char *name, const struct pass *p, long count)
+{
+	long expected = expected_filtered(count);
+
+	if (p->received != expected || p->bad > 0) {
+		fprintf(stderr, "%s: %ld reports (%ld not matching the filter), expected %ld\n",
+			name, p->received, p->bad, expected);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct hid_input_filter filter;
+	struct feeder feeder;
+	struct pass unfiltered, filtered, kernel;
+	struct uhid_event ev;
+	hid_device *dev;
+	int opt, res, result = 0;
+
+	feeder.count = 5000;
+	feeder.pause_usec = 200;
+	while ((opt = getopt(argc, argv, "n:u:")) != -1) {
+		switch (opt) {
+		case 'n': feeder.count = strtol(optarg, NULL, 0); break;
+		case 'u': feeder.pause_usec = strtol(optarg, NULL, 0); break;
+		default: return 1;
+		}
+	}
+
+	feeder.uhid_fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (feeder.uhid_fd < 0) {
+		fprintf(stderr, "can't open /dev/uhid: %s\n", strerror(errno));
+		return SKIP;
+	}
+	if (uhid_create(feeder.uhid_fd) < 0) {
+		fprintf(stderr, "UHID_CREATE2 failed: %s\n", strerror(errno));
+		close(feeder.uhid_fd);
+		return SKIP;
+	}
+
+	if (hid_init() < 0)
+		return 1;
+
+	dev = open_virtual_device();
+	if (!dev) {
+		fprintf(stderr, "can't open the virtual device\n");
+		close(feeder.uhid_fd);
+		return 1;
+	}
+
+	run_pass(dev, &feeder, 0, &unfiltered);
+	print_pass("unfiltered", &unfiltered);
+	if (unfiltered.received != feeder.count) {
+		fprintf(stderr, "unfiltered: expected %ld reports, increase -u if the reports are lost\n", feeder.count);
+		result = 1;
+	}
+
+	memset(&filter, 0, sizeof(filter));
+	filter.numbered_reports = 1;
+	filter.report_ids[0] = 1 << 1;
+	filter.ignore_unchanged = 1;
+	filter.mask[0] = 0xFF; /* the sequence number in bytes 1..4 is ignored */
+	filter.mask_length = 5;
+	filter.trim_length = 6;
+	if (hid_set_input_filter(dev, &filter) < 0) {
+		fprintf(stderr, "hid_set_input_filter failed: %ls\n", hid_error(dev));
+		result = 1;
+	}
+	else {
+		run_pass(dev, &feeder, 1, &filtered);
+		print_pass("filtered", &filtered);
+		result |= check_filtered("filtered", &filtered, feeder.count);
+
+		filter.kernel_filter = 1;
+		res = hid_set_input_filter(dev, &filter);
+		if (res < 0) {
+			fprintf(stderr, "hid_set_input_filter (kernel) failed: %ls\n", hid_error(dev));
+			result = 1;
+		}
+		else if (res == 0) {
+			printf("kernel filtered: skipped, HID-BPF is not available\n");
+		}
+		else {
+			run_pass(dev, &feeder, 1, &kernel);
+			print_pass("kernel filtered", &kernel);
+			result |= check_filtered("kernel filtered", &kernel, feeder.count);
+			if (kernel.wakeups >= filtered.wakeups) {
+				fprintf(stderr, "kernel filtered: %ld wakeups, not fewer than the %ld of the user-space filter\n",
+					kernel.wakeups, filtered.wakeups);
+				result = 1;
+			}
+		}
+	}
+
+	hid_close(dev);
+	hid_exit();
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	uhid_write(feeder.uhid_fd, &ev);
+	close(feeder.uhid_fd);
+
+	return result;
+}
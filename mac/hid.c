@@ -34,9 +34,12 @@
 #include <pthread.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <limits.h>
+#include <time.h>
 #include <dlfcn.h>
 
 #include "hidapi_darwin.h"
+#include "hid_enumerate_diff.h"
 
 /* Barrier implementation because Mac OSX doesn't have pthread_barrier.
    It also doesn't have clock_gettime(). So much for POSIX and SUSv2.
@@ -144,9 +147,60 @@ struct hid_device_ {
 	wchar_t *last_error_str;
 };
 
+/* Set by hid_set_allocator(), all NULL to use the C runtime */
+static struct hid_allocator allocator = { NULL, NULL, NULL, NULL };
+
+static void *hid_internal_malloc(size_t size)
+{
+	if (allocator.malloc_fn)
+		return allocator.malloc_fn(size, allocator.user_data);
+	return malloc(size);
+}
+
+static void *hid_internal_calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (!allocator.malloc_fn)
+		return calloc(count, size);
+
+	if (size != 0 && count > (size_t) -1 / size)
+		return NULL;
+	ptr = hid_internal_malloc(count * size);
+	if (ptr)
+		memset(ptr, 0, count * size);
+	return ptr;
+}
+
+static void hid_internal_free(void *ptr)
+{
+	if (allocator.free_fn)
+		allocator.free_fn(ptr, allocator.user_data);
+	else
+		free(ptr);
+}
+
+static char *hid_internal_strdup(const char *s)
+{
+	size_t size = strlen(s) + 1;
+	char *ret = (char*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
+static wchar_t *hid_internal_wcsdup(const wchar_t *s)
+{
+	size_t size = (wcslen(s) + 1) * sizeof(wchar_t);
+	wchar_t *ret = (wchar_t*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
 static hid_device *new_hid_device(void)
 {
-	hid_device *dev = (hid_device*) calloc(1, sizeof(hid_device));
+	hid_device *dev = (hid_device*) hid_internal_calloc(1, sizeof(hid_device));
 	if (dev == NULL) {
 		return NULL;
 	}
@@ -182,19 +236,19 @@ static void free_hid_device(hid_device *dev)
 	struct input_report *rpt = dev->input_reports;
 	while (rpt) {
 		struct input_report *next = rpt->next;
-		free(rpt->data);
-		free(rpt);
+		hid_internal_free(rpt->data);
+		hid_internal_free(rpt);
 		rpt = next;
 	}
 
 	/* Free the string and the report buffer. The check for NULL
 	   is necessary here as CFRelease() doesn't handle NULL like
-	   free() and others do. */
+	   hid_internal_free() and others do. */
 	if (dev->run_loop_mode)
 		CFRelease(dev->run_loop_mode);
 	if (dev->source)
 		CFRelease(dev->source);
-	free(dev->input_report_buf);
+	hid_internal_free(dev->input_report_buf);
 	hid_free_enumeration(dev->device_info);
 
 	/* Clean up the thread objects */
@@ -204,11 +258,11 @@ static void free_hid_device(hid_device *dev)
 	pthread_mutex_destroy(&dev->mutex);
 
 	/* Free the structure itself. */
-	free(dev);
+	hid_internal_free(dev);
 }
 
 
-/* The caller must free the returned string with free(). */
+/* The caller must free the returned string with hid_internal_free(). */
 static wchar_t *utf8_to_wchar_t(const char *utf8)
 {
 	wchar_t *ret = NULL;
@@ -216,9 +270,9 @@ static wchar_t *utf8_to_wchar_t(const char *utf8)
 	if (utf8) {
 		size_t wlen = mbstowcs(NULL, utf8, 0);
 		if ((size_t) -1 == wlen) {
-			return wcsdup(L"");
+			return hid_internal_wcsdup(L"");
 		}
-		ret = (wchar_t*) calloc(wlen+1, sizeof(wchar_t));
+		ret = (wchar_t*) hid_internal_calloc(wlen+1, sizeof(wchar_t));
 		if (ret == NULL) {
 			/* as much as we can do at this point */
 			return NULL;
@@ -237,7 +291,7 @@ static wchar_t *utf8_to_wchar_t(const char *utf8)
  * Use register_error_str(NULL) to free the error message completely. */
 static void register_error_str(wchar_t **error_str, const char *msg)
 {
-	free(*error_str);
+	hid_internal_free(*error_str);
 	*error_str = utf8_to_wchar_t(msg);
 }
 
@@ -422,16 +476,6 @@ static int get_product_string(IOHIDDeviceRef device, wchar_t *buf, size_t len)
 }
 
 
-/* Implementation of wcsdup() for Mac. */
-static wchar_t *dup_wcs(const wchar_t *s)
-{
-	size_t len = wcslen(s);
-	wchar_t *ret = (wchar_t*) malloc((len+1)*sizeof(wchar_t));
-	wcscpy(ret, s);
-
-	return ret;
-}
-
 /* Initialize the IOHIDManager. Return 0 for success and -1 for failure. */
 static int init_hid_manager(void)
 {
@@ -489,6 +533,32 @@ int HID_API_EXPORT hid_exit(void)
 	return 0;
 }
 
+int HID_API_EXPORT hid_set_allocator(const struct hid_allocator *new_allocator)
+{
+	if (new_allocator && (!new_allocator->malloc_fn || !new_allocator->realloc_fn || !new_allocator->free_fn)) {
+		register_global_error("hid_set_allocator: malloc_fn, realloc_fn and free_fn must all be set");
+		return -1;
+	}
+
+	/* The global error message was allocated with the previous allocator */
+	register_global_error(NULL);
+
+	if (new_allocator)
+		allocator = *new_allocator;
+	else
+		memset(&allocator, 0, sizeof(allocator));
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_executor(const struct hid_executor *new_executor)
+{
+	/* Stub */
+	(void)new_executor;
+	register_global_error("hid_set_executor is not supported on this platform");
+	return -1;
+}
+
 static void process_pending_events(void) {
 	SInt32 res;
 	do {
@@ -553,7 +623,7 @@ static struct hid_device_info *create_device_info_with_usage(IOHIDDeviceRef dev,
 		return NULL;
 	}
 
-	cur_dev = (struct hid_device_info *)calloc(1, sizeof(struct hid_device_info));
+	cur_dev = (struct hid_device_info *)hid_internal_calloc(1, sizeof(struct hid_device_info));
 	if (cur_dev == NULL) {
 		return NULL;
 	}
@@ -582,7 +652,7 @@ static struct hid_device_info *create_device_info_with_usage(IOHIDDeviceRef dev,
 		   so for (max) "path" string 'DevSrvsID:18446744073709551615' we would need
 		   9+1+20+1=31 bytes buffer, but allocate 32 for simple alignment */
 		const size_t path_len = 32;
-		cur_dev->path = calloc(1, path_len);
+		cur_dev->path = hid_internal_calloc(1, path_len);
 		if (cur_dev->path != NULL) {
 			snprintf(cur_dev->path, path_len, "DevSrvsID:%llu", entry_id);
 		}
@@ -590,18 +660,18 @@ static struct hid_device_info *create_device_info_with_usage(IOHIDDeviceRef dev,
 
 	if (cur_dev->path == NULL) {
 		/* for whatever reason, trying to keep it a non-NULL string */
-		cur_dev->path = strdup("");
+		cur_dev->path = hid_internal_strdup("");
 	}
 
 	/* Serial Number */
 	get_serial_number(dev, buf, BUF_LEN);
-	cur_dev->serial_number = dup_wcs(buf);
+	cur_dev->serial_number = hid_internal_wcsdup(buf);
 
 	/* Manufacturer and Product strings */
 	get_manufacturer_string(dev, buf, BUF_LEN);
-	cur_dev->manufacturer_string = dup_wcs(buf);
+	cur_dev->manufacturer_string = hid_internal_wcsdup(buf);
 	get_product_string(dev, buf, BUF_LEN);
-	cur_dev->product_string = dup_wcs(buf);
+	cur_dev->product_string = hid_internal_wcsdup(buf);
 
 	/* VID/PID */
 	cur_dev->vendor_id = dev_vid;
@@ -696,19 +766,14 @@ static struct hid_device_info *create_device_info(IOHIDDeviceRef device)
 	return root;
 }
 
-struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Returns -1 if the device list couldn't be copied, 0 otherwise (even if no device matched) */
+static int hid_internal_enumerate(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs)
 {
-	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *root = NULL;
 	struct hid_device_info *cur_dev = NULL;
 	CFIndex num_devices;
 	int i;
 
-	/* Set up the HID Manager if it hasn't been done */
-	if (hid_init() < 0) {
-		return NULL;
-	}
-	/* register_global_error: global error is set/reset by hid_init */
-
 	/* give the IOHIDManager a chance to update itself */
 	process_pending_events();
 
@@ -741,7 +806,12 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 	if (device_set != NULL) {
 		/* Convert the list into a C array so we can iterate easily. */
 		num_devices = CFSetGetCount(device_set);
-		device_array = (IOHIDDeviceRef*) calloc(num_devices, sizeof(IOHIDDeviceRef));
+		device_array = (IOHIDDeviceRef*) hid_internal_calloc(num_devices, sizeof(IOHIDDeviceRef));
+		if (num_devices > 0 && !device_array) {
+			CFRelease(device_set);
+			register_global_error("Failed to allocate memory for the device list");
+			return -1;
+		}
 		CFSetGetValues(device_set, (const void **) device_array);
 	} else {
 		num_devices = 0;
@@ -774,10 +844,27 @@ struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id,
 		}
 	}
 
-	free(device_array);
+	hid_internal_free(device_array);
 	if (device_set != NULL)
 		CFRelease(device_set);
 
+	*devs = root;
+	return 0;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root = NULL; /* return object */
+
+	/* Set up the HID Manager if it hasn't been done */
+	if (hid_init() < 0) {
+		return NULL;
+	}
+	/* register_global_error: global error is set/reset by hid_init */
+
+	if (hid_internal_enumerate(vendor_id, product_id, &root) < 0)
+		return NULL;
+
 	if (root == NULL) {
 		if (vendor_id == 0 && product_id == 0) {
 			register_global_error("No HID devices found in the system.");
@@ -795,15 +882,72 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	struct hid_device_info *d = devs;
 	while (d) {
 		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
+		hid_internal_free(d->path);
+		hid_internal_free(d->serial_number);
+		hid_internal_free(d->manufacturer_string);
+		hid_internal_free(d->product_string);
+		hid_internal_free(d);
 		d = next;
 	}
 }
 
+int HID_API_EXPORT HID_API_CALL hid_enumerate_foreach(unsigned short vendor_id, unsigned short product_id, hid_enumerate_callback_fn callback, void *user_data)
+{
+	struct hid_device_info *devs;
+	int stop = 0;
+
+	if (!callback) {
+		register_global_error("Enumeration callback is NULL");
+		return -1;
+	}
+
+	if (hid_init() < 0) {
+		/* register_global_error: global error is reset by hid_init */
+		return -1;
+	}
+
+	/* The IOHIDManager reports the matching devices as a single set,
+	   so all of the devices are probed first and reported one by one afterwards. */
+	devs = hid_enumerate(vendor_id, product_id);
+	while (devs) {
+		struct hid_device_info *next = devs->next;
+		devs->next = NULL;
+		if (!stop)
+			stop = callback(devs, user_data) ? 1 : 0;
+		hid_free_enumeration(devs);
+		devs = next;
+	}
+
+	return stop;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_diff(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs, struct hid_device_info **added, struct hid_device_info **removed)
+{
+	struct hid_device_info *current;
+
+	if (!devs || !added || !removed) {
+		register_global_error("Invalid parameters for hid_enumerate_diff");
+		return -1;
+	}
+
+	if (hid_init() < 0) {
+		/* register_global_error: global error is reset by hid_init */
+		return -1;
+	}
+
+	if (hid_internal_enumerate(vendor_id, product_id, &current) < 0)
+		return -1;
+
+	return hid_internal_enumerate_merge(current, devs, added, removed);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_generation(unsigned int *generation)
+{
+	(void)generation;
+	register_global_error("hid_enumerate_generation is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short vendor_id, unsigned short product_id, int events, int flags, hid_hotplug_callback_fn callback, void *user_data, hid_hotplug_callback_handle *callback_handle)
 {
 	/* Stub */
@@ -899,8 +1043,8 @@ static void hid_report_callback(void *context, IOReturn result, void *sender,
 	hid_device *dev = (hid_device*) context;
 
 	/* Make a new Input Report object */
-	rpt = (struct input_report*) calloc(1, sizeof(struct input_report));
-	rpt->data = (uint8_t*) calloc(1, report_length);
+	rpt = (struct input_report*) hid_internal_calloc(1, sizeof(struct input_report));
+	rpt->data = (uint8_t*) hid_internal_calloc(1, report_length);
 	memcpy(rpt->data, report, report_length);
 	rpt->len = report_length;
 	rpt->next = NULL;
@@ -1082,7 +1226,7 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 
 	/* Create the buffers for receiving data */
 	dev->max_input_report_len = (CFIndex) get_max_report_length(dev->device_handle);
-	dev->input_report_buf = (uint8_t*) calloc(dev->max_input_report_len, sizeof(uint8_t));
+	dev->input_report_buf = (uint8_t*) hid_internal_calloc(dev->max_input_report_len, sizeof(uint8_t));
 
 	/* Create the Run Loop Mode for this device.
 	   printing the reference seems to work. */
@@ -1202,6 +1346,46 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 	return set_report(dev, kIOHIDReportTypeOutput, data, length);
 }
 
+int HID_API_EXPORT hid_write_many(struct hid_write_request *requests, size_t count, struct timespec *spread)
+{
+	struct timespec first = { 0, 0 }, last = { 0, 0 };
+	int written = 0;
+	int res = 0;
+	size_t i;
+
+	if (!requests && count > 0) {
+		register_global_error("requests is NULL");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		requests[i].result = hid_write(requests[i].dev, requests[i].data, requests[i].length);
+		if (requests[i].result < 0) {
+			res = -1;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &last);
+		if (!written++)
+			first = last;
+	}
+
+	if (spread) {
+		spread->tv_sec = 0;
+		spread->tv_nsec = 0;
+		if (written > 1) {
+			spread->tv_sec = last.tv_sec - first.tv_sec;
+			spread->tv_nsec = last.tv_nsec - first.tv_nsec;
+			if (spread->tv_nsec < 0) {
+				spread->tv_sec--;
+				spread->tv_nsec += 1000000000L;
+			}
+		}
+	}
+
+	return res;
+}
+
 /* Helper function, so that this isn't duplicated in hid_read(). */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
@@ -1213,8 +1397,8 @@ static int return_data(hid_device *dev, unsigned char *data, size_t length)
 		memcpy(data, rpt->data, len);
 	}
 	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+	hid_internal_free(rpt->data);
+	hid_internal_free(rpt);
 	return (int) len;
 }
 
@@ -1340,11 +1524,150 @@ ret:
 	return bytes_read;
 }
 
+int HID_API_EXPORT hid_read_timeout_ts(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	long long milliseconds;
+
+	if (!timeout)
+		return hid_read_timeout(dev, data, length, -1);
+
+	if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000L) {
+		register_device_error(dev, "hid_read_timeout_ts: invalid timeout");
+		return -1;
+	}
+
+	/* Only millisecond resolution is available here, round up
+	   so a short timeout doesn't turn into a non-blocking read */
+	milliseconds = (long long)timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+	if (milliseconds > INT_MAX)
+		milliseconds = INT_MAX;
+
+	return hid_read_timeout(dev, data, length, (int)milliseconds);
+}
+
+int HID_API_EXPORT hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline)
+{
+	struct timespec now, remaining;
+
+	if (!deadline)
+		return hid_read_timeout(dev, data, length, -1);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining.tv_sec = deadline->tv_sec - now.tv_sec;
+	remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (remaining.tv_nsec < 0) {
+		remaining.tv_sec--;
+		remaining.tv_nsec += 1000000000L;
+	}
+	if (remaining.tv_sec < 0) {
+		/* Already expired, only return a report that is already there */
+		remaining.tv_sec = 0;
+		remaining.tv_nsec = 0;
+	}
+
+	return hid_read_timeout_ts(dev, data, length, &remaining);
+}
+
 int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT hid_interrupt_read(hid_device *dev)
+{
+	/* Stub */
+	register_device_error(dev, "hid_interrupt_read is not supported on this platform");
+	return -1;
+}
+
+hid_subscription * HID_API_EXPORT hid_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow)
+{
+	/* Stub */
+	(void) capacity;
+	(void) report_length;
+	(void) overflow;
+	register_device_error(dev, "hid_subscribe is not supported on this platform");
+	return NULL;
+}
+
+int HID_API_EXPORT hid_subscription_read_timeout(hid_subscription *subscription, unsigned char *data, size_t length, int milliseconds)
+{
+	/* Stub */
+	(void) subscription;
+	(void) data;
+	(void) length;
+	(void) milliseconds;
+	return -1;
+}
+
+size_t HID_API_EXPORT hid_subscription_dropped(hid_subscription *subscription)
+{
+	/* Stub */
+	(void) subscription;
+	return 0;
+}
+
+void HID_API_EXPORT hid_unsubscribe(hid_subscription *subscription)
+{
+	/* Stub */
+	(void) subscription;
+}
+
+hid_dispatcher * HID_API_EXPORT hid_dispatcher_create(unsigned int num_threads)
+{
+	/* Stub */
+	(void) num_threads;
+	register_global_error("hid_dispatcher_create is not supported on this platform");
+	return NULL;
+}
+
+hid_subscription * HID_API_EXPORT hid_subscribe_dispatch(hid_dispatcher *dispatcher, hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_input_callback_fn callback, void *user_data)
+{
+	/* Stub */
+	(void) dispatcher;
+	(void) capacity;
+	(void) report_length;
+	(void) overflow;
+	(void) callback;
+	(void) user_data;
+	register_device_error(dev, "hid_subscribe_dispatch is not supported on this platform");
+	return NULL;
+}
+
+void HID_API_EXPORT hid_dispatcher_destroy(hid_dispatcher *dispatcher)
+{
+	/* Stub */
+	(void) dispatcher;
+}
+
+int HID_API_EXPORT hid_set_health_monitor(hid_device *dev, unsigned int expected_interval_us, unsigned int silence_threshold_ms, hid_health_callback_fn callback, void *user_data)
+{
+	/* Stub */
+	(void) expected_interval_us;
+	(void) callback;
+	(void) user_data;
+	if (silence_threshold_ms == 0)
+		return 0;
+	register_device_error(dev, "hid_set_health_monitor is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT hid_get_health_stats(hid_device *dev, struct hid_health_stats *stats)
+{
+	/* Stub */
+	(void) stats;
+	register_device_error(dev, "hid_get_health_stats is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT hid_set_input_filter(hid_device *dev, const struct hid_input_filter *filter)
+{
+	/* Stub */
+	(void) filter;
+	register_device_error(dev, "hid_set_input_filter is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* All Nonblocking operation is handled by the library. */
@@ -1363,6 +1686,14 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 	return get_report(dev, kIOHIDReportTypeFeature, data, length);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_milliseconds)
+{
+	/* Stub */
+	(void)ttl_milliseconds;
+	register_device_error(dev, "hid_set_feature_report_cache is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_get_input_report(hid_device *dev, unsigned char *data, size_t length)
 {
 	return get_report(dev, kIOHIDReportTypeInput, data, length);
@@ -1422,6 +1753,18 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	free_hid_device(dev);
 }
 
+void HID_API_EXPORT hid_close_many(hid_device **devs, size_t count)
+{
+	/* Closing a device is cheap on this backend, nothing to gain from doing it in parallel */
+	size_t i;
+
+	if (!devs)
+		return;
+
+	for (i = 0; i < count; i++)
+		hid_close(devs[i]);
+}
+
 int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
 {
 	if (!string || !maxlen)
@@ -1572,3 +1915,20 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 		return L"Success";
 	return last_global_error_str;
 }
+
+int HID_API_EXPORT HID_API_CALL hid_debug_log_enable(int enable)
+{
+	/* Stub */
+	(void)enable;
+	register_global_error("hid_debug_log_enable is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_debug_log_read(char *buffer, size_t size)
+{
+	/* Stub */
+	(void)buffer;
+	(void)size;
+	register_global_error("hid_debug_log_read is not supported on this platform");
+	return -1;
+}
@@ -24,6 +24,8 @@
 #include <string.h>
 #include <locale.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
 #include <errno.h>
 
 /* Unix */
@@ -38,6 +40,7 @@
 #include <dev/usb/usbhid.h>
 
 #include "hidapi.h"
+#include "hid_enumerate_diff.h"
 
 #define HIDAPI_MAX_CHILD_DEVICES 256
 
@@ -64,7 +67,58 @@ typedef void (*enumerate_devices_callback) (const struct usb_device_info *, void
 
 static wchar_t *last_global_error_str = NULL;
 
-/* The caller must free the returned string with free(). */
+/* Set by hid_set_allocator(), all NULL to use the C runtime */
+static struct hid_allocator allocator = { NULL, NULL, NULL, NULL };
+
+static void *hid_internal_malloc(size_t size)
+{
+	if (allocator.malloc_fn)
+		return allocator.malloc_fn(size, allocator.user_data);
+	return malloc(size);
+}
+
+static void *hid_internal_calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (!allocator.malloc_fn)
+		return calloc(count, size);
+
+	if (size != 0 && count > (size_t) -1 / size)
+		return NULL;
+	ptr = hid_internal_malloc(count * size);
+	if (ptr)
+		memset(ptr, 0, count * size);
+	return ptr;
+}
+
+static void hid_internal_free(void *ptr)
+{
+	if (allocator.free_fn)
+		allocator.free_fn(ptr, allocator.user_data);
+	else
+		free(ptr);
+}
+
+static char *hid_internal_strdup(const char *s)
+{
+	size_t size = strlen(s) + 1;
+	char *ret = (char*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
+static wchar_t *hid_internal_wcsdup(const wchar_t *s)
+{
+	size_t size = (wcslen(s) + 1) * sizeof(wchar_t);
+	wchar_t *ret = (wchar_t*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
+/* The caller must free the returned string with hid_internal_free(). */
 static wchar_t *utf8_to_wchar_t(const char *utf8)
 {
 	wchar_t *ret = NULL;
@@ -72,9 +126,9 @@ static wchar_t *utf8_to_wchar_t(const char *utf8)
 	if (utf8) {
 		size_t wlen = mbstowcs(NULL, utf8, 0);
 		if ((size_t) -1 == wlen) {
-			return wcsdup(L"");
+			return hid_internal_wcsdup(L"");
 		}
-		ret = (wchar_t*) calloc(wlen+1, sizeof(wchar_t));
+		ret = (wchar_t*) hid_internal_calloc(wlen+1, sizeof(wchar_t));
 		if (ret == NULL) {
 			/* as much as we can do at this point */
 			return NULL;
@@ -92,7 +146,7 @@ static wchar_t *utf8_to_wchar_t(const char *utf8)
  * Use register_error_str(NULL) to free the error message completely. */
 static void register_error_str(wchar_t **error_str, const char *msg)
 {
-	free(*error_str);
+	hid_internal_free(*error_str);
 	*error_str = utf8_to_wchar_t(msg);
 }
 
@@ -366,14 +420,14 @@ static struct hid_device_info *create_device_info(const struct usb_device_info *
 	struct hid_device_info *root;
 	struct hid_device_info *end;
 
-	root = (struct hid_device_info *) calloc(1, sizeof(struct hid_device_info));
+	root = (struct hid_device_info *) hid_internal_calloc(1, sizeof(struct hid_device_info));
 	if (!root)
 		return NULL;
 
 	end = root;
 
 	/* Path */
-	end->path = (path) ? strdup(path) : NULL;
+	end->path = (path) ? hid_internal_strdup(path) : NULL;
 
 	/* Vendor Id */
 	end->vendor_id = udi->udi_vendorNo;
@@ -431,19 +485,19 @@ static struct hid_device_info *create_device_info(const struct usb_device_info *
 		 */
 		while (get_next_hid_usage(ucrd->ucrd_data, ucrd->ucrd_size, &usage_iterator, &page, &usage) == 0) {
 			/* Create new record for additional usage pairs */
-			struct hid_device_info *node = (struct hid_device_info *) calloc(1, sizeof(struct hid_device_info));
+			struct hid_device_info *node = (struct hid_device_info *) hid_internal_calloc(1, sizeof(struct hid_device_info));
 
 			if (!node)
 				continue;
 
 			/* Update fields */
-			node->path = (end->path) ? strdup(end->path) : NULL;
+			node->path = (end->path) ? hid_internal_strdup(end->path) : NULL;
 			node->vendor_id = end->vendor_id;
 			node->product_id = end->product_id;
-			node->serial_number = (end->serial_number) ? wcsdup(end->serial_number) : NULL;
+			node->serial_number = (end->serial_number) ? hid_internal_wcsdup(end->serial_number) : NULL;
 			node->release_number = end->release_number;
-			node->manufacturer_string = (end->manufacturer_string) ? wcsdup(end->manufacturer_string) : NULL;
-			node->product_string = (end->product_string) ? wcsdup(end->product_string) : NULL;
+			node->manufacturer_string = (end->manufacturer_string) ? hid_internal_wcsdup(end->manufacturer_string) : NULL;
+			node->product_string = (end->product_string) ? hid_internal_wcsdup(end->product_string) : NULL;
 			node->usage_page = page;
 			node->usage = usage;
 			node->interface_number = end->interface_number;
@@ -681,22 +735,44 @@ int HID_API_EXPORT HID_API_CALL hid_exit(void)
 	return 0;
 }
 
-struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+int HID_API_EXPORT HID_API_CALL hid_set_allocator(const struct hid_allocator *new_allocator)
+{
+	if (new_allocator && (!new_allocator->malloc_fn || !new_allocator->realloc_fn || !new_allocator->free_fn)) {
+		register_global_error("hid_set_allocator: malloc_fn, realloc_fn and free_fn must all be set");
+		return -1;
+	}
+
+	/* The global error message was allocated with the previous allocator */
+	register_global_error(NULL);
+
+	if (new_allocator)
+		allocator = *new_allocator;
+	else
+		memset(&allocator, 0, sizeof(allocator));
+
+	return 0;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_executor(const struct hid_executor *new_executor)
+{
+	/* Stub */
+	(void)new_executor;
+	register_global_error("hid_set_executor is not supported on this platform");
+	return -1;
+}
+
+/* Returns -1 if the device tree couldn't be walked, 0 otherwise (even if no device matched) */
+static int hid_internal_enumerate(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs)
 {
-	int res;
 	int drvctl;
 	char arr[HIDAPI_MAX_CHILD_DEVICES][USB_MAX_DEVNAMELEN];
 	size_t len;
 	struct hid_enumerate_data hed;
 
-	res = hid_init();
-	if (res == -1)
-		return NULL;
-
 	drvctl = open(DRVCTLDEV, O_RDONLY | O_CLOEXEC);
 	if (drvctl == -1) {
 		register_global_error_format("failed to open drvctl: %s", strerror(errno));
-		return NULL;
+		return -1;
 	}
 
 	len = 0;
@@ -726,22 +802,95 @@ struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned shor
 
 	close(drvctl);
 
-	return hed.root;
+	*devs = hed.root;
+	return 0;
+}
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root = NULL;
+	int res;
+
+	res = hid_init();
+	if (res == -1)
+		return NULL;
+
+	if (hid_internal_enumerate(vendor_id, product_id, &root) < 0)
+		return NULL;
+
+	return root;
 }
 
 void HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *devs)
 {
 	while (devs) {
 		struct hid_device_info *next = devs->next;
-		free(devs->path);
-		free(devs->serial_number);
-		free(devs->manufacturer_string);
-		free(devs->product_string);
-		free(devs);
+		hid_internal_free(devs->path);
+		hid_internal_free(devs->serial_number);
+		hid_internal_free(devs->manufacturer_string);
+		hid_internal_free(devs->product_string);
+		hid_internal_free(devs);
 		devs = next;
 	}
 }
 
+int HID_API_EXPORT HID_API_CALL hid_enumerate_foreach(unsigned short vendor_id, unsigned short product_id, hid_enumerate_callback_fn callback, void *user_data)
+{
+	struct hid_device_info *devs;
+	int stop = 0;
+
+	if (!callback) {
+		register_global_error("Enumeration callback is NULL");
+		return -1;
+	}
+
+	if (hid_init() < 0) {
+		/* register_global_error: global error is reset by hid_init */
+		return -1;
+	}
+
+	/* The devices are found by walking the whole USB device tree,
+	   so all of the devices are probed first and reported one by one afterwards. */
+	devs = hid_enumerate(vendor_id, product_id);
+	while (devs) {
+		struct hid_device_info *next = devs->next;
+		devs->next = NULL;
+		if (!stop)
+			stop = callback(devs, user_data) ? 1 : 0;
+		hid_free_enumeration(devs);
+		devs = next;
+	}
+
+	return stop;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_diff(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs, struct hid_device_info **added, struct hid_device_info **removed)
+{
+	struct hid_device_info *current;
+
+	if (!devs || !added || !removed) {
+		register_global_error("Invalid parameters for hid_enumerate_diff");
+		return -1;
+	}
+
+	if (hid_init() < 0) {
+		/* register_global_error: global error is reset by hid_init */
+		return -1;
+	}
+
+	if (hid_internal_enumerate(vendor_id, product_id, &current) < 0)
+		return -1;
+
+	return hid_internal_enumerate_merge(current, devs, added, removed);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_generation(unsigned int *generation)
+{
+	(void)generation;
+	register_global_error("hid_enumerate_generation is not supported on this platform");
+	return -1;
+}
+
 HID_API_EXPORT hid_device * HID_API_CALL hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	struct hid_device_info *devs;
@@ -791,7 +940,7 @@ HID_API_EXPORT hid_device * HID_API_CALL hid_open_path(const char *path)
 	if (res == -1)
 		goto err_0;
 
-	dev = (hid_device *) calloc(1, sizeof(hid_device));
+	dev = (hid_device *) hid_internal_calloc(1, sizeof(hid_device));
 	if (!dev) {
 		register_global_error("could not allocate hid_device");
 		goto err_0;
@@ -861,7 +1010,7 @@ err_3:
 err_2:
 	close(drvctl);
 err_1:
-	free(dev);
+	hid_internal_free(dev);
 err_0:
 	return NULL;
 }
@@ -871,6 +1020,46 @@ int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *
 	return set_report(dev, data, length, UHID_OUTPUT_REPORT);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_write_many(struct hid_write_request *requests, size_t count, struct timespec *spread)
+{
+	struct timespec first = { 0, 0 }, last = { 0, 0 };
+	int written = 0;
+	int res = 0;
+	size_t i;
+
+	if (!requests && count > 0) {
+		register_global_error("requests is NULL");
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		requests[i].result = hid_write(requests[i].dev, requests[i].data, requests[i].length);
+		if (requests[i].result < 0) {
+			res = -1;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &last);
+		if (!written++)
+			first = last;
+	}
+
+	if (spread) {
+		spread->tv_sec = 0;
+		spread->tv_nsec = 0;
+		if (written > 1) {
+			spread->tv_sec = last.tv_sec - first.tv_sec;
+			spread->tv_nsec = last.tv_nsec - first.tv_nsec;
+			if (spread->tv_nsec < 0) {
+				spread->tv_sec--;
+				spread->tv_nsec += 1000000000L;
+			}
+		}
+	}
+
+	return res;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
 	int res;
@@ -913,11 +1102,150 @@ int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char
 	return n;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_read_timeout_ts(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	long long milliseconds;
+
+	if (!timeout)
+		return hid_read_timeout(dev, data, length, -1);
+
+	if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000L) {
+		register_device_error(dev, "hid_read_timeout_ts: invalid timeout");
+		return -1;
+	}
+
+	/* Only millisecond resolution is available here, round up
+	   so a short timeout doesn't turn into a non-blocking read */
+	milliseconds = (long long)timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+	if (milliseconds > INT_MAX)
+		milliseconds = INT_MAX;
+
+	return hid_read_timeout(dev, data, length, (int)milliseconds);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline)
+{
+	struct timespec now, remaining;
+
+	if (!deadline)
+		return hid_read_timeout(dev, data, length, -1);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining.tv_sec = deadline->tv_sec - now.tv_sec;
+	remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (remaining.tv_nsec < 0) {
+		remaining.tv_sec--;
+		remaining.tv_nsec += 1000000000L;
+	}
+	if (remaining.tv_sec < 0) {
+		/* Already expired, only return a report that is already there */
+		remaining.tv_sec = 0;
+		remaining.tv_nsec = 0;
+	}
+
+	return hid_read_timeout_ts(dev, data, length, &remaining);
+}
+
 int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking) ? -1 : 0);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_interrupt_read(hid_device *dev)
+{
+	/* Stub */
+	register_device_error(dev, "hid_interrupt_read is not supported on this platform");
+	return -1;
+}
+
+HID_API_EXPORT hid_subscription * HID_API_CALL hid_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow)
+{
+	/* Stub */
+	(void) capacity;
+	(void) report_length;
+	(void) overflow;
+	register_device_error(dev, "hid_subscribe is not supported on this platform");
+	return NULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_subscription_read_timeout(hid_subscription *subscription, unsigned char *data, size_t length, int milliseconds)
+{
+	/* Stub */
+	(void) subscription;
+	(void) data;
+	(void) length;
+	(void) milliseconds;
+	return -1;
+}
+
+size_t HID_API_EXPORT HID_API_CALL hid_subscription_dropped(hid_subscription *subscription)
+{
+	/* Stub */
+	(void) subscription;
+	return 0;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_unsubscribe(hid_subscription *subscription)
+{
+	/* Stub */
+	(void) subscription;
+}
+
+HID_API_EXPORT hid_dispatcher * HID_API_CALL hid_dispatcher_create(unsigned int num_threads)
+{
+	/* Stub */
+	(void) num_threads;
+	register_global_error("hid_dispatcher_create is not supported on this platform");
+	return NULL;
+}
+
+HID_API_EXPORT hid_subscription * HID_API_CALL hid_subscribe_dispatch(hid_dispatcher *dispatcher, hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_input_callback_fn callback, void *user_data)
+{
+	/* Stub */
+	(void) dispatcher;
+	(void) capacity;
+	(void) report_length;
+	(void) overflow;
+	(void) callback;
+	(void) user_data;
+	register_device_error(dev, "hid_subscribe_dispatch is not supported on this platform");
+	return NULL;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_dispatcher_destroy(hid_dispatcher *dispatcher)
+{
+	/* Stub */
+	(void) dispatcher;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_health_monitor(hid_device *dev, unsigned int expected_interval_us, unsigned int silence_threshold_ms, hid_health_callback_fn callback, void *user_data)
+{
+	/* Stub */
+	(void) expected_interval_us;
+	(void) callback;
+	(void) user_data;
+	if (silence_threshold_ms == 0)
+		return 0;
+	register_device_error(dev, "hid_set_health_monitor is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_health_stats(hid_device *dev, struct hid_health_stats *stats)
+{
+	/* Stub */
+	(void) stats;
+	register_device_error(dev, "hid_get_health_stats is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_input_filter(hid_device *dev, const struct hid_input_filter *filter)
+{
+	/* Stub */
+	(void) filter;
+	register_device_error(dev, "hid_set_input_filter is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -934,6 +1262,14 @@ int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned
 	return get_report(dev, data, length, UHID_FEATURE_REPORT);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_milliseconds)
+{
+	/* Stub */
+	(void)ttl_milliseconds;
+	register_device_error(dev, "hid_set_feature_report_cache is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_get_input_report(hid_device *dev, unsigned char *data, size_t length)
 {
 	return get_report(dev, data, length, UHID_INPUT_REPORT);
@@ -952,7 +1288,19 @@ void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev)
 	for (size_t i = 0; i < dev->poll_handles_length; i++)
 		close(dev->poll_handles[i].fd);
 
-	free(dev);
+	hid_internal_free(dev);
+}
+
+void HID_API_EXPORT HID_API_CALL hid_close_many(hid_device **devs, size_t count)
+{
+	/* Closing a device is cheap on this backend, nothing to gain from doing it in parallel */
+	size_t i;
+
+	if (!devs)
+		return;
+
+	for (i = 0; i < count; i++)
+		hid_close(devs[i]);
 }
 
 int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
@@ -1156,6 +1504,23 @@ HID_API_EXPORT const wchar_t* HID_API_CALL hid_error(hid_device *dev)
 	return last_global_error_str;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_debug_log_enable(int enable)
+{
+	/* Stub */
+	(void)enable;
+	register_global_error("hid_debug_log_enable is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_debug_log_read(char *buffer, size_t size)
+{
+	/* Stub */
+	(void)buffer;
+	(void)size;
+	register_global_error("hid_debug_log_read is not supported on this platform");
+	return -1;
+}
+
 HID_API_EXPORT const struct hid_api_version* HID_API_CALL hid_version(void)
 {
 	static const struct hid_api_version api_version = {
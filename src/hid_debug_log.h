@@ -0,0 +1,502 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Debug log of the hidraw and libusb backends (internal, not installed).
+ *
+ * Included once by the hid.c of a backend, which gets its own static copy.
+ *
+ * HID_DEBUG_LOG() doesn't format anything: it stores the format string
+ * (which must be a literal) and the raw arguments in a binary record, in a
+ * ring owned by the calling thread, with no lock and no system call. The
+ * records are only formatted when they are read, by hid_debug_log_read().
+ * When the log is disabled, which is the default, HID_DEBUG_LOG() costs
+ * an atomic load.
+ *
+ * A full ring drops the new records, and the number of dropped records is
+ * reported by the reader. Strings given with %s are copied into the
+ * record, truncated if the record is full.
+ */
+
+#ifndef HID_DEBUG_LOG_H__
+#define HID_DEBUG_LOG_H__
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Number of threads with a ring, the records of the other threads are dropped */
+#define HID_DEBUG_LOG_THREADS 8
+/* Records per ring, a power of 2 */
+#ifndef HID_DEBUG_LOG_RECORDS
+#define HID_DEBUG_LOG_RECORDS 256
+#endif
+/* Room for the arguments of a record */
+#define HID_DEBUG_LOG_ARGS_SIZE 96
+
+struct hid_debug_log_record {
+	uint64_t timestamp_ns; /* CLOCK_MONOTONIC */
+	const char *format;
+	unsigned int thread;
+	unsigned int args_length;
+	unsigned char args[HID_DEBUG_LOG_ARGS_SIZE];
+};
+
+struct hid_debug_log_ring {
+	int owned;
+	/* Number of the owner, for the output */
+	unsigned int thread;
+	/* Written by the owner only */
+	uint32_t head;
+	/* Written by the reader only */
+	uint32_t tail;
+	uint32_t dropped;
+	struct hid_debug_log_record records[HID_DEBUG_LOG_RECORDS];
+};
+
+static int hid_debug_log_enabled = 0;
+static struct hid_debug_log_ring hid_debug_log_rings[HID_DEBUG_LOG_THREADS];
+/* Records of the threads without a ring */
+static uint32_t hid_debug_log_dropped = 0;
+static unsigned int hid_debug_log_next_thread = 0;
+
+static pthread_once_t hid_debug_log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t hid_debug_log_key;
+static pthread_mutex_t hid_debug_log_reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Marks the threads for which no ring was left */
+static char hid_debug_log_no_ring;
+#define HID_DEBUG_LOG_NO_RING ((struct hid_debug_log_ring *) (void *) &hid_debug_log_no_ring)
+
+#define HID_DEBUG_LOG(...) \
+	do { \
+		if (__atomic_load_n(&hid_debug_log_enabled, __ATOMIC_RELAXED)) \
+			hid_debug_log_write(__VA_ARGS__); \
+	} while (0)
+
+static void hid_debug_log_release_ring(void *ring)
+{
+	if (ring != (void *) &hid_debug_log_no_ring)
+		__atomic_store_n(&((struct hid_debug_log_ring *) ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void hid_debug_log_create_key(void)
+{
+	pthread_key_create(&hid_debug_log_key, hid_debug_log_release_ring);
+}
+
+static struct hid_debug_log_ring *hid_debug_log_thread_ring(void)
+{
+	struct hid_debug_log_ring *ring;
+	size_t i;
+	int pass;
+
+	pthread_once(&hid_debug_log_once, hid_debug_log_create_key);
+
+	ring = (struct hid_debug_log_ring *) pthread_getspecific(hid_debug_log_key);
+	if (ring)
+		return ring;
+
+	/* The ring of a thread that exited is reused, after its records:
+	   the empty rings are taken first */
+	ring = HID_DEBUG_LOG_NO_RING;
+	for (pass = 0; pass < 2 && ring == HID_DEBUG_LOG_NO_RING; pass++) {
+		for (i = 0; i < HID_DEBUG_LOG_THREADS; i++) {
+			struct hid_debug_log_ring *candidate = &hid_debug_log_rings[i];
+			int expected = 0;
+
+			if (!__atomic_compare_exchange_n(&candidate->owned, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				continue;
+			if (pass == 0 && candidate->head != __atomic_load_n(&candidate->tail, __ATOMIC_ACQUIRE)) {
+				__atomic_store_n(&candidate->owned, 0, __ATOMIC_RELEASE);
+				continue;
+			}
+
+			ring = candidate;
+			ring->thread = __atomic_add_fetch(&hid_debug_log_next_thread, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	pthread_setspecific(hid_debug_log_key, ring);
+	return ring;
+}
+
+/* The next conversion of a format: returns a pointer to its conversion character,
+   *length_modifier is set to 'h', 'l', 'L' (ll), 'z', 'j', 't' or 0 */
+static const char *hid_debug_log_next_conversion(const char *p, char *length_modifier)
+{
+	*length_modifier = 0;
+
+	/* Flags, width and precision */
+	while (*p && strchr("-+ #0123456789.", *p))
+		p++;
+
+	switch (*p) {
+	case 'h':
+		*length_modifier = 'h';
+		while (*p == 'h')
+			p++;
+		break;
+	case 'l':
+		*length_modifier = (p[1] == 'l')? 'L': 'l';
+		p += (p[1] == 'l')? 2: 1;
+		break;
+	case 'z':
+	case 'j':
+	case 't':
+		*length_modifier = *p++;
+		break;
+	default:
+		break;
+	}
+
+	return p;
+}
+
+static int hid_debug_log_is_signed(char conversion)
+{
+	return conversion == 'd' || conversion == 'i';
+}
+
+static int hid_debug_log_is_unsigned(char conversion)
+{
+	return conversion == 'u' || conversion == 'x' || conversion == 'X' || conversion == 'o' || conversion == 'c';
+}
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 1, 2)))
+#endif
+static void hid_debug_log_write(const char *format, ...);
+
+static void hid_debug_log_write(const char *format, ...)
+{
+	struct hid_debug_log_ring *ring = hid_debug_log_thread_ring();
+	struct hid_debug_log_record *record;
+	struct timespec now;
+	uint32_t head;
+	size_t length = 0;
+	const char *p;
+	va_list args;
+
+	if (ring == HID_DEBUG_LOG_NO_RING) {
+		__atomic_add_fetch(&hid_debug_log_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == HID_DEBUG_LOG_RECORDS) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	record = &ring->records[head % HID_DEBUG_LOG_RECORDS];
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record->timestamp_ns = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+	record->format = format;
+	record->thread = ring->thread;
+
+	/* Store the arguments as 64-bit values, and the strings inline */
+	va_start(args, format);
+	for (p = strchr(format, '%'); p; p = strchr(p, '%')) {
+		char length_modifier;
+		char conversion;
+		uint64_t value;
+
+		p = hid_debug_log_next_conversion(p + 1, &length_modifier);
+		conversion = *p;
+		if (!conversion)
+			break;
+		p++;
+
+		if (conversion == '%')
+			continue;
+
+		if (conversion == 's') {
+			const char *s = va_arg(args, const char *);
+			size_t n;
+
+			if (!s)
+				s = "(null)";
+			n = strlen(s);
+			if (length >= HID_DEBUG_LOG_ARGS_SIZE)
+				break;
+			if (n > HID_DEBUG_LOG_ARGS_SIZE - length - 1)
+				n = HID_DEBUG_LOG_ARGS_SIZE - length - 1;
+			memcpy(record->args + length, s, n);
+			record->args[length + n] = '\0';
+			length += n + 1;
+			continue;
+		}
+
+		if (hid_debug_log_is_signed(conversion)) {
+			switch (length_modifier) {
+			case 'l': value = (uint64_t) (long long) va_arg(args, long); break;
+			case 'L': value = (uint64_t) va_arg(args, long long); break;
+			case 'z': value = (uint64_t) va_arg(args, size_t); break;
+			case 'j': value = (uint64_t) va_arg(args, intmax_t); break;
+			case 't': value = (uint64_t) va_arg(args, ptrdiff_t); break;
+			default: value = (uint64_t) (long long) va_arg(args, int); break;
+			}
+		}
+		else if (hid_debug_log_is_unsigned(conversion)) {
+			switch (length_modifier) {
+			case 'l': value = (uint64_t) va_arg(args, unsigned long); break;
+			case 'L': value = (uint64_t) va_arg(args, unsigned long long); break;
+			case 'z': value = (uint64_t) va_arg(args, size_t); break;
+			case 'j': value = (uint64_t) va_arg(args, uintmax_t); break;
+			case 't': value = (uint64_t) va_arg(args, ptrdiff_t); break;
+			default: value = (uint64_t) va_arg(args, unsigned int); break;
+			}
+		}
+		else if (conversion == 'p') {
+			value = (uint64_t) (uintptr_t) va_arg(args, void *);
+		}
+		else if (strchr("fFeEgGaA", conversion)) {
+			double d = va_arg(args, double);
+			memcpy(&value, &d, sizeof(value));
+		}
+		else {
+			/* Not supported, and nothing can be read after it */
+			break;
+		}
+
+		if (length + sizeof(value) > HID_DEBUG_LOG_ARGS_SIZE)
+			break;
+		memcpy(record->args + length, &value, sizeof(value));
+		length += sizeof(value);
+	}
+	va_end(args);
+
+	record->args_length = (unsigned int) length;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Format a record like printf() would have, with a timestamp and the thread */
+static size_t hid_debug_log_format(const struct hid_debug_log_record *record, char *line, size_t size)
+{
+	size_t length = 0;
+	size_t offset = 0;
+	const char *p = record->format;
+	int n;
+
+#define HID_DEBUG_LOG_APPEND(...) \
+	do { \
+		n = snprintf(line + length, size - length, __VA_ARGS__); \
+		if (n < 0) \
+			n = 0; \
+		length += ((size_t) n < size - length)? (size_t) n: size - length - 1; \
+	} while (0)
+
+	HID_DEBUG_LOG_APPEND("[%llu.%06llu] T%u: ", (unsigned long long) (record->timestamp_ns / 1000000000ULL), (unsigned long long) (record->timestamp_ns % 1000000000ULL / 1000ULL), record->thread);
+
+	while (*p && length + 1 < size) {
+		const char *start = p;
+		const char *end;
+		char spec[32];
+		char length_modifier;
+		char conversion;
+		size_t spec_length;
+		uint64_t value;
+
+		if (*p != '%') {
+			line[length++] = *p++;
+			continue;
+		}
+
+		end = hid_debug_log_next_conversion(p + 1, &length_modifier);
+		conversion = *end;
+		if (!conversion)
+			break;
+		p = end + 1;
+
+		if (conversion == '%') {
+			line[length++] = '%';
+			continue;
+		}
+
+		/* The flags, width and precision of the conversion, without its length modifier */
+		spec_length = (size_t) (end - start);
+		while (spec_length > 1 && strchr("hlzjt", start[spec_length - 1]))
+			spec_length--;
+		if (spec_length + 4 > sizeof(spec) || offset >= record->args_length)
+			break;
+		memcpy(spec, start, spec_length);
+
+		if (conversion == 's') {
+			const char *s = (const char *) record->args + offset;
+			spec[spec_length] = 's';
+			spec[spec_length + 1] = '\0';
+			HID_DEBUG_LOG_APPEND(spec, s);
+			offset += strlen(s) + 1;
+			continue;
+		}
+
+		if (offset + sizeof(value) > record->args_length)
+			break;
+		memcpy(&value, record->args + offset, sizeof(value));
+		offset += sizeof(value);
+
+		if (hid_debug_log_is_signed(conversion) || hid_debug_log_is_unsigned(conversion)) {
+			/* Everything was stored as a long long */
+			if (conversion == 'c') {
+				spec[spec_length] = 'c';
+				spec[spec_length + 1] = '\0';
+				HID_DEBUG_LOG_APPEND(spec, (int) value);
+			}
+			else {
+				spec[spec_length] = 'l';
+				spec[spec_length + 1] = 'l';
+				spec[spec_length + 2] = conversion;
+				spec[spec_length + 3] = '\0';
+				if (hid_debug_log_is_signed(conversion))
+					HID_DEBUG_LOG_APPEND(spec, (long long) value);
+				else
+					HID_DEBUG_LOG_APPEND(spec, (unsigned long long) value);
+			}
+		}
+		else if (conversion == 'p') {
+			spec[spec_length] = 'p';
+			spec[spec_length + 1] = '\0';
+			HID_DEBUG_LOG_APPEND(spec, (void *) (uintptr_t) value);
+		}
+		else {
+			double d;
+			memcpy(&d, &value, sizeof(d));
+			spec[spec_length] = conversion;
+			spec[spec_length + 1] = '\0';
+			HID_DEBUG_LOG_APPEND(spec, d);
+		}
+	}
+
+#undef HID_DEBUG_LOG_APPEND
+
+	/* One record per line */
+	if (length > 0 && line[length - 1] != '\n') {
+		if (length + 1 >= size)
+			length--;
+		line[length++] = '\n';
+	}
+	line[length] = '\0';
+
+	return length;
+}
+
+/* Format the oldest records of all the threads, in the order they were written */
+static int hid_debug_log_read_records(char *buffer, size_t size)
+{
+	size_t length = 0;
+	size_t i;
+
+	if (!buffer || size == 0)
+		return -1;
+
+	pthread_mutex_lock(&hid_debug_log_reader_mutex);
+
+	/* The records dropped since the last read come first */
+	for (i = 0; i <= HID_DEBUG_LOG_THREADS; i++) {
+		uint32_t *counter = (i < HID_DEBUG_LOG_THREADS)? &hid_debug_log_rings[i].dropped: &hid_debug_log_dropped;
+		uint32_t dropped = __atomic_load_n(counter, __ATOMIC_RELAXED);
+		char line[64];
+		int n;
+
+		if (dropped == 0)
+			continue;
+		n = snprintf(line, sizeof(line), "hidapi: %u debug log records dropped\n", dropped);
+		if (n < 0 || (size_t) n >= size - length)
+			break;
+		memcpy(buffer + length, line, (size_t) n);
+		length += (size_t) n;
+		__atomic_sub_fetch(counter, dropped, __ATOMIC_RELAXED);
+	}
+
+	for (;;) {
+		struct hid_debug_log_ring *oldest = NULL;
+		const struct hid_debug_log_record *record = NULL;
+		char line[512];
+		size_t line_length;
+
+		for (i = 0; i < HID_DEBUG_LOG_THREADS; i++) {
+			struct hid_debug_log_ring *ring = &hid_debug_log_rings[i];
+			uint32_t tail = ring->tail;
+
+			if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+				continue;
+			if (!record || ring->records[tail % HID_DEBUG_LOG_RECORDS].timestamp_ns < record->timestamp_ns) {
+				oldest = ring;
+				record = &ring->records[tail % HID_DEBUG_LOG_RECORDS];
+			}
+		}
+		if (!oldest)
+			break;
+
+		line_length = hid_debug_log_format(record, line, sizeof(line));
+		if (line_length >= size - length)
+			break;
+		memcpy(buffer + length, line, line_length);
+		length += line_length;
+
+		__atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+	}
+
+	buffer[length] = '\0';
+
+	pthread_mutex_unlock(&hid_debug_log_reader_mutex);
+
+	return (int) length;
+}
+
+static pthread_once_t hid_debug_log_env_once = PTHREAD_ONCE_INIT;
+
+static void hid_debug_log_read_env(void)
+{
+	const char *env = getenv("HIDAPI_DEBUG_LOG");
+
+#ifdef DEBUG_PRINTF
+	/* Debug builds log from the start */
+	__atomic_store_n(&hid_debug_log_enabled, 1, __ATOMIC_RELAXED);
+#endif
+	if (env && *env && strcmp(env, "0") != 0)
+		__atomic_store_n(&hid_debug_log_enabled, 1, __ATOMIC_RELAXED);
+}
+
+/* Turn the log on with the HIDAPI_DEBUG_LOG environment variable, once:
+   hid_init() is called again by hid_enumerate() and hid_open() */
+static void hid_debug_log_init(void)
+{
+	pthread_once(&hid_debug_log_env_once, hid_debug_log_read_env);
+}
+
+/* Debug builds write the records not read yet to stderr */
+static void hid_debug_log_exit(void)
+{
+#ifdef DEBUG_PRINTF
+	char buffer[4096];
+
+	while (hid_debug_log_read_records(buffer, sizeof(buffer)) > 0)
+		fputs(buffer, stderr);
+#endif
+}
+
+#endif
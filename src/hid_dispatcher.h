@@ -0,0 +1,286 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Thread pool of hid_dispatcher_create() (internal, not installed).
+ *
+ * Included by the hid.c of the hidraw and libusb backends, after their
+ * hid_internal_calloc(), hid_internal_free() and hid_internal_thread_start()/
+ * hid_internal_thread_join(), which it uses.
+ *
+ * The pool runs serial queues: a queue is notified by a producer when it
+ * has work, and its run function is then called by one worker at a time,
+ * so the work of a queue is done in order while the queues run in parallel.
+ *
+ * Each worker has its own list of ready queues. A notified queue goes to
+ * the list of its home worker (the queues are spread over the workers when
+ * they are attached), a queue with work left after a run goes back to the
+ * list of the worker that ran it, and a worker with an empty list steals
+ * the oldest ready queue of the others before going to sleep.
+ */
+
+#ifndef HID_DISPATCHER_H__
+#define HID_DISPATCHER_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+/* States of a queue */
+#define HID_DISPATCH_IDLE             0
+#define HID_DISPATCH_SCHEDULED        1 /* In the list of a worker */
+#define HID_DISPATCH_RUNNING          2
+#define HID_DISPATCH_RUNNING_NOTIFIED 3 /* Notified while running: to be run again */
+
+struct hid_dispatch_queue {
+	/* Does a batch of the work of the queue, returns nonzero if work is left */
+	int (*run)(struct hid_dispatch_queue *queue);
+	void *context;
+
+	struct hid_dispatcher_ *dispatcher;
+	unsigned int home;
+	int state;
+	/* Set by hid_dispatch_queue_detach() */
+	int detaching;
+
+	/* Next in the list of a worker */
+	struct hid_dispatch_queue *next;
+};
+
+struct hid_dispatch_worker {
+	struct hid_dispatcher_ *dispatcher;
+	unsigned int index;
+	struct hid_internal_thread thread;
+
+	/* Ready queues, protected by mutex */
+	pthread_mutex_t mutex;
+	struct hid_dispatch_queue *first;
+	struct hid_dispatch_queue *last;
+};
+
+struct hid_dispatcher_ {
+	struct hid_dispatch_worker *workers;
+	unsigned int num_workers;
+	/* Home of the next attached queue */
+	unsigned int next_home;
+
+	/* Number of ready queues in all the lists, and of the workers
+	   sleeping (or about to) on wakeup */
+	size_t num_ready;
+	unsigned int num_sleeping;
+	int shutdown;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t wakeup;
+	/* Signalled when a detaching queue becomes idle */
+	pthread_cond_t idle;
+};
+
+static void hid_dispatch_push(struct hid_dispatch_worker *worker, struct hid_dispatch_queue *queue)
+{
+	struct hid_dispatcher_ *dispatcher = worker->dispatcher;
+
+	queue->next = NULL;
+	pthread_mutex_lock(&worker->mutex);
+	if (worker->last)
+		worker->last->next = queue;
+	else
+		worker->first = queue;
+	worker->last = queue;
+	pthread_mutex_unlock(&worker->mutex);
+
+	__atomic_add_fetch(&dispatcher->num_ready, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&dispatcher->num_sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&dispatcher->mutex);
+		pthread_cond_signal(&dispatcher->wakeup);
+		pthread_mutex_unlock(&dispatcher->mutex);
+	}
+}
+
+static struct hid_dispatch_queue *hid_dispatch_pop(struct hid_dispatch_worker *worker)
+{
+	struct hid_dispatch_queue *queue;
+
+	pthread_mutex_lock(&worker->mutex);
+	queue = worker->first;
+	if (queue) {
+		worker->first = queue->next;
+		if (!worker->first)
+			worker->last = NULL;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	if (queue)
+		__atomic_sub_fetch(&worker->dispatcher->num_ready, 1, __ATOMIC_SEQ_CST);
+
+	return queue;
+}
+
+/* Called by a producer once the queue has work */
+static void hid_dispatch_notify(struct hid_dispatch_queue *queue)
+{
+	int state = __atomic_load_n(&queue->state, __ATOMIC_SEQ_CST);
+	int next;
+
+	do {
+		if (state == HID_DISPATCH_SCHEDULED || state == HID_DISPATCH_RUNNING_NOTIFIED)
+			return;
+		next = (state == HID_DISPATCH_IDLE)? HID_DISPATCH_SCHEDULED: HID_DISPATCH_RUNNING_NOTIFIED;
+	} while (!__atomic_compare_exchange_n(&queue->state, &state, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	if (next == HID_DISPATCH_SCHEDULED)
+		hid_dispatch_push(&queue->dispatcher->workers[queue->home], queue);
+}
+
+static void hid_dispatch_run(struct hid_dispatch_worker *worker, struct hid_dispatch_queue *queue)
+{
+	int state = HID_DISPATCH_RUNNING;
+
+	/* The work added from now on is either seen by run() or notifies the queue again */
+	__atomic_store_n(&queue->state, HID_DISPATCH_RUNNING, __ATOMIC_SEQ_CST);
+
+	if (!queue->run(queue) && __atomic_compare_exchange_n(&queue->state, &state, HID_DISPATCH_IDLE, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		if (__atomic_load_n(&queue->detaching, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&worker->dispatcher->mutex);
+			pthread_cond_broadcast(&worker->dispatcher->idle);
+			pthread_mutex_unlock(&worker->dispatcher->mutex);
+		}
+		return;
+	}
+
+	/* Work is left: after the other ready queues of this worker */
+	__atomic_store_n(&queue->state, HID_DISPATCH_SCHEDULED, __ATOMIC_SEQ_CST);
+	hid_dispatch_push(worker, queue);
+}
+
+static void *hid_dispatch_worker_thread(void *param)
+{
+	struct hid_dispatch_worker *worker = (struct hid_dispatch_worker *) param;
+	struct hid_dispatcher_ *dispatcher = worker->dispatcher;
+
+	for (;;) {
+		struct hid_dispatch_queue *queue = hid_dispatch_pop(worker);
+		unsigned int i;
+
+		/* Steal from the others, starting with the next worker */
+		for (i = 1; !queue && i < dispatcher->num_workers; i++)
+			queue = hid_dispatch_pop(&dispatcher->workers[(worker->index + i) % dispatcher->num_workers]);
+
+		if (queue) {
+			hid_dispatch_run(worker, queue);
+			continue;
+		}
+
+		pthread_mutex_lock(&dispatcher->mutex);
+		__atomic_add_fetch(&dispatcher->num_sleeping, 1, __ATOMIC_SEQ_CST);
+		/* Checked with num_sleeping set: a queue pushed from now on wakes a worker up */
+		if (__atomic_load_n(&dispatcher->num_ready, __ATOMIC_SEQ_CST) == 0 && !dispatcher->shutdown)
+			pthread_cond_wait(&dispatcher->wakeup, &dispatcher->mutex);
+		__atomic_sub_fetch(&dispatcher->num_sleeping, 1, __ATOMIC_SEQ_CST);
+		if (dispatcher->shutdown) {
+			pthread_mutex_unlock(&dispatcher->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&dispatcher->mutex);
+	}
+
+	return NULL;
+}
+
+static void hid_dispatch_queue_attach(struct hid_dispatcher_ *dispatcher, struct hid_dispatch_queue *queue, int (*run)(struct hid_dispatch_queue *), void *context)
+{
+	queue->run = run;
+	queue->context = context;
+	queue->dispatcher = dispatcher;
+	queue->home = __atomic_fetch_add(&dispatcher->next_home, 1, __ATOMIC_RELAXED) % dispatcher->num_workers;
+	queue->state = HID_DISPATCH_IDLE;
+	queue->detaching = 0;
+	queue->next = NULL;
+}
+
+/* Wait until the queue is idle for good. The producer must not notify it anymore,
+   and run() must not find work once detaching is set. */
+static void hid_dispatch_queue_detach(struct hid_dispatch_queue *queue)
+{
+	struct hid_dispatcher_ *dispatcher = queue->dispatcher;
+
+	__atomic_store_n(&queue->detaching, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&dispatcher->mutex);
+	while (__atomic_load_n(&queue->state, __ATOMIC_SEQ_CST) != HID_DISPATCH_IDLE)
+		pthread_cond_wait(&dispatcher->idle, &dispatcher->mutex);
+	pthread_mutex_unlock(&dispatcher->mutex);
+}
+
+static void hid_dispatcher_free(struct hid_dispatcher_ *dispatcher, unsigned int num_started)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&dispatcher->mutex);
+	dispatcher->shutdown = 1;
+	pthread_cond_broadcast(&dispatcher->wakeup);
+	pthread_mutex_unlock(&dispatcher->mutex);
+
+	for (i = 0; i < num_started; i++)
+		hid_internal_thread_join(&dispatcher->workers[i].thread);
+	for (i = 0; i < dispatcher->num_workers; i++)
+		pthread_mutex_destroy(&dispatcher->workers[i].mutex);
+
+	pthread_cond_destroy(&dispatcher->idle);
+	pthread_cond_destroy(&dispatcher->wakeup);
+	pthread_mutex_destroy(&dispatcher->mutex);
+	hid_internal_free(dispatcher->workers);
+	hid_internal_free(dispatcher);
+}
+
+/* Returns NULL if out of memory or if a thread couldn't be started */
+static struct hid_dispatcher_ *hid_dispatcher_new(unsigned int num_workers)
+{
+	struct hid_dispatcher_ *dispatcher;
+	unsigned int i;
+
+	dispatcher = (struct hid_dispatcher_ *) hid_internal_calloc(1, sizeof(*dispatcher));
+	if (!dispatcher)
+		return NULL;
+	dispatcher->workers = (struct hid_dispatch_worker *) hid_internal_calloc(num_workers, sizeof(*dispatcher->workers));
+	if (!dispatcher->workers) {
+		hid_internal_free(dispatcher);
+		return NULL;
+	}
+
+	dispatcher->num_workers = num_workers;
+	pthread_mutex_init(&dispatcher->mutex, NULL);
+	pthread_cond_init(&dispatcher->wakeup, NULL);
+	pthread_cond_init(&dispatcher->idle, NULL);
+	for (i = 0; i < num_workers; i++) {
+		dispatcher->workers[i].dispatcher = dispatcher;
+		dispatcher->workers[i].index = i;
+		pthread_mutex_init(&dispatcher->workers[i].mutex, NULL);
+	}
+
+	for (i = 0; i < num_workers; i++) {
+		if (hid_internal_thread_start(&dispatcher->workers[i].thread, &hid_dispatch_worker_thread, &dispatcher->workers[i]) < 0) {
+			hid_dispatcher_free(dispatcher, i);
+			return NULL;
+		}
+	}
+
+	return dispatcher;
+}
+
+#endif
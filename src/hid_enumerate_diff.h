@@ -0,0 +1,95 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Snapshot merge of hid_enumerate_diff() (internal, not installed).
+ *
+ * Included by the hid.c of every backend, after hidapi.h. The backend
+ * checks the parameters and enumerates; only a successful enumeration
+ * is merged, so that a failure never shows up as all devices removed.
+ */
+
+#ifndef HID_ENUMERATE_DIFF_H__
+#define HID_ENUMERATE_DIFF_H__
+
+#include <string.h>
+
+static int hid_internal_same_device(const struct hid_device_info *a, const struct hid_device_info *b)
+{
+	if (a->vendor_id != b->vendor_id || a->product_id != b->product_id ||
+	    a->usage_page != b->usage_page || a->usage != b->usage ||
+	    a->interface_number != b->interface_number)
+		return 0;
+
+	if (!a->path || !b->path)
+		return a->path == b->path;
+
+	return strcmp(a->path, b->path) == 0;
+}
+
+/* Merge current, a new enumeration which it takes over, into *devs.
+   Returns the number of added and removed entries. */
+static int hid_internal_enumerate_merge(struct hid_device_info *current, struct hid_device_info **devs, struct hid_device_info **added, struct hid_device_info **removed)
+{
+	struct hid_device_info *kept = NULL, **kept_tail = &kept;
+	struct hid_device_info *gone = NULL, **gone_tail = &gone;
+	struct hid_device_info *prev;
+	int changes = 0;
+
+	/* Split the previous snapshot into the entries that are still present and the removed ones */
+	prev = *devs;
+	while (prev) {
+		struct hid_device_info *next = prev->next;
+		struct hid_device_info **cur = &current;
+
+		prev->next = NULL;
+		while (*cur && !hid_internal_same_device(prev, *cur))
+			cur = &(*cur)->next;
+
+		if (*cur) {
+			/* Still present: keep the previous entry, so pointers to it remain valid */
+			struct hid_device_info *duplicate = *cur;
+			*cur = duplicate->next;
+			duplicate->next = NULL;
+			hid_free_enumeration(duplicate);
+
+			*kept_tail = prev;
+			kept_tail = &prev->next;
+		}
+		else {
+			*gone_tail = prev;
+			gone_tail = &prev->next;
+			changes++;
+		}
+		prev = next;
+	}
+
+	/* Whatever is left of the new enumeration wasn't there before */
+	*added = current;
+	*kept_tail = current;
+	for (; current; current = current->next)
+		changes++;
+
+	*devs = kept;
+	*removed = gone;
+
+	return changes;
+}
+
+#endif
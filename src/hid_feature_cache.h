@@ -0,0 +1,145 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Feature report cache of hid_set_feature_report_cache() (internal, not installed).
+ *
+ * Included by the hid.c of the hidraw and libusb backends, after their
+ * hid_internal_malloc(), hid_internal_calloc() and hid_internal_free(),
+ * which it uses.
+ *
+ * The cache belongs to the device and is only used by the API calls made
+ * on it, so it has no lock of its own. A NULL cache is a disabled one.
+ */
+
+#ifndef HID_FEATURE_CACHE_H__
+#define HID_FEATURE_CACHE_H__
+
+#include <string.h>
+#include <time.h>
+
+/* Cached result of hid_get_feature_report() for a single report ID */
+struct hid_feature_report_cache_entry {
+	/* CLOCK_MONOTONIC time in milliseconds after which the entry is stale */
+	unsigned long long expires;
+	size_t length;
+	unsigned char data[];
+};
+
+struct hid_feature_report_cache {
+	int ttl_milliseconds;
+	struct hid_feature_report_cache_entry *entries[256];
+};
+
+static unsigned long long hid_internal_monotonic_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+static void hid_internal_feature_cache_invalidate(struct hid_feature_report_cache *cache, unsigned char report_id)
+{
+	if (cache) {
+		hid_internal_free(cache->entries[report_id]);
+		cache->entries[report_id] = NULL;
+	}
+}
+
+static void hid_internal_feature_cache_clear(struct hid_feature_report_cache *cache)
+{
+	int i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < 256; i++) {
+		hid_internal_free(cache->entries[i]);
+		cache->entries[i] = NULL;
+	}
+}
+
+/* Returns the number of bytes copied to data, or -1 if there is no usable entry */
+static int hid_internal_feature_cache_get(struct hid_feature_report_cache *cache, unsigned char *data, size_t length)
+{
+	struct hid_feature_report_cache_entry *entry;
+
+	if (!cache || !data || length == 0)
+		return -1;
+
+	entry = cache->entries[data[0]];
+	if (!entry || entry->length > length)
+		return -1;
+
+	if (hid_internal_monotonic_ms() >= entry->expires) {
+		hid_internal_feature_cache_invalidate(cache, data[0]);
+		return -1;
+	}
+
+	memcpy(data, entry->data, entry->length);
+	return (int)entry->length;
+}
+
+static void hid_internal_feature_cache_put(struct hid_feature_report_cache *cache, const unsigned char *data, size_t length)
+{
+	struct hid_feature_report_cache_entry *entry;
+	unsigned char report_id = data[0];
+
+	if (!cache)
+		return;
+
+	entry = cache->entries[report_id];
+	if (!entry || entry->length != length) {
+		hid_internal_free(entry);
+		entry = (struct hid_feature_report_cache_entry*) hid_internal_malloc(sizeof(*entry) + length);
+		cache->entries[report_id] = entry;
+		if (!entry)
+			return;
+		entry->length = length;
+	}
+
+	memcpy(entry->data, data, length);
+	entry->expires = hid_internal_monotonic_ms() + (unsigned long long)cache->ttl_milliseconds;
+}
+
+/* A ttl_milliseconds <= 0 frees the cache. Returns -1 if out of memory. */
+static int hid_internal_feature_cache_set(struct hid_feature_report_cache **cache, int ttl_milliseconds)
+{
+	if (ttl_milliseconds <= 0) {
+		hid_internal_feature_cache_clear(*cache);
+		hid_internal_free(*cache);
+		*cache = NULL;
+		return 0;
+	}
+
+	if (!*cache) {
+		*cache = (struct hid_feature_report_cache*) hid_internal_calloc(1, sizeof(struct hid_feature_report_cache));
+		if (!*cache)
+			return -1;
+	}
+	else {
+		/* Entries cached with the previous TTL would expire at the wrong time */
+		hid_internal_feature_cache_clear(*cache);
+	}
+
+	(*cache)->ttl_milliseconds = ttl_milliseconds;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,480 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Health monitoring of hid_set_health_monitor() (internal, not installed).
+ *
+ * Included by the hid.c of the hidraw and libusb backends, after their
+ * executor and hid_internal_thread_start()/hid_internal_thread_join(),
+ * which it uses, and before their struct hid_device_, which embeds a
+ * struct hid_health_monitor.
+ *
+ * The reader of each device records the arrival of the reports in its
+ * hid_health_monitor, a single thread checks all the monitored devices
+ * on a hashed timer wheel with one slot per millisecond.
+ * With an executor timer, the wheel is advanced by timer tasks instead of a thread.
+ */
+
+#ifndef HID_HEALTH_H__
+#define HID_HEALTH_H__
+
+#include <pthread.h>
+#include <time.h>
+
+/* Health monitoring state of a device, see hid_set_health_monitor() */
+struct hid_health_monitor {
+	hid_device *dev;
+	/* Set while the device is monitored */
+	int enabled;
+
+	/* Written by the reader of the device, read by the health thread.
+	   Times are CLOCK_MONOTONIC microseconds. */
+	unsigned long long started_us;
+	unsigned long long last_report_us;
+	unsigned long long reports;
+	unsigned long long late_reports;
+	unsigned long long last_gap_us;
+	unsigned long long min_gap_us;
+	unsigned long long max_gap_us;
+	unsigned long long total_gap_us;
+	unsigned long long expected_interval_us;
+
+	/* Protected by hid_health_context.mutex */
+	unsigned int silence_threshold_ms;
+	hid_health_callback_fn callback;
+	void *user_data;
+	int stalled;
+	unsigned long long reports_at_stall;
+	/* Position on the timer wheel, pprev is NULL when not scheduled */
+	unsigned long long deadline_ms;
+	struct hid_health_monitor *next;
+	struct hid_health_monitor **pprev;
+};
+
+#define HEALTH_WHEEL_SLOTS 512
+
+/* Clock of hid_health_context.condition. Not every platform allows to choose
+   it (same as HIDAPI_THREAD_CLOCK of libusb/hidapi_thread_pthread.h). */
+#if defined(CLOCK_MONOTONIC) && !defined(__APPLE__) && !defined(__HAIKU__)
+#define HEALTH_CONDITION_CLOCK CLOCK_MONOTONIC
+#define HEALTH_CONDATTR_SETCLOCK
+#else
+#define HEALTH_CONDITION_CLOCK CLOCK_REALTIME
+#endif
+
+static struct hid_health_context {
+	pthread_mutex_t mutex;
+	pthread_cond_t condition;
+	int condition_ready;
+
+	struct hid_internal_thread thread;
+	int thread_running;
+	/* With executor.timer: number of timer tasks pending or running,
+	   and the deadline of the last one armed (~0ULL once it ran) */
+	int timer_armed;
+	unsigned long long timer_ms;
+	int shutdown;
+
+	/* Number of monitors on the wheel */
+	size_t num_monitors;
+	/* Millisecond of the next slot to expire */
+	unsigned long long current_ms;
+	struct hid_health_monitor *slots[HEALTH_WHEEL_SLOTS];
+
+	/* Monitor whose callback is running, and whether
+	   hid_set_health_monitor() was called for it meanwhile */
+	struct hid_health_monitor *dispatching;
+	int dispatching_changed;
+	pthread_t dispatching_thread;
+} hid_health_context = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.condition_ready = 0,
+	.thread_running = 0,
+	.num_monitors = 0,
+	.dispatching = NULL
+};
+
+static unsigned long long hid_internal_monotonic_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + (unsigned long long)ts.tv_nsec / 1000ULL;
+}
+
+/* Called by the reader of the device for each Input report */
+static void hid_internal_health_report(struct hid_health_monitor *h)
+{
+	unsigned long long now, reports;
+
+	if (!__atomic_load_n(&h->enabled, __ATOMIC_ACQUIRE))
+		return;
+
+	now = hid_internal_monotonic_us();
+	reports = __atomic_load_n(&h->reports, __ATOMIC_RELAXED);
+
+	if (reports > 0) {
+		unsigned long long gap = now - __atomic_load_n(&h->last_report_us, __ATOMIC_RELAXED);
+		unsigned long long expected = __atomic_load_n(&h->expected_interval_us, __ATOMIC_RELAXED);
+
+		__atomic_store_n(&h->last_gap_us, gap, __ATOMIC_RELAXED);
+		if (reports == 1 || gap < __atomic_load_n(&h->min_gap_us, __ATOMIC_RELAXED))
+			__atomic_store_n(&h->min_gap_us, gap, __ATOMIC_RELAXED);
+		if (gap > __atomic_load_n(&h->max_gap_us, __ATOMIC_RELAXED))
+			__atomic_store_n(&h->max_gap_us, gap, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->total_gap_us, __atomic_load_n(&h->total_gap_us, __ATOMIC_RELAXED) + gap, __ATOMIC_RELAXED);
+		if (expected > 0 && gap > 2 * expected)
+			__atomic_store_n(&h->late_reports, __atomic_load_n(&h->late_reports, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&h->last_report_us, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->reports, reports + 1, __ATOMIC_RELEASE);
+}
+
+static void hid_internal_health_stats(struct hid_health_monitor *h, struct hid_health_stats *stats)
+{
+	unsigned long long reports = __atomic_load_n(&h->reports, __ATOMIC_ACQUIRE);
+	unsigned long long last = (reports > 0)? __atomic_load_n(&h->last_report_us, __ATOMIC_RELAXED): h->started_us;
+	unsigned long long now = hid_internal_monotonic_us();
+
+	stats->reports = reports;
+	stats->late_reports = __atomic_load_n(&h->late_reports, __ATOMIC_RELAXED);
+	stats->last_gap_us = __atomic_load_n(&h->last_gap_us, __ATOMIC_RELAXED);
+	stats->min_gap_us = __atomic_load_n(&h->min_gap_us, __ATOMIC_RELAXED);
+	stats->max_gap_us = __atomic_load_n(&h->max_gap_us, __ATOMIC_RELAXED);
+	stats->mean_gap_us = (reports > 1)? __atomic_load_n(&h->total_gap_us, __ATOMIC_RELAXED) / (reports - 1): 0;
+	stats->silence_us = (now > last)? now - last: 0;
+}
+
+/* The functions below are called with hid_health_context.mutex held */
+
+static void hid_internal_health_schedule(struct hid_health_monitor *h, unsigned long long deadline_ms)
+{
+	struct hid_health_monitor **slot;
+
+	/* An expired deadline goes to the next slot to be checked */
+	if (deadline_ms < hid_health_context.current_ms)
+		deadline_ms = hid_health_context.current_ms;
+
+	h->deadline_ms = deadline_ms;
+	slot = &hid_health_context.slots[deadline_ms % HEALTH_WHEEL_SLOTS];
+	h->next = *slot;
+	if (h->next)
+		h->next->pprev = &h->next;
+	h->pprev = slot;
+	*slot = h;
+	hid_health_context.num_monitors++;
+}
+
+static void hid_internal_health_unschedule(struct hid_health_monitor *h)
+{
+	if (!h->pprev)
+		return;
+
+	*h->pprev = h->next;
+	if (h->next)
+		h->next->pprev = h->pprev;
+	h->next = NULL;
+	h->pprev = NULL;
+	hid_health_context.num_monitors--;
+}
+
+/* Deadline of a monitor that isn't stalled: one silence threshold after the last report */
+static unsigned long long hid_internal_health_deadline(struct hid_health_monitor *h)
+{
+	unsigned long long last = (__atomic_load_n(&h->reports, __ATOMIC_ACQUIRE) > 0)? __atomic_load_n(&h->last_report_us, __ATOMIC_RELAXED): h->started_us;
+
+	return (last + (unsigned long long)h->silence_threshold_ms * 1000ULL + 999ULL) / 1000ULL;
+}
+
+static void hid_internal_health_check(struct hid_health_monitor *h, unsigned long long tick)
+{
+	unsigned long long reports = __atomic_load_n(&h->reports, __ATOMIC_ACQUIRE);
+	struct hid_health_stats stats;
+	hid_health_event event;
+	hid_health_callback_fn callback;
+	void *user_data;
+
+	if (!h->stalled) {
+		unsigned long long deadline = hid_internal_health_deadline(h);
+		if (deadline > tick) {
+			/* A report came in time */
+			hid_internal_health_schedule(h, deadline);
+			return;
+		}
+		h->stalled = 1;
+		h->reports_at_stall = reports;
+		event = HID_API_HEALTH_STALLED;
+	}
+	else {
+		if (reports == h->reports_at_stall) {
+			/* Still silent, check again later */
+			hid_internal_health_schedule(h, tick + h->silence_threshold_ms);
+			return;
+		}
+		h->stalled = 0;
+		event = HID_API_HEALTH_RECOVERED;
+	}
+
+	hid_internal_health_stats(h, &stats);
+	callback = h->callback;
+	user_data = h->user_data;
+
+	/* The callback may call hid_set_health_monitor() */
+	hid_health_context.dispatching = h;
+	hid_health_context.dispatching_changed = 0;
+	hid_health_context.dispatching_thread = pthread_self();
+	pthread_mutex_unlock(&hid_health_context.mutex);
+
+	callback(h->dev, event, &stats, user_data);
+
+	pthread_mutex_lock(&hid_health_context.mutex);
+	hid_health_context.dispatching = NULL;
+	pthread_cond_broadcast(&hid_health_context.condition);
+
+	/* Otherwise, hid_set_health_monitor() took care of the monitor (and the device may be gone) */
+	if (!hid_health_context.dispatching_changed)
+		hid_internal_health_schedule(h, h->stalled? tick + h->silence_threshold_ms: hid_internal_health_deadline(h));
+}
+
+/* Check the monitors of the slots up to the current millisecond */
+static void hid_internal_health_expire(void)
+{
+	unsigned long long now_ms = hid_internal_monotonic_us() / 1000ULL;
+
+	/* Visiting a full revolution of slots is enough to catch up */
+	if (now_ms > hid_health_context.current_ms + HEALTH_WHEEL_SLOTS)
+		hid_health_context.current_ms = now_ms - HEALTH_WHEEL_SLOTS;
+
+	while (hid_health_context.current_ms <= now_ms && !hid_health_context.shutdown) {
+		unsigned long long tick = hid_health_context.current_ms;
+		struct hid_health_monitor **slot = &hid_health_context.slots[tick % HEALTH_WHEEL_SLOTS];
+		struct hid_health_monitor *pending = *slot;
+		struct hid_health_monitor *h;
+
+		/* Detach the slot, the monitors rescheduled meanwhile go to the next ticks */
+		*slot = NULL;
+		if (pending)
+			pending->pprev = &pending;
+		hid_health_context.current_ms = tick + 1;
+
+		while ((h = pending) != NULL) {
+			hid_internal_health_unschedule(h);
+			if (h->deadline_ms > tick)
+				hid_internal_health_schedule(h, h->deadline_ms); /* Later revolution */
+			else
+				hid_internal_health_check(h, tick);
+		}
+	}
+}
+
+/* The earliest deadline on the wheel, ~0ULL if it is empty.
+   Sleeping until then rather than tick by tick keeps an idle wheel quiet. */
+static unsigned long long hid_internal_health_next_deadline(void)
+{
+	unsigned long long next = ~0ULL;
+	struct hid_health_monitor *h;
+	size_t i;
+
+	for (i = 0; i < HEALTH_WHEEL_SLOTS; i++) {
+		for (h = hid_health_context.slots[i]; h; h = h->next) {
+			if (h->deadline_ms < next)
+				next = h->deadline_ms;
+		}
+	}
+
+	return next;
+}
+
+static void *health_thread(void *param)
+{
+	(void) param;
+
+	pthread_mutex_lock(&hid_health_context.mutex);
+
+	while (!hid_health_context.shutdown) {
+		struct timespec ts;
+		unsigned long long next_ms, now_ms, delay_ms;
+
+		if (hid_health_context.num_monitors == 0) {
+			pthread_cond_wait(&hid_health_context.condition, &hid_health_context.mutex);
+			continue;
+		}
+
+		hid_internal_health_expire();
+
+		/* Sleep until the earliest deadline, the wheel is on CLOCK_MONOTONIC.
+		   hid_set_health_monitor() wakes the thread up for an earlier one. */
+		next_ms = hid_internal_health_next_deadline();
+		now_ms = hid_internal_monotonic_us() / 1000ULL;
+		if (next_ms == ~0ULL || next_ms <= now_ms)
+			continue;
+		delay_ms = next_ms - now_ms;
+		clock_gettime(HEALTH_CONDITION_CLOCK, &ts);
+		ts.tv_sec += (time_t)(delay_ms / 1000ULL);
+		ts.tv_nsec += (long)(delay_ms % 1000ULL) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&hid_health_context.condition, &hid_health_context.mutex, &ts);
+	}
+
+	pthread_mutex_unlock(&hid_health_context.mutex);
+	return NULL;
+}
+
+static void HID_API_CALL health_timer(void *param);
+
+/* With executor.timer: arm a timer for the earliest deadline,
+   unless a pending timer runs by then */
+static void hid_internal_health_arm_timer(void)
+{
+	unsigned long long now_ms, next_ms;
+	unsigned int delay_ms;
+
+	if (hid_health_context.shutdown || hid_health_context.num_monitors == 0)
+		return;
+
+	next_ms = hid_internal_health_next_deadline();
+	if (hid_health_context.timer_armed > 0 && hid_health_context.timer_ms <= next_ms)
+		return;
+
+	now_ms = hid_internal_monotonic_us() / 1000ULL;
+	delay_ms = (next_ms > now_ms)? (unsigned int)(next_ms - now_ms): 0;
+
+	if (executor.timer(executor.context, delay_ms, health_timer, NULL) != 0) {
+		LOG("hid_set_health_monitor: the executor failed to arm a timer\n");
+		return;
+	}
+	hid_health_context.timer_armed++;
+	hid_health_context.timer_ms = next_ms;
+}
+
+static void HID_API_CALL health_timer(void *param)
+{
+	(void) param;
+
+	pthread_mutex_lock(&hid_health_context.mutex);
+
+	if (!hid_health_context.shutdown)
+		hid_internal_health_expire();
+
+	/* Another pending timer may be due after the next deadline: arm one, at worst twice */
+	hid_health_context.timer_armed--;
+	hid_health_context.timer_ms = ~0ULL;
+	hid_internal_health_arm_timer();
+	/* For hid_internal_health_exit() */
+	pthread_cond_broadcast(&hid_health_context.condition);
+
+	pthread_mutex_unlock(&hid_health_context.mutex);
+}
+
+static void hid_internal_health_exit(void)
+{
+	pthread_mutex_lock(&hid_health_context.mutex);
+	hid_health_context.shutdown = 1;
+
+	/* The timer tasks must be done before hid_exit() returns */
+	while (hid_health_context.timer_armed)
+		pthread_cond_wait(&hid_health_context.condition, &hid_health_context.mutex);
+
+	if (!hid_health_context.thread_running) {
+		pthread_mutex_unlock(&hid_health_context.mutex);
+		return;
+	}
+	pthread_cond_broadcast(&hid_health_context.condition);
+	pthread_mutex_unlock(&hid_health_context.mutex);
+
+	hid_internal_thread_join(&hid_health_context.thread);
+	hid_health_context.thread_running = 0;
+}
+
+/* Start, restart or (with a zero silence_threshold_ms) stop the monitoring of dev.
+   The callback is checked by the caller. Returns -1 if the health thread fails to start. */
+static int hid_internal_health_set(struct hid_health_monitor *h, hid_device *dev, unsigned int expected_interval_us, unsigned int silence_threshold_ms, hid_health_callback_fn callback, void *user_data)
+{
+	unsigned long long now_us;
+
+	pthread_mutex_lock(&hid_health_context.mutex);
+
+	/* Wait for the callback of this device to return, unless called from it */
+	while (hid_health_context.dispatching == h && !pthread_equal(pthread_self(), hid_health_context.dispatching_thread))
+		pthread_cond_wait(&hid_health_context.condition, &hid_health_context.mutex);
+	if (hid_health_context.dispatching == h)
+		hid_health_context.dispatching_changed = 1;
+
+	hid_internal_health_unschedule(h);
+	__atomic_store_n(&h->enabled, 0, __ATOMIC_RELEASE);
+
+	if (silence_threshold_ms == 0) {
+		pthread_mutex_unlock(&hid_health_context.mutex);
+		return 0;
+	}
+
+	if (!hid_health_context.condition_ready) {
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+#ifdef HEALTH_CONDATTR_SETCLOCK
+		pthread_condattr_setclock(&attr, HEALTH_CONDITION_CLOCK);
+#endif
+		pthread_cond_init(&hid_health_context.condition, &attr);
+		pthread_condattr_destroy(&attr);
+		hid_health_context.condition_ready = 1;
+	}
+
+	hid_health_context.shutdown = 0;
+	if (!executor.timer && !hid_health_context.thread_running) {
+		if (hid_internal_thread_start(&hid_health_context.thread, &health_thread, NULL) < 0) {
+			pthread_mutex_unlock(&hid_health_context.mutex);
+			return -1;
+		}
+		hid_health_context.thread_running = 1;
+	}
+
+	now_us = hid_internal_monotonic_us();
+
+	h->dev = dev;
+	h->silence_threshold_ms = silence_threshold_ms;
+	h->callback = callback;
+	h->user_data = user_data;
+	h->stalled = 0;
+	h->started_us = now_us;
+	__atomic_store_n(&h->expected_interval_us, (unsigned long long)expected_interval_us, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->reports, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->late_reports, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->last_gap_us, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->min_gap_us, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->max_gap_us, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->total_gap_us, 0, __ATOMIC_RELAXED);
+
+	/* An idle wheel restarts from the current time */
+	if (hid_health_context.num_monitors == 0 && !hid_health_context.dispatching)
+		hid_health_context.current_ms = now_us / 1000ULL;
+	hid_internal_health_schedule(h, hid_internal_health_deadline(h));
+	if (executor.timer)
+		hid_internal_health_arm_timer();
+
+	__atomic_store_n(&h->enabled, 1, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&hid_health_context.condition);
+	pthread_mutex_unlock(&hid_health_context.mutex);
+
+	return 0;
+}
+
+#endif
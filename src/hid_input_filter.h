@@ -0,0 +1,96 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Input report filter of hid_set_input_filter() (internal, not installed).
+ *
+ * Included by the hid.c of the hidraw and libusb backends, after their
+ * hid_internal_malloc() and hid_internal_free(), which it uses.
+ *
+ * The filter has no lock of its own: the backend runs it and replaces it
+ * under the lock of its reader.
+ */
+
+#ifndef HID_INPUT_FILTER_H__
+#define HID_INPUT_FILTER_H__
+
+#include <string.h>
+
+/* See hid_set_input_filter() */
+struct hid_input_filter_state {
+	struct hid_input_filter spec;
+	/* The last delivered report per Report ID (only [0] is used without
+	   numbered reports), compared by ignore_unchanged */
+	unsigned char *last[256];
+	size_t last_length[256];
+};
+
+/* Returns the number of bytes of the report to deliver, 0 to drop it */
+static size_t hid_internal_input_filter(struct hid_input_filter_state *f, const unsigned char *data, size_t length)
+{
+	const struct hid_input_filter *spec = &f->spec;
+	unsigned char id = 0;
+
+	if (spec->numbered_reports) {
+		id = data[0];
+		if (!(spec->report_ids[id / 8] & (1 << (id % 8))))
+			return 0;
+	}
+
+	if (spec->ignore_unchanged) {
+		unsigned char *last = f->last[id];
+		int changed = (last == NULL || f->last_length[id] != length);
+		size_t i;
+
+		for (i = 0; i < length && !changed; i++) {
+			unsigned char mask = (i < spec->mask_length)? spec->mask[i]: 0xFF;
+			changed = ((data[i] ^ last[i]) & mask) != 0;
+		}
+		if (!changed)
+			return 0;
+
+		if (f->last_length[id] != length) {
+			/* Without memory every report counts as changed */
+			hid_internal_free(last);
+			last = (unsigned char *) hid_internal_malloc(length);
+			f->last[id] = last;
+			f->last_length[id] = last? length: 0;
+		}
+		if (last)
+			memcpy(last, data, length);
+	}
+
+	if (spec->trim_length > 0 && spec->trim_length < length)
+		return spec->trim_length;
+	return length;
+}
+
+static void hid_internal_input_filter_free(struct hid_input_filter_state *f)
+{
+	int i;
+
+	if (!f)
+		return;
+
+	for (i = 0; i < 256; i++)
+		hid_internal_free(f->last[i]);
+	hid_internal_free(f);
+}
+
+#endif
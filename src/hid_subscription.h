@@ -0,0 +1,182 @@
+/*******************************************************
+ HIDAPI - Multi-Platform library for
+ communication with HID devices.
+
+ libusb/hidapi Team
+
+ Copyright 2023, All Rights Reserved.
+
+ At the discretion of the user of this library,
+ this software may be licensed under the terms of the
+ GNU General Public License v3, a BSD-Style license, or the
+ original HIDAPI license as outlined in the LICENSE.txt,
+ LICENSE-gpl3.txt, LICENSE-bsd.txt, and LICENSE-orig.txt
+ files located at the root of the source distribution.
+ These files may also be found in the public source
+ code repository located at:
+        https://github.com/libusb/hidapi .
+********************************************************/
+
+/*
+ * Input report ring of hid_subscribe() and hid_subscribe_dispatch()
+ * (internal, not installed).
+ *
+ * Included by the hid.c of the hidraw and libusb backends, after
+ * hid_dispatcher.h and their hid_internal_wait_state, which the consumer
+ * of a subscription sleeps on, and hid_internal_wait_notify(), which wakes
+ * it up. The backend links the subscriptions to its devices, pushes the
+ * reports from its reader and implements the blocking reads.
+ */
+
+#ifndef HID_SUBSCRIPTION_H__
+#define HID_SUBSCRIPTION_H__
+
+#include <string.h>
+
+/* A subscriber to the input reports, see hid_subscribe().
+   The reports go through a lock-free single-producer (the backend's reader)
+   single-consumer (the subscriber) ring. */
+struct hid_subscription_ {
+	hid_device *dev;
+	/* Next in dev->subscriptions */
+	struct hid_subscription_ *next;
+
+	hid_subscription_overflow overflow;
+	size_t report_length;
+	/* One slot more than the capacity, so that the producer never
+	   overwrites the slot the consumer is copying from */
+	size_t num_slots;
+	size_t *lengths;
+	unsigned char *reports;
+
+	/* Free-running counters. head is only written by the producer,
+	   tail by the consumer and by the producer when it drops the oldest report. */
+	size_t head;
+	size_t tail;
+	size_t dropped;
+	/* Set once no more reports will be pushed */
+	int finished;
+
+	/* Lets the consumer sleep while the ring is empty */
+	hid_internal_wait_state wait_state;
+	int waiting;
+
+	/* Set by hid_subscribe_dispatch(): the consumer is the worker of
+	   the dispatcher running dispatch_queue */
+	hid_dispatcher *dispatcher;
+	struct hid_dispatch_queue dispatch_queue;
+	hid_input_callback_fn callback;
+	void *user_data;
+	unsigned char *dispatch_buf;
+	/* Set once the callback was told that the device is gone */
+	int end_dispatched;
+};
+
+static void hid_internal_subscription_wakeup(hid_subscription *sub)
+{
+	hid_internal_wait_notify(&sub->wait_state);
+}
+
+/* Producer side: queue a report, or drop one according to the overflow policy */
+static void hid_internal_subscription_push(hid_subscription *sub, const unsigned char *data, size_t length)
+{
+	size_t head = sub->head;
+	size_t tail = __atomic_load_n(&sub->tail, __ATOMIC_ACQUIRE);
+	size_t slot;
+
+	while (head - tail >= sub->num_slots - 1) {
+		if (sub->overflow == HID_API_SUBSCRIPTION_DROP_NEWEST) {
+			__atomic_store_n(&sub->dropped, sub->dropped + 1, __ATOMIC_RELAXED);
+			return;
+		}
+
+		/* Drop the oldest report, unless the consumer has just taken it */
+		if (__atomic_compare_exchange_n(&sub->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&sub->dropped, sub->dropped + 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+
+	if (length > sub->report_length)
+		length = sub->report_length;
+
+	slot = head % sub->num_slots;
+	memcpy(sub->reports + slot * sub->report_length, data, length);
+	sub->lengths[slot] = length;
+	__atomic_store_n(&sub->head, head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&sub->waiting, __ATOMIC_SEQ_CST))
+		hid_internal_subscription_wakeup(sub);
+	if (sub->dispatcher)
+		hid_dispatch_notify(&sub->dispatch_queue);
+}
+
+/* Consumer side: returns the length of the report copied into data, 0 if the ring is empty */
+static int hid_internal_subscription_pop(hid_subscription *sub, unsigned char *data, size_t length)
+{
+	size_t tail = __atomic_load_n(&sub->tail, __ATOMIC_ACQUIRE);
+
+	while (tail != __atomic_load_n(&sub->head, __ATOMIC_SEQ_CST)) {
+		size_t slot = tail % sub->num_slots;
+		size_t report_length = sub->lengths[slot];
+
+		if (report_length > length)
+			report_length = length;
+		memcpy(data, sub->reports + slot * sub->report_length, report_length);
+
+		/* If the producer dropped this report meanwhile, the copy may be torn:
+		   start over from the new tail */
+		if (__atomic_compare_exchange_n(&sub->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return (int) report_length;
+	}
+
+	return 0;
+}
+
+/* No more reports will be pushed: wake the consumer up so it sees the end of the stream */
+static void hid_internal_subscription_finish(hid_subscription *sub)
+{
+	__atomic_store_n(&sub->finished, 1, __ATOMIC_SEQ_CST);
+	hid_internal_subscription_wakeup(sub);
+	if (sub->dispatcher)
+		hid_dispatch_notify(&sub->dispatch_queue);
+}
+
+/* Maximum number of reports passed to the callback of a subscription in a row,
+   before the worker moves on to the other subscriptions */
+#define HID_DISPATCH_BATCH 16
+
+/* Run function of the dispatch_queue of a subscription */
+static int hid_internal_subscription_dispatch(struct hid_dispatch_queue *queue)
+{
+	hid_subscription *sub = (hid_subscription *) queue->context;
+	int i;
+
+	for (i = 0; i < HID_DISPATCH_BATCH; i++) {
+		int res;
+
+		if (__atomic_load_n(&queue->detaching, __ATOMIC_SEQ_CST))
+			return 0;
+
+		res = hid_internal_subscription_pop(sub, sub->dispatch_buf, sub->report_length);
+		if (res == 0 && __atomic_load_n(&sub->finished, __ATOMIC_SEQ_CST)) {
+			/* The last report may have been pushed right before finished was set */
+			res = hid_internal_subscription_pop(sub, sub->dispatch_buf, sub->report_length);
+			if (res == 0) {
+				if (!sub->end_dispatched) {
+					sub->end_dispatched = 1;
+					sub->callback(sub->dev, NULL, 0, sub->user_data);
+				}
+				return 0;
+			}
+		}
+		if (res == 0)
+			return 0;
+
+		sub->callback(sub->dev, sub->dispatch_buf, (size_t) res, sub->user_data);
+	}
+
+	return 1;
+}
+
+#endif
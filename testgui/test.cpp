@@ -22,12 +22,170 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <math.h>
 
 #ifdef _WIN32
 	// Thanks Microsoft, but I know how to use strncpy().
 	#pragma warning(disable:4996)
 #endif
 
+// An Input report, as queued by the InputReader.
+struct ReceivedReport {
+	FXlong time; // nanoseconds, FXThread::time()
+	int length;
+	unsigned char data[256];
+};
+
+// Counters of the InputReader since the last call to takeStats().
+struct InputStats {
+	FXlong reports;
+	FXlong bytes;
+	FXlong dropped;
+	// Inter-arrival times, in microseconds
+	FXlong gaps;
+	double gap_sum;
+	double gap_sum_sq;
+	// Reports waiting in the queue
+	int queue_depth;
+	bool error;
+};
+
+// Reads the device in the background, so that the GUI thread doesn't fall
+// behind at high report rates: the reports are queued in a ring buffer,
+// the GUI shows them and the statistics on its timer.
+class InputReader : public FXThread {
+public:
+	enum { QUEUE_SIZE = 4096 };
+
+	InputReader(hid_device *dev);
+	virtual ~InputReader();
+
+	// Stop the thread and wait for it.
+	void stop();
+
+	// Move up to max queued reports to out, returns their number.
+	int takeReports(ReceivedReport *out, int max);
+	// Get the counters and reset them.
+	void takeStats(InputStats &stats);
+
+	virtual FXint run();
+
+private:
+	hid_device *device;
+	FXMutex mutex;
+	bool stopping;
+
+	// Ring buffer of the received reports, the oldest is dropped when full
+	ReceivedReport *queue;
+	int head;
+	int count;
+
+	InputStats stats;
+	FXlong last_time;
+};
+
+InputReader::InputReader(hid_device *dev)
+	: device(dev), stopping(false), head(0), count(0), last_time(0)
+{
+	queue = new ReceivedReport[QUEUE_SIZE];
+	memset(&stats, 0, sizeof(stats));
+}
+
+InputReader::~InputReader()
+{
+	stop();
+	delete [] queue;
+}
+
+void
+InputReader::stop()
+{
+	mutex.lock();
+	stopping = true;
+	mutex.unlock();
+
+	if (running())
+		join();
+}
+
+FXint
+InputReader::run()
+{
+	unsigned char buf[256];
+
+	for (;;) {
+		mutex.lock();
+		bool stop_requested = stopping;
+		mutex.unlock();
+		if (stop_requested)
+			break;
+
+		// A timeout, so that stop() is noticed
+		int res = hid_read_timeout(device, buf, sizeof(buf), 100);
+		if (res == 0)
+			continue;
+
+		FXlong now = FXThread::time();
+		FXMutexLock lock(mutex);
+
+		if (res < 0) {
+			stats.error = true;
+			break;
+		}
+
+		if (count == QUEUE_SIZE) {
+			head = (head + 1) % QUEUE_SIZE;
+			count--;
+			stats.dropped++;
+		}
+		ReceivedReport &report = queue[(head + count) % QUEUE_SIZE];
+		report.time = now;
+		report.length = res;
+		memcpy(report.data, buf, res);
+		count++;
+
+		stats.reports++;
+		stats.bytes += res;
+		if (last_time != 0) {
+			double gap = (double)(now - last_time) / 1000.0;
+			stats.gaps++;
+			stats.gap_sum += gap;
+			stats.gap_sum_sq += gap * gap;
+		}
+		last_time = now;
+	}
+
+	return 0;
+}
+
+int
+InputReader::takeReports(ReceivedReport *out, int max)
+{
+	FXMutexLock lock(mutex);
+	int n = (count < max)? count: max;
+
+	for (int i = 0; i < n; i++) {
+		out[i] = queue[head];
+		head = (head + 1) % QUEUE_SIZE;
+	}
+	count -= n;
+
+	return n;
+}
+
+void
+InputReader::takeStats(InputStats &out)
+{
+	FXMutexLock lock(mutex);
+
+	out = stats;
+	out.queue_depth = count;
+
+	bool error = stats.error;
+	memset(&stats, 0, sizeof(stats));
+	stats.error = error;
+}
+
 class MainWindow : public FXMainWindow {
 	FXDECLARE(MainWindow)
 	
@@ -61,10 +219,21 @@ private:
 	FXTextField *feature_len;
 	FXTextField *get_feature_text;
 	FXText *input_text;
+	FXLabel *rate_label;
+	FXLabel *throughput_label;
+	FXLabel *queue_label;
+	FXLabel *jitter_label;
 	FXFont *title_font;
 	
 	struct hid_device_info *devices;
 	hid_device *connected_device;
+	InputReader *input_reader;
+	ReceivedReport *received_reports;
+	// Accumulated counters of the current statistics period
+	InputStats period_stats;
+	FXlong period_start;
+	void resetStats();
+	void updateStats(const InputStats &stats);
 	size_t getDataFromTextField(FXTextField *tf, char *buf, size_t len);
 	int getLengthFromTextField(FXTextField *tf);
 
@@ -117,6 +286,8 @@ MainWindow::MainWindow(FXApp *app)
 {
 	devices = NULL;
 	connected_device = NULL;
+	input_reader = NULL;
+	received_reports = new ReceivedReport[InputReader::QUEUE_SIZE];
 
 	FXVerticalFrame *vf = new FXVerticalFrame(this, LAYOUT_FILL_Y|LAYOUT_FILL_X);
 
@@ -189,15 +360,30 @@ MainWindow::MainWindow(FXApp *app)
 	input_text = new FXText(new FXHorizontalFrame(innerVF,LAYOUT_FILL_X|LAYOUT_FILL_Y|FRAME_SUNKEN|FRAME_THICK, 0,0,0,0, 0,0,0,0), NULL, 0, LAYOUT_FILL_X|LAYOUT_FILL_Y);
 	input_text->setEditable(false);
 	new FXButton(innerVF, "Clear", NULL, this, ID_CLEAR, BUTTON_NORMAL|LAYOUT_RIGHT);
-	
 
+	// Statistics Group Box
+	gb = new FXGroupBox(vf, "Statistics", FRAME_GROOVE|LAYOUT_FILL_X);
+	matrix = new FXMatrix(gb, 2, MATRIX_BY_COLUMNS|LAYOUT_FILL_X);
+	new FXLabel(matrix, "Reports/sec:");
+	rate_label = new FXLabel(matrix, "-", NULL, JUSTIFY_LEFT|LAYOUT_FILL_X|LAYOUT_FILL_COLUMN);
+	new FXLabel(matrix, "Bytes/sec:");
+	throughput_label = new FXLabel(matrix, "-", NULL, JUSTIFY_LEFT|LAYOUT_FILL_X|LAYOUT_FILL_COLUMN);
+	new FXLabel(matrix, "Queue depth:");
+	queue_label = new FXLabel(matrix, "-", NULL, JUSTIFY_LEFT|LAYOUT_FILL_X|LAYOUT_FILL_COLUMN);
+	new FXLabel(matrix, "Inter-arrival:");
+	jitter_label = new FXLabel(matrix, "-", NULL, JUSTIFY_LEFT|LAYOUT_FILL_X|LAYOUT_FILL_COLUMN);
+
+	resetStats();
 }
 
 MainWindow::~MainWindow()
 {
+	// The reader must be done with the device before it is closed
+	delete input_reader;
 	if (connected_device)
 		hid_close(connected_device);
 	hid_exit();
+	delete [] received_reports;
 	delete title_font;
 }
 
@@ -241,10 +427,12 @@ MainWindow::onConnect(FXObject *sender, FXSelector sel, void *ptr)
 		return -1;
 	}
 	
-	hid_set_nonblocking(connected_device, 1);
+	resetStats();
+	input_reader = new InputReader(connected_device);
+	input_reader->start();
 
 	getApp()->addTimeout(this, ID_TIMER,
-		5 * timeout_scalar /*5ms*/);
+		50 * timeout_scalar /*50ms*/);
 	
 	FXString s;
 	s.format("Connected to: %04hx:%04hx -", device_info->vendor_id, device_info->product_id);
@@ -265,6 +453,8 @@ MainWindow::onConnect(FXObject *sender, FXSelector sel, void *ptr)
 long
 MainWindow::onDisconnect(FXObject *sender, FXSelector sel, void *ptr)
 {
+	delete input_reader;
+	input_reader = NULL;
 	hid_close(connected_device);
 	connected_device = NULL;
 	connected_label->setText("Disconnected");
@@ -275,6 +465,7 @@ MainWindow::onDisconnect(FXObject *sender, FXSelector sel, void *ptr)
 	disconnect_button->disable();
 
 	getApp()->removeTimeout(this, ID_TIMER);
+	resetStats();
 	
 	return 1;
 }
@@ -476,35 +667,102 @@ MainWindow::onClear(FXObject *sender, FXSelector sel, void *ptr)
 	return 1;
 }
 
+void
+MainWindow::resetStats()
+{
+	memset(&period_stats, 0, sizeof(period_stats));
+	period_start = FXThread::time();
+	rate_label->setText("-");
+	throughput_label->setText("-");
+	queue_label->setText("-");
+	jitter_label->setText("-");
+}
+
+// Accumulate the counters of the reader, refresh the panel once per second.
+void
+MainWindow::updateStats(const InputStats &stats)
+{
+	period_stats.reports += stats.reports;
+	period_stats.bytes += stats.bytes;
+	period_stats.dropped += stats.dropped;
+	period_stats.gaps += stats.gaps;
+	period_stats.gap_sum += stats.gap_sum;
+	period_stats.gap_sum_sq += stats.gap_sum_sq;
+	if (stats.queue_depth > period_stats.queue_depth)
+		period_stats.queue_depth = stats.queue_depth;
+
+	FXlong now = FXThread::time();
+	double seconds = (double)(now - period_start) / 1e9;
+	if (seconds < 1.0)
+		return;
+
+	FXString s;
+	s.format("%.0f", (double)period_stats.reports / seconds);
+	rate_label->setText(s);
+	s.format("%.0f", (double)period_stats.bytes / seconds);
+	throughput_label->setText(s);
+	s.format("%d now, %d max of %d, %ld dropped", stats.queue_depth, period_stats.queue_depth,
+		(int)InputReader::QUEUE_SIZE, (long)period_stats.dropped);
+	queue_label->setText(s);
+	if (period_stats.gaps > 0) {
+		double mean = period_stats.gap_sum / (double)period_stats.gaps;
+		double variance = period_stats.gap_sum_sq / (double)period_stats.gaps - mean * mean;
+		s.format("%.1f us mean, %.1f us jitter (std. dev.)", mean, (variance > 0)? sqrt(variance): 0.0);
+	}
+	else {
+		s = "-";
+	}
+	jitter_label->setText(s);
+
+	memset(&period_stats, 0, sizeof(period_stats));
+	period_start = now;
+}
+
 long
 MainWindow::onTimeout(FXObject *sender, FXSelector sel, void *ptr)
 {
-	unsigned char buf[256];
-	int res = hid_read(connected_device, buf, sizeof(buf));
-	
-	if (res > 0) {
+	// Show at most this many reports per tick, the text view can't keep up with more
+	const int max_shown = 64;
+	int n = input_reader->takeReports(received_reports, InputReader::QUEUE_SIZE);
+
+	if (n > 0) {
 		FXString s;
-		s.format("Received %d bytes:\n", res);
-		for (int i = 0; i < res; i++) {
+		for (int r = 0; r < n && r < max_shown; r++) {
+			const ReceivedReport &report = received_reports[r];
 			FXString t;
-			t.format("%02hhx ", buf[i]);
+			t.format("Received %d bytes:\n", report.length);
+			s += t;
+			for (int i = 0; i < report.length; i++) {
+				t.format("%02hhx ", report.data[i]);
+				s += t;
+				if ((i+1) % 4 == 0)
+					s += " ";
+				if ((i+1) % 16 == 0)
+					s += "\n";
+			}
+			s += "\n";
+		}
+		if (n > max_shown) {
+			FXString t;
+			t.format("(%d more reports not shown)\n", n - max_shown);
 			s += t;
-			if ((i+1) % 4 == 0)
-				s += " ";
-			if ((i+1) % 16 == 0)
-				s += "\n";
 		}
-		s += "\n";
 		input_text->appendText(s);
 		input_text->setBottomLine(INT_MAX);
 	}
-	if (res < 0) {
+
+	InputStats stats;
+	input_reader->takeStats(stats);
+	updateStats(stats);
+	if (stats.error) {
 		input_text->appendText("hid_read() returned error\n");
 		input_text->setBottomLine(INT_MAX);
+		// The reader stopped, no need to poll it anymore
+		return 1;
 	}
 
 	getApp()->addTimeout(this, ID_TIMER,
-		5 * timeout_scalar /*5ms*/);
+		50 * timeout_scalar /*50ms*/);
 	return 1;
 }
 
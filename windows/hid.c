@@ -55,10 +55,12 @@ typedef LONG NTSTATUS;
 #include "hidapi_cfgmgr32.h"
 #include "hidapi_hidclass.h"
 #include "hidapi_hidsdi.h"
+#include "hid_enumerate_diff.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #ifdef MIN
 #undef MIN
@@ -218,9 +220,59 @@ static struct hid_hotplug_context {
 	.devs = NULL
 };
 
+/* Set by hid_set_allocator(), all NULL to use the C runtime */
+static struct hid_allocator allocator = { NULL, NULL, NULL, NULL };
+
+/* Also used by hidapi_descriptor_reconstruct.c */
+void *hid_internal_malloc(size_t size)
+{
+	if (allocator.malloc_fn)
+		return allocator.malloc_fn(size, allocator.user_data);
+	return malloc(size);
+}
+
+static void *hid_internal_calloc(size_t count, size_t size)
+{
+	void *ptr;
+
+	if (!allocator.malloc_fn)
+		return calloc(count, size);
+
+	if (size != 0 && count > (size_t) -1 / size)
+		return NULL;
+	ptr = hid_internal_malloc(count * size);
+	if (ptr)
+		memset(ptr, 0, count * size);
+	return ptr;
+}
+
+static void *hid_internal_realloc(void *ptr, size_t size)
+{
+	if (allocator.realloc_fn)
+		return allocator.realloc_fn(ptr, size, allocator.user_data);
+	return realloc(ptr, size);
+}
+
+void hid_internal_free(void *ptr)
+{
+	if (allocator.free_fn)
+		allocator.free_fn(ptr, allocator.user_data);
+	else
+		free(ptr);
+}
+
+static wchar_t *hid_internal_wcsdup(const wchar_t *s)
+{
+	size_t size = (wcslen(s) + 1) * sizeof(wchar_t);
+	wchar_t *ret = (wchar_t*) hid_internal_malloc(size);
+	if (ret)
+		memcpy(ret, s, size);
+	return ret;
+}
+
 static hid_device *new_hid_device()
 {
-	hid_device *dev = (hid_device*) calloc(1, sizeof(hid_device));
+	hid_device *dev = (hid_device*) hid_internal_calloc(1, sizeof(hid_device));
 
 	if (dev == NULL) {
 		return NULL;
@@ -250,18 +302,18 @@ static void free_hid_device(hid_device *dev)
 	CloseHandle(dev->ol.hEvent);
 	CloseHandle(dev->write_ol.hEvent);
 	CloseHandle(dev->device_handle);
-	free(dev->last_error_str);
+	hid_internal_free(dev->last_error_str);
 	dev->last_error_str = NULL;
-	free(dev->write_buf);
-	free(dev->feature_buf);
-	free(dev->read_buf);
+	hid_internal_free(dev->write_buf);
+	hid_internal_free(dev->feature_buf);
+	hid_internal_free(dev->read_buf);
 	hid_free_enumeration(dev->device_info);
-	free(dev);
+	hid_internal_free(dev);
 }
 
 static void register_winapi_error_to_buffer(wchar_t **error_buffer, const WCHAR *op)
 {
-	free(*error_buffer);
+	hid_internal_free(*error_buffer);
 	*error_buffer = NULL;
 
 	/* Only clear out error messages if NULL is passed into op */
@@ -291,7 +343,7 @@ static void register_winapi_error_to_buffer(wchar_t **error_buffer, const WCHAR
 		+ system_err_len
 		;
 
-	*error_buffer = (WCHAR *)calloc(msg_len + 1, sizeof (WCHAR));
+	*error_buffer = (WCHAR *)hid_internal_calloc(msg_len + 1, sizeof (WCHAR));
 	WCHAR *msg = *error_buffer;
 
 	if (!msg)
@@ -321,16 +373,16 @@ static void register_winapi_error_to_buffer(wchar_t **error_buffer, const WCHAR
 #endif
 /* A bug in GCC/mingw gives:
  * error: array subscript 0 is outside array bounds of 'wchar_t *[0]' {aka 'short unsigned int *[]'} [-Werror=array-bounds]
- * |         free(*error_buffer);
+ * |         hid_internal_free(*error_buffer);
  * Which doesn't make sense in this context. */
 
 static void register_string_error_to_buffer(wchar_t **error_buffer, const WCHAR *string_error)
 {
-	free(*error_buffer);
+	hid_internal_free(*error_buffer);
 	*error_buffer = NULL;
 
 	if (string_error) {
-		*error_buffer = _wcsdup(string_error);
+		*error_buffer = hid_internal_wcsdup(string_error);
 	}
 }
 
@@ -459,7 +511,7 @@ static void hid_internal_hotplug_exit()
 	/* Remove all callbacks from the list */
 	while (*current) {
 		struct hid_hotplug_callback* next = (*current)->next;
-		free(*current);
+		hid_internal_free(*current);
 		*current = next;
 	}
 	hid_internal_hotplug_cleanup();
@@ -481,6 +533,32 @@ int HID_API_EXPORT hid_exit(void)
 	return 0;
 }
 
+int HID_API_EXPORT hid_set_allocator(const struct hid_allocator *new_allocator)
+{
+	if (new_allocator && (!new_allocator->malloc_fn || !new_allocator->realloc_fn || !new_allocator->free_fn)) {
+		register_global_error(L"hid_set_allocator: malloc_fn, realloc_fn and free_fn must all be set");
+		return -1;
+	}
+
+	/* The global error message was allocated with the previous allocator */
+	register_global_error(NULL);
+
+	if (new_allocator)
+		allocator = *new_allocator;
+	else
+		memset(&allocator, 0, sizeof(allocator));
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_set_executor(const struct hid_executor *new_executor)
+{
+	/* Stub */
+	(void)new_executor;
+	register_global_error(L"hid_set_executor is not supported on this platform");
+	return -1;
+}
+
 static void* hid_internal_get_devnode_property(DEVINST dev_node, const DEVPROPKEY* property_key, DEVPROPTYPE expected_property_type)
 {
 	ULONG len = 0;
@@ -492,10 +570,10 @@ static void* hid_internal_get_devnode_property(DEVINST dev_node, const DEVPROPKE
 	if (cr != CR_BUFFER_SMALL || property_type != expected_property_type)
 		return NULL;
 
-	property_value = (PBYTE)calloc(len, sizeof(BYTE));
+	property_value = (PBYTE)hid_internal_calloc(len, sizeof(BYTE));
 	cr = CM_Get_DevNode_PropertyW(dev_node, property_key, &property_type, property_value, &len, 0);
 	if (cr != CR_SUCCESS) {
-		free(property_value);
+		hid_internal_free(property_value);
 		return NULL;
 	}
 
@@ -513,10 +591,10 @@ static void* hid_internal_get_device_interface_property(const wchar_t* interface
 	if (cr != CR_BUFFER_SMALL || property_type != expected_property_type)
 		return NULL;
 
-	property_value = (PBYTE)calloc(len, sizeof(BYTE));
+	property_value = (PBYTE)hid_internal_calloc(len, sizeof(BYTE));
 	cr = CM_Get_Device_Interface_PropertyW(interface_path, property_key, &property_type, property_value, &len, 0);
 	if (cr != CR_SUCCESS) {
-		free(property_value);
+		hid_internal_free(property_value);
 		return NULL;
 	}
 
@@ -600,7 +678,7 @@ static void hid_internal_get_usb_info(struct hid_device_info* dev, DEVINST dev_n
 	if (wcslen(dev->manufacturer_string) == 0) {
 		wchar_t* manufacturer_string = hid_internal_get_devnode_property(dev_node, &DEVPKEY_Device_Manufacturer, DEVPROP_TYPE_STRING);
 		if (manufacturer_string) {
-			free(dev->manufacturer_string);
+			hid_internal_free(dev->manufacturer_string);
 			dev->manufacturer_string = manufacturer_string;
 		}
 	}
@@ -617,7 +695,7 @@ static void hid_internal_get_usb_info(struct hid_device_info* dev, DEVINST dev_n
 		}
 
 		/* Get the device id of the USB device. */
-		free(device_id);
+		hid_internal_free(device_id);
 		device_id = hid_internal_get_devnode_property(usb_dev_node, &DEVPKEY_Device_InstanceId, DEVPROP_TYPE_STRING);
 		if (!device_id)
 			goto end;
@@ -633,8 +711,8 @@ static void hid_internal_get_usb_info(struct hid_device_info* dev, DEVINST dev_n
 				break;
 
 			if (*ptr == L'\\') {
-				free(dev->serial_number);
-				dev->serial_number = _wcsdup(ptr + 1);
+				hid_internal_free(dev->serial_number);
+				dev->serial_number = hid_internal_wcsdup(ptr + 1);
 				break;
 			}
 		}
@@ -645,8 +723,8 @@ static void hid_internal_get_usb_info(struct hid_device_info* dev, DEVINST dev_n
 		dev->interface_number = 0;
 
 end:
-	free(device_id);
-	free(hardware_ids);
+	hid_internal_free(device_id);
+	hid_internal_free(hardware_ids);
 }
 
 /* HidD_GetProductString/HidD_GetManufacturerString/HidD_GetSerialNumberString is not working for BLE HID devices
@@ -659,7 +737,7 @@ static void hid_internal_get_ble_info(struct hid_device_info* dev, DEVINST dev_n
 		/* Manufacturer Name String (UUID: 0x2A29) */
 		wchar_t* manufacturer_string = hid_internal_get_devnode_property(dev_node, (const DEVPROPKEY*)&PKEY_DeviceInterface_Bluetooth_Manufacturer, DEVPROP_TYPE_STRING);
 		if (manufacturer_string) {
-			free(dev->manufacturer_string);
+			hid_internal_free(dev->manufacturer_string);
 			dev->manufacturer_string = manufacturer_string;
 		}
 	}
@@ -668,7 +746,7 @@ static void hid_internal_get_ble_info(struct hid_device_info* dev, DEVINST dev_n
 		/* Serial Number String (UUID: 0x2A25) */
 		wchar_t* serial_number = hid_internal_get_devnode_property(dev_node, (const DEVPROPKEY*)&PKEY_DeviceInterface_Bluetooth_DeviceAddress, DEVPROP_TYPE_STRING);
 		if (serial_number) {
-			free(dev->serial_number);
+			hid_internal_free(dev->serial_number);
 			dev->serial_number = serial_number;
 		}
 	}
@@ -686,7 +764,7 @@ static void hid_internal_get_ble_info(struct hid_device_info* dev, DEVINST dev_n
 		}
 
 		if (product_string) {
-			free(dev->product_string);
+			hid_internal_free(dev->product_string);
 			dev->product_string = product_string;
 		}
 	}
@@ -767,8 +845,8 @@ static void hid_internal_get_info(const wchar_t* interface_path, struct hid_devi
 		}
 	}
 end:
-	free(device_id);
-	free(compatible_ids);
+	hid_internal_free(device_id);
+	hid_internal_free(compatible_ids);
 }
 
 static char *hid_internal_UTF16toUTF8(const wchar_t *src)
@@ -776,7 +854,7 @@ static char *hid_internal_UTF16toUTF8(const wchar_t *src)
 	char *dst = NULL;
 	int len = WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, src, -1, NULL, 0, NULL, NULL);
 	if (len) {
-		dst = (char*)calloc(len, sizeof(char));
+		dst = (char*)hid_internal_calloc(len, sizeof(char));
 		if (dst == NULL) {
 			return NULL;
 		}
@@ -791,7 +869,7 @@ static wchar_t *hid_internal_UTF8toUTF16(const char *src)
 	wchar_t *dst = NULL;
 	int len = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, src, -1, NULL, 0);
 	if (len) {
-		dst = (wchar_t*)calloc(len, sizeof(wchar_t));
+		dst = (wchar_t*)hid_internal_calloc(len, sizeof(wchar_t));
 		if (dst == NULL) {
 			return NULL;
 		}
@@ -810,7 +888,7 @@ static struct hid_device_info *hid_internal_get_device_info(const wchar_t *path,
 	wchar_t string[MAX_STRING_WCHARS];
 
 	/* Create the record. */
-	dev = (struct hid_device_info*)calloc(1, sizeof(struct hid_device_info));
+	dev = (struct hid_device_info*)hid_internal_calloc(1, sizeof(struct hid_device_info));
 
 	if (dev == NULL) {
 		return NULL;
@@ -845,38 +923,37 @@ static struct hid_device_info *hid_internal_get_device_info(const wchar_t *path,
 	string[0] = L'\0';
 	HidD_GetSerialNumberString(handle, string, sizeof(string));
 	string[MAX_STRING_WCHARS - 1] = L'\0';
-	dev->serial_number = _wcsdup(string);
+	dev->serial_number = hid_internal_wcsdup(string);
 
 	/* Manufacturer String */
 	string[0] = L'\0';
 	HidD_GetManufacturerString(handle, string, sizeof(string));
 	string[MAX_STRING_WCHARS - 1] = L'\0';
-	dev->manufacturer_string = _wcsdup(string);
+	dev->manufacturer_string = hid_internal_wcsdup(string);
 
 	/* Product String */
 	string[0] = L'\0';
 	HidD_GetProductString(handle, string, sizeof(string));
 	string[MAX_STRING_WCHARS - 1] = L'\0';
-	dev->product_string = _wcsdup(string);
+	dev->product_string = hid_internal_wcsdup(string);
 
 	hid_internal_get_info(path, dev);
 
 	return dev;
 }
 
-struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Returns -1 if the device interface list couldn't be retrieved, 0 otherwise
+   (even if no device matched) */
+static int hid_internal_enumerate(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs)
 {
-	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *root = NULL;
 	struct hid_device_info *cur_dev = NULL;
 	GUID interface_class_guid;
 	CONFIGRET cr;
 	wchar_t* device_interface_list = NULL;
+	wchar_t* new_device_interface_list;
 	DWORD len;
-
-	if (hid_init() < 0) {
-		/* register_global_error: global error is reset by hid_init */
-		return NULL;
-	}
+	int res = -1;
 
 	/* Retrieve HID Interface Class GUID
 	   https://docs.microsoft.com/windows-hardware/drivers/install/guid-devinterface-hid */
@@ -892,15 +969,12 @@ struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned shor
 			break;
 		}
 
-		if (device_interface_list != NULL) {
-			free(device_interface_list);
-		}
-
-		device_interface_list = (wchar_t*)calloc(len, sizeof(wchar_t));
-		if (device_interface_list == NULL) {
+		new_device_interface_list = (wchar_t*)hid_internal_realloc(device_interface_list, len * sizeof(wchar_t));
+		if (new_device_interface_list == NULL) {
 			register_global_error(L"Failed to allocate memory for HID device interface list");
-			return NULL;
+			goto end_of_function;
 		}
+		device_interface_list = new_device_interface_list;
 		cr = CM_Get_Device_Interface_ListW(&interface_class_guid, NULL, device_interface_list, len, CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
 		if (cr != CR_SUCCESS && cr != CR_BUFFER_SMALL) {
 			register_global_error(L"Failed to get HID device interface list");
@@ -953,6 +1027,26 @@ struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned shor
 cont_close:
 		CloseHandle(device_handle);
 	}
+	res = 0;
+
+end_of_function:
+	hid_internal_free(device_interface_list);
+
+	*devs = root;
+	return res;
+}
+
+struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_info *root = NULL; /* return object */
+
+	if (hid_init() < 0) {
+		/* register_global_error: global error is reset by hid_init */
+		return NULL;
+	}
+
+	if (hid_internal_enumerate(vendor_id, product_id, &root) < 0)
+		return NULL;
 
 	if (root == NULL) {
 		if (vendor_id == 0 && product_id == 0) {
@@ -962,9 +1056,6 @@ cont_close:
 		}
 	}
 
-end_of_function:
-	free(device_interface_list);
-
 	return root;
 }
 
@@ -974,15 +1065,72 @@ void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *d
 	struct hid_device_info *d = devs;
 	while (d) {
 		struct hid_device_info *next = d->next;
-		free(d->path);
-		free(d->serial_number);
-		free(d->manufacturer_string);
-		free(d->product_string);
-		free(d);
+		hid_internal_free(d->path);
+		hid_internal_free(d->serial_number);
+		hid_internal_free(d->manufacturer_string);
+		hid_internal_free(d->product_string);
+		hid_internal_free(d);
 		d = next;
 	}
 }
 
+int HID_API_EXPORT HID_API_CALL hid_enumerate_foreach(unsigned short vendor_id, unsigned short product_id, hid_enumerate_callback_fn callback, void *user_data)
+{
+	struct hid_device_info *devs;
+	int stop = 0;
+
+	if (!callback) {
+		register_global_error(L"Enumeration callback is NULL");
+		return -1;
+	}
+
+	if (hid_init() < 0) {
+		/* register_global_error: global error is reset by hid_init */
+		return -1;
+	}
+
+	/* The device interface list is retrieved at once and each interface has to be opened to be matched,
+	   so all of the devices are probed first and reported one by one afterwards. */
+	devs = hid_enumerate(vendor_id, product_id);
+	while (devs) {
+		struct hid_device_info *next = devs->next;
+		devs->next = NULL;
+		if (!stop)
+			stop = callback(devs, user_data) ? 1 : 0;
+		hid_free_enumeration(devs);
+		devs = next;
+	}
+
+	return stop;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_diff(unsigned short vendor_id, unsigned short product_id, struct hid_device_info **devs, struct hid_device_info **added, struct hid_device_info **removed)
+{
+	struct hid_device_info *current;
+
+	if (!devs || !added || !removed) {
+		register_global_error(L"Invalid parameters for hid_enumerate_diff");
+		return -1;
+	}
+
+	if (hid_init() < 0) {
+		/* register_global_error: global error is reset by hid_init */
+		return -1;
+	}
+
+	if (hid_internal_enumerate(vendor_id, product_id, &current) < 0)
+		return -1;
+
+	return hid_internal_enumerate_merge(current, devs, added, removed);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_enumerate_generation(unsigned int *generation)
+{
+	(void)generation;
+	register_global_error(L"hid_enumerate_generation is not supported on this platform");
+	return -1;
+}
+
 DWORD WINAPI hid_internal_notify_callback(HCMNOTIFICATION notify,
 										  PVOID context,
 										  CM_NOTIFY_ACTION action,
@@ -1054,7 +1202,7 @@ DWORD WINAPI hid_internal_notify_callback(HCMNOTIFICATION notify,
 			}
 		}
 
-		free(path);
+		hid_internal_free(path);
 	}
 
 	if (device) {
@@ -1069,7 +1217,7 @@ DWORD WINAPI hid_internal_notify_callback(HCMNOTIFICATION notify,
 				if (result) {
 					struct hid_hotplug_callback *callback = *current;
 					*current = (*current)->next;
-					free(callback);
+					hid_internal_free(callback);
 					continue;
 				}
 			}
@@ -1078,7 +1226,7 @@ DWORD WINAPI hid_internal_notify_callback(HCMNOTIFICATION notify,
 
 		/* Free removed device */
 		if (hotplug_event == HID_API_HOTPLUG_EVENT_DEVICE_LEFT) {
-			free(device);
+			hid_internal_free(device);
 		}
 	}
 
@@ -1099,7 +1247,7 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_register_callback(unsigned short ven
 		return -1;
 	}
 
-	hotplug_cb = (struct hid_hotplug_callback*)calloc(1, sizeof(struct hid_hotplug_callback));
+	hotplug_cb = (struct hid_hotplug_callback*)hid_internal_calloc(1, sizeof(struct hid_hotplug_callback));
 
 	if (hotplug_cb == NULL) {
 		return -1;
@@ -1207,7 +1355,7 @@ int HID_API_EXPORT HID_API_CALL hid_hotplug_deregister_callback(hid_hotplug_call
 		if ((*current)->handle == callback_handle) {
 			struct hid_hotplug_callback *next = (*current)->next;
 			*current = next;
-			free(*current);
+			hid_internal_free(*current);
 			break;
 		}
 	}
@@ -1331,11 +1479,11 @@ HID_API_EXPORT hid_device * HID_API_CALL hid_open_path(const char *path)
 	dev->output_report_length = caps.OutputReportByteLength;
 	dev->input_report_length = caps.InputReportByteLength;
 	dev->feature_report_length = caps.FeatureReportByteLength;
-	dev->read_buf = (char*) malloc(dev->input_report_length);
+	dev->read_buf = (char*) hid_internal_malloc(dev->input_report_length);
 	dev->device_info = hid_internal_get_device_info(interface_path, dev->device_handle);
 
 end_of_function:
-	free(interface_path);
+	hid_internal_free(interface_path);
 	CloseHandle(device_handle);
 
 	if (pp_data) {
@@ -1372,7 +1520,7 @@ int HID_API_EXPORT HID_API_CALL hid_write(hid_device *dev, const unsigned char *
 		buf = (unsigned char *) data;
 	} else {
 		if (dev->write_buf == NULL)
-			dev->write_buf = (unsigned char *) malloc(dev->output_report_length);
+			dev->write_buf = (unsigned char *) hid_internal_malloc(dev->output_report_length);
 		buf = dev->write_buf;
 		memcpy(buf, data, length);
 		memset(buf + length, 0, dev->output_report_length - length);
@@ -1416,6 +1564,47 @@ end_of_function:
 	return function_result;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_write_many(struct hid_write_request *requests, size_t count, struct timespec *spread)
+{
+	LARGE_INTEGER first, last, frequency;
+	int written = 0;
+	int res = 0;
+	size_t i;
+
+	if (!requests && count > 0) {
+		register_global_error(L"requests is NULL");
+		return -1;
+	}
+
+	first.QuadPart = 0;
+	last.QuadPart = 0;
+
+	for (i = 0; i < count; i++) {
+		requests[i].result = hid_write(requests[i].dev, requests[i].data, requests[i].length);
+		if (requests[i].result < 0) {
+			res = -1;
+			continue;
+		}
+
+		QueryPerformanceCounter(&last);
+		if (!written++)
+			first = last;
+	}
+
+	if (spread) {
+		spread->tv_sec = 0;
+		spread->tv_nsec = 0;
+		if (written > 1) {
+			LONGLONG ticks = last.QuadPart - first.QuadPart;
+			QueryPerformanceFrequency(&frequency);
+			spread->tv_sec = (time_t) (ticks / frequency.QuadPart);
+			spread->tv_nsec = (long) ((ticks % frequency.QuadPart) * 1000000000LL / frequency.QuadPart);
+		}
+	}
+
+	return res;
+}
+
 
 int HID_API_EXPORT HID_API_CALL hid_read_timeout(hid_device *dev, unsigned char *data, size_t length, int milliseconds)
 {
@@ -1504,11 +1693,137 @@ end_of_function:
 	return (int) copy_len;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_read_timeout_ts(hid_device *dev, unsigned char *data, size_t length, const struct timespec *timeout)
+{
+	long long milliseconds;
+
+	if (!timeout)
+		return hid_read_timeout(dev, data, length, -1);
+
+	if (timeout->tv_sec < 0 || timeout->tv_nsec < 0 || timeout->tv_nsec >= 1000000000L) {
+		register_string_error(dev, L"hid_read_timeout_ts: invalid timeout");
+		return -1;
+	}
+
+	/* Only millisecond resolution is available here, round up
+	   so a short timeout doesn't turn into a non-blocking read */
+	milliseconds = (long long)timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+	if (milliseconds > INT_MAX)
+		milliseconds = INT_MAX;
+
+	return hid_read_timeout(dev, data, length, (int)milliseconds);
+}
+
+int HID_API_EXPORT HID_API_CALL hid_read_deadline(hid_device *dev, unsigned char *data, size_t length, const struct timespec *deadline)
+{
+	/* There is no CLOCK_MONOTONIC to express the deadline with */
+	(void)data;
+	(void)length;
+	(void)deadline;
+	register_string_error(dev, L"hid_read_deadline is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, size_t length)
 {
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_interrupt_read(hid_device *dev)
+{
+	/* Stub */
+	register_string_error(dev, L"hid_interrupt_read is not supported on this platform");
+	return -1;
+}
+
+HID_API_EXPORT hid_subscription * HID_API_CALL hid_subscribe(hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow)
+{
+	/* Stub */
+	(void) capacity;
+	(void) report_length;
+	(void) overflow;
+	register_string_error(dev, L"hid_subscribe is not supported on this platform");
+	return NULL;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_subscription_read_timeout(hid_subscription *subscription, unsigned char *data, size_t length, int milliseconds)
+{
+	/* Stub */
+	(void) subscription;
+	(void) data;
+	(void) length;
+	(void) milliseconds;
+	return -1;
+}
+
+size_t HID_API_EXPORT HID_API_CALL hid_subscription_dropped(hid_subscription *subscription)
+{
+	/* Stub */
+	(void) subscription;
+	return 0;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_unsubscribe(hid_subscription *subscription)
+{
+	/* Stub */
+	(void) subscription;
+}
+
+HID_API_EXPORT hid_dispatcher * HID_API_CALL hid_dispatcher_create(unsigned int num_threads)
+{
+	/* Stub */
+	(void) num_threads;
+	register_global_error(L"hid_dispatcher_create is not supported on this platform");
+	return NULL;
+}
+
+HID_API_EXPORT hid_subscription * HID_API_CALL hid_subscribe_dispatch(hid_dispatcher *dispatcher, hid_device *dev, size_t capacity, size_t report_length, hid_subscription_overflow overflow, hid_input_callback_fn callback, void *user_data)
+{
+	/* Stub */
+	(void) dispatcher;
+	(void) capacity;
+	(void) report_length;
+	(void) overflow;
+	(void) callback;
+	(void) user_data;
+	register_string_error(dev, L"hid_subscribe_dispatch is not supported on this platform");
+	return NULL;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_dispatcher_destroy(hid_dispatcher *dispatcher)
+{
+	/* Stub */
+	(void) dispatcher;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_health_monitor(hid_device *dev, unsigned int expected_interval_us, unsigned int silence_threshold_ms, hid_health_callback_fn callback, void *user_data)
+{
+	/* Stub */
+	(void) expected_interval_us;
+	(void) callback;
+	(void) user_data;
+	if (silence_threshold_ms == 0)
+		return 0;
+	register_string_error(dev, L"hid_set_health_monitor is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_health_stats(hid_device *dev, struct hid_health_stats *stats)
+{
+	/* Stub */
+	(void) stats;
+	register_string_error(dev, L"hid_get_health_stats is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_set_input_filter(hid_device *dev, const struct hid_input_filter *filter)
+{
+	/* Stub */
+	(void) filter;
+	register_string_error(dev, L"hid_set_input_filter is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -1538,7 +1853,7 @@ int HID_API_EXPORT HID_API_CALL hid_send_feature_report(hid_device *dev, const u
 		length_to_send = length;
 	} else {
 		if (dev->feature_buf == NULL)
-			dev->feature_buf = (unsigned char *) malloc(dev->feature_report_length);
+			dev->feature_buf = (unsigned char *) hid_internal_malloc(dev->feature_report_length);
 		buf = dev->feature_buf;
 		memcpy(buf, data, length);
 		memset(buf + length, 0, dev->feature_report_length - length);
@@ -1609,6 +1924,14 @@ int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned
 	return hid_get_report(dev, IOCTL_HID_GET_FEATURE, data, length);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_set_feature_report_cache(hid_device *dev, int ttl_milliseconds)
+{
+	/* Stub */
+	(void)ttl_milliseconds;
+	register_string_error(dev, L"hid_set_feature_report_cache is not supported on this platform");
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_get_input_report(hid_device *dev, unsigned char *data, size_t length)
 {
 	/* We could use HidD_GetInputReport() instead, but it doesn't give us an actual length, unfortunately */
@@ -1624,6 +1947,18 @@ void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev)
 	free_hid_device(dev);
 }
 
+void HID_API_EXPORT HID_API_CALL hid_close_many(hid_device **devs, size_t count)
+{
+	/* Closing a device is cheap on this backend, nothing to gain from doing it in parallel */
+	size_t i;
+
+	if (!devs)
+		return;
+
+	for (i = 0; i < count; i++)
+		hid_close(devs[i]);
+}
+
 int HID_API_EXPORT_CALL HID_API_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
 {
 	if (!string || !maxlen) {
@@ -1754,8 +2089,8 @@ int HID_API_EXPORT_CALL hid_winapi_get_container_id(hid_device *dev, GUID *conta
 		register_string_error(dev, L"Failed to read ContainerId property from device node");
 
 end:
-	free(interface_path);
-	free(device_id);
+	hid_internal_free(interface_path);
+	hid_internal_free(device_id);
 
 	return cr == CR_SUCCESS ? 0 : -1;
 }
@@ -1790,6 +2125,23 @@ HID_API_EXPORT const wchar_t * HID_API_CALL  hid_error(hid_device *dev)
 	return last_global_error_str;
 }
 
+int HID_API_EXPORT HID_API_CALL hid_debug_log_enable(int enable)
+{
+	/* Stub */
+	(void)enable;
+	register_global_error(L"hid_debug_log_enable is not supported on this platform");
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_debug_log_read(char *buffer, size_t size)
+{
+	/* Stub */
+	(void)buffer;
+	(void)size;
+	register_global_error(L"hid_debug_log_read is not supported on this platform");
+	return -1;
+}
+
 #ifndef hidapi_winapi_EXPORTS
 #include "hidapi_descriptor_reconstruct.c"
 #endif
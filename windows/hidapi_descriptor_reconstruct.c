@@ -140,7 +140,7 @@ static struct rd_main_item_node * rd_append_main_item_node(int first_bit, int la
 		list = &(*list)->next;
 	}
 
-	new_list_node = malloc(sizeof(*new_list_node)); // Create new list entry
+	new_list_node = hid_internal_malloc(sizeof(*new_list_node)); // Create new list entry
 	new_list_node->FirstBit = first_bit;
 	new_list_node->LastBit = last_bit;
 	new_list_node->TypeOfNode = type_of_node;
@@ -203,13 +203,13 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 	
 	// Allocate memory and initialize lookup table
 	rd_bit_range ****coll_bit_range;
-	coll_bit_range = malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_bit_range));
+	coll_bit_range = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_bit_range));
 	for (USHORT collection_node_idx = 0; collection_node_idx < pp_data->NumberLinkCollectionNodes; collection_node_idx++) {
-		coll_bit_range[collection_node_idx] = malloc(256 * sizeof(*coll_bit_range[0])); // 256 possible report IDs (incl. 0x00)
+		coll_bit_range[collection_node_idx] = hid_internal_malloc(256 * sizeof(*coll_bit_range[0])); // 256 possible report IDs (incl. 0x00)
 		for (int reportid_idx = 0; reportid_idx < 256; reportid_idx++) {
-			coll_bit_range[collection_node_idx][reportid_idx] = malloc(NUM_OF_HIDP_REPORT_TYPES * sizeof(*coll_bit_range[0][0]));
+			coll_bit_range[collection_node_idx][reportid_idx] = hid_internal_malloc(NUM_OF_HIDP_REPORT_TYPES * sizeof(*coll_bit_range[0][0]));
 			for (HIDP_REPORT_TYPE rt_idx = 0; rt_idx < NUM_OF_HIDP_REPORT_TYPES; rt_idx++) {
-				coll_bit_range[collection_node_idx][reportid_idx][rt_idx] = malloc(sizeof(rd_bit_range));
+				coll_bit_range[collection_node_idx][reportid_idx][rt_idx] = hid_internal_malloc(sizeof(rd_bit_range));
 				coll_bit_range[collection_node_idx][reportid_idx][rt_idx]->FirstBit = -1;
 				coll_bit_range[collection_node_idx][reportid_idx][rt_idx]->LastBit = -1;
 			}
@@ -241,8 +241,8 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 	//  coll_number_of_direct_childs[COLLECTION_INDEX]
 	// *************************************************************************
 	int max_coll_level = 0;
-	int *coll_levels = malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_levels[0]));
-	int *coll_number_of_direct_childs = malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_number_of_direct_childs[0]));
+	int *coll_levels = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_levels[0]));
+	int *coll_number_of_direct_childs = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_number_of_direct_childs[0]));
 	for (USHORT collection_node_idx = 0; collection_node_idx < pp_data->NumberLinkCollectionNodes; collection_node_idx++) {
 		coll_levels[collection_node_idx] = -1;
 		coll_number_of_direct_childs[collection_node_idx] = 0;
@@ -308,10 +308,10 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 	// and store it this index coll_child_order[COLLECTION_INDEX][DIRECT_CHILD_INDEX]
 	// **************************************************************************************************
 	USHORT **coll_child_order;
-	coll_child_order = malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_child_order));
+	coll_child_order = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_child_order));
 	{
 		BOOLEAN *coll_parsed_flag;
-		coll_parsed_flag = malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_parsed_flag[0]));
+		coll_parsed_flag = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_parsed_flag[0]));
 		for (USHORT collection_node_idx = 0; collection_node_idx < pp_data->NumberLinkCollectionNodes; collection_node_idx++) {
 			coll_parsed_flag[collection_node_idx] = FALSE;
 		}
@@ -321,7 +321,7 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 			if ((coll_number_of_direct_childs[collection_node_idx] != 0) &&
 				(coll_parsed_flag[link_collection_nodes[collection_node_idx].FirstChild] == FALSE)) {
 				coll_parsed_flag[link_collection_nodes[collection_node_idx].FirstChild] = TRUE;
-				coll_child_order[collection_node_idx] = malloc((coll_number_of_direct_childs[collection_node_idx]) * sizeof(*coll_child_order[0]));
+				coll_child_order[collection_node_idx] = hid_internal_malloc((coll_number_of_direct_childs[collection_node_idx]) * sizeof(*coll_child_order[0]));
 
 				{
 					// Create list of child collection indices
@@ -371,7 +371,7 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 				}
 			}
 		}
-		free(coll_parsed_flag);
+		hid_internal_free(coll_parsed_flag);
 	}
 
 
@@ -380,10 +380,10 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 	// ***************************************************************************************
 	struct rd_main_item_node *main_item_list = NULL; // List root
 	// Lookup table to find the Collection items in the list by index
-	struct rd_main_item_node **coll_begin_lookup = malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_begin_lookup));
-	struct rd_main_item_node **coll_end_lookup = malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_end_lookup));
+	struct rd_main_item_node **coll_begin_lookup = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_begin_lookup));
+	struct rd_main_item_node **coll_end_lookup = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(*coll_end_lookup));
 	{
-		int *coll_last_written_child = malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_last_written_child[0]));
+		int *coll_last_written_child = hid_internal_malloc(pp_data->NumberLinkCollectionNodes * sizeof(coll_last_written_child[0]));
 		for (USHORT collection_node_idx = 0; collection_node_idx < pp_data->NumberLinkCollectionNodes; collection_node_idx++) {
 			coll_last_written_child[collection_node_idx] = -1;
 		}
@@ -459,7 +459,7 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 				collection_node_idx = link_collection_nodes[collection_node_idx].Parent;
 			}
 		}
-		free(coll_last_written_child);
+		hid_internal_free(coll_last_written_child);
 	}
 
 
@@ -959,7 +959,7 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 		// Go to next item in main_item_list and free the memory of the actual item
 		struct rd_main_item_node *main_item_list_prev = main_item_list;
 		main_item_list = main_item_list->next;
-		free(main_item_list_prev);
+		hid_internal_free(main_item_list_prev);
 	}
 
 	// Free multidimensionable array: coll_bit_range[COLLECTION_INDEX][REPORT_ID][INPUT/OUTPUT/FEATURE]
@@ -967,21 +967,21 @@ int hid_winapi_descriptor_reconstruct_pp_data(void *preparsed_data, unsigned cha
 	for (USHORT collection_node_idx = 0; collection_node_idx < pp_data->NumberLinkCollectionNodes; collection_node_idx++) {
 		for (int reportid_idx = 0; reportid_idx < 256; reportid_idx++) {
 			for (HIDP_REPORT_TYPE rt_idx = 0; rt_idx < NUM_OF_HIDP_REPORT_TYPES; rt_idx++) {
-				free(coll_bit_range[collection_node_idx][reportid_idx][rt_idx]);
+				hid_internal_free(coll_bit_range[collection_node_idx][reportid_idx][rt_idx]);
 			}
-			free(coll_bit_range[collection_node_idx][reportid_idx]);
+			hid_internal_free(coll_bit_range[collection_node_idx][reportid_idx]);
 		}
-		free(coll_bit_range[collection_node_idx]);
-		if (coll_number_of_direct_childs[collection_node_idx] != 0) free(coll_child_order[collection_node_idx]);
+		hid_internal_free(coll_bit_range[collection_node_idx]);
+		if (coll_number_of_direct_childs[collection_node_idx] != 0) hid_internal_free(coll_child_order[collection_node_idx]);
 	}
-	free(coll_bit_range);
-	free(coll_child_order);
+	hid_internal_free(coll_bit_range);
+	hid_internal_free(coll_child_order);
 
 	// Free one dimensional arrays
-	free(coll_begin_lookup);
-	free(coll_end_lookup);
-	free(coll_levels);
-	free(coll_number_of_direct_childs);
+	hid_internal_free(coll_begin_lookup);
+	hid_internal_free(coll_end_lookup);
+	hid_internal_free(coll_levels);
+	hid_internal_free(coll_number_of_direct_childs);
 
 	return (int) rpt_desc.byte_idx;
 }
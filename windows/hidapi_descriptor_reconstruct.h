@@ -39,6 +39,10 @@
 #include "hidapi_hidsdi.h"
 #include <assert.h>
 
+/* Defined in hid.c, honor the allocator set by hid_set_allocator() */
+void *hid_internal_malloc(size_t size);
+void hid_internal_free(void *ptr);
+
 #define NUM_OF_HIDP_REPORT_TYPES 3
 
 typedef enum rd_items_ {